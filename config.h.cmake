@@ -91,6 +91,7 @@
 #cmakedefine GRN_WITH_ONIGMO
 #cmakedefine GRN_WITH_ZEROMQ
 #cmakedefine GRN_WITH_ZLIB
+#cmakedefine GRN_WITH_ZSTD
 
 /* headers */
 #cmakedefine HAVE_DIRENT_H
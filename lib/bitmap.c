@@ -0,0 +1,604 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2015 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "grn_ctx.h"
+#include "grn_bitmap.h"
+
+#include <string.h>
+
+#define KEY_OF(id)   ((uint16_t)((id) >> 16))
+#define VALUE_OF(id) ((uint16_t)((id) & 0xffff))
+#define BITMAP_WORD_BIT(v) (((uint64_t)1) << ((v) & 63))
+
+#ifdef __GNUC__
+# define POPCOUNT(w) ((uint32_t)__builtin_popcountll(w))
+# define CTZ(w)      ((uint32_t)__builtin_ctzll(w))
+#else /* __GNUC__ */
+static inline uint32_t
+POPCOUNT(uint64_t w)
+{
+  w = w - ((w >> 1) & 0x5555555555555555ULL);
+  w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+  w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (uint32_t)((w * 0x0101010101010101ULL) >> 56);
+}
+
+static inline uint32_t
+CTZ(uint64_t w)
+{
+  uint32_t n = 0;
+  while (!(w & 1)) {
+    w >>= 1;
+    n++;
+  }
+  return n;
+}
+#endif /* __GNUC__ */
+
+/* container */
+
+static void
+container_fin(grn_ctx *ctx, grn_bitmap_container *c)
+{
+  if (c->data.values) {
+    GRN_FREE(c->data.values);
+    c->data.values = NULL;
+  }
+}
+
+static uint32_t
+words_count(const uint64_t *words)
+{
+  uint32_t i, n = 0;
+  for (i = 0; i < GRN_BITMAP_N_WORDS; i++) {
+    n += POPCOUNT(words[i]);
+  }
+  return n;
+}
+
+static grn_rc
+container_to_bitset(grn_ctx *ctx, grn_bitmap_container *c)
+{
+  uint32_t i;
+  uint64_t *words = GRN_CALLOC(sizeof(uint64_t) * GRN_BITMAP_N_WORDS);
+  if (!words) { return GRN_NO_MEMORY_AVAILABLE; }
+  for (i = 0; i < c->n_values; i++) {
+    uint16_t v = c->data.values[i];
+    words[v >> 6] |= BITMAP_WORD_BIT(v);
+  }
+  GRN_FREE(c->data.values);
+  c->data.words = words;
+  c->is_bitset = GRN_TRUE;
+  c->capacity = 0;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+container_to_array(grn_ctx *ctx, grn_bitmap_container *c)
+{
+  uint32_t i, n = 0;
+  uint16_t *values;
+  if (!(values = GRN_MALLOCN(uint16_t, c->n_values ? c->n_values : 1))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  for (i = 0; i < GRN_BITMAP_N_WORDS; i++) {
+    uint64_t w = c->data.words[i];
+    while (w) {
+      values[n++] = (uint16_t)((i << 6) + CTZ(w));
+      w &= w - 1;
+    }
+  }
+  GRN_FREE(c->data.words);
+  c->data.values = values;
+  c->is_bitset = GRN_FALSE;
+  c->capacity = c->n_values ? c->n_values : 1;
+  return GRN_SUCCESS;
+}
+
+/* Converts a sparse bitset back to an array to save memory. */
+static grn_rc
+container_shrink(grn_ctx *ctx, grn_bitmap_container *c)
+{
+  if (c->is_bitset && c->n_values <= GRN_BITMAP_ARRAY_MAX_SIZE) {
+    return container_to_array(ctx, c);
+  }
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+container_copy(grn_ctx *ctx, grn_bitmap_container *dest,
+               const grn_bitmap_container *src)
+{
+  *dest = *src;
+  if (src->is_bitset) {
+    size_t size = sizeof(uint64_t) * GRN_BITMAP_N_WORDS;
+    if (!(dest->data.words = GRN_MALLOC(size))) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    grn_memcpy(dest->data.words, src->data.words, size);
+  } else {
+    dest->capacity = src->n_values ? src->n_values : 1;
+    if (!(dest->data.values = GRN_MALLOCN(uint16_t, dest->capacity))) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    grn_memcpy(dest->data.values, src->data.values,
+               sizeof(uint16_t) * src->n_values);
+  }
+  return GRN_SUCCESS;
+}
+
+static inline int
+array_find(const uint16_t *values, uint32_t n, uint16_t v)
+{
+  int low = 0, high = (int)n - 1;
+  while (low <= high) {
+    int mid = (low + high) >> 1;
+    if (values[mid] < v) {
+      low = mid + 1;
+    } else if (values[mid] > v) {
+      high = mid - 1;
+    } else {
+      return mid;
+    }
+  }
+  return -(low + 1);
+}
+
+static grn_rc
+container_add(grn_ctx *ctx, grn_bitmap_container *c, uint16_t v)
+{
+  uint32_t pos;
+  if (c->is_bitset) {
+    uint64_t *w = &(c->data.words[v >> 6]);
+    if (!(*w & BITMAP_WORD_BIT(v))) {
+      *w |= BITMAP_WORD_BIT(v);
+      c->n_values++;
+    }
+    return GRN_SUCCESS;
+  }
+  if (!c->n_values || c->data.values[c->n_values - 1] < v) {
+    pos = c->n_values;
+  } else {
+    int found = array_find(c->data.values, c->n_values, v);
+    if (found >= 0) { return GRN_SUCCESS; }
+    pos = -(found + 1);
+  }
+  if (c->n_values == GRN_BITMAP_ARRAY_MAX_SIZE) {
+    grn_rc rc = container_to_bitset(ctx, c);
+    if (rc) { return rc; }
+    return container_add(ctx, c, v);
+  }
+  if (c->n_values == c->capacity) {
+    uint32_t capacity = c->capacity ? c->capacity * 2 : 4;
+    uint16_t *values;
+    if (capacity > GRN_BITMAP_ARRAY_MAX_SIZE) {
+      capacity = GRN_BITMAP_ARRAY_MAX_SIZE;
+    }
+    values = GRN_REALLOC(c->data.values, sizeof(uint16_t) * capacity);
+    if (!values) { return GRN_NO_MEMORY_AVAILABLE; }
+    c->data.values = values;
+    c->capacity = capacity;
+  }
+  if (pos < c->n_values) {
+    memmove(c->data.values + pos + 1, c->data.values + pos,
+            sizeof(uint16_t) * (c->n_values - pos));
+  }
+  c->data.values[pos] = v;
+  c->n_values++;
+  return GRN_SUCCESS;
+}
+
+static grn_bool
+container_contain(const grn_bitmap_container *c, uint16_t v)
+{
+  if (c->is_bitset) {
+    return (c->data.words[v >> 6] & BITMAP_WORD_BIT(v)) != 0;
+  } else {
+    return array_find(c->data.values, c->n_values, v) >= 0;
+  }
+}
+
+static grn_rc
+container_and(grn_ctx *ctx, grn_bitmap_container *a,
+              const grn_bitmap_container *b)
+{
+  uint32_t i, j, n = 0;
+  if (a->is_bitset && b->is_bitset) {
+    for (i = 0; i < GRN_BITMAP_N_WORDS; i++) {
+      a->data.words[i] &= b->data.words[i];
+    }
+    a->n_values = words_count(a->data.words);
+    return container_shrink(ctx, a);
+  }
+  if (a->is_bitset) {
+    uint16_t *values = GRN_MALLOCN(uint16_t, b->n_values ? b->n_values : 1);
+    if (!values) { return GRN_NO_MEMORY_AVAILABLE; }
+    for (i = 0; i < b->n_values; i++) {
+      uint16_t v = b->data.values[i];
+      if (a->data.words[v >> 6] & BITMAP_WORD_BIT(v)) { values[n++] = v; }
+    }
+    GRN_FREE(a->data.words);
+    a->data.values = values;
+    a->is_bitset = GRN_FALSE;
+    a->capacity = b->n_values ? b->n_values : 1;
+    a->n_values = n;
+    return GRN_SUCCESS;
+  }
+  if (b->is_bitset) {
+    for (i = 0; i < a->n_values; i++) {
+      uint16_t v = a->data.values[i];
+      if (b->data.words[v >> 6] & BITMAP_WORD_BIT(v)) { a->data.values[n++] = v; }
+    }
+  } else {
+    for (i = 0, j = 0; i < a->n_values && j < b->n_values;) {
+      uint16_t va = a->data.values[i], vb = b->data.values[j];
+      if (va < vb) {
+        i++;
+      } else if (va > vb) {
+        j++;
+      } else {
+        a->data.values[n++] = va;
+        i++;
+        j++;
+      }
+    }
+  }
+  a->n_values = n;
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+container_or(grn_ctx *ctx, grn_bitmap_container *a,
+             const grn_bitmap_container *b)
+{
+  uint32_t i, j, n = 0;
+  grn_rc rc;
+  if (!a->is_bitset && !b->is_bitset) {
+    uint16_t *values = GRN_MALLOCN(uint16_t, a->n_values + b->n_values);
+    if (!values) { return GRN_NO_MEMORY_AVAILABLE; }
+    for (i = 0, j = 0; i < a->n_values || j < b->n_values;) {
+      if (j == b->n_values ||
+          (i < a->n_values && a->data.values[i] < b->data.values[j])) {
+        values[n++] = a->data.values[i++];
+      } else if (i == a->n_values || a->data.values[i] > b->data.values[j]) {
+        values[n++] = b->data.values[j++];
+      } else {
+        values[n++] = a->data.values[i];
+        i++;
+        j++;
+      }
+    }
+    GRN_FREE(a->data.values);
+    a->data.values = values;
+    a->capacity = a->n_values + b->n_values;
+    a->n_values = n;
+    if (n > GRN_BITMAP_ARRAY_MAX_SIZE) {
+      return container_to_bitset(ctx, a);
+    }
+    return GRN_SUCCESS;
+  }
+  if (!a->is_bitset && (rc = container_to_bitset(ctx, a))) {
+    return rc;
+  }
+  if (b->is_bitset) {
+    for (i = 0; i < GRN_BITMAP_N_WORDS; i++) {
+      a->data.words[i] |= b->data.words[i];
+    }
+    a->n_values = words_count(a->data.words);
+  } else {
+    for (i = 0; i < b->n_values; i++) {
+      uint16_t v = b->data.values[i];
+      uint64_t *w = &(a->data.words[v >> 6]);
+      if (!(*w & BITMAP_WORD_BIT(v))) {
+        *w |= BITMAP_WORD_BIT(v);
+        a->n_values++;
+      }
+    }
+  }
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+container_and_not(grn_ctx *ctx, grn_bitmap_container *a,
+                  const grn_bitmap_container *b)
+{
+  uint32_t i, j, n = 0;
+  if (a->is_bitset) {
+    if (b->is_bitset) {
+      for (i = 0; i < GRN_BITMAP_N_WORDS; i++) {
+        a->data.words[i] &= ~(b->data.words[i]);
+      }
+      a->n_values = words_count(a->data.words);
+    } else {
+      for (i = 0; i < b->n_values; i++) {
+        uint16_t v = b->data.values[i];
+        uint64_t *w = &(a->data.words[v >> 6]);
+        if (*w & BITMAP_WORD_BIT(v)) {
+          *w &= ~BITMAP_WORD_BIT(v);
+          a->n_values--;
+        }
+      }
+    }
+    return container_shrink(ctx, a);
+  }
+  if (b->is_bitset) {
+    for (i = 0; i < a->n_values; i++) {
+      uint16_t v = a->data.values[i];
+      if (!(b->data.words[v >> 6] & BITMAP_WORD_BIT(v))) { a->data.values[n++] = v; }
+    }
+  } else {
+    for (i = 0, j = 0; i < a->n_values;) {
+      uint16_t va = a->data.values[i];
+      if (j == b->n_values || va < b->data.values[j]) {
+        a->data.values[n++] = va;
+        i++;
+      } else if (va > b->data.values[j]) {
+        j++;
+      } else {
+        i++;
+        j++;
+      }
+    }
+  }
+  a->n_values = n;
+  return GRN_SUCCESS;
+}
+
+/* bitmap */
+
+grn_bitmap *
+grn_bitmap_open(grn_ctx *ctx)
+{
+  grn_bitmap *bitmap = GRN_MALLOCN(grn_bitmap, 1);
+  if (!bitmap) {
+    ERR(GRN_NO_MEMORY_AVAILABLE, "[bitmap] failed to allocate");
+    return NULL;
+  }
+  bitmap->containers = NULL;
+  bitmap->n_containers = 0;
+  bitmap->capacity = 0;
+  return bitmap;
+}
+
+void
+grn_bitmap_close(grn_ctx *ctx, grn_bitmap *bitmap)
+{
+  uint32_t i;
+  if (!bitmap) { return; }
+  for (i = 0; i < bitmap->n_containers; i++) {
+    container_fin(ctx, &(bitmap->containers[i]));
+  }
+  if (bitmap->containers) {
+    GRN_FREE(bitmap->containers);
+  }
+  GRN_FREE(bitmap);
+}
+
+static int
+bitmap_find(grn_bitmap *bitmap, uint16_t key)
+{
+  int low = 0, high = (int)bitmap->n_containers - 1;
+  while (low <= high) {
+    int mid = (low + high) >> 1;
+    uint16_t k = bitmap->containers[mid].key;
+    if (k < key) {
+      low = mid + 1;
+    } else if (k > key) {
+      high = mid - 1;
+    } else {
+      return mid;
+    }
+  }
+  return -(low + 1);
+}
+
+static grn_bitmap_container *
+bitmap_insert(grn_ctx *ctx, grn_bitmap *bitmap, uint32_t pos, uint16_t key)
+{
+  grn_bitmap_container *c;
+  if (bitmap->n_containers == bitmap->capacity) {
+    uint32_t capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+    grn_bitmap_container *containers =
+      GRN_REALLOC(bitmap->containers, sizeof(grn_bitmap_container) * capacity);
+    if (!containers) { return NULL; }
+    bitmap->containers = containers;
+    bitmap->capacity = capacity;
+  }
+  if (pos < bitmap->n_containers) {
+    memmove(bitmap->containers + pos + 1, bitmap->containers + pos,
+            sizeof(grn_bitmap_container) * (bitmap->n_containers - pos));
+  }
+  bitmap->n_containers++;
+  c = &(bitmap->containers[pos]);
+  c->key = key;
+  c->is_bitset = GRN_FALSE;
+  c->n_values = 0;
+  c->capacity = 0;
+  c->data.values = NULL;
+  return c;
+}
+
+grn_rc
+grn_bitmap_add(grn_ctx *ctx, grn_bitmap *bitmap, grn_id id)
+{
+  uint16_t key = KEY_OF(id);
+  grn_bitmap_container *c;
+  uint32_t n = bitmap->n_containers;
+  if (n && bitmap->containers[n - 1].key == key) {
+    c = &(bitmap->containers[n - 1]);
+  } else {
+    int found;
+    if (!n || bitmap->containers[n - 1].key < key) {
+      found = -((int)n + 1);
+    } else {
+      found = bitmap_find(bitmap, key);
+    }
+    if (found >= 0) {
+      c = &(bitmap->containers[found]);
+    } else {
+      if (!(c = bitmap_insert(ctx, bitmap, -(found + 1), key))) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+    }
+  }
+  return container_add(ctx, c, VALUE_OF(id));
+}
+
+grn_bool
+grn_bitmap_contain(grn_ctx *ctx, grn_bitmap *bitmap, grn_id id)
+{
+  int found = bitmap_find(bitmap, KEY_OF(id));
+  if (found < 0) { return GRN_FALSE; }
+  return container_contain(&(bitmap->containers[found]), VALUE_OF(id));
+}
+
+uint32_t
+grn_bitmap_size(grn_ctx *ctx, grn_bitmap *bitmap)
+{
+  uint32_t i, n = 0;
+  for (i = 0; i < bitmap->n_containers; i++) {
+    n += bitmap->containers[i].n_values;
+  }
+  return n;
+}
+
+/* Removes empty containers. */
+static void
+bitmap_compact(grn_ctx *ctx, grn_bitmap *bitmap)
+{
+  uint32_t i, n = 0;
+  for (i = 0; i < bitmap->n_containers; i++) {
+    grn_bitmap_container *c = &(bitmap->containers[i]);
+    if (c->n_values) {
+      bitmap->containers[n++] = *c;
+    } else {
+      container_fin(ctx, c);
+    }
+  }
+  bitmap->n_containers = n;
+}
+
+grn_rc
+grn_bitmap_and(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other)
+{
+  grn_rc rc = GRN_SUCCESS;
+  uint32_t i, j = 0;
+  for (i = 0; i < bitmap->n_containers; i++) {
+    grn_bitmap_container *c = &(bitmap->containers[i]);
+    while (j < other->n_containers && other->containers[j].key < c->key) {
+      j++;
+    }
+    if (j < other->n_containers && other->containers[j].key == c->key) {
+      if ((rc = container_and(ctx, c, &(other->containers[j])))) { break; }
+    } else {
+      c->n_values = 0;
+    }
+  }
+  bitmap_compact(ctx, bitmap);
+  return rc;
+}
+
+grn_rc
+grn_bitmap_or(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other)
+{
+  uint32_t i = 0, j;
+  for (j = 0; j < other->n_containers; j++) {
+    const grn_bitmap_container *oc = &(other->containers[j]);
+    grn_rc rc;
+    while (i < bitmap->n_containers && bitmap->containers[i].key < oc->key) {
+      i++;
+    }
+    if (i < bitmap->n_containers && bitmap->containers[i].key == oc->key) {
+      rc = container_or(ctx, &(bitmap->containers[i]), oc);
+    } else {
+      grn_bitmap_container *c = bitmap_insert(ctx, bitmap, i, oc->key);
+      if (!c) { return GRN_NO_MEMORY_AVAILABLE; }
+      rc = container_copy(ctx, c, oc);
+      if (rc) {
+        c->n_values = 0;
+        c->data.values = NULL;
+        bitmap_compact(ctx, bitmap);
+      }
+    }
+    if (rc) { return rc; }
+  }
+  return GRN_SUCCESS;
+}
+
+grn_rc
+grn_bitmap_and_not(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other)
+{
+  grn_rc rc = GRN_SUCCESS;
+  uint32_t i, j = 0;
+  for (i = 0; i < bitmap->n_containers; i++) {
+    grn_bitmap_container *c = &(bitmap->containers[i]);
+    while (j < other->n_containers && other->containers[j].key < c->key) {
+      j++;
+    }
+    if (j < other->n_containers && other->containers[j].key == c->key) {
+      if ((rc = container_and_not(ctx, c, &(other->containers[j])))) {
+        break;
+      }
+    }
+  }
+  bitmap_compact(ctx, bitmap);
+  return rc;
+}
+
+void
+grn_bitmap_cursor_init(grn_ctx *ctx, grn_bitmap_cursor *cursor,
+                       grn_bitmap *bitmap)
+{
+  cursor->bitmap = bitmap;
+  cursor->container = 0;
+  cursor->offset = 0;
+  cursor->word = 0;
+  if (bitmap->n_containers && bitmap->containers[0].is_bitset) {
+    cursor->word = bitmap->containers[0].data.words[0];
+  }
+}
+
+grn_id
+grn_bitmap_cursor_next(grn_ctx *ctx, grn_bitmap_cursor *cursor)
+{
+  grn_bitmap *bitmap = cursor->bitmap;
+  while (cursor->container < bitmap->n_containers) {
+    grn_bitmap_container *c = &(bitmap->containers[cursor->container]);
+    grn_id high = ((grn_id)c->key) << 16;
+    if (c->is_bitset) {
+      while (!cursor->word && ++cursor->offset < GRN_BITMAP_N_WORDS) {
+        cursor->word = c->data.words[cursor->offset];
+      }
+      if (cursor->word) {
+        grn_id id = high + (cursor->offset << 6) + CTZ(cursor->word);
+        cursor->word &= cursor->word - 1;
+        return id;
+      }
+    } else if (cursor->offset < c->n_values) {
+      return high + c->data.values[cursor->offset++];
+    }
+    cursor->container++;
+    cursor->offset = 0;
+    cursor->word = 0;
+    if (cursor->container < bitmap->n_containers &&
+        bitmap->containers[cursor->container].is_bitset) {
+      cursor->word = bitmap->containers[cursor->container].data.words[0];
+    }
+  }
+  return GRN_ID_NIL;
+}
@@ -22,6 +22,7 @@
 #include "grn_tokenizers.h"
 #include "grn_ctx_impl.h"
 #include "grn_ii.h"
+#include "grn_expr.h"
 #include "grn_pat.h"
 #include "grn_proc.h"
 #include "grn_plugin.h"
@@ -95,7 +96,10 @@ grn_init_from_env(void)
   grn_ctx_impl_mrb_init_from_env();
   grn_io_init_from_env();
   grn_ii_init_from_env();
+  grn_ja_init_from_env();
   grn_db_init_from_env();
+  grn_expr_init_from_env();
+  grn_output_init_from_env();
   grn_proc_init_from_env();
   grn_plugin_init_from_env();
 }
@@ -572,6 +576,12 @@ grn_ctx_impl_init(grn_ctx *ctx)
       grn_get_default_match_escalation_threshold();
   }
 
+  ctx->impl->top_k.limit = -1;
+  ctx->impl->top_k.n_hits = -1;
+  ctx->impl->score_ignorable = GRN_FALSE;
+
+  ctx->impl->expr_cache = NULL;
+
   ctx->impl->finalizer = NULL;
 
   ctx->impl->com = NULL;
@@ -580,6 +590,7 @@ grn_ctx_impl_init(grn_ctx *ctx)
   ctx->impl->data.ptr = NULL;
   ctx->impl->tv.tv_sec = 0;
   ctx->impl->tv.tv_nsec = 0;
+  grn_output_flush_reset(ctx);
   ctx->impl->edge = NULL;
   grn_loader_init(&ctx->impl->loader);
   ctx->impl->plugin_path = NULL;
@@ -723,6 +734,7 @@ grn_ctx_fin(grn_ctx *ctx)
     if (ctx->impl->parser) {
       grn_expr_parser_close(ctx);
     }
+    grn_expr_cache_close(ctx);
     if (ctx->impl->values) {
 #ifndef USE_MEMORY_DEBUG
       grn_db_obj *o;
@@ -945,6 +957,10 @@ grn_init(void)
             "failed to initialize request canceler (%d)", rc);
     return rc;
   }
+  grn_io_segment_manager_init();
+  grn_ii_chunk_cache_init();
+  grn_ja_value_cache_init();
+  grn_ii_merger_init();
   GRN_LOG(ctx, GRN_LOG_NOTICE, "grn_init");
   check_overcommit_memory(ctx);
   return rc;
@@ -1020,6 +1036,7 @@ grn_fin(void)
 {
   grn_ctx *ctx, *ctx_;
   if (grn_gctx.stat == GRN_CTX_FIN) { return GRN_INVALID_ARGUMENT; }
+  grn_ii_merger_fin();
   for (ctx = grn_gctx.next; ctx != &grn_gctx; ctx = ctx_) {
     ctx_ = ctx->next;
     if (ctx->stat != GRN_CTX_FIN) { grn_ctx_fin(ctx); }
@@ -1032,10 +1049,13 @@ grn_fin(void)
   grn_query_logger_fin(ctx);
   grn_request_canceler_fin();
   grn_cache_fin();
+  grn_ja_value_cache_fin();
   grn_tokenizers_fin();
   grn_normalizer_fin();
   grn_plugins_fin();
   grn_ctx_fin(ctx);
+  grn_ii_chunk_cache_fin();
+  grn_io_segment_manager_fin();
   grn_com_fin();
   GRN_LOG(ctx, GRN_LOG_NOTICE, "grn_fin (%d)", alloc_count);
   grn_logger_fin(ctx);
@@ -1565,6 +1585,7 @@ grn_ctx_send(grn_ctx *ctx, const char *str, unsigned int str_len, int flags)
         ctx->impl->mime_type = "application/json";
         ctx->impl->output_type = GRN_CONTENT_JSON;
         grn_timeval_now(ctx, &ctx->impl->tv);
+        grn_output_flush_reset(ctx);
         GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_COMMAND,
                       ">", "%.*s", str_len, str);
         if (str_len && *str == '/') {
@@ -1587,6 +1608,7 @@ grn_ctx_send(grn_ctx *ctx, const char *str, unsigned int str_len, int flags)
         }
       }
       if (expr) { grn_expr_clear_vars(ctx, expr); }
+      grn_io_segment_manager_reclaim(ctx);
       goto exit;
     }
   }
@@ -20,6 +20,7 @@
 #include "grn_pat.h"
 #include "grn_dat.h"
 #include "grn_ii.h"
+#include "grn_expr.h"
 #include "grn_ctx_impl.h"
 #include "grn_token_cursor.h"
 #include "grn_tokenizers.h"
@@ -88,6 +89,8 @@ grn_obj_get_range_info(grn_ctx *ctx, grn_obj *obj,
 
 static char grn_db_key[GRN_ENV_BUFFER_SIZE];
 static uint64_t grn_index_sparsity = 10;
+static int grn_table_group_n_threads = 1;
+static unsigned int grn_table_group_n_records_per_partition = 0x4000;
 
 void
 grn_db_init_from_env(void)
@@ -110,6 +113,33 @@ grn_db_init_from_env(void)
       }
     }
   }
+
+  {
+    char grn_table_group_n_threads_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_GROUP_N_THREADS",
+               grn_table_group_n_threads_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_group_n_threads_env[0]) {
+      grn_table_group_n_threads = atoi(grn_table_group_n_threads_env);
+      if (grn_table_group_n_threads < 1) {
+        grn_table_group_n_threads = 1;
+      }
+    }
+  }
+
+  {
+    char grn_table_group_n_records_per_partition_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_GROUP_N_RECORDS_PER_PARTITION",
+               grn_table_group_n_records_per_partition_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_group_n_records_per_partition_env[0]) {
+      int n_records = atoi(grn_table_group_n_records_per_partition_env);
+      if (n_records < 1) {
+        n_records = 1;
+      }
+      grn_table_group_n_records_per_partition = n_records;
+    }
+  }
 }
 
 inline static void
@@ -206,6 +236,7 @@ grn_db_create(grn_ctx *ctx, const char *path, grn_db_create_optarg *optarg)
       }
       if (s->keys) {
         CRITICAL_SECTION_INIT(s->lock);
+        s->schema_generation = 0;
         GRN_DB_OBJ_SET_TYPE(s, GRN_DB);
         s->obj.db = (grn_obj *)s;
         s->obj.header.domain = GRN_ID_NIL;
@@ -279,6 +310,7 @@ grn_db_open(grn_ctx *ctx, const char *path)
         gen_pathname(path, specs_path, 0);
         if ((s->specs = grn_ja_open(ctx, specs_path))) {
           CRITICAL_SECTION_INIT(s->lock);
+          s->schema_generation = 0;
           GRN_DB_OBJ_SET_TYPE(s, GRN_DB);
           s->obj.db = (grn_obj *)s;
           s->obj.header.domain = GRN_ID_NIL;
@@ -348,6 +380,7 @@ grn_db_close(grn_ctx *ctx, grn_obj *db)
     if (ctx->impl->parser) {
       grn_expr_parser_close(ctx);
     }
+    grn_expr_cache_close(ctx);
   }
 
   GRN_TINY_ARRAY_EACH(&s->values, 1, grn_db_curr_id(ctx, db), id, vp, {
@@ -470,6 +503,27 @@ grn_db_lastmod(grn_obj *s)
   return grn_obj_io(((grn_db *)s)->keys)->header->lastmod;
 }
 
+/*
+  Schema generation is incremented when an object is registered,
+  renamed or removed and when sources of a column are changed. It is
+  used to expire objects that refer schema such as parsed expressions.
+*/
+uint32_t
+grn_db_schema_generation(grn_obj *s)
+{
+  return ((grn_db *)s)->schema_generation;
+}
+
+static void
+grn_db_increment_schema_generation(grn_ctx *ctx, grn_obj *s)
+{
+  uint32_t generation;
+  if (!GRN_DB_P(s)) {
+    return;
+  }
+  GRN_ATOMIC_ADD_EX(&(((grn_db *)s)->schema_generation), 1, generation);
+}
+
 void
 grn_db_touch(grn_ctx *ctx, grn_obj *s)
 {
@@ -2785,6 +2839,20 @@ grn_table_next(grn_ctx *ctx, grn_obj *table, grn_id id)
   GRN_API_RETURN(r);
 }
 
+grn_id
+grn_table_max_id(grn_ctx *ctx, grn_obj *table)
+{
+  grn_id max_id = GRN_ID_NIL;
+  grn_table_cursor *tc;
+  if ((tc = grn_table_cursor_open(ctx, table,
+                                  NULL, 0, NULL, 0, 0, 1,
+                                  GRN_CURSOR_BY_ID|GRN_CURSOR_DESCENDING))) {
+    max_id = grn_table_cursor_next(ctx, tc);
+    grn_table_cursor_close(ctx, tc);
+  }
+  return max_id;
+}
+
 static grn_rc
 grn_accessor_resolve_one_index_column(grn_ctx *ctx, grn_accessor *accessor,
                                       grn_obj *current_res, grn_obj **next_res,
@@ -3261,7 +3329,8 @@ grn_table_group_add_subrec(grn_ctx *ctx,
 
 static grn_bool
 accelerated_table_group(grn_ctx *ctx, grn_obj *table, grn_obj *key,
-                        grn_table_group_result *result)
+                        grn_table_group_result *result,
+                        int offset, int limit)
 {
   grn_obj *res = result->table;
   grn_obj *calc_target = result->calc_target;
@@ -3273,7 +3342,8 @@ accelerated_table_group(grn_ctx *ctx, grn_obj *table, grn_obj *key,
       grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
       int idp = GRN_OBJ_TABLEP(range);
       grn_table_cursor *tc;
-      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                                      offset, limit, 0))) {
         grn_bool processed = GRN_TRUE;
         grn_obj value_buffer;
         GRN_VOID_INIT(&value_buffer);
@@ -3361,7 +3431,8 @@ accelerated_table_group(grn_ctx *ctx, grn_obj *table, grn_obj *key,
 
 static void
 grn_table_group_single_key_records(grn_ctx *ctx, grn_obj *table,
-                                   grn_obj *key, grn_table_group_result *result)
+                                   grn_obj *key, grn_table_group_result *result,
+                                   int offset, int limit)
 {
   grn_obj bulk;
   grn_obj value_buffer;
@@ -3371,7 +3442,8 @@ grn_table_group_single_key_records(grn_ctx *ctx, grn_obj *table,
 
   GRN_TEXT_INIT(&bulk, 0);
   GRN_VOID_INIT(&value_buffer);
-  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+  if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0,
+                                  offset, limit, 0))) {
     grn_id id;
     grn_obj *range = grn_ctx_at(ctx, grn_obj_get_range(ctx, key));
     int idp = GRN_OBJ_TABLEP(range);
@@ -3445,9 +3517,268 @@ grn_table_group_single_key_records(grn_ctx *ctx, grn_obj *table,
     }
     grn_table_cursor_close(ctx, tc);
   }
+  GRN_OBJ_FIN(ctx, &value_buffer);
   grn_obj_close(ctx, &bulk);
 }
 
+static grn_obj *
+grn_table_group_create_result_table(grn_ctx *ctx, grn_obj *table,
+                                    grn_table_sort_key *keys, int n_keys,
+                                    grn_table_group_result *result)
+{
+  grn_obj *res;
+  grn_obj_flags flags;
+  grn_obj *key_type = NULL;
+  uint32_t additional_value_size;
+
+  flags = GRN_TABLE_HASH_KEY|
+    GRN_OBJ_WITH_SUBREC|
+    GRN_OBJ_UNIT_USERDEF_DOCUMENT;
+  if (n_keys == 1) {
+    key_type = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys[0].key));
+  } else {
+    flags |= GRN_OBJ_KEY_VAR_SIZE;
+  }
+  additional_value_size = grn_rset_recinfo_calc_values_size(ctx,
+                                                            result->flags);
+  res = grn_table_create_with_max_n_subrecs(ctx, NULL, 0, NULL,
+                                            flags,
+                                            key_type, table,
+                                            result->max_n_subrecs,
+                                            additional_value_size);
+  if (key_type) {
+    grn_obj_unlink(ctx, key_type);
+  }
+  if (!res) {
+    return NULL;
+  }
+  DB_OBJ(res)->flags.group = result->flags;
+  return res;
+}
+
+/*
+  Parallel group splits records into partitions of
+  grn_table_group_n_records_per_partition records in cursor order.
+  Worker threads group partitions into worker local result tables,
+  one partition per worker at a time. Each worker has its own
+  grn_ctx. Local result tables are merged into the result table in
+  partition order. Groups are added in the same order as grouping by
+  one thread and sub records are merged in the same order. Because
+  grouping keeps the first max_n_subrecs sub records, the merged
+  result is the same as the result of grouping by one thread.
+
+  Partitions don't depend on the number of threads. So AVG, that is
+  merged as a weighted mean, is also the same for any number of
+  threads.
+*/
+#define GRN_TABLE_GROUP_N_THREADS_MAX 64
+
+typedef struct {
+  grn_ctx ctx;
+  grn_obj *table;
+  grn_obj *key;
+  grn_table_group_result result;
+  int offset;
+  int limit;
+  grn_thread thread;
+  grn_bool running;
+} grn_table_group_worker;
+
+static grn_thread_func_result CALLBACK
+grn_table_group_worker_run(void *arg)
+{
+  grn_table_group_worker *worker = arg;
+  grn_ctx *ctx = &(worker->ctx);
+
+  if (!accelerated_table_group(ctx, worker->table, worker->key,
+                               &(worker->result),
+                               worker->offset, worker->limit)) {
+    grn_table_group_single_key_records(ctx, worker->table, worker->key,
+                                       &(worker->result),
+                                       worker->offset, worker->limit);
+  }
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+static void
+grn_table_group_merge_recinfo(grn_ctx *ctx,
+                              grn_obj *res, grn_rset_recinfo *ri,
+                              grn_rset_recinfo *local_ri)
+{
+  int limit = DB_OBJ(res)->max_n_subrecs;
+  int local_n_subrecs = GRN_RSET_N_SUBRECS(local_ri);
+
+  if (DB_OBJ(res)->flags.group & (GRN_TABLE_GROUP_CALC_MAX |
+                                  GRN_TABLE_GROUP_CALC_MIN |
+                                  GRN_TABLE_GROUP_CALC_SUM |
+                                  GRN_TABLE_GROUP_CALC_AVG)) {
+    grn_rset_recinfo_merge_calc_values(ctx, ri, res, local_ri);
+  }
+  ri->score += local_ri->score;
+  if (limit) {
+    int i, n_local_subrecs;
+    int subrec_size = DB_OBJ(res)->subrec_size;
+    n_local_subrecs = local_n_subrecs < limit ? local_n_subrecs : limit;
+    for (i = 0; i < n_local_subrecs; i++) {
+      double *subrec = GRN_RSET_SUBRECS_NTH(local_ri->subrecs, subrec_size, i);
+      int n_subrecs;
+      ri->n_subrecs += 1;
+      n_subrecs = GRN_RSET_N_SUBRECS(ri);
+      if (limit < n_subrecs) {
+        if (GRN_RSET_SUBRECS_CMP(*subrec, *((double *)(ri->subrecs)), 0) > 0) {
+          subrecs_replace_min((byte *)ri->subrecs, subrec_size, limit,
+                              *subrec, (byte *)subrec + GRN_RSET_SCORE_SIZE,
+                              0);
+        }
+      } else {
+        subrecs_push((byte *)ri->subrecs, subrec_size, n_subrecs,
+                     *subrec, (byte *)subrec + GRN_RSET_SCORE_SIZE, 0);
+      }
+    }
+    ri->n_subrecs += local_n_subrecs - n_local_subrecs;
+  } else {
+    ri->n_subrecs += local_n_subrecs;
+  }
+}
+
+static grn_bool
+grn_table_group_single_key_parallel(grn_ctx *ctx, grn_obj *table,
+                                    grn_table_sort_key *keys,
+                                    grn_table_group_result *result)
+{
+  int i, n_workers = grn_table_group_n_threads;
+  unsigned int n_records, n_partitions, partition;
+  unsigned int n_records_per_partition =
+    grn_table_group_n_records_per_partition;
+  grn_obj *res = result->table;
+  grn_table_group_worker *workers;
+
+  if (n_workers <= 1) {
+    return GRN_FALSE;
+  }
+  n_records = grn_table_size(ctx, table);
+  n_partitions = n_records / n_records_per_partition;
+  if (n_records % n_records_per_partition) {
+    n_partitions++;
+  }
+  if (n_partitions <= 1) {
+    return GRN_FALSE;
+  }
+  if (n_workers > GRN_TABLE_GROUP_N_THREADS_MAX) {
+    n_workers = GRN_TABLE_GROUP_N_THREADS_MAX;
+  }
+  if (n_partitions < (unsigned int)n_workers) {
+    n_workers = n_partitions;
+  }
+  if (!(workers = GRN_CALLOC(sizeof(grn_table_group_worker) * n_workers))) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    grn_table_group_worker *worker = &(workers[i]);
+    grn_ctx_init(&(worker->ctx), 0);
+    grn_ctx_use(&(worker->ctx), grn_ctx_db(ctx));
+    worker->table = table;
+    worker->key = keys->key;
+    worker->result = *result;
+    worker->result.table =
+      grn_table_group_create_result_table(&(worker->ctx), table, keys, 1,
+                                          result);
+    if (!worker->result.table) {
+      break;
+    }
+  }
+  if (i < n_workers) {
+    int n_initialized = i + 1;
+    for (i = 0; i < n_initialized; i++) {
+      grn_table_group_worker *worker = &(workers[i]);
+      if (worker->result.table) {
+        grn_obj_close(&(worker->ctx), worker->result.table);
+      }
+      grn_ctx_fin(&(worker->ctx));
+    }
+    GRN_FREE(workers);
+    return GRN_FALSE;
+  }
+
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "[table][group] group in parallel: "
+          "n_threads:%d n_records:%u n_partitions:%u",
+          n_workers, n_records, n_partitions);
+  for (partition = 0;
+       partition < n_partitions && !ctx->rc;
+       partition += n_workers) {
+    int n_running_workers = n_workers;
+    if (n_partitions - partition < (unsigned int)n_running_workers) {
+      n_running_workers = n_partitions - partition;
+    }
+    for (i = 0; i < n_running_workers; i++) {
+      grn_table_group_worker *worker = &(workers[i]);
+      unsigned int start = (partition + i) * n_records_per_partition;
+      worker->offset = start;
+      worker->limit = n_records_per_partition;
+      if (!worker->result.table) {
+        worker->result.table =
+          grn_table_group_create_result_table(&(worker->ctx), table, keys, 1,
+                                              result);
+        if (!worker->result.table) {
+          ERR(worker->ctx.rc ? worker->ctx.rc : GRN_NO_MEMORY_AVAILABLE,
+              "[table][group] worker<%d>: "
+              "failed to create local result table", i);
+          break;
+        }
+      }
+      if (THREAD_CREATE(worker->thread, grn_table_group_worker_run, worker)) {
+        SERR("[table][group] failed to create worker thread");
+        break;
+      }
+      worker->running = GRN_TRUE;
+    }
+    for (i = 0; i < n_running_workers; i++) {
+      grn_table_group_worker *worker = &(workers[i]);
+      if (worker->running) {
+        THREAD_JOIN(worker->thread);
+      }
+    }
+
+    for (i = 0; i < n_running_workers; i++) {
+      grn_table_group_worker *worker = &(workers[i]);
+      if (worker->running && !ctx->rc) {
+        if (worker->ctx.rc) {
+          ERR(worker->ctx.rc, "[table][group] worker<%d>: %s",
+              i, worker->ctx.errbuf);
+        } else {
+          grn_hash *local = (grn_hash *)(worker->result.table);
+          void *key;
+          unsigned int key_size;
+          grn_rset_recinfo *local_ri;
+          GRN_HASH_EACH(ctx, local, id, &key, &key_size, &local_ri, {
+            grn_rset_recinfo *ri;
+            if (grn_table_add_v_inline(ctx, res, key, key_size,
+                                       (void **)&ri, NULL)) {
+              grn_table_group_merge_recinfo(ctx, res, ri, local_ri);
+            }
+          });
+        }
+      }
+      worker->running = GRN_FALSE;
+      if (worker->result.table) {
+        grn_obj_close(&(worker->ctx), worker->result.table);
+        worker->result.table = NULL;
+      }
+    }
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    grn_table_group_worker *worker = &(workers[i]);
+    if (worker->result.table) {
+      grn_obj_close(&(worker->ctx), worker->result.table);
+    }
+    grn_ctx_fin(&(worker->ctx));
+  }
+  GRN_FREE(workers);
+  return GRN_TRUE;
+}
+
 grn_rc
 grn_table_group_with_range_gap(grn_ctx *ctx, grn_obj *table,
                                grn_table_sort_key *group_key,
@@ -3823,6 +4154,7 @@ grn_table_group(grn_ctx *ctx, grn_obj *table,
     int k, r;
     grn_table_sort_key *kp;
     grn_table_group_result *rp;
+    grn_bool created_result_table = GRN_FALSE;
     for (k = 0, kp = keys; k < n_keys; k++, kp++) {
       if ((kp->flags & GRN_TABLE_GROUP_BY_COLUMN_VALUE) && !kp->key) {
         ERR(GRN_INVALID_ARGUMENT, "column missing in (%d)", k);
@@ -3831,37 +4163,21 @@ grn_table_group(grn_ctx *ctx, grn_obj *table,
     }
     for (r = 0, rp = results; r < n_results; r++, rp++) {
       if (!rp->table) {
-        grn_obj_flags flags;
-        grn_obj *key_type = NULL;
-        uint32_t additional_value_size;
-
-        flags = GRN_TABLE_HASH_KEY|
-          GRN_OBJ_WITH_SUBREC|
-          GRN_OBJ_UNIT_USERDEF_DOCUMENT;
-        if (n_keys == 1) {
-          key_type = grn_ctx_at(ctx, grn_obj_get_range(ctx, keys[0].key));
-        } else {
-          flags |= GRN_OBJ_KEY_VAR_SIZE;
-        }
-        additional_value_size = grn_rset_recinfo_calc_values_size(ctx,
-                                                                  rp->flags);
-        rp->table = grn_table_create_with_max_n_subrecs(ctx, NULL, 0, NULL,
-                                                        flags,
-                                                        key_type, table,
-                                                        rp->max_n_subrecs,
-                                                        additional_value_size);
-        if (key_type) {
-          grn_obj_unlink(ctx, key_type);
-        }
+        rp->table = grn_table_group_create_result_table(ctx, table,
+                                                        keys, n_keys, rp);
         if (!rp->table) {
           goto exit;
         }
-        DB_OBJ(rp->table)->flags.group = rp->flags;
+        created_result_table = GRN_TRUE;
       }
     }
     if (n_keys == 1 && n_results == 1) {
-      if (!accelerated_table_group(ctx, table, keys->key, results)) {
-        grn_table_group_single_key_records(ctx, table, keys->key, results);
+      if (!(created_result_table &&
+            grn_table_group_single_key_parallel(ctx, table, keys, results))) {
+        if (!accelerated_table_group(ctx, table, keys->key, results, 0, -1)) {
+          grn_table_group_single_key_records(ctx, table, keys->key, results,
+                                             0, -1);
+        }
       }
     } else {
       grn_bool have_vector = GRN_FALSE;
@@ -4180,6 +4496,13 @@ grn_column_create(grn_ctx *ctx, grn_obj *table,
     GRN_DB_CHECK_NAME_ERR("[column][create]", name, name_size);
     goto exit;
   }
+  if ((flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_BP128 &&
+      (flags & GRN_OBJ_COLUMN_TYPE_MASK) != GRN_OBJ_COLUMN_INDEX) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[column][create] COMPRESS_BP128 is only for index column: <%.*s>",
+        name_size, name);
+    goto exit;
+  }
   if ((domain = DB_OBJ(table)->id)) {
     int len = grn_table_get_key(ctx, s->keys, domain, fullname, GRN_TABLE_MAX_KEY_SIZE);
     if (name_size + 1 + len > GRN_TABLE_MAX_KEY_SIZE) {
@@ -6871,6 +7194,11 @@ grn_obj_set_value(grn_ctx *ctx, grn_obj *obj, grn_id id,
   GRN_API_RETURN(rc);
 }
 
+/*
+  A value in a column is returned after its segment is unrefed. The
+  caller must pin the io of the column by grn_io_pin() while it uses
+  the value. See grn_table_sort_keys_pin().
+*/
 const char *
 grn_obj_get_value_(grn_ctx *ctx, grn_obj *obj, grn_id id, uint32_t *size)
 {
@@ -6898,6 +7226,11 @@ grn_obj_get_value_(grn_ctx *ctx, grn_obj *obj, grn_id id, uint32_t *size)
     {
       grn_io_win jw;
       if ((value = grn_ja_ref(ctx, (grn_ja *)obj, id, &jw, size))) {
+        if (jw.uncompressed_value) {
+          /* It's freed by grn_ja_unref(). Use grn_obj_get_value() instead. */
+          value = NULL;
+          *size = 0;
+        }
         grn_ja_unref(ctx, &jw);
       }
     }
@@ -7230,6 +7563,18 @@ grn_obj_get_info(grn_ctx *ctx, grn_obj *obj, grn_info_type type, grn_obj *valueb
     GRN_BOOL_PUT(ctx, valuebuf, GRN_FALSE);
 #endif /* GRN_WITH_LZ4 */
     break;
+  case GRN_INFO_SUPPORT_ZSTD :
+    if (!valuebuf && !(valuebuf = grn_obj_open(ctx, GRN_BULK, 0, GRN_DB_BOOL))) {
+      ERR(GRN_INVALID_ARGUMENT,
+          "failed to open value buffer for GRN_INFO_ZSTD_SUPPORT");
+      goto exit;
+    }
+#ifdef GRN_WITH_ZSTD
+    GRN_BOOL_PUT(ctx, valuebuf, GRN_TRUE);
+#else /* GRN_WITH_ZSTD */
+    GRN_BOOL_PUT(ctx, valuebuf, GRN_FALSE);
+#endif /* GRN_WITH_ZSTD */
+    break;
   default :
     if (!obj) {
       ERR(GRN_INVALID_ARGUMENT, "grn_obj_get_info failed");
@@ -7822,6 +8167,7 @@ grn_obj_set_info_source(grn_ctx *ctx, grn_obj *obj, grn_obj *value)
     return rc;
   }
   grn_obj_spec_save(ctx, DB_OBJ(obj));
+  grn_db_increment_schema_generation(ctx, DB_OBJ(obj)->db);
 
   return rc;
 }
@@ -8530,6 +8876,7 @@ _grn_obj_remove(grn_ctx *ctx, grn_obj *obj)
   if (GRN_DB_OBJP(obj)) {
     id = DB_OBJ(obj)->id;
     db = DB_OBJ(obj)->db;
+    grn_db_increment_schema_generation(ctx, db);
   }
   switch (obj->header.type) {
   case GRN_DB :
@@ -8628,6 +8975,9 @@ grn_obj_rename(grn_ctx *ctx, grn_obj *obj, const char *name, unsigned int name_s
     grn_db *s = (grn_db *)ctx->impl->db;
     grn_obj *keys = (grn_obj *)s->keys;
     rc = grn_table_update_by_id(ctx, keys, DB_OBJ(obj)->id, name, name_size);
+    if (rc == GRN_SUCCESS) {
+      grn_db_increment_schema_generation(ctx, (grn_obj *)s);
+    }
   }
   GRN_API_RETURN(rc);
 }
@@ -8738,6 +9088,8 @@ grn_obj_register(grn_ctx *ctx, grn_obj *db, const char *name, unsigned int name_
       ERR(GRN_INVALID_ARGUMENT,
           "already used name was assigned: <%.*s>", name_size, name);
       id = GRN_ID_NIL;
+    } else {
+      grn_db_increment_schema_generation(ctx, db);
     }
   } else if (ctx->impl && ctx->impl->values) {
     id = grn_array_add(ctx, ctx->impl->values, NULL) | GRN_OBJ_TMP_OBJECT;
@@ -10060,6 +10412,390 @@ grn_table_sort_reference(grn_ctx *ctx, grn_obj *table,
 }
 
 
+/*
+  Normalized key sort encodes the first sort key of each record into
+  an unsigned 64bit integer once. Integers are ordered in the same
+  order as compare_reference(): an integer value is stored with the
+  sign bit flipped, a float value is stored with the order preserving
+  bit pattern and a text value is stored as a big endian prefix. The
+  most significant byte of a key that is 7 bytes or less is 1 when the
+  record has a value to sort records without value first. All bits are
+  inverted for descending order.
+
+  If normalized keys of records are the same, the records are ordered
+  by compare_reference() when the normalized key may lose information
+  (a text key, 64bit keys and multiple keys).
+
+  Only offset + limit records are kept by a bounded heap when they are
+  a small part of records. All records are sorted by LSD radix sort
+  when many records are requested. A small window after many records
+  is selected by grn_table_sort_reference() because it sorts only
+  partitions that overlap the window.
+
+  It returns -1 when it can't allocate memory. The caller can fall back
+  to grn_table_sort_reference() that needs less memory.
+*/
+#define SORT_NORMALIZED_HEAP_RATIO 64
+#define SORT_NORMALIZED_RADIX_RATIO 16
+#define SORT_NORMALIZED_RADIX_BITS 8
+#define SORT_NORMALIZED_RADIX_SIZE (1 << SORT_NORMALIZED_RADIX_BITS)
+#define SORT_NORMALIZED_RADIX_N_PASSES \
+  (sizeof(uint64_t) * 8 / SORT_NORMALIZED_RADIX_BITS)
+
+typedef struct {
+  sort_reference_entry entry;
+  uint64_t key;
+} sort_normalized_entry;
+
+typedef struct {
+  grn_table_sort_key *keys;
+  int n_keys;
+  grn_bool need_tie_break;
+} sort_normalized_data;
+
+static void
+sort_normalized_data_init(sort_normalized_data *data,
+                          grn_table_sort_key *keys, int n_keys)
+{
+  data->keys = keys;
+  data->n_keys = n_keys;
+  switch (keys->offset) {
+  case KEY_BULK :
+  case KEY_INT64 :
+  case KEY_UINT64 :
+  case KEY_FLOAT64 :
+    data->need_tie_break = GRN_TRUE;
+    break;
+  default :
+    data->need_tie_break = (n_keys > 1);
+    break;
+  }
+}
+
+#define SORT_NORMALIZED_PRESENT(value, size)\
+  ((((uint64_t)1) << ((size) * 8)) | (value))
+
+inline static uint64_t
+sort_normalized_encode(sort_normalized_data *data, sort_reference_entry *entry)
+{
+  const unsigned char *value = entry->value;
+  uint64_t key = 0;
+  if (data->keys->offset == KEY_ID) {
+    key = (uint32_t)(uintptr_t)value;
+  } else if (entry->size > 0 && value) {
+    switch (data->keys->offset) {
+    case KEY_BULK :
+      {
+        uint32_t i;
+        for (i = 0; i < sizeof(uint64_t) - 1; i++) {
+          key <<= 8;
+          if (i < entry->size) {
+            key |= value[i];
+          }
+        }
+        key = SORT_NORMALIZED_PRESENT(key, sizeof(uint64_t) - 1);
+      }
+      break;
+    case KEY_INT8 :
+      key = (uint8_t)(*((int8_t *)value)) ^ 0x80;
+      key = SORT_NORMALIZED_PRESENT(key, sizeof(int8_t));
+      break;
+    case KEY_INT16 :
+      key = (uint16_t)(*((int16_t *)value)) ^ 0x8000;
+      key = SORT_NORMALIZED_PRESENT(key, sizeof(int16_t));
+      break;
+    case KEY_INT32 :
+      key = (uint32_t)(*((int32_t *)value)) ^ 0x80000000;
+      key = SORT_NORMALIZED_PRESENT(key, sizeof(int32_t));
+      break;
+    case KEY_INT64 :
+      /* A record without value has the same key as INT64_MIN. */
+      key = ((uint64_t)(*((int64_t *)value))) ^ (((uint64_t)1) << 63);
+      break;
+    case KEY_UINT8 :
+      key = SORT_NORMALIZED_PRESENT(*((uint8_t *)value), sizeof(uint8_t));
+      break;
+    case KEY_UINT16 :
+      key = SORT_NORMALIZED_PRESENT(*((uint16_t *)value), sizeof(uint16_t));
+      break;
+    case KEY_UINT32 :
+      key = SORT_NORMALIZED_PRESENT(*((uint32_t *)value), sizeof(uint32_t));
+      break;
+    case KEY_UINT64 :
+      key = *((uint64_t *)value);
+      break;
+    case KEY_FLOAT32 :
+      {
+        float float_value = *((float *)value);
+        uint32_t bits = 0;
+        /* -0.0 and 0.0 are the same value. */
+        if (float_value < 0 || float_value > 0) {
+          grn_memcpy(&bits, &float_value, sizeof(uint32_t));
+        }
+        if (bits & 0x80000000) {
+          bits = ~bits;
+        } else {
+          bits |= 0x80000000;
+        }
+        key = SORT_NORMALIZED_PRESENT(bits, sizeof(uint32_t));
+      }
+      break;
+    case KEY_FLOAT64 :
+      {
+        double float_value = *((double *)value);
+        uint64_t bits = 0;
+        if (float_value < 0 || float_value > 0) {
+          grn_memcpy(&bits, &float_value, sizeof(uint64_t));
+        }
+        if (bits & (((uint64_t)1) << 63)) {
+          key = ~bits;
+        } else {
+          key = bits | (((uint64_t)1) << 63);
+        }
+      }
+      break;
+    }
+  }
+  if (data->keys->flags & GRN_TABLE_SORT_DESC) {
+    key = ~key;
+  }
+  return key;
+}
+
+#undef SORT_NORMALIZED_PRESENT
+
+inline static grn_bool
+sort_normalized_greater(grn_ctx *ctx, sort_normalized_data *data,
+                        sort_normalized_entry *a, sort_normalized_entry *b)
+{
+  if (a->key != b->key) {
+    return a->key > b->key;
+  }
+  if (!data->need_tie_break) {
+    return GRN_FALSE;
+  }
+  return compare_reference(ctx, &(a->entry), &(b->entry),
+                           data->keys, data->n_keys);
+}
+
+static sort_normalized_entry *
+sort_normalized_radix(sort_normalized_entry *entries,
+                      sort_normalized_entry *buffer,
+                      int n)
+{
+  uint32_t counts[SORT_NORMALIZED_RADIX_N_PASSES][SORT_NORMALIZED_RADIX_SIZE];
+  uint32_t pass;
+  int i;
+  memset(counts, 0, sizeof(counts));
+  for (i = 0; i < n; i++) {
+    uint64_t key = entries[i].key;
+    for (pass = 0; pass < SORT_NORMALIZED_RADIX_N_PASSES; pass++) {
+      counts[pass][key & (SORT_NORMALIZED_RADIX_SIZE - 1)]++;
+      key >>= SORT_NORMALIZED_RADIX_BITS;
+    }
+  }
+  for (pass = 0; pass < SORT_NORMALIZED_RADIX_N_PASSES; pass++) {
+    uint32_t shift = pass * SORT_NORMALIZED_RADIX_BITS;
+    uint32_t offsets[SORT_NORMALIZED_RADIX_SIZE];
+    uint32_t j, offset = 0;
+    sort_normalized_entry *tmp;
+    if (counts[pass][(entries[0].key >> shift) &
+                     (SORT_NORMALIZED_RADIX_SIZE - 1)] == (uint32_t)n) {
+      continue;
+    }
+    for (j = 0; j < SORT_NORMALIZED_RADIX_SIZE; j++) {
+      offsets[j] = offset;
+      offset += counts[pass][j];
+    }
+    for (i = 0; i < n; i++) {
+      uint32_t bucket =
+        (entries[i].key >> shift) & (SORT_NORMALIZED_RADIX_SIZE - 1);
+      buffer[offsets[bucket]++] = entries[i];
+    }
+    tmp = entries;
+    entries = buffer;
+    buffer = tmp;
+  }
+  return entries;
+}
+
+static grn_rc
+sort_normalized_tie_break(grn_ctx *ctx, sort_normalized_data *data,
+                          sort_normalized_entry *entries, int n,
+                          int offset, int e)
+{
+  int head = 0;
+  sort_reference_entry *run = NULL;
+  int run_size = 0;
+  while (head < n && head < e) {
+    int tail = head + 1;
+    while (tail < n && entries[tail].key == entries[head].key) {
+      tail++;
+    }
+    if (tail - head > 1 && tail > offset) {
+      int i, m = tail - head;
+      if (m > run_size) {
+        sort_reference_entry *new_run;
+        new_run = GRN_REALLOC(run, sizeof(sort_reference_entry) * m);
+        if (!new_run) {
+          if (run) {
+            GRN_FREE(run);
+          }
+          return ctx->rc;
+        }
+        run = new_run;
+        run_size = m;
+      }
+      for (i = 0; i < m; i++) {
+        run[i] = entries[head + i].entry;
+      }
+      sort_reference(ctx, run, run + m - 1, offset - head, e - head,
+                     data->keys, data->n_keys);
+      for (i = 0; i < m; i++) {
+        entries[head + i].entry = run[i];
+      }
+    }
+    head = tail;
+  }
+  if (run) {
+    GRN_FREE(run);
+  }
+  return GRN_SUCCESS;
+}
+
+inline static void
+sort_normalized_heap_sift_down(grn_ctx *ctx, sort_normalized_data *data,
+                               sort_normalized_entry *heap, int n, int i)
+{
+  sort_normalized_entry entry = heap[i];
+  for (;;) {
+    int child = i * 2 + 1;
+    if (child >= n) { break; }
+    if (child + 1 < n &&
+        sort_normalized_greater(ctx, data, &(heap[child + 1]),
+                                &(heap[child]))) {
+      child++;
+    }
+    if (!sort_normalized_greater(ctx, data, &(heap[child]), &entry)) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = entry;
+}
+
+inline static void
+sort_normalized_heap_sift_up(grn_ctx *ctx, sort_normalized_data *data,
+                             sort_normalized_entry *heap, int i)
+{
+  sort_normalized_entry entry = heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!sort_normalized_greater(ctx, data, &entry, &(heap[parent]))) {
+      break;
+    }
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = entry;
+}
+
+static int
+grn_table_sort_normalized(grn_ctx *ctx, grn_obj *table,
+                          int offset, int limit,
+                          grn_obj *result,
+                          grn_table_sort_key *keys, int n_keys)
+{
+  int i, n, n_entries = 0, e = offset + limit;
+  grn_bool use_heap;
+  sort_normalized_data data;
+  sort_normalized_entry *array, *buffer = NULL, *entries;
+  sort_normalized_entry entry;
+  grn_table_cursor *tc;
+
+  sort_normalized_data_init(&data, keys, n_keys);
+  n = grn_table_size(ctx, table);
+  if (e == 0 || n == 0) {
+    return 0;
+  }
+  use_heap = ((int64_t)e * SORT_NORMALIZED_HEAP_RATIO < n);
+  if (!use_heap && (int64_t)limit * SORT_NORMALIZED_RADIX_RATIO < n) {
+    return grn_table_sort_reference(ctx, table, offset, limit, result,
+                                    keys, n_keys);
+  }
+  if (!(array = GRN_MALLOC(sizeof(sort_normalized_entry) *
+                           (use_heap ? e : n)))) {
+    return -1;
+  }
+  if (!use_heap &&
+      !(buffer = GRN_MALLOC(sizeof(sort_normalized_entry) * n))) {
+    GRN_FREE(array);
+    return -1;
+  }
+  entries = array;
+
+  tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0);
+  if (!tc) {
+    goto exit;
+  }
+  if (use_heap) {
+    while ((entry.entry.id = grn_table_cursor_next_inline(ctx, tc))) {
+      entry.entry.value = grn_obj_get_value_(ctx, keys->key, entry.entry.id,
+                                             &(entry.entry.size));
+      entry.key = sort_normalized_encode(&data, &(entry.entry));
+      if (n_entries < e) {
+        entries[n_entries] = entry;
+        sort_normalized_heap_sift_up(ctx, &data, entries, n_entries);
+        n_entries++;
+      } else if (sort_normalized_greater(ctx, &data, &(entries[0]), &entry)) {
+        entries[0] = entry;
+        sort_normalized_heap_sift_down(ctx, &data, entries, n_entries, 0);
+      }
+    }
+    for (i = n_entries - 1; i > 0; i--) {
+      entry = entries[0];
+      entries[0] = entries[i];
+      entries[i] = entry;
+      sort_normalized_heap_sift_down(ctx, &data, entries, i, 0);
+    }
+  } else {
+    while (n_entries < n &&
+           (entry.entry.id = grn_table_cursor_next_inline(ctx, tc))) {
+      entry.entry.value = grn_obj_get_value_(ctx, keys->key, entry.entry.id,
+                                             &(entry.entry.size));
+      entry.key = sort_normalized_encode(&data, &(entry.entry));
+      entries[n_entries++] = entry;
+    }
+    if (n_entries > 1) {
+      entries = sort_normalized_radix(entries, buffer, n_entries);
+      if (data.need_tie_break) {
+        if (sort_normalized_tie_break(ctx, &data, entries, n_entries,
+                                      offset, e) != GRN_SUCCESS) {
+          n_entries = -1;
+        }
+      }
+    }
+  }
+  grn_table_cursor_close(ctx, tc);
+
+exit :
+  if (n_entries < 0) {
+    i = -1;
+  } else {
+    grn_id *v;
+    for (i = 0; i < limit && offset + i < n_entries; i++) {
+      if (!grn_array_add(ctx, (grn_array *)result, (void **)&v)) { break; }
+      *v = entries[offset + i].entry.id;
+    }
+  }
+  if (buffer) {
+    GRN_FREE(buffer);
+  }
+  GRN_FREE(array);
+  return i;
+}
+
 typedef struct {
   grn_id id;
   grn_obj value;
@@ -10320,11 +11056,29 @@ is_compressed_column(grn_ctx *ctx, grn_obj *obj)
     return GRN_FALSE;
   }
 
+  if (obj->header.type == GRN_ACCESSOR) {
+    grn_accessor *accessor = (grn_accessor *)obj;
+    while (accessor->next) {
+      accessor = accessor->next;
+    }
+    if (accessor->action != GRN_ACCESSOR_GET_COLUMN_VALUE) {
+      return GRN_FALSE;
+    }
+    obj = accessor->obj;
+  }
+
   if (obj->header.type != GRN_COLUMN_VAR_SIZE) {
     return GRN_FALSE;
   }
 
-  return (obj->header.flags & (GRN_OBJ_COMPRESS_ZLIB | GRN_OBJ_COMPRESS_LZ4));
+  switch (obj->header.flags & GRN_OBJ_COMPRESS_MASK) {
+  case GRN_OBJ_COMPRESS_ZLIB :
+  case GRN_OBJ_COMPRESS_LZ4 :
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
 }
 
 static grn_bool
@@ -10355,6 +11109,50 @@ is_sub_record_accessor(grn_ctx *ctx, grn_obj *obj)
   return GRN_FALSE;
 }
 
+/*
+  grn_obj_get_value_() returns a value in a column segment after it
+  unrefs the segment. grn_table_sort_normalized() and
+  grn_table_sort_reference() keep the values until they finish. So
+  they pin ios of the columns to keep the segments mapped.
+*/
+static void
+grn_table_sort_key_pin_column(grn_ctx *ctx, grn_obj *column, grn_bool pin)
+{
+  if (!column) {
+    return;
+  }
+  switch (column->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    if (pin) {
+      grn_io_pin(grn_obj_io(column));
+    } else {
+      grn_io_unpin(grn_obj_io(column));
+    }
+    break;
+  default :
+    break;
+  }
+}
+
+static void
+grn_table_sort_keys_pin(grn_ctx *ctx, grn_table_sort_key *keys, int n_keys,
+                        grn_bool pin)
+{
+  int i;
+  for (i = 0; i < n_keys; i++) {
+    grn_obj *key = keys[i].key;
+    if (key->header.type == GRN_ACCESSOR) {
+      grn_accessor *accessor;
+      for (accessor = (grn_accessor *)key; accessor; accessor = accessor->next) {
+        grn_table_sort_key_pin_column(ctx, accessor->obj, pin);
+      }
+    } else {
+      grn_table_sort_key_pin_column(ctx, key, pin);
+    }
+  }
+}
+
 static int
 range_is_idp(grn_obj *obj)
 {
@@ -10517,8 +11315,16 @@ grn_table_sort(grn_ctx *ctx, grn_obj *table, int offset, int limit,
       i = grn_table_sort_value(ctx, table, offset, limit, result,
                                keys, n_keys);
     } else {
-      i = grn_table_sort_reference(ctx, table, offset, limit, result,
-                                   keys, n_keys);
+      grn_table_sort_keys_pin(ctx, keys, n_keys, GRN_TRUE);
+      i = grn_table_sort_normalized(ctx, table, offset, limit, result,
+                                    keys, n_keys);
+      if (i < 0) {
+        /* Normalized keys need more memory. Retry with less memory. */
+        ERRCLR(ctx);
+        i = grn_table_sort_reference(ctx, table, offset, limit, result,
+                                     keys, n_keys);
+      }
+      grn_table_sort_keys_pin(ctx, keys, n_keys, GRN_FALSE);
     }
   }
 exit :
@@ -20,6 +20,7 @@
 #include "grn_ctx_impl.h"
 #include <string.h>
 #include "grn_ii.h"
+#include "grn_bitmap.h"
 #include "grn_geo.h"
 #include "grn_expr.h"
 #include "grn_expr_code.h"
@@ -27,6 +28,56 @@
 #include "grn_mrb.h"
 #include "mrb/mrb_expr.h"
 
+static int grn_table_select_sequential_n_threads = 1;
+static uint32_t grn_table_select_sequential_n_records_per_thread_min = 0x4000;
+static uint32_t grn_expr_cache_max_n_entries = 100;
+
+void
+grn_expr_init_from_env(void)
+{
+  {
+    char grn_table_select_sequential_n_threads_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SELECT_SEQUENTIAL_N_THREADS",
+               grn_table_select_sequential_n_threads_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_table_select_sequential_n_threads_env[0]) {
+      grn_table_select_sequential_n_threads =
+        atoi(grn_table_select_sequential_n_threads_env);
+      if (grn_table_select_sequential_n_threads < 1) {
+        grn_table_select_sequential_n_threads = 1;
+      }
+    }
+  }
+
+  {
+    char n_records_per_thread_min_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_TABLE_SELECT_SEQUENTIAL_N_RECORDS_PER_THREAD_MIN",
+               n_records_per_thread_min_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (n_records_per_thread_min_env[0]) {
+      grn_table_select_sequential_n_records_per_thread_min =
+        atoi(n_records_per_thread_min_env);
+      if (grn_table_select_sequential_n_records_per_thread_min < 1) {
+        grn_table_select_sequential_n_records_per_thread_min = 1;
+      }
+    }
+  }
+
+  {
+    char grn_expr_cache_max_n_entries_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_EXPR_CACHE_MAX_N_ENTRIES",
+               grn_expr_cache_max_n_entries_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_expr_cache_max_n_entries_env[0]) {
+      int max_n_entries = atoi(grn_expr_cache_max_n_entries_env);
+      if (max_n_entries < 0) {
+        max_n_entries = 0;
+      }
+      grn_expr_cache_max_n_entries = max_n_entries;
+    }
+  }
+}
+
 grn_obj *
 grn_expr_alloc(grn_ctx *ctx, grn_obj *expr, grn_id domain, grn_obj_flags flags)
 {
@@ -4608,8 +4659,219 @@ scan_info_build(grn_ctx *ctx, grn_obj *expr, int *n,
   return sis;
 }
 
-void
-grn_inspect_scan_info_list(grn_ctx *ctx, grn_obj *buffer, scan_info **sis, int n)
+/*
+  Estimates the number of records that match "si" by its index. Returns
+  GRN_FALSE when "si" can't be estimated. For example, "si" doesn't
+  have any index or it calls a function.
+*/
+static grn_bool
+scan_info_estimate_size(grn_ctx *ctx, scan_info *si, grn_obj *table,
+                        unsigned int *size)
+{
+  grn_obj *index;
+  grn_obj *lexicon;
+  grn_obj key;
+  grn_bool estimated = GRN_FALSE;
+
+  if (GRN_BULK_VSIZE(&(si->index)) == 0) {
+    return GRN_FALSE;
+  }
+  if (!si->query || si->query->header.type != GRN_BULK ||
+      GRN_BULK_VSIZE(si->query) == 0) {
+    return GRN_FALSE;
+  }
+  index = GRN_PTR_VALUE(&(si->index));
+  if (index->header.type == GRN_ACCESSOR) {
+    grn_accessor *a = (grn_accessor *)index;
+    if (si->op != GRN_OP_EQUAL || a->next) {
+      return GRN_FALSE;
+    }
+    switch (a->action) {
+    case GRN_ACCESSOR_GET_ID :
+    case GRN_ACCESSOR_GET_KEY :
+      *size = 1;
+      return GRN_TRUE;
+    default :
+      return GRN_FALSE;
+    }
+  }
+  if (index->header.type != GRN_COLUMN_INDEX) {
+    return GRN_FALSE;
+  }
+
+  switch (si->op) {
+  case GRN_OP_MATCH :
+    if (!(GRN_DB_SHORT_TEXT <= si->query->header.domain &&
+          si->query->header.domain <= GRN_DB_LONG_TEXT)) {
+      return GRN_FALSE;
+    }
+    *size = grn_ii_estimate_size_for_query(ctx, (grn_ii *)index,
+                                           GRN_TEXT_VALUE(si->query),
+                                           GRN_TEXT_LEN(si->query),
+                                           NULL);
+    return GRN_TRUE;
+  case GRN_OP_EQUAL :
+    break;
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    /* Range search by index doesn't support "constant OP column" yet. */
+    if (si->flags & SCAN_PRE_CONST) {
+      return GRN_FALSE;
+    }
+    break;
+  default :
+    return GRN_FALSE;
+  }
+
+  lexicon = grn_ctx_at(ctx, index->header.domain);
+  if (!lexicon) {
+    return GRN_FALSE;
+  }
+  GRN_OBJ_INIT(&key, GRN_BULK, 0, lexicon->header.domain);
+  if (grn_obj_cast(ctx, si->query, &key, GRN_FALSE) != GRN_SUCCESS) {
+    GRN_OBJ_FIN(ctx, &key);
+    return GRN_FALSE;
+  }
+  if (si->op == GRN_OP_EQUAL) {
+    grn_id tid;
+    tid = grn_table_get(ctx, lexicon,
+                        GRN_BULK_HEAD(&key), GRN_BULK_VSIZE(&key));
+    *size = tid ? grn_ii_estimate_size(ctx, (grn_ii *)index, tid) : 0;
+    estimated = GRN_TRUE;
+  } else {
+    grn_table_cursor *cursor;
+    const void *min = NULL, *max = NULL;
+    unsigned int min_size = 0, max_size = 0;
+    int flags = GRN_CURSOR_ASCENDING;
+    switch (si->op) {
+    case GRN_OP_LESS :
+      flags |= GRN_CURSOR_LT;
+      max = GRN_BULK_HEAD(&key);
+      max_size = GRN_BULK_VSIZE(&key);
+      break;
+    case GRN_OP_GREATER :
+      flags |= GRN_CURSOR_GT;
+      min = GRN_BULK_HEAD(&key);
+      min_size = GRN_BULK_VSIZE(&key);
+      break;
+    case GRN_OP_LESS_EQUAL :
+      flags |= GRN_CURSOR_LE;
+      max = GRN_BULK_HEAD(&key);
+      max_size = GRN_BULK_VSIZE(&key);
+      break;
+    default :
+      flags |= GRN_CURSOR_GE;
+      min = GRN_BULK_HEAD(&key);
+      min_size = GRN_BULK_VSIZE(&key);
+      break;
+    }
+    cursor = grn_table_cursor_open(ctx, lexicon,
+                                   min, min_size, max, max_size,
+                                   0, -1, flags);
+    if (cursor) {
+      *size = grn_ii_estimate_size_for_lexicon_cursor(ctx, (grn_ii *)index,
+                                                      cursor);
+      grn_table_cursor_close(ctx, cursor);
+      estimated = GRN_TRUE;
+    }
+  }
+  GRN_OBJ_FIN(ctx, &key);
+  return estimated;
+}
+
+/*
+  Reorders the leading conditions that are combined by && so that the
+  condition that is estimated to match the fewest records is evaluated
+  first. The following conditions are evaluated against the smaller
+  result set. Conditions that can't be estimated keep their order
+  after estimated ones. Scores aren't changed because they are summed
+  up. If "sizes" isn't NULL, it receives the estimated size of each
+  scan_info. Conditions that can't be estimated have the table size.
+*/
+static void
+scan_info_optimize(grn_ctx *ctx, grn_obj *expr, scan_info **sis, int n,
+                   unsigned int *sizes)
+{
+  grn_obj *var;
+  grn_obj *table;
+  unsigned int table_size;
+  unsigned int *allocated_sizes = NULL;
+  grn_bool *estimated;
+  int i, n_ands;
+
+  if (!(var = grn_expr_get_var_by_offset(ctx, expr, 0))) { return; }
+  if (!(table = grn_ctx_at(ctx, var->header.domain))) { return; }
+  if (!sizes) {
+    if (!(allocated_sizes = GRN_MALLOCN(unsigned int, n))) { return; }
+    sizes = allocated_sizes;
+  }
+  if (!(estimated = GRN_MALLOCN(grn_bool, n))) {
+    if (allocated_sizes) {
+      GRN_FREE(allocated_sizes);
+    }
+    return;
+  }
+
+  table_size = grn_table_size(ctx, table);
+  for (i = 0; i < n; i++) {
+    estimated[i] = GRN_FALSE;
+    sizes[i] = table_size;
+    if (sis[i]->flags & SCAN_POP) {
+      continue;
+    }
+    estimated[i] = scan_info_estimate_size(ctx, sis[i], table, &(sizes[i]));
+    if (ctx->rc) {
+      ERRCLR(ctx);
+      estimated[i] = GRN_FALSE;
+      sizes[i] = table_size;
+    }
+  }
+
+  for (n_ands = 0; n_ands < n; n_ands++) {
+    scan_info *si = sis[n_ands];
+    if (si->flags & (SCAN_PUSH | SCAN_POP)) {
+      break;
+    }
+    if (n_ands > 0 && si->logical_op != GRN_OP_AND) {
+      break;
+    }
+  }
+
+  /* Stable insertion sort. n_ands is small. */
+  for (i = 1; i < n_ands; i++) {
+    scan_info *si = sis[i];
+    unsigned int size = sizes[i];
+    grn_bool is_estimated = estimated[i];
+    int j;
+    if (!is_estimated) {
+      continue;
+    }
+    for (j = i;
+         j > 0 && (!estimated[j - 1] || size < sizes[j - 1]);
+         j--) {
+      sis[j] = sis[j - 1];
+      sizes[j] = sizes[j - 1];
+      estimated[j] = estimated[j - 1];
+    }
+    sis[j] = si;
+    sizes[j] = size;
+    estimated[j] = is_estimated;
+  }
+  for (i = 0; i < n_ands; i++) {
+    sis[i]->logical_op = (i == 0) ? GRN_OP_OR : GRN_OP_AND;
+  }
+
+  GRN_FREE(estimated);
+  if (allocated_sizes) {
+    GRN_FREE(allocated_sizes);
+  }
+}
+
+static void
+scan_info_list_inspect(grn_ctx *ctx, grn_obj *buffer, scan_info **sis, int n,
+                       unsigned int *sizes)
 {
   int i;
 
@@ -4630,9 +4892,20 @@ grn_inspect_scan_info_list(grn_ctx *ctx, grn_obj *buffer, scan_info **sis, int n
 
     grn_text_printf(ctx, buffer,
                     "  expr:       <%d..%d>\n", si->start, si->end);
+
+    if (sizes) {
+      grn_text_printf(ctx, buffer,
+                      "  estimated:  <%u>\n", sizes[i]);
+    }
   }
 }
 
+void
+grn_inspect_scan_info_list(grn_ctx *ctx, grn_obj *buffer, scan_info **sis, int n)
+{
+  scan_info_list_inspect(ctx, buffer, sis, n, NULL);
+}
+
 void
 grn_p_scan_info_list(grn_ctx *ctx, scan_info **sis, int n)
 {
@@ -4669,123 +4942,2129 @@ exec_result_to_score(grn_ctx *ctx, grn_obj *result, grn_obj *score_buffer)
   }
 }
 
-static void
-grn_table_select_sequential(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
-                            grn_obj *v, grn_obj *res, grn_operator op)
+/*
+  Batch evaluation evaluates a filter that consists of only comparisons
+  between a fixed size numeric column and a numeric constant combined by
+  && and || for GRN_TABLE_SELECT_BATCH_SIZE records at once. Column
+  values are read from grn_ra segments directly into an array of the
+  type that C comparison of the column value and the constant uses. So
+  the result is the same as grn_operator_exec_*(). Comparisons and
+  combinations are simple loops over arrays that compilers can
+  vectorize.
+*/
+#define GRN_TABLE_SELECT_BATCH_SIZE 1024
+
+typedef enum {
+  GRN_BATCH_INT32,
+  GRN_BATCH_UINT32,
+  GRN_BATCH_INT64,
+  GRN_BATCH_UINT64,
+  GRN_BATCH_FLOAT
+} grn_batch_type;
+
+typedef union {
+  int32_t int32_value;
+  uint32_t uint32_value;
+  int64_t int64_value;
+  uint64_t uint64_value;
+  double float_value;
+} grn_batch_value;
+
+typedef struct {
+  grn_operator op;
+  grn_ra *ra;
+  grn_id column_domain;
+  grn_batch_type type;
+  grn_batch_value value;
+} grn_batch_code;
+
+typedef struct {
+  grn_batch_code *codes;
+  int n_codes;
+  int max_depth;
+  grn_id ids[GRN_TABLE_SELECT_BATCH_SIZE];
+  grn_rset_recinfo *ris[GRN_TABLE_SELECT_BATCH_SIZE];
+  grn_id entries[GRN_TABLE_SELECT_BATCH_SIZE];
+  union {
+    int32_t int32_values[GRN_TABLE_SELECT_BATCH_SIZE];
+    uint32_t uint32_values[GRN_TABLE_SELECT_BATCH_SIZE];
+    int64_t int64_values[GRN_TABLE_SELECT_BATCH_SIZE];
+    uint64_t uint64_values[GRN_TABLE_SELECT_BATCH_SIZE];
+    double float_values[GRN_TABLE_SELECT_BATCH_SIZE];
+  } values;
+  uint8_t *masks;
+} grn_batch;
+
+static grn_bool
+grn_batch_type_resolve(grn_id domain, grn_batch_type *type)
 {
-  int32_t score;
-  grn_id id, *idp;
-  grn_table_cursor *tc;
-  grn_hash_cursor *hc;
-  grn_hash *s = (grn_hash *)res;
-  grn_obj *r;
-  grn_obj score_buffer;
-  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
-  GRN_INT32_INIT(&score_buffer, 0);
-  switch (op) {
-  case GRN_OP_OR :
-    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while ((id = grn_table_cursor_next(ctx, tc))) {
-        GRN_RECORD_SET(ctx, v, id);
-        r = grn_expr_exec(ctx, expr, 0);
-        if (ctx->rc) {
-          break;
-        }
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
-            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
-          }
-        }
-      }
-      grn_table_cursor_close(ctx, tc);
-    }
+  switch (domain) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+  case GRN_DB_INT32 :
+    *type = GRN_BATCH_INT32;
+    return GRN_TRUE;
+  case GRN_DB_UINT32 :
+    *type = GRN_BATCH_UINT32;
+    return GRN_TRUE;
+  case GRN_DB_INT64 :
+    *type = GRN_BATCH_INT64;
+    return GRN_TRUE;
+  case GRN_DB_UINT64 :
+    *type = GRN_BATCH_UINT64;
+    return GRN_TRUE;
+  case GRN_DB_FLOAT :
+    *type = GRN_BATCH_FLOAT;
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+#define GRN_BATCH_CAST_CONSTANT(constant, c_type, dest) do {\
+  switch ((constant)->header.domain) {\
+  case GRN_DB_INT8 :\
+    dest = (c_type)GRN_INT8_VALUE(constant);\
+    break;\
+  case GRN_DB_UINT8 :\
+    dest = (c_type)GRN_UINT8_VALUE(constant);\
+    break;\
+  case GRN_DB_INT16 :\
+    dest = (c_type)GRN_INT16_VALUE(constant);\
+    break;\
+  case GRN_DB_UINT16 :\
+    dest = (c_type)GRN_UINT16_VALUE(constant);\
+    break;\
+  case GRN_DB_INT32 :\
+    dest = (c_type)GRN_INT32_VALUE(constant);\
+    break;\
+  case GRN_DB_UINT32 :\
+    dest = (c_type)GRN_UINT32_VALUE(constant);\
+    break;\
+  case GRN_DB_INT64 :\
+    dest = (c_type)GRN_INT64_VALUE(constant);\
+    break;\
+  case GRN_DB_UINT64 :\
+    dest = (c_type)GRN_UINT64_VALUE(constant);\
+    break;\
+  case GRN_DB_FLOAT :\
+    dest = (c_type)GRN_FLOAT_VALUE(constant);\
+    break;\
+  }\
+} while (0)
+
+static grn_bool
+grn_batch_code_compile_compare(grn_ctx *ctx, grn_batch_code *code,
+                               grn_operator op,
+                               grn_obj *column, grn_obj *constant)
+{
+  grn_batch_type column_type, constant_type;
+  grn_id column_domain = DB_OBJ(column)->range;
+
+  if (!grn_batch_type_resolve(column_domain, &column_type)) {
+    return GRN_FALSE;
+  }
+  if (constant->header.type != GRN_BULK ||
+      GRN_BULK_VSIZE(constant) == 0 ||
+      !grn_batch_type_resolve(constant->header.domain, &constant_type)) {
+    return GRN_FALSE;
+  }
+  code->op = op;
+  code->ra = (grn_ra *)column;
+  code->column_domain = column_domain;
+  /* The usual arithmetic conversions of C. */
+  code->type = column_type > constant_type ? column_type : constant_type;
+  switch (code->type) {
+  case GRN_BATCH_INT32 :
+    GRN_BATCH_CAST_CONSTANT(constant, int32_t, code->value.int32_value);
     break;
-  case GRN_OP_AND :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        if (ctx->rc) {
-          break;
-        }
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        } else {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
-    }
+  case GRN_BATCH_UINT32 :
+    GRN_BATCH_CAST_CONSTANT(constant, uint32_t, code->value.uint32_value);
     break;
-  case GRN_OP_AND_NOT :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        if (ctx->rc) {
-          break;
-        }
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_hash_cursor_delete(ctx, hc, NULL);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
-    }
+  case GRN_BATCH_INT64 :
+    GRN_BATCH_CAST_CONSTANT(constant, int64_t, code->value.int64_value);
     break;
-  case GRN_OP_ADJUST :
-    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
-      while (grn_hash_cursor_next(ctx, hc)) {
-        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
-        GRN_RECORD_SET(ctx, v, *idp);
-        r = grn_expr_exec(ctx, expr, 0);
-        if (ctx->rc) {
-          break;
-        }
-        score = exec_result_to_score(ctx, r, &score_buffer);
-        if (score > 0) {
-          grn_rset_recinfo *ri;
-          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
-          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
-        }
-      }
-      grn_hash_cursor_close(ctx, hc);
-    }
+  case GRN_BATCH_UINT64 :
+    GRN_BATCH_CAST_CONSTANT(constant, uint64_t, code->value.uint64_value);
     break;
-  default :
+  case GRN_BATCH_FLOAT :
+    GRN_BATCH_CAST_CONSTANT(constant, double, code->value.float_value);
     break;
   }
-  GRN_OBJ_FIN(ctx, &score_buffer);
+  return GRN_TRUE;
 }
 
-static inline grn_bool
-grn_table_select_index_range_column(grn_ctx *ctx, grn_obj *table,
-                                    grn_obj *index,
-                                    scan_info *si, grn_operator logical_op,
-                                    grn_obj *res)
+static grn_operator
+grn_batch_swap_compare_operator(grn_operator op)
 {
-  grn_bool processed = GRN_FALSE;
-  grn_obj *index_table;
-  grn_obj range;
+  switch (op) {
+  case GRN_OP_LESS :
+    return GRN_OP_GREATER;
+  case GRN_OP_GREATER :
+    return GRN_OP_LESS;
+  case GRN_OP_LESS_EQUAL :
+    return GRN_OP_GREATER_EQUAL;
+  case GRN_OP_GREATER_EQUAL :
+    return GRN_OP_LESS_EQUAL;
+  default :
+    return op;
+  }
+}
 
-  index_table = grn_ctx_at(ctx, index->header.domain);
-  if (!index_table) {
+/* grn_operator_exec_equal() doesn't support "Float == Int8" and so on. */
+static grn_bool
+grn_batch_is_unsupported_swapped_compare(grn_ctx *ctx, grn_operator op,
+                                         grn_obj *constant, grn_obj *column)
+{
+  if (op != GRN_OP_EQUAL && op != GRN_OP_NOT_EQUAL) {
+    return GRN_FALSE;
+  }
+  if (constant->header.domain != GRN_DB_FLOAT) {
+    return GRN_FALSE;
+  }
+  switch (DB_OBJ(column)->range) {
+  case GRN_DB_INT8 :
+  case GRN_DB_UINT8 :
+  case GRN_DB_INT16 :
+  case GRN_DB_UINT16 :
+    return GRN_TRUE;
+  default :
     return GRN_FALSE;
   }
+}
 
-  GRN_OBJ_INIT(&range, GRN_BULK, 0, index_table->header.domain);
-  if (grn_obj_cast(ctx, si->query, &range, GRN_FALSE) == GRN_SUCCESS) {
-    grn_table_cursor *cursor;
-    const void *min = NULL, *max = NULL;
-    unsigned int min_size = 0, max_size = 0;
-    int offset = 0;
+static grn_bool
+grn_batch_is_batchable_column(grn_ctx *ctx, grn_obj *table, grn_obj *column)
+{
+  grn_batch_type type;
+  if (!column || column->header.type != GRN_COLUMN_FIX_SIZE) {
+    return GRN_FALSE;
+  }
+  if (column->header.domain != DB_OBJ(table)->id) {
+    return GRN_FALSE;
+  }
+  return grn_batch_type_resolve(DB_OBJ(column)->range, &type);
+}
+
+static grn_batch *
+grn_batch_open(grn_ctx *ctx, grn_obj *table, grn_obj *expr)
+{
+  grn_obj *var;
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *c, *ce;
+  grn_obj *operands[2];
+  int n_operands = 0;
+  int depth = 0;
+  grn_batch *batch;
+
+  if (!(var = grn_expr_get_var_by_offset(ctx, expr, 0))) { return NULL; }
+  if (e->codes_curr == 0) { return NULL; }
+  if (!(batch = GRN_MALLOCN(grn_batch, 1))) { return NULL; }
+  batch->n_codes = 0;
+  batch->max_depth = 0;
+  batch->masks = NULL;
+  if (!(batch->codes = GRN_MALLOCN(grn_batch_code, e->codes_curr))) {
+    GRN_FREE(batch);
+    return NULL;
+  }
+  for (c = e->codes, ce = e->codes + e->codes_curr; c < ce; c++) {
+    switch (c->op) {
+    case GRN_OP_GET_VALUE :
+      if (n_operands == 2 ||
+          !grn_batch_is_batchable_column(ctx, table, c->value)) {
+        goto exit;
+      }
+      operands[n_operands++] = c->value;
+      break;
+    case GRN_OP_PUSH :
+      if (n_operands == 2 || c->value == var ||
+          !c->value || c->value->header.type != GRN_BULK) {
+        goto exit;
+      }
+      operands[n_operands++] = c->value;
+      break;
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      {
+        grn_batch_code *code = batch->codes + batch->n_codes;
+        grn_bool compiled;
+        if (n_operands != 2 || c->nargs != 2) { goto exit; }
+        if ((operands[0]->header.type == GRN_COLUMN_FIX_SIZE) ==
+            (operands[1]->header.type == GRN_COLUMN_FIX_SIZE)) {
+          goto exit;
+        }
+        if (operands[0]->header.type == GRN_COLUMN_FIX_SIZE) {
+          compiled = grn_batch_code_compile_compare(ctx, code, c->op,
+                                                    operands[0],
+                                                    operands[1]);
+        } else {
+          if (grn_batch_is_unsupported_swapped_compare(ctx, c->op,
+                                                       operands[0],
+                                                       operands[1])) {
+            goto exit;
+          }
+          compiled =
+            grn_batch_code_compile_compare(ctx, code,
+                                           grn_batch_swap_compare_operator(c->op),
+                                           operands[1],
+                                           operands[0]);
+        }
+        if (!compiled) { goto exit; }
+        batch->n_codes++;
+        n_operands = 0;
+        depth++;
+        if (depth > batch->max_depth) { batch->max_depth = depth; }
+      }
+      break;
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+      if (n_operands != 0 || depth < 2) { goto exit; }
+      batch->codes[batch->n_codes++].op = c->op;
+      depth--;
+      break;
+    default :
+      goto exit;
+    }
+  }
+  if (n_operands == 0 && depth == 1) {
+    batch->masks = GRN_MALLOC(GRN_TABLE_SELECT_BATCH_SIZE * batch->max_depth);
+  }
+exit :
+  if (!batch->masks) {
+    GRN_FREE(batch->codes);
+    GRN_FREE(batch);
+    return NULL;
+  }
+  return batch;
+}
+
+static void
+grn_batch_close(grn_ctx *ctx, grn_batch *batch)
+{
+  GRN_FREE(batch->masks);
+  GRN_FREE(batch->codes);
+  GRN_FREE(batch);
+}
+
+#define GRN_BATCH_GATHER(column_type, values) do {\
+  for (i = 0; i < n; i++) {\
+    void *raw_value = grn_ra_ref_cache(ctx, code->ra, batch->ids[i], &cache);\
+    values[i] = raw_value ? *((column_type *)raw_value) : 0;\
+  }\
+} while (0)
+
+#define GRN_BATCH_GATHER_COLUMN(values) do {\
+  switch (code->column_domain) {\
+  case GRN_DB_INT8 :\
+    GRN_BATCH_GATHER(int8_t, values);\
+    break;\
+  case GRN_DB_UINT8 :\
+    GRN_BATCH_GATHER(uint8_t, values);\
+    break;\
+  case GRN_DB_INT16 :\
+    GRN_BATCH_GATHER(int16_t, values);\
+    break;\
+  case GRN_DB_UINT16 :\
+    GRN_BATCH_GATHER(uint16_t, values);\
+    break;\
+  case GRN_DB_INT32 :\
+    GRN_BATCH_GATHER(int32_t, values);\
+    break;\
+  case GRN_DB_UINT32 :\
+    GRN_BATCH_GATHER(uint32_t, values);\
+    break;\
+  case GRN_DB_INT64 :\
+    GRN_BATCH_GATHER(int64_t, values);\
+    break;\
+  case GRN_DB_UINT64 :\
+    GRN_BATCH_GATHER(uint64_t, values);\
+    break;\
+  case GRN_DB_FLOAT :\
+    GRN_BATCH_GATHER(double, values);\
+    break;\
+  }\
+} while (0)
+
+#define GRN_BATCH_COMPARE(values, value) do {\
+  switch (code->op) {\
+  case GRN_OP_EQUAL :\
+    for (i = 0; i < n; i++) {\
+      mask[i] = (values[i] <= value && values[i] >= value);\
+    }\
+    break;\
+  case GRN_OP_NOT_EQUAL :\
+    for (i = 0; i < n; i++) {\
+      mask[i] = !(values[i] <= value && values[i] >= value);\
+    }\
+    break;\
+  case GRN_OP_LESS :\
+    for (i = 0; i < n; i++) { mask[i] = (values[i] < value); }\
+    break;\
+  case GRN_OP_GREATER :\
+    for (i = 0; i < n; i++) { mask[i] = (values[i] > value); }\
+    break;\
+  case GRN_OP_LESS_EQUAL :\
+    for (i = 0; i < n; i++) { mask[i] = (values[i] <= value); }\
+    break;\
+  case GRN_OP_GREATER_EQUAL :\
+    for (i = 0; i < n; i++) { mask[i] = (values[i] >= value); }\
+    break;\
+  default :\
+    break;\
+  }\
+} while (0)
+
+#define GRN_BATCH_EVAL_COMPARE(values, value) do {\
+  GRN_BATCH_GATHER_COLUMN(values);\
+  GRN_BATCH_COMPARE(values, value);\
+} while (0)
+
+/* Evaluates the first n records in batch->ids and returns the mask. */
+static uint8_t *
+grn_batch_exec(grn_ctx *ctx, grn_batch *batch, int n)
+{
+  int i, j, depth = 0;
+  for (j = 0; j < batch->n_codes; j++) {
+    grn_batch_code *code = batch->codes + j;
+    uint8_t *mask;
+    switch (code->op) {
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+      {
+        uint8_t *x, *y;
+        depth--;
+        x = batch->masks + GRN_TABLE_SELECT_BATCH_SIZE * (depth - 1);
+        y = batch->masks + GRN_TABLE_SELECT_BATCH_SIZE * depth;
+        if (code->op == GRN_OP_AND) {
+          for (i = 0; i < n; i++) { x[i] &= y[i]; }
+        } else {
+          for (i = 0; i < n; i++) { x[i] |= y[i]; }
+        }
+      }
+      break;
+    default :
+      {
+        grn_ra_cache cache;
+        mask = batch->masks + GRN_TABLE_SELECT_BATCH_SIZE * depth;
+        depth++;
+        GRN_RA_CACHE_INIT(code->ra, &cache);
+        switch (code->type) {
+        case GRN_BATCH_INT32 :
+          GRN_BATCH_EVAL_COMPARE(batch->values.int32_values,
+                                 code->value.int32_value);
+          break;
+        case GRN_BATCH_UINT32 :
+          GRN_BATCH_EVAL_COMPARE(batch->values.uint32_values,
+                                 code->value.uint32_value);
+          break;
+        case GRN_BATCH_INT64 :
+          GRN_BATCH_EVAL_COMPARE(batch->values.int64_values,
+                                 code->value.int64_value);
+          break;
+        case GRN_BATCH_UINT64 :
+          GRN_BATCH_EVAL_COMPARE(batch->values.uint64_values,
+                                 code->value.uint64_value);
+          break;
+        case GRN_BATCH_FLOAT :
+          GRN_BATCH_EVAL_COMPARE(batch->values.float_values,
+                                 code->value.float_value);
+          break;
+        }
+        GRN_RA_CACHE_FIN(code->ra, &cache);
+      }
+      break;
+    }
+  }
+  return batch->masks;
+}
+
+#undef GRN_BATCH_EVAL_COMPARE
+#undef GRN_BATCH_COMPARE
+#undef GRN_BATCH_GATHER_COLUMN
+#undef GRN_BATCH_GATHER
+
+static void
+grn_batch_flush(grn_ctx *ctx, grn_batch *batch, int n,
+                grn_obj *res, grn_operator op)
+{
+  int i;
+  grn_hash *s = (grn_hash *)res;
+  uint8_t *mask = grn_batch_exec(ctx, batch, n);
+  switch (op) {
+  case GRN_OP_OR :
+    for (i = 0; i < n; i++) {
+      grn_rset_recinfo *ri;
+      if (!mask[i]) { continue; }
+      if (grn_hash_add(ctx, s, batch->ids + i, s->key_size, (void **)&ri, NULL)) {
+        grn_table_add_subrec(res, ri, 1, (grn_rset_posinfo *)(batch->ids + i), 1);
+      }
+    }
+    break;
+  case GRN_OP_AND :
+    for (i = 0; i < n; i++) {
+      if (mask[i]) {
+        grn_table_add_subrec(res, batch->ris[i], 1,
+                             (grn_rset_posinfo *)(batch->ids + i), 1);
+      } else {
+        grn_hash_delete_by_id(ctx, s, batch->entries[i], NULL);
+      }
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    for (i = 0; i < n; i++) {
+      if (mask[i]) {
+        grn_hash_delete_by_id(ctx, s, batch->entries[i], NULL);
+      }
+    }
+    break;
+  default :
+    break;
+  }
+}
+
+static grn_bool
+grn_table_select_sequential_batch(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
+                                  grn_obj *res, grn_operator op)
+{
+  int n = 0;
+  grn_id id;
+  grn_batch *batch;
+  grn_hash *s = (grn_hash *)res;
+
+  switch (op) {
+  case GRN_OP_OR :
+  case GRN_OP_AND :
+  case GRN_OP_AND_NOT :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if (!(batch = grn_batch_open(ctx, table, expr))) {
+    return GRN_FALSE;
+  }
+
+  if (op == GRN_OP_OR) {
+    grn_table_cursor *tc;
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        batch->ids[n++] = id;
+        if (n == GRN_TABLE_SELECT_BATCH_SIZE) {
+          grn_batch_flush(ctx, batch, n, res, op);
+          n = 0;
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+  } else {
+    grn_hash_cursor *hc;
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      grn_id *idp;
+      while ((id = grn_hash_cursor_next(ctx, hc))) {
+        grn_hash_cursor_get_key_value(ctx, hc, (void **)&idp, NULL,
+                                      (void **)(batch->ris + n));
+        batch->ids[n] = *idp;
+        batch->entries[n] = id;
+        n++;
+        if (n == GRN_TABLE_SELECT_BATCH_SIZE) {
+          grn_batch_flush(ctx, batch, n, res, op);
+          n = 0;
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+  }
+  if (n > 0) {
+    grn_batch_flush(ctx, batch, n, res, op);
+  }
+  grn_batch_close(ctx, batch);
+  return GRN_TRUE;
+}
+
+/*
+  A closure is a tree of nodes compiled from a filter expression. Each
+  node has a function that is specialized for its operator and the types
+  of its operands. So evaluating a filter for a record doesn't dispatch
+  on grn_expr_code nor box values into grn_obj. Columns and accessors
+  are resolved and constants are cast when the closure is compiled.
+  Comparisons between constants are folded. A filter is compiled only
+  when all of its operators and operand types are supported and the
+  result is the same as grn_operator_exec_*(). Other filters are
+  evaluated by grn_expr_exec().
+*/
+typedef struct _grn_expr_closure_node grn_expr_closure_node;
+
+typedef grn_bool grn_expr_closure_func(grn_ctx *ctx,
+                                       grn_expr_closure_node *node,
+                                       grn_id id);
+typedef int32_t grn_expr_closure_int32_func(grn_ctx *ctx,
+                                            grn_expr_closure_node *node,
+                                            grn_id id);
+typedef double grn_expr_closure_float_func(grn_ctx *ctx,
+                                           grn_expr_closure_node *node,
+                                           grn_id id);
+
+typedef enum {
+  GRN_EXPR_CLOSURE_SOURCE_COLUMN,
+  GRN_EXPR_CLOSURE_SOURCE_ID,
+  GRN_EXPR_CLOSURE_SOURCE_KEY,
+  GRN_EXPR_CLOSURE_SOURCE_KEY_COLUMN,
+  GRN_EXPR_CLOSURE_SOURCE_SCORE
+} grn_expr_closure_source;
+
+struct _grn_expr_closure_node {
+  grn_expr_closure_func *func;
+  /* Arithmetic nodes have one of them by "domain". */
+  grn_expr_closure_int32_func *int32_func;
+  grn_expr_closure_float_func *float_func;
+  grn_expr_closure_node *left;
+  grn_expr_closure_node *right;
+  /* TRUE when grn_expr_exec() returns Int32 1 or 0 for the node. */
+  grn_bool is_comparison;
+  grn_expr_closure_source source;
+  grn_obj *table;
+  grn_obj *column;
+  grn_id domain;
+  grn_bool use_cache;
+  grn_ra_cache cache;
+  grn_obj buffer;
+  grn_batch_value value;
+  grn_obj text;
+};
+
+typedef struct {
+  grn_expr_closure_node *root;
+  grn_expr_closure_node *nodes;
+  int n_nodes;
+  /* The operator of "_score OP value" for scorers. */
+  grn_operator assign_op;
+} grn_expr_closure;
+
+typedef struct {
+  grn_obj *value;
+  grn_expr_closure_node *node;
+} grn_expr_closure_operand;
+
+static grn_bool
+grn_expr_closure_true(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return GRN_TRUE;
+}
+
+static grn_bool
+grn_expr_closure_false(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return GRN_FALSE;
+}
+
+static grn_bool
+grn_expr_closure_and(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return node->left->func(ctx, node->left, id) &&
+    node->right->func(ctx, node->right, id);
+}
+
+static grn_bool
+grn_expr_closure_or(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return node->left->func(ctx, node->left, id) ||
+    node->right->func(ctx, node->right, id);
+}
+
+static grn_bool
+grn_expr_closure_and_not(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return node->left->func(ctx, node->left, id) &&
+    !node->right->func(ctx, node->right, id);
+}
+
+static grn_bool
+grn_expr_closure_not(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  return !node->left->func(ctx, node->left, id);
+}
+
+static inline const void *
+grn_expr_closure_node_ref(grn_ctx *ctx, grn_expr_closure_node *node,
+                          grn_id id, uint32_t *size)
+{
+  switch (node->source) {
+  case GRN_EXPR_CLOSURE_SOURCE_KEY :
+    return _grn_table_key(ctx, node->table, id, size);
+  case GRN_EXPR_CLOSURE_SOURCE_SCORE :
+    {
+      grn_rset_recinfo *ri;
+      ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, node->table, id, size);
+      if (!ri) {
+        *size = 0;
+        return NULL;
+      }
+      *size = sizeof(ri->score);
+      return &(ri->score);
+    }
+  case GRN_EXPR_CLOSURE_SOURCE_KEY_COLUMN :
+    {
+      uint32_t key_size;
+      const grn_id *key;
+      key = (const grn_id *)_grn_table_key(ctx, node->table, id, &key_size);
+      if (!key) {
+        *size = 0;
+        return NULL;
+      }
+      id = *key;
+    }
+    /* fallthru */
+  case GRN_EXPR_CLOSURE_SOURCE_COLUMN :
+    if (node->use_cache) {
+      *size = ((grn_ra *)(node->column))->header->element_size;
+      return grn_ra_ref_cache(ctx, (grn_ra *)(node->column), id,
+                              &(node->cache));
+    }
+    GRN_BULK_REWIND(&(node->buffer));
+    grn_obj_get_value(ctx, node->column, id, &(node->buffer));
+    *size = GRN_TEXT_LEN(&(node->buffer));
+    return GRN_TEXT_VALUE(&(node->buffer));
+  default :
+    *size = 0;
+    return NULL;
+  }
+}
+
+static grn_bool
+grn_expr_closure_bool(grn_ctx *ctx, grn_expr_closure_node *node, grn_id id)
+{
+  uint32_t size;
+  const void *raw_value = grn_expr_closure_node_ref(ctx, node, id, &size);
+  return raw_value ? *((const grn_bool *)raw_value) != 0 : GRN_FALSE;
+}
+
+#define GRN_EXPR_CLOSURE_DEFINE_LOAD(type_name, c_type)                 \
+static inline c_type                                                    \
+grn_expr_closure_load_ ## type_name(grn_ctx *ctx,                       \
+                                    grn_expr_closure_node *node,        \
+                                    grn_id id)                          \
+{                                                                       \
+  uint32_t size;                                                        \
+  const void *raw_value;                                                \
+  if (node->source == GRN_EXPR_CLOSURE_SOURCE_ID) {                     \
+    return (c_type)id;                                                  \
+  }                                                                     \
+  raw_value = grn_expr_closure_node_ref(ctx, node, id, &size);          \
+  if (!raw_value) {                                                     \
+    return 0;                                                           \
+  }                                                                     \
+  switch (node->domain) {                                               \
+  case GRN_DB_INT8 :                                                    \
+    return (c_type)*((const int8_t *)raw_value);                        \
+  case GRN_DB_UINT8 :                                                   \
+    return (c_type)*((const uint8_t *)raw_value);                       \
+  case GRN_DB_INT16 :                                                   \
+    return (c_type)*((const int16_t *)raw_value);                       \
+  case GRN_DB_UINT16 :                                                  \
+    return (c_type)*((const uint16_t *)raw_value);                      \
+  case GRN_DB_INT32 :                                                   \
+    return (c_type)*((const int32_t *)raw_value);                       \
+  case GRN_DB_UINT32 :                                                  \
+    return (c_type)*((const uint32_t *)raw_value);                      \
+  case GRN_DB_INT64 :                                                   \
+  case GRN_DB_TIME :                                                    \
+    return (c_type)*((const int64_t *)raw_value);                       \
+  case GRN_DB_UINT64 :                                                  \
+    return (c_type)*((const uint64_t *)raw_value);                      \
+  case GRN_DB_FLOAT :                                                   \
+    return (c_type)*((const double *)raw_value);                        \
+  default :                                                             \
+    return 0;                                                           \
+  }                                                                     \
+}
+
+GRN_EXPR_CLOSURE_DEFINE_LOAD(int32, int32_t)
+GRN_EXPR_CLOSURE_DEFINE_LOAD(uint32, uint32_t)
+GRN_EXPR_CLOSURE_DEFINE_LOAD(int64, int64_t)
+GRN_EXPR_CLOSURE_DEFINE_LOAD(uint64, uint64_t)
+GRN_EXPR_CLOSURE_DEFINE_LOAD(float, double)
+
+#undef GRN_EXPR_CLOSURE_DEFINE_LOAD
+
+#define GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,      \
+                                        op_name, x, y, expression)      \
+static grn_bool                                                         \
+grn_expr_closure_ ## type_name ## _ ## op_name(grn_ctx *ctx,            \
+                                               grn_expr_closure_node *node, \
+                                               grn_id id)               \
+{                                                                       \
+  c_type x = grn_expr_closure_load_ ## type_name(ctx, node, id);        \
+  c_type y = node->value.member;                                        \
+  return expression;                                                    \
+}
+
+#define GRN_EXPR_CLOSURE_DEFINE_COMPARES(type_name, c_type, member)     \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  equal, x, y, (x <= y && x >= y))      \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  not_equal, x, y, !(x <= y && x >= y)) \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  less, x, y, (x < y))                  \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  greater, x, y, (x > y))               \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  less_equal, x, y, (x <= y))           \
+  GRN_EXPR_CLOSURE_DEFINE_COMPARE(type_name, c_type, member,            \
+                                  greater_equal, x, y, (x >= y))
+
+GRN_EXPR_CLOSURE_DEFINE_COMPARES(int32, int32_t, int32_value)
+GRN_EXPR_CLOSURE_DEFINE_COMPARES(uint32, uint32_t, uint32_value)
+GRN_EXPR_CLOSURE_DEFINE_COMPARES(int64, int64_t, int64_value)
+GRN_EXPR_CLOSURE_DEFINE_COMPARES(uint64, uint64_t, uint64_value)
+GRN_EXPR_CLOSURE_DEFINE_COMPARES(float, double, float_value)
+
+#undef GRN_EXPR_CLOSURE_DEFINE_COMPARES
+#undef GRN_EXPR_CLOSURE_DEFINE_COMPARE
+
+static inline int
+grn_expr_closure_compare_text(grn_ctx *ctx, grn_expr_closure_node *node,
+                              grn_id id)
+{
+  int r;
+  uint32_t la, lb = GRN_TEXT_LEN(&(node->text));
+  const char *a = grn_expr_closure_node_ref(ctx, node, id, &la);
+  const char *b = GRN_TEXT_VALUE(&(node->text));
+  if (!a) {
+    la = 0;
+  }
+  if (la > lb) {
+    if (!(r = memcmp(a, b, lb))) {
+      r = 1;
+    }
+  } else {
+    if (!(r = memcmp(a, b, la))) {
+      r = la == lb ? 0 : -1;
+    }
+  }
+  return r;
+}
+
+#define GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(op_name, op)               \
+static grn_bool                                                         \
+grn_expr_closure_text_ ## op_name(grn_ctx *ctx,                         \
+                                  grn_expr_closure_node *node,          \
+                                  grn_id id)                            \
+{                                                                       \
+  return grn_expr_closure_compare_text(ctx, node, id) op 0;             \
+}
+
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(equal, ==)
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(not_equal, !=)
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(less, <)
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(greater, >)
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(less_equal, <=)
+GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT(greater_equal, >=)
+
+#undef GRN_EXPR_CLOSURE_DEFINE_COMPARE_TEXT
+
+#define GRN_EXPR_CLOSURE_COMPARE_FUNC(type_name, op)                    \
+  ((op) == GRN_OP_EQUAL ? grn_expr_closure_ ## type_name ## _equal :    \
+   (op) == GRN_OP_NOT_EQUAL ? grn_expr_closure_ ## type_name ## _not_equal : \
+   (op) == GRN_OP_LESS ? grn_expr_closure_ ## type_name ## _less :      \
+   (op) == GRN_OP_GREATER ? grn_expr_closure_ ## type_name ## _greater : \
+   (op) == GRN_OP_LESS_EQUAL ? grn_expr_closure_ ## type_name ## _less_equal : \
+   grn_expr_closure_ ## type_name ## _greater_equal)
+
+static grn_bool
+grn_expr_closure_is_text_domain(grn_id domain)
+{
+  switch (domain) {
+  case GRN_DB_SHORT_TEXT :
+  case GRN_DB_TEXT :
+  case GRN_DB_LONG_TEXT :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+static grn_bool
+grn_expr_closure_is_numeric_domain(grn_id domain)
+{
+  grn_batch_type type;
+  return domain == GRN_DB_TIME || grn_batch_type_resolve(domain, &type);
+}
+
+static grn_bool
+grn_expr_closure_node_init_column(grn_ctx *ctx, grn_expr_closure_node *node,
+                                  grn_id table_id, grn_obj *target)
+{
+  switch (target->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    if (target->header.domain != table_id) { return GRN_FALSE; }
+    node->domain = DB_OBJ(target)->range;
+    if (node->domain != GRN_DB_BOOL &&
+        !grn_expr_closure_is_numeric_domain(node->domain)) {
+      return GRN_FALSE;
+    }
+    node->source = GRN_EXPR_CLOSURE_SOURCE_COLUMN;
+    node->column = target;
+    node->use_cache = GRN_TRUE;
+    GRN_RA_CACHE_INIT((grn_ra *)target, &(node->cache));
+    return GRN_TRUE;
+  case GRN_COLUMN_VAR_SIZE :
+    if (target->header.domain != table_id) { return GRN_FALSE; }
+    if ((target->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+        GRN_OBJ_COLUMN_SCALAR) {
+      return GRN_FALSE;
+    }
+    node->domain = DB_OBJ(target)->range;
+    if (!grn_expr_closure_is_text_domain(node->domain)) { return GRN_FALSE; }
+    node->source = GRN_EXPR_CLOSURE_SOURCE_COLUMN;
+    node->column = target;
+    GRN_TEXT_INIT(&(node->buffer), 0);
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/*
+  Makes a leaf node that reads the value of the record from
+  "target". Returns FALSE when "target" isn't supported.
+*/
+static grn_bool
+grn_expr_closure_node_init_source(grn_ctx *ctx, grn_expr_closure_node *node,
+                                  grn_obj *table, grn_obj *target)
+{
+  switch (target->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    return grn_expr_closure_node_init_column(ctx, node, DB_OBJ(table)->id,
+                                             target);
+  case GRN_ACCESSOR :
+    {
+      grn_accessor *a = (grn_accessor *)target;
+      if (a->obj != table) { return GRN_FALSE; }
+      if (a->next) {
+        /* "_key.column" of a result set such as "column" in scorers. */
+        if (a->action != GRN_ACCESSOR_GET_KEY ||
+            table->header.type != GRN_TABLE_HASH_KEY ||
+            a->next->action != GRN_ACCESSOR_GET_COLUMN_VALUE ||
+            a->next->next) {
+          return GRN_FALSE;
+        }
+        if (!grn_expr_closure_node_init_column(ctx, node,
+                                               table->header.domain,
+                                               a->next->obj)) {
+          return GRN_FALSE;
+        }
+        node->source = GRN_EXPR_CLOSURE_SOURCE_KEY_COLUMN;
+        node->table = table;
+        return GRN_TRUE;
+      }
+      switch (a->action) {
+      case GRN_ACCESSOR_GET_ID :
+        node->source = GRN_EXPR_CLOSURE_SOURCE_ID;
+        node->domain = GRN_DB_UINT32;
+        return GRN_TRUE;
+      case GRN_ACCESSOR_GET_KEY :
+        switch (table->header.type) {
+        case GRN_TABLE_HASH_KEY :
+        case GRN_TABLE_PAT_KEY :
+        case GRN_TABLE_DAT_KEY :
+          break;
+        default :
+          return GRN_FALSE;
+        }
+        node->domain = table->header.domain;
+        /* Only hash table has numeric keys as is. */
+        if (!grn_expr_closure_is_text_domain(node->domain) &&
+            table->header.type != GRN_TABLE_HASH_KEY) {
+          return GRN_FALSE;
+        }
+        if (node->domain != GRN_DB_BOOL &&
+            !grn_expr_closure_is_numeric_domain(node->domain) &&
+            !grn_expr_closure_is_text_domain(node->domain)) {
+          return GRN_FALSE;
+        }
+        node->source = GRN_EXPR_CLOSURE_SOURCE_KEY;
+        node->table = table;
+        return GRN_TRUE;
+      case GRN_ACCESSOR_GET_SCORE :
+        if (!(table->header.flags & GRN_OBJ_WITH_SUBREC)) { return GRN_FALSE; }
+        node->source = GRN_EXPR_CLOSURE_SOURCE_SCORE;
+        node->domain = GRN_DB_FLOAT;
+        node->table = table;
+        return GRN_TRUE;
+      default :
+        return GRN_FALSE;
+      }
+    }
+  default :
+    return GRN_FALSE;
+  }
+}
+
+#define GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, type_name, c_type) do {\
+  GRN_BATCH_CAST_CONSTANT(constant, c_type, node->value.type_name ## _value);\
+  node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(type_name, op);\
+} while (0)
+
+/*
+  Compiles "source OP constant" where "node" is already initialized as
+  a leaf node for "source".
+*/
+static grn_bool
+grn_expr_closure_node_compile_compare(grn_ctx *ctx,
+                                      grn_expr_closure_node *node,
+                                      grn_operator op, grn_bool swapped,
+                                      grn_obj *constant)
+{
+  grn_batch_type source_type, constant_type;
+
+  if (constant->header.type != GRN_BULK) { return GRN_FALSE; }
+
+  if (grn_expr_closure_is_text_domain(node->domain)) {
+    if (!grn_expr_closure_is_text_domain(constant->header.domain)) {
+      return GRN_FALSE;
+    }
+    GRN_TEXT_INIT(&(node->text), 0);
+    GRN_TEXT_PUT(ctx, &(node->text),
+                 GRN_TEXT_VALUE(constant), GRN_TEXT_LEN(constant));
+    node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(text, op);
+    return GRN_TRUE;
+  }
+
+  if (node->domain == GRN_DB_TIME) {
+    /* "constant OP time" isn't symmetric with "time OP constant". */
+    if (swapped) { return GRN_FALSE; }
+    if (GRN_BULK_VSIZE(constant) == 0) { return GRN_FALSE; }
+    switch (constant->header.domain) {
+    case GRN_DB_INT32 :
+      node->value.int64_value = GRN_TIME_PACK(GRN_INT32_VALUE(constant), 0);
+      node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(int64, op);
+      return GRN_TRUE;
+    case GRN_DB_UINT32 :
+      node->value.int64_value = GRN_TIME_PACK(GRN_UINT32_VALUE(constant), 0);
+      node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(int64, op);
+      return GRN_TRUE;
+    case GRN_DB_FLOAT :
+      node->value.int64_value = GRN_TIME_PACK(GRN_FLOAT_VALUE(constant), 0);
+      node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(int64, op);
+      return GRN_TRUE;
+    case GRN_DB_INT64 :
+    case GRN_DB_TIME :
+      node->value.int64_value = GRN_INT64_VALUE(constant);
+      node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(int64, op);
+      return GRN_TRUE;
+    case GRN_DB_UINT64 :
+      node->value.uint64_value = GRN_UINT64_VALUE(constant);
+      node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(uint64, op);
+      return GRN_TRUE;
+    case GRN_DB_SHORT_TEXT :
+    case GRN_DB_TEXT :
+    case GRN_DB_LONG_TEXT :
+      {
+        grn_obj time_value;
+        GRN_TIME_INIT(&time_value, 0);
+        if (grn_obj_cast(ctx, constant, &time_value, GRN_FALSE) ==
+            GRN_SUCCESS) {
+          node->value.int64_value = GRN_TIME_VALUE(&time_value);
+          node->func = GRN_EXPR_CLOSURE_COMPARE_FUNC(int64, op);
+        } else {
+          node->func = grn_expr_closure_false;
+        }
+        GRN_OBJ_FIN(ctx, &time_value);
+      }
+      return GRN_TRUE;
+    default :
+      return GRN_FALSE;
+    }
+  }
+
+  if (!grn_batch_type_resolve(node->domain, &source_type)) {
+    return GRN_FALSE;
+  }
+  /* Literals are one of them. Others may not be comparable in C way. */
+  switch (constant->header.domain) {
+  case GRN_DB_INT32 :
+  case GRN_DB_UINT32 :
+  case GRN_DB_INT64 :
+  case GRN_DB_UINT64 :
+  case GRN_DB_FLOAT :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if (GRN_BULK_VSIZE(constant) == 0) { return GRN_FALSE; }
+  grn_batch_type_resolve(constant->header.domain, &constant_type);
+  /* grn_operator_exec_equal() doesn't support "Float == Int8" and so on. */
+  if (swapped && constant_type == GRN_BATCH_FLOAT &&
+      (op == GRN_OP_EQUAL || op == GRN_OP_NOT_EQUAL)) {
+    switch (node->domain) {
+    case GRN_DB_INT8 :
+    case GRN_DB_UINT8 :
+    case GRN_DB_INT16 :
+    case GRN_DB_UINT16 :
+      return GRN_FALSE;
+    default :
+      break;
+    }
+  }
+  /* The usual arithmetic conversions of C. */
+  switch (source_type > constant_type ? source_type : constant_type) {
+  case GRN_BATCH_INT32 :
+    GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, int32, int32_t);
+    break;
+  case GRN_BATCH_UINT32 :
+    GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, uint32, uint32_t);
+    break;
+  case GRN_BATCH_INT64 :
+    GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, int64, int64_t);
+    break;
+  case GRN_BATCH_UINT64 :
+    GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, uint64, uint64_t);
+    break;
+  case GRN_BATCH_FLOAT :
+    GRN_EXPR_CLOSURE_CAST_CONSTANT(constant, float, double);
+    break;
+  }
+  return GRN_TRUE;
+}
+
+#undef GRN_EXPR_CLOSURE_CAST_CONSTANT
+#undef GRN_BATCH_CAST_CONSTANT
+#undef GRN_EXPR_CLOSURE_COMPARE_FUNC
+
+static grn_bool
+grn_expr_closure_fold_compare(grn_ctx *ctx, grn_operator op,
+                              grn_obj *x, grn_obj *y)
+{
+  switch (op) {
+  case GRN_OP_EQUAL :
+    return grn_operator_exec_equal(ctx, x, y);
+  case GRN_OP_NOT_EQUAL :
+    return grn_operator_exec_not_equal(ctx, x, y);
+  case GRN_OP_LESS :
+    return grn_operator_exec_less(ctx, x, y);
+  case GRN_OP_GREATER :
+    return grn_operator_exec_greater(ctx, x, y);
+  case GRN_OP_LESS_EQUAL :
+    return grn_operator_exec_less_equal(ctx, x, y);
+  default :
+    return grn_operator_exec_greater_equal(ctx, x, y);
+  }
+}
+
+static void grn_expr_closure_close(grn_ctx *ctx, grn_expr_closure *closure);
+
+/*
+  Makes "operand" a node that returns a truth value. Only Bool sources
+  and Bool constants are accepted because && and || return one of
+  their operands and it is used as the score.
+*/
+static grn_expr_closure_node *
+grn_expr_closure_operand_to_node(grn_ctx *ctx, grn_expr_closure *closure,
+                                 grn_obj *table,
+                                 grn_expr_closure_operand *operand)
+{
+  grn_expr_closure_node *node;
+  if (operand->node) {
+    return operand->node;
+  }
+  if (operand->value->header.type == GRN_BULK) {
+    grn_bool value;
+    if (operand->value->header.domain != GRN_DB_BOOL) { return NULL; }
+    GRN_TRUEP(ctx, operand->value, value);
+    node = closure->nodes + closure->n_nodes++;
+    node->func = value ? grn_expr_closure_true : grn_expr_closure_false;
+    return node;
+  }
+  node = closure->nodes + closure->n_nodes++;
+  if (!grn_expr_closure_node_init_source(ctx, node, table, operand->value) ||
+      node->domain != GRN_DB_BOOL) {
+    return NULL;
+  }
+  node->func = grn_expr_closure_bool;
+  return node;
+}
+
+static grn_expr_closure *
+grn_expr_closure_open(grn_ctx *ctx, grn_obj *table, grn_obj *expr)
+{
+  grn_obj *var;
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *c, *ce;
+  grn_expr_closure *closure;
+  grn_expr_closure_operand *operands;
+  int n_operands = 0;
+
+  if (!(var = grn_expr_get_var_by_offset(ctx, expr, 0))) { return NULL; }
+  if (e->codes_curr == 0) { return NULL; }
+  if (!(closure = GRN_MALLOCN(grn_expr_closure, 1))) { return NULL; }
+  closure->root = NULL;
+  closure->n_nodes = 0;
+  closure->nodes = GRN_CALLOC(sizeof(grn_expr_closure_node) * e->codes_curr);
+  operands = GRN_MALLOCN(grn_expr_closure_operand, e->codes_curr);
+  if (!closure->nodes || !operands) {
+    goto exit;
+  }
+  for (c = e->codes, ce = e->codes + e->codes_curr; c < ce; c++) {
+    switch (c->op) {
+    case GRN_OP_GET_VALUE :
+      if (!c->value) { goto exit; }
+      operands[n_operands].value = c->value;
+      operands[n_operands].node = NULL;
+      n_operands++;
+      break;
+    case GRN_OP_PUSH :
+      if (!c->value || c->value == var ||
+          c->value->header.type != GRN_BULK) {
+        goto exit;
+      }
+      operands[n_operands].value = c->value;
+      operands[n_operands].node = NULL;
+      n_operands++;
+      break;
+    case GRN_OP_EQUAL :
+    case GRN_OP_NOT_EQUAL :
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      {
+        grn_expr_closure_operand *x, *y;
+        grn_expr_closure_node *node;
+        if (c->nargs != 2 || n_operands < 2) { goto exit; }
+        x = operands + n_operands - 2;
+        y = operands + n_operands - 1;
+        if (x->node || y->node) { goto exit; }
+        node = closure->nodes + closure->n_nodes++;
+        if (x->value->header.type == GRN_BULK &&
+            y->value->header.type == GRN_BULK) {
+          grn_bool r = grn_expr_closure_fold_compare(ctx, c->op,
+                                                     x->value, y->value);
+          node->func = r ? grn_expr_closure_true : grn_expr_closure_false;
+          node->is_comparison = GRN_TRUE;
+        } else if (y->value->header.type == GRN_BULK) {
+          if (!grn_expr_closure_node_init_source(ctx, node, table,
+                                                 x->value) ||
+              !grn_expr_closure_node_compile_compare(ctx, node, c->op,
+                                                     GRN_FALSE, y->value)) {
+            goto exit;
+          }
+          node->is_comparison = GRN_TRUE;
+        } else if (x->value->header.type == GRN_BULK) {
+          if (!grn_expr_closure_node_init_source(ctx, node, table,
+                                                 y->value) ||
+              !grn_expr_closure_node_compile_compare(
+                ctx, node, grn_batch_swap_compare_operator(c->op),
+                GRN_TRUE, x->value)) {
+            goto exit;
+          }
+          node->is_comparison = GRN_TRUE;
+        } else {
+          goto exit;
+        }
+        n_operands--;
+        x->value = NULL;
+        x->node = node;
+      }
+      break;
+    case GRN_OP_AND :
+    case GRN_OP_OR :
+    case GRN_OP_AND_NOT :
+      {
+        grn_expr_closure_node *left, *right, *node;
+        if (c->nargs != 2 || n_operands < 2) { goto exit; }
+        left = grn_expr_closure_operand_to_node(ctx, closure, table,
+                                                operands + n_operands - 2);
+        if (!left) { goto exit; }
+        right = grn_expr_closure_operand_to_node(ctx, closure, table,
+                                                 operands + n_operands - 1);
+        if (!right) { goto exit; }
+        node = closure->nodes + closure->n_nodes++;
+        node->left = left;
+        node->right = right;
+        switch (c->op) {
+        case GRN_OP_AND :
+          node->func = grn_expr_closure_and;
+          break;
+        case GRN_OP_OR :
+          node->func = grn_expr_closure_or;
+          break;
+        default :
+          /* && ! reads operands as Int32. */
+          if (!left->is_comparison || !right->is_comparison) { goto exit; }
+          node->func = grn_expr_closure_and_not;
+          node->is_comparison = GRN_TRUE;
+          break;
+        }
+        n_operands--;
+        operands[n_operands - 1].value = NULL;
+        operands[n_operands - 1].node = node;
+      }
+      break;
+    case GRN_OP_NOT :
+      {
+        grn_expr_closure_node *target, *node;
+        if (c->nargs != 1 || n_operands < 1) { goto exit; }
+        target = grn_expr_closure_operand_to_node(ctx, closure, table,
+                                                  operands + n_operands - 1);
+        if (!target) { goto exit; }
+        node = closure->nodes + closure->n_nodes++;
+        node->left = target;
+        node->func = grn_expr_closure_not;
+        operands[n_operands - 1].value = NULL;
+        operands[n_operands - 1].node = node;
+      }
+      break;
+    default :
+      goto exit;
+    }
+  }
+  if (n_operands == 1) {
+    closure->root = grn_expr_closure_operand_to_node(ctx, closure, table,
+                                                     operands);
+  }
+exit :
+  if (operands) {
+    GRN_FREE(operands);
+  }
+  if (!closure->root) {
+    grn_expr_closure_close(ctx, closure);
+    return NULL;
+  }
+  return closure;
+}
+
+static void
+grn_expr_closure_close(grn_ctx *ctx, grn_expr_closure *closure)
+{
+  int i;
+  for (i = 0; i < closure->n_nodes; i++) {
+    grn_expr_closure_node *node = closure->nodes + i;
+    if (!node->column) {
+      continue;
+    }
+    if (node->use_cache) {
+      GRN_RA_CACHE_FIN((grn_ra *)(node->column), &(node->cache));
+    } else {
+      GRN_OBJ_FIN(ctx, &(node->buffer));
+    }
+  }
+  for (i = 0; i < closure->n_nodes; i++) {
+    grn_expr_closure_node *node = closure->nodes + i;
+    if (node->is_comparison &&
+        grn_expr_closure_is_text_domain(node->domain)) {
+      GRN_OBJ_FIN(ctx, &(node->text));
+    }
+  }
+  if (closure->nodes) {
+    GRN_FREE(closure->nodes);
+  }
+  GRN_FREE(closure);
+}
+
+static inline grn_bool
+grn_expr_closure_exec(grn_ctx *ctx, grn_expr_closure *closure, grn_id id)
+{
+  return closure->root->func(ctx, closure->root, id);
+}
+
+/*
+  Scorers such as "_score = _score * 2 + column" are also compiled into
+  a closure. The root node computes the right hand side and
+  "assign_op" applies it to the score. Only +, - and * over Int32 and
+  Float values are supported because the result type follows
+  grn_expr_exec(): "Int32 op Int32" is Int32 and others are Float.
+
+  grn_expr_exec() stores the result of "Int32 constant op Float value"
+  such as "2 * _score" and "1 + float_column" into the right operand's
+  work area and resets its domain to Int32. The result is the Float
+  bits read as Int32. The closure doesn't emulate it. Scorers that have
+  the operation are evaluated by grn_expr_exec().
+*/
+static int32_t
+grn_expr_closure_int32_source(grn_ctx *ctx, grn_expr_closure_node *node,
+                              grn_id id)
+{
+  return grn_expr_closure_load_int32(ctx, node, id);
+}
+
+static int32_t
+grn_expr_closure_int32_constant(grn_ctx *ctx, grn_expr_closure_node *node,
+                                grn_id id)
+{
+  return node->value.int32_value;
+}
+
+static double
+grn_expr_closure_float_source(grn_ctx *ctx, grn_expr_closure_node *node,
+                              grn_id id)
+{
+  return grn_expr_closure_load_float(ctx, node, id);
+}
+
+static double
+grn_expr_closure_float_constant(grn_ctx *ctx, grn_expr_closure_node *node,
+                                grn_id id)
+{
+  return node->value.float_value;
+}
+
+static inline double
+grn_expr_closure_node_float(grn_ctx *ctx, grn_expr_closure_node *node,
+                            grn_id id)
+{
+  if (node->domain == GRN_DB_FLOAT) {
+    return node->float_func(ctx, node, id);
+  } else {
+    return node->int32_func(ctx, node, id);
+  }
+}
+
+#define GRN_EXPR_CLOSURE_DEFINE_ARITHMETIC(op_name, operator)           \
+static int32_t                                                          \
+grn_expr_closure_int32_ ## op_name(grn_ctx *ctx,                        \
+                                   grn_expr_closure_node *node,         \
+                                   grn_id id)                           \
+{                                                                       \
+  return node->left->int32_func(ctx, node->left, id) operator           \
+    node->right->int32_func(ctx, node->right, id);                      \
+}                                                                       \
+                                                                        \
+static double                                                           \
+grn_expr_closure_float_ ## op_name(grn_ctx *ctx,                        \
+                                   grn_expr_closure_node *node,         \
+                                   grn_id id)                           \
+{                                                                       \
+  return grn_expr_closure_node_float(ctx, node->left, id) operator      \
+    grn_expr_closure_node_float(ctx, node->right, id);                  \
+}
+
+GRN_EXPR_CLOSURE_DEFINE_ARITHMETIC(plus, +)
+GRN_EXPR_CLOSURE_DEFINE_ARITHMETIC(minus, -)
+GRN_EXPR_CLOSURE_DEFINE_ARITHMETIC(star, *)
+
+#undef GRN_EXPR_CLOSURE_DEFINE_ARITHMETIC
+
+/*
+  Makes "operand" a node that returns an Int32 or Float value.
+*/
+static grn_expr_closure_node *
+grn_expr_closure_operand_to_value_node(grn_ctx *ctx,
+                                       grn_expr_closure *closure,
+                                       grn_obj *table,
+                                       grn_expr_closure_operand *operand)
+{
+  grn_expr_closure_node *node;
+  if (operand->node) {
+    return operand->node;
+  }
+  node = closure->nodes + closure->n_nodes++;
+  if (operand->value->header.type == GRN_BULK) {
+    if (GRN_BULK_VSIZE(operand->value) == 0) { return NULL; }
+    node->domain = operand->value->header.domain;
+    switch (node->domain) {
+    case GRN_DB_INT32 :
+      node->value.int32_value = GRN_INT32_VALUE(operand->value);
+      node->int32_func = grn_expr_closure_int32_constant;
+      return node;
+    case GRN_DB_FLOAT :
+      node->value.float_value = GRN_FLOAT_VALUE(operand->value);
+      node->float_func = grn_expr_closure_float_constant;
+      return node;
+    default :
+      return NULL;
+    }
+  }
+  if (!grn_expr_closure_node_init_source(ctx, node, table, operand->value)) {
+    return NULL;
+  }
+  switch (node->domain) {
+  case GRN_DB_INT32 :
+    node->int32_func = grn_expr_closure_int32_source;
+    return node;
+  case GRN_DB_FLOAT :
+    node->float_func = grn_expr_closure_float_source;
+    return node;
+  default :
+    return NULL;
+  }
+}
+
+static grn_expr_closure *
+grn_expr_closure_open_scorer(grn_ctx *ctx, grn_obj *table, grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *c, *ce;
+  grn_expr_closure *closure;
+  grn_expr_closure_operand *operands;
+  int n_operands = 0;
+
+  if (e->codes_curr < 2) { return NULL; }
+  c = e->codes;
+  ce = e->codes + e->codes_curr - 1;
+  if (c->op != GRN_OP_GET_REF || c->nargs != 1 || !c->value ||
+      c->value->header.type != GRN_ACCESSOR) {
+    return NULL;
+  }
+  {
+    grn_accessor *a = (grn_accessor *)(c->value);
+    if (a->action != GRN_ACCESSOR_GET_SCORE || a->next || a->obj != table) {
+      return NULL;
+    }
+  }
+  switch (ce->op) {
+  case GRN_OP_ASSIGN :
+  case GRN_OP_PLUS_ASSIGN :
+  case GRN_OP_MINUS_ASSIGN :
+  case GRN_OP_STAR_ASSIGN :
+    if (ce->nargs != 2) { return NULL; }
+    break;
+  default :
+    return NULL;
+  }
+
+  if (!(closure = GRN_MALLOCN(grn_expr_closure, 1))) { return NULL; }
+  closure->root = NULL;
+  closure->n_nodes = 0;
+  closure->assign_op = ce->op;
+  closure->nodes = GRN_CALLOC(sizeof(grn_expr_closure_node) * e->codes_curr);
+  operands = GRN_MALLOCN(grn_expr_closure_operand, e->codes_curr);
+  if (!closure->nodes || !operands) {
+    goto exit;
+  }
+  for (c++; c < ce; c++) {
+    switch (c->op) {
+    case GRN_OP_GET_VALUE :
+    case GRN_OP_PUSH :
+      if (!c->value) { goto exit; }
+      operands[n_operands].value = c->value;
+      operands[n_operands].node = NULL;
+      n_operands++;
+      break;
+    case GRN_OP_PLUS :
+    case GRN_OP_MINUS :
+    case GRN_OP_STAR :
+      {
+        grn_expr_closure_node *left, *right, *node;
+        grn_bool left_is_constant, right_is_constant;
+        if (c->nargs != 2 || n_operands < 2) { goto exit; }
+        left_is_constant =
+          !operands[n_operands - 2].node &&
+          operands[n_operands - 2].value->header.type == GRN_BULK;
+        right_is_constant =
+          !operands[n_operands - 1].node &&
+          operands[n_operands - 1].value->header.type == GRN_BULK;
+        left = grn_expr_closure_operand_to_value_node(ctx, closure, table,
+                                                      operands +
+                                                      n_operands - 2);
+        if (!left) { goto exit; }
+        right = grn_expr_closure_operand_to_value_node(ctx, closure, table,
+                                                       operands +
+                                                       n_operands - 1);
+        if (!right) { goto exit; }
+        if (left_is_constant && left->domain == GRN_DB_INT32 &&
+            !right_is_constant && right->domain == GRN_DB_FLOAT) {
+          goto exit;
+        }
+        node = closure->nodes + closure->n_nodes++;
+        node->left = left;
+        node->right = right;
+        if (left->domain == GRN_DB_INT32 && right->domain == GRN_DB_INT32) {
+          node->domain = GRN_DB_INT32;
+          switch (c->op) {
+          case GRN_OP_PLUS :
+            node->int32_func = grn_expr_closure_int32_plus;
+            break;
+          case GRN_OP_MINUS :
+            node->int32_func = grn_expr_closure_int32_minus;
+            break;
+          default :
+            node->int32_func = grn_expr_closure_int32_star;
+            break;
+          }
+        } else {
+          node->domain = GRN_DB_FLOAT;
+          switch (c->op) {
+          case GRN_OP_PLUS :
+            node->float_func = grn_expr_closure_float_plus;
+            break;
+          case GRN_OP_MINUS :
+            node->float_func = grn_expr_closure_float_minus;
+            break;
+          default :
+            node->float_func = grn_expr_closure_float_star;
+            break;
+          }
+        }
+        n_operands--;
+        operands[n_operands - 1].value = NULL;
+        operands[n_operands - 1].node = node;
+      }
+      break;
+    default :
+      goto exit;
+    }
+  }
+  if (ce->value) {
+    operands[n_operands].value = ce->value;
+    operands[n_operands].node = NULL;
+    n_operands++;
+  }
+  if (n_operands == 1) {
+    closure->root = grn_expr_closure_operand_to_value_node(ctx, closure,
+                                                           table, operands);
+  }
+exit :
+  if (operands) {
+    GRN_FREE(operands);
+  }
+  if (!closure->root) {
+    grn_expr_closure_close(ctx, closure);
+    return NULL;
+  }
+  return closure;
+}
+
+static inline void
+grn_expr_closure_exec_scorer(grn_ctx *ctx, grn_expr_closure *closure,
+                             grn_obj *table, grn_id id)
+{
+  grn_rset_recinfo *ri;
+  uint32_t size;
+  double value;
+
+  value = grn_expr_closure_node_float(ctx, closure->root, id);
+  ri = (grn_rset_recinfo *)grn_obj_get_value_(ctx, table, id, &size);
+  if (!ri) {
+    return;
+  }
+  switch (closure->assign_op) {
+  case GRN_OP_ASSIGN :
+    ri->score = value;
+    break;
+  case GRN_OP_PLUS_ASSIGN :
+    ri->score += value;
+    break;
+  case GRN_OP_MINUS_ASSIGN :
+    ri->score -= value;
+    break;
+  default :
+    ri->score *= value;
+    break;
+  }
+}
+
+grn_rc
+grn_table_apply_scorer(grn_ctx *ctx, grn_obj *table, grn_obj *scorer)
+{
+  grn_obj *v;
+  grn_table_cursor *tc;
+  grn_expr_closure *closure;
+  grn_id id;
+
+  if (!(v = grn_expr_get_var_by_offset(ctx, scorer, 0))) {
+    ERR(GRN_INVALID_ARGUMENT, "[table][apply][scorer] no record variable");
+    return ctx->rc;
+  }
+  if (!(tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+    return ctx->rc;
+  }
+  closure = grn_expr_closure_open_scorer(ctx, table, scorer);
+  while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
+    if (closure) {
+      grn_expr_closure_exec_scorer(ctx, closure, table, id);
+    } else {
+      GRN_RECORD_SET(ctx, v, id);
+      grn_expr_exec(ctx, scorer, 0);
+      if (ctx->rc) {
+        break;
+      }
+    }
+  }
+  if (closure) {
+    grn_expr_closure_close(ctx, closure);
+  }
+  grn_table_cursor_close(ctx, tc);
+  return ctx->rc;
+}
+
+static inline int32_t
+grn_table_select_sequential_exec(grn_ctx *ctx, grn_obj *expr,
+                                 grn_expr_closure *closure,
+                                 grn_obj *v, grn_id id,
+                                 grn_obj *score_buffer)
+{
+  grn_obj *r;
+  if (closure) {
+    return grn_expr_closure_exec(ctx, closure, id) ? 1 : 0;
+  }
+  GRN_RECORD_SET(ctx, v, id);
+  r = grn_expr_exec(ctx, expr, 0);
+  if (ctx->rc) {
+    return 0;
+  }
+  return exec_result_to_score(ctx, r, score_buffer);
+}
+
+/*
+  Parallel sequential scan splits the record ID space into ranges and
+  evaluates the filter for each range by a worker thread. Each worker
+  has its own grn_ctx and its own copy of the expression because
+  grn_expr_exec() uses the expression's values and variables as work
+  area. Matched records are collected by each worker and added to the
+  result set in ascending record ID order after all workers finish.
+*/
+#define GRN_TABLE_SELECT_SEQUENTIAL_N_THREADS_MAX 64
+
+typedef struct {
+  grn_id id;
+  int32_t score;
+} grn_table_select_sequential_record;
+
+typedef struct {
+  grn_ctx ctx;
+  grn_obj *table;
+  grn_obj *expr;
+  grn_id start;
+  grn_id end;
+  grn_obj records;
+  grn_thread thread;
+  grn_bool running;
+} grn_table_select_sequential_worker;
+
+static grn_bool
+grn_table_select_sequential_expr_is_copyable(grn_ctx *ctx, grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr_code *c, *ce;
+  uint32_t i;
+
+  if (!(DB_OBJ(expr)->id & GRN_OBJ_TMP_OBJECT)) {
+    return GRN_FALSE;
+  }
+  for (c = e->codes, ce = e->codes + e->codes_curr; c < ce; c++) {
+    /* Functions may not be thread safe. */
+    if (c->op == GRN_OP_CALL) {
+      return GRN_FALSE;
+    }
+  }
+  for (i = 0; i < e->nconsts; i++) {
+    switch (e->consts[i].header.type) {
+    case GRN_VOID :
+    case GRN_BULK :
+    case GRN_UVECTOR :
+      break;
+    default :
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
+static void
+grn_table_select_sequential_copy_value(grn_ctx *ctx, grn_obj *dest,
+                                       grn_obj *src, unsigned char impl_flags)
+{
+  GRN_OBJ_INIT(dest, src->header.type, impl_flags, src->header.domain);
+  dest->header.flags = src->header.flags & GRN_OBJ_VECTOR;
+  if (src->header.type != GRN_VOID && GRN_BULK_VSIZE(src) > 0) {
+    grn_bulk_write(ctx, dest, GRN_BULK_HEAD(src), GRN_BULK_VSIZE(src));
+  }
+}
+
+/*
+  Copies expr that is owned by src_ctx to an expression owned by
+  ctx. Objects in the database, accessors and so on are shared.
+*/
+static grn_obj *
+grn_table_select_sequential_expr_copy(grn_ctx *ctx, grn_ctx *src_ctx,
+                                      grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_expr *copied;
+  grn_hash *src_vars;
+  uint32_t i, n_src_vars;
+
+  if (!(src_vars = grn_expr_get_vars(src_ctx, expr, &n_src_vars))) {
+    return NULL;
+  }
+  if (!(copied = GRN_MALLOCN(grn_expr, 1))) {
+    return NULL;
+  }
+  GRN_DB_OBJ_SET_TYPE(copied, GRN_EXPR);
+  copied->obj.header = e->obj.header;
+  copied->obj.id = e->obj.id;
+  copied->obj.range = e->obj.range;
+  copied->cacheable = e->cacheable;
+  copied->taintable = e->taintable;
+  GRN_TEXT_INIT(&(copied->name_buf), 0);
+  GRN_TEXT_INIT(&(copied->dfi), 0);
+  GRN_PTR_INIT(&(copied->objs), GRN_OBJ_VECTOR, GRN_ID_NIL);
+  copied->vars = NULL;
+  copied->nvars = 0;
+  copied->consts = NULL;
+  copied->nconsts = 0;
+  copied->code0 = NULL;
+  copied->values = NULL;
+  copied->values_curr = 0;
+  copied->values_tail = 0;
+  copied->values_size = 0;
+  copied->codes_curr = 0;
+  copied->codes_size = 0;
+  if (!(copied->codes = GRN_MALLOCN(grn_expr_code, e->codes_curr))) {
+    goto exit;
+  }
+  grn_memcpy(copied->codes, e->codes, sizeof(grn_expr_code) * e->codes_curr);
+  copied->codes_curr = copied->codes_size = e->codes_curr;
+  if (!(copied->values = GRN_MALLOCN(grn_obj, GRN_STACK_SIZE))) {
+    goto exit;
+  }
+  for (i = 0; i < GRN_STACK_SIZE; i++) {
+    GRN_OBJ_INIT(&(copied->values[i]), GRN_BULK, GRN_OBJ_EXPRVALUE,
+                 GRN_ID_NIL);
+  }
+  copied->values_size = GRN_STACK_SIZE;
+  for (i = 0; i < e->nconsts; i++) {
+    grn_obj *constant = grn_expr_alloc_const(ctx, (grn_obj *)copied);
+    if (!constant) {
+      goto exit;
+    }
+    grn_table_select_sequential_copy_value(ctx, constant, &(e->consts[i]),
+                                           GRN_OBJ_EXPRCONST);
+  }
+  for (i = 0; i < n_src_vars; i++) {
+    uint32_t name_size, value_size;
+    const char *name;
+    grn_obj *src_var, *var;
+    name = _grn_hash_key(src_ctx, src_vars, i + 1, &name_size);
+    src_var = (grn_obj *)grn_hash_get_value_(src_ctx, src_vars, i + 1,
+                                             &value_size);
+    if (!name || !src_var) {
+      goto exit;
+    }
+    var = grn_expr_get_or_add_var(ctx, (grn_obj *)copied, name, name_size);
+    if (!var) {
+      goto exit;
+    }
+    GRN_OBJ_FIN(ctx, var);
+    grn_table_select_sequential_copy_value(ctx, var, src_var, 0);
+  }
+
+  {
+    grn_expr_code *c, *ce;
+    for (c = copied->codes, ce = c + copied->codes_curr; c < ce; c++) {
+      grn_obj *value = c->value;
+      if (!value) {
+        continue;
+      }
+      if (e->consts &&
+          e->consts <= value && value < e->consts + e->nconsts) {
+        c->value = copied->consts + (value - e->consts);
+      } else if (e->values <= value && value < e->values + e->values_size) {
+        c->value = copied->values + (value - e->values);
+      } else {
+        for (i = 0; i < n_src_vars; i++) {
+          uint32_t size;
+          if (value ==
+              (grn_obj *)grn_hash_get_value_(src_ctx, src_vars, i + 1, &size)) {
+            c->value = grn_expr_get_var_by_offset(ctx, (grn_obj *)copied, i);
+            break;
+          }
+        }
+      }
+    }
+  }
+  return (grn_obj *)copied;
+
+exit :
+  grn_expr_close(ctx, (grn_obj *)copied);
+  return NULL;
+}
+
+static grn_thread_func_result CALLBACK
+grn_table_select_sequential_worker_run(void *arg)
+{
+  grn_table_select_sequential_worker *worker = arg;
+  grn_ctx *ctx = &(worker->ctx);
+  grn_obj *expr = worker->expr;
+  grn_obj *v = grn_expr_get_var_by_offset(ctx, expr, 0);
+  grn_obj score_buffer;
+  grn_expr_closure *closure;
+  grn_id id;
+
+  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, worker->table));
+  GRN_INT32_INIT(&score_buffer, 0);
+  closure = grn_expr_closure_open(ctx, worker->table, expr);
+  for (id = worker->start; id <= worker->end; id++) {
+    grn_table_select_sequential_record record;
+    if (grn_table_at(ctx, worker->table, id) == GRN_ID_NIL) { continue; }
+    record.score = grn_table_select_sequential_exec(ctx, expr, closure, v, id,
+                                                    &score_buffer);
+    if (ctx->rc) {
+      break;
+    }
+    if (record.score > 0) {
+      record.id = id;
+      if (grn_bulk_write(ctx, &(worker->records),
+                         (const char *)&record, sizeof(record))) {
+        break;
+      }
+    }
+  }
+  if (closure) {
+    grn_expr_closure_close(ctx, closure);
+  }
+  GRN_OBJ_FIN(ctx, &score_buffer);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+static grn_bool
+grn_table_select_sequential_parallel(grn_ctx *ctx, grn_obj *table,
+                                     grn_obj *expr, grn_obj *res)
+{
+  int i, n_workers = grn_table_select_sequential_n_threads;
+  grn_id max_id;
+  grn_hash *s = (grn_hash *)res;
+  grn_table_select_sequential_worker *workers;
+
+  if (n_workers <= 1) {
+    return GRN_FALSE;
+  }
+  /* Other tables don't return records in ID order. */
+  switch (table->header.type) {
+  case GRN_TABLE_HASH_KEY :
+  case GRN_TABLE_NO_KEY :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if (!grn_table_select_sequential_expr_is_copyable(ctx, expr)) {
+    return GRN_FALSE;
+  }
+  max_id = grn_table_max_id(ctx, table);
+  if (n_workers > GRN_TABLE_SELECT_SEQUENTIAL_N_THREADS_MAX) {
+    n_workers = GRN_TABLE_SELECT_SEQUENTIAL_N_THREADS_MAX;
+  }
+  if (max_id / grn_table_select_sequential_n_records_per_thread_min <
+      n_workers) {
+    n_workers = max_id / grn_table_select_sequential_n_records_per_thread_min;
+  }
+  if (n_workers <= 1) {
+    return GRN_FALSE;
+  }
+  if (!(workers = GRN_CALLOC(sizeof(grn_table_select_sequential_worker) *
+                             n_workers))) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    grn_table_select_sequential_worker *worker = &(workers[i]);
+    grn_ctx_init(&(worker->ctx), 0);
+    grn_ctx_use(&(worker->ctx), grn_ctx_db(ctx));
+    GRN_TEXT_INIT(&(worker->records), 0);
+    worker->table = table;
+    worker->start = GRN_ID_NIL + 1 + (uint64_t)max_id * i / n_workers;
+    worker->end = GRN_ID_NIL + (uint64_t)max_id * (i + 1) / n_workers;
+    worker->expr = grn_table_select_sequential_expr_copy(&(worker->ctx),
+                                                         ctx, expr);
+    if (!worker->expr) {
+      break;
+    }
+  }
+  if (i < n_workers) {
+    int n_initialized = i + 1;
+    for (i = 0; i < n_initialized; i++) {
+      grn_table_select_sequential_worker *worker = &(workers[i]);
+      if (worker->expr) {
+        grn_expr_close(&(worker->ctx), worker->expr);
+      }
+      GRN_OBJ_FIN(&(worker->ctx), &(worker->records));
+      grn_ctx_fin(&(worker->ctx));
+    }
+    GRN_FREE(workers);
+    return GRN_FALSE;
+  }
+
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "[table][select][sequential] scan in parallel: "
+          "n_threads:%d max_id:%u",
+          n_workers, max_id);
+  for (i = 0; i < n_workers; i++) {
+    grn_table_select_sequential_worker *worker = &(workers[i]);
+    if (THREAD_CREATE(worker->thread,
+                      grn_table_select_sequential_worker_run,
+                      worker)) {
+      SERR("[table][select][sequential] failed to create worker thread");
+      break;
+    }
+    worker->running = GRN_TRUE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    grn_table_select_sequential_worker *worker = &(workers[i]);
+    if (worker->running) {
+      THREAD_JOIN(worker->thread);
+    }
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    grn_table_select_sequential_worker *worker = &(workers[i]);
+    if (worker->running && !ctx->rc) {
+      if (worker->ctx.rc) {
+        ERR(worker->ctx.rc, "[table][select][sequential] worker<%d>: %s",
+            i, worker->ctx.errbuf);
+      } else {
+        grn_table_select_sequential_record *record, *record_end;
+        record =
+          (grn_table_select_sequential_record *)GRN_BULK_HEAD(&(worker->records));
+        record_end =
+          (grn_table_select_sequential_record *)GRN_BULK_CURR(&(worker->records));
+        for (; record < record_end; record++) {
+          grn_rset_recinfo *ri;
+          if (grn_hash_add(ctx, s, &(record->id), s->key_size,
+                           (void **)&ri, NULL)) {
+            grn_table_add_subrec(res, ri, record->score,
+                                 (grn_rset_posinfo *)&(record->id), 1);
+          }
+        }
+      }
+    }
+    if (worker->expr) {
+      grn_expr_close(&(worker->ctx), worker->expr);
+    }
+    GRN_OBJ_FIN(&(worker->ctx), &(worker->records));
+    grn_ctx_fin(&(worker->ctx));
+  }
+  GRN_FREE(workers);
+  return GRN_TRUE;
+}
+
+static void
+grn_table_select_sequential(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
+                            grn_obj *v, grn_obj *res, grn_operator op)
+{
+  int32_t score;
+  grn_id id, *idp;
+  grn_table_cursor *tc;
+  grn_hash_cursor *hc;
+  grn_hash *s = (grn_hash *)res;
+  grn_obj score_buffer;
+  grn_expr_closure *closure;
+  if (grn_table_select_sequential_batch(ctx, table, expr, res, op)) {
+    return;
+  }
+  GRN_RECORD_INIT(v, 0, grn_obj_id(ctx, table));
+  GRN_INT32_INIT(&score_buffer, 0);
+  closure = grn_expr_closure_open(ctx, table, expr);
+  switch (op) {
+  case GRN_OP_OR :
+    if (grn_table_select_sequential_parallel(ctx, table, expr, res)) {
+      break;
+    }
+    if ((tc = grn_table_cursor_open(ctx, table, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while ((id = grn_table_cursor_next(ctx, tc))) {
+        score = grn_table_select_sequential_exec(ctx, expr, closure, v, id,
+                                                 &score_buffer);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          if (grn_hash_add(ctx, s, &id, s->key_size, (void **)&ri, NULL)) {
+            grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)&id, 1);
+          }
+        }
+      }
+      grn_table_cursor_close(ctx, tc);
+    }
+    break;
+  case GRN_OP_AND :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        score = grn_table_select_sequential_exec(ctx, expr, closure, v, *idp,
+                                                 &score_buffer);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        } else {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_AND_NOT :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        score = grn_table_select_sequential_exec(ctx, expr, closure, v, *idp,
+                                                 &score_buffer);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_hash_cursor_delete(ctx, hc, NULL);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  case GRN_OP_ADJUST :
+    if ((hc = grn_hash_cursor_open(ctx, s, NULL, 0, NULL, 0, 0, -1, 0))) {
+      while (grn_hash_cursor_next(ctx, hc)) {
+        grn_hash_cursor_get_key(ctx, hc, (void **) &idp);
+        score = grn_table_select_sequential_exec(ctx, expr, closure, v, *idp,
+                                                 &score_buffer);
+        if (ctx->rc) {
+          break;
+        }
+        if (score > 0) {
+          grn_rset_recinfo *ri;
+          grn_hash_cursor_get_value(ctx, hc, (void **) &ri);
+          grn_table_add_subrec(res, ri, score, (grn_rset_posinfo *)idp, 1);
+        }
+      }
+      grn_hash_cursor_close(ctx, hc);
+    }
+    break;
+  default :
+    break;
+  }
+  if (closure) {
+    grn_expr_closure_close(ctx, closure);
+  }
+  GRN_OBJ_FIN(ctx, &score_buffer);
+}
+
+static inline grn_bool
+grn_table_select_index_range_column(grn_ctx *ctx, grn_obj *table,
+                                    grn_obj *index,
+                                    scan_info *si, grn_operator logical_op,
+                                    grn_obj *res)
+{
+  grn_bool processed = GRN_FALSE;
+  grn_obj *index_table;
+  grn_obj range;
+
+  index_table = grn_ctx_at(ctx, index->header.domain);
+  if (!index_table) {
+    return GRN_FALSE;
+  }
+
+  GRN_OBJ_INIT(&range, GRN_BULK, 0, index_table->header.domain);
+  if (grn_obj_cast(ctx, si->query, &range, GRN_FALSE) == GRN_SUCCESS) {
+    grn_table_cursor *cursor;
+    const void *min = NULL, *max = NULL;
+    unsigned int min_size = 0, max_size = 0;
+    int offset = 0;
     int limit = -1;
     int flags = GRN_CURSOR_ASCENDING;
 
@@ -5005,6 +7284,227 @@ grn_table_select_index_range_accessor(grn_ctx *ctx, grn_obj *table,
   return current_res == res;
 }
 
+/*
+  Returns GRN_TRUE when "query" is the default value of "range_id" such
+  as 0, "" and no reference. Records that refer no record and records
+  that don't have the value have the default value but indexes don't
+  have them.
+*/
+static grn_bool
+grn_table_select_index_equal_accessor_is_default(grn_ctx *ctx,
+                                                 grn_id range_id,
+                                                 grn_obj *query)
+{
+  grn_obj *range;
+  grn_obj casted_query;
+  grn_bool is_default = GRN_TRUE;
+
+  range = grn_ctx_at(ctx, range_id);
+  if (range && GRN_OBJ_TABLEP(range)) {
+    grn_id id;
+    if (GRN_OBJ_GET_DOMAIN(query) == range_id) {
+      id = GRN_RECORD_VALUE(query);
+    } else {
+      id = grn_table_get(ctx, range,
+                         GRN_BULK_HEAD(query), GRN_BULK_VSIZE(query));
+    }
+    grn_obj_unlink(ctx, range);
+    return id == GRN_ID_NIL;
+  }
+  if (range) {
+    grn_obj_unlink(ctx, range);
+  }
+
+  GRN_OBJ_INIT(&casted_query, GRN_BULK, 0, range_id);
+  if (grn_obj_cast(ctx, query, &casted_query, GRN_FALSE) == GRN_SUCCESS) {
+    if (range_id == GRN_DB_FLOAT) {
+      double value = GRN_FLOAT_VALUE(&casted_query);
+      is_default = (value <= 0.0 && value >= 0.0);
+    } else {
+      const char *value = GRN_BULK_HEAD(&casted_query);
+      size_t i, size = GRN_BULK_VSIZE(&casted_query);
+      for (i = 0; i < size; i++) {
+        if (value[i]) {
+          is_default = GRN_FALSE;
+          break;
+        }
+      }
+    }
+  }
+  GRN_OBJ_FIN(ctx, &casted_query);
+
+  return is_default;
+}
+
+/*
+  Evaluates "a.b.c == value" as a semi-join: the last step is searched
+  by its own index (or key) on the referenced table and matched
+  records are mapped back to table through the indexes of the reference
+  columns by grn_accessor_resolve(). Only scalar reference columns are
+  supported in the chain because "==" against a vector has different
+  semantics. "value" must not be the default value because it also
+  matches records whose chain has no reference.
+*/
+static inline grn_bool
+grn_table_select_index_equal_accessor(grn_ctx *ctx, grn_obj *table,
+                                      grn_accessor *accessor,
+                                      scan_info *si, grn_obj *res)
+{
+  grn_accessor *a;
+  grn_accessor *last_accessor = NULL;
+  int n_accessors = 0;
+  grn_obj *base_res;
+  grn_obj *resolve_res = NULL;
+  grn_rc rc;
+
+  if (accessor->obj->header.domain != DB_OBJ(table)->id) {
+    return GRN_FALSE;
+  }
+  for (a = accessor; a; a = a->next) {
+    n_accessors++;
+    if (!a->next) {
+      last_accessor = a;
+      break;
+    }
+    if (a->action != GRN_ACCESSOR_GET_COLUMN_VALUE ||
+        a->obj->header.type != GRN_COLUMN_FIX_SIZE) {
+      return GRN_FALSE;
+    }
+    {
+      grn_obj *index;
+      if (grn_column_index(ctx, a->obj, GRN_OP_MATCH, &index, 1, NULL) == 0) {
+        return GRN_FALSE;
+      }
+    }
+  }
+
+  if (grn_table_select_index_equal_accessor_is_default(
+        ctx, grn_obj_get_range(ctx, (grn_obj *)last_accessor), si->query)) {
+    return GRN_FALSE;
+  }
+
+  switch (last_accessor->action) {
+  case GRN_ACCESSOR_GET_ID :
+  case GRN_ACCESSOR_GET_KEY :
+    {
+      grn_obj *base_table = last_accessor->obj;
+      grn_obj dest;
+      grn_id id;
+
+      if (!GRN_OBJ_TABLEP(base_table)) {
+        return GRN_FALSE;
+      }
+      if (last_accessor->action == GRN_ACCESSOR_GET_ID) {
+        GRN_UINT32_INIT(&dest, 0);
+      } else {
+        if (base_table->header.type == GRN_TABLE_NO_KEY) {
+          return GRN_FALSE;
+        }
+        GRN_OBJ_INIT(&dest, GRN_BULK, 0, base_table->header.domain);
+      }
+      if (grn_obj_cast(ctx, si->query, &dest, GRN_FALSE) != GRN_SUCCESS) {
+        GRN_OBJ_FIN(ctx, &dest);
+        return GRN_FALSE;
+      }
+      if (last_accessor->action == GRN_ACCESSOR_GET_ID) {
+        id = GRN_UINT32_VALUE(&dest);
+        if (id != GRN_ID_NIL && grn_table_at(ctx, base_table, id) != id) {
+          id = GRN_ID_NIL;
+        }
+      } else {
+        id = grn_table_get(ctx, base_table,
+                           GRN_BULK_HEAD(&dest), GRN_BULK_VSIZE(&dest));
+      }
+      GRN_OBJ_FIN(ctx, &dest);
+
+      base_res = grn_table_create(ctx, NULL, 0, NULL,
+                                  GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                                  base_table, NULL);
+      if (!base_res) {
+        return GRN_FALSE;
+      }
+      if (id != GRN_ID_NIL) {
+        grn_ii_posting posting;
+        posting.rid = id;
+        posting.sid = 1;
+        posting.pos = 0;
+        posting.weight = 0;
+        grn_ii_posting_add(ctx, &posting, (grn_hash *)base_res, GRN_OP_OR);
+      }
+    }
+    break;
+  case GRN_ACCESSOR_GET_COLUMN_VALUE :
+    {
+      grn_index_datum index_datum;
+      grn_obj *range;
+      grn_obj *lexicon;
+      grn_id tid;
+
+      if ((last_accessor->obj->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+          GRN_OBJ_COLUMN_SCALAR) {
+        return GRN_FALSE;
+      }
+      if (grn_column_find_index_data(ctx, last_accessor->obj, GRN_OP_EQUAL,
+                                     &index_datum, 1) == 0) {
+        return GRN_FALSE;
+      }
+      if (index_datum.section > 0) {
+        return GRN_FALSE;
+      }
+
+      range = grn_ctx_at(ctx, DB_OBJ(index_datum.index)->range);
+      base_res = grn_table_create(ctx, NULL, 0, NULL,
+                                  GRN_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                                  range, NULL);
+      grn_obj_unlink(ctx, range);
+      if (!base_res) {
+        return GRN_FALSE;
+      }
+      lexicon = grn_ctx_at(ctx, index_datum.index->header.domain);
+      if (GRN_OBJ_GET_DOMAIN(si->query) == DB_OBJ(lexicon)->id) {
+        tid = GRN_RECORD_VALUE(si->query);
+      } else {
+        tid = grn_table_get(ctx, lexicon,
+                            GRN_BULK_HEAD(si->query),
+                            GRN_BULK_VSIZE(si->query));
+      }
+      grn_obj_unlink(ctx, lexicon);
+      if (tid != GRN_ID_NIL) {
+        grn_ii_at(ctx, (grn_ii *)(index_datum.index), tid,
+                  (grn_hash *)base_res, GRN_OP_OR);
+      }
+    }
+    break;
+  default :
+    return GRN_FALSE;
+  }
+
+  rc = grn_accessor_resolve(ctx, (grn_obj *)accessor, n_accessors - 1,
+                            base_res, &resolve_res, NULL);
+  grn_obj_unlink(ctx, base_res);
+  if (rc != GRN_SUCCESS) {
+    return GRN_FALSE;
+  }
+
+  {
+    grn_id *record_id;
+    grn_rset_recinfo *recinfo;
+    GRN_HASH_EACH(ctx, (grn_hash *)resolve_res, id, &record_id, NULL,
+                  &recinfo, {
+      grn_ii_posting posting;
+      posting.rid = *record_id;
+      posting.sid = 1;
+      posting.pos = 0;
+      posting.weight = recinfo->score - 1;
+      grn_ii_posting_add(ctx, &posting, (grn_hash *)res, si->logical_op);
+    });
+  }
+  grn_ii_resolve_sel_and(ctx, (grn_hash *)res, si->logical_op);
+  grn_obj_unlink(ctx, resolve_res);
+
+  return GRN_TRUE;
+}
+
 static inline grn_bool
 grn_table_select_index_range(grn_ctx *ctx, grn_obj *table, grn_obj *index,
                              scan_info *si, grn_obj *res)
@@ -5087,6 +7587,11 @@ grn_table_select_index(grn_ctx *ctx, grn_obj *table, scan_info *si,
             GRN_OBJ_FIN(ctx, &dest);
             break;
           }
+        } else if (index->header.type == GRN_ACCESSOR) {
+          processed =
+            grn_table_select_index_equal_accessor(ctx, table,
+                                                  (grn_accessor *)index,
+                                                  si, res);
         }
       } else {
         grn_obj *domain = grn_ctx_at(ctx, index->header.domain);
@@ -5169,15 +7674,13 @@ grn_table_select_index(grn_ctx *ctx, grn_obj *table, scan_info *si,
           grn_hash *pres;
           if ((pres = grn_hash_create(ctx, NULL, sizeof(grn_id), 0,
                                       GRN_OBJ_TABLE_HASH_KEY))) {
-            grn_id *key;
             grn_table_search(ctx, domain,
                              GRN_BULK_HEAD(si->query),
                              GRN_BULK_VSIZE(si->query),
                              si->op, (grn_obj *)pres, GRN_OP_OR);
             grn_obj_unlink(ctx, domain);
-            GRN_HASH_EACH(ctx, pres, id, &key, NULL, NULL, {
-                grn_ii_at(ctx, (grn_ii *)index, *key, (grn_hash *)res, si->logical_op);
-              });
+            grn_ii_at_terms(ctx, (grn_ii *)index, pres, (grn_hash *)res,
+                            si->logical_op);
             grn_hash_close(ctx, pres);
           }
           grn_obj_unlink(ctx, domain);
@@ -5296,32 +7799,421 @@ grn_table_select_index(grn_ctx *ctx, grn_obj *table, scan_info *si,
     case GRN_OP_GREATER :
     case GRN_OP_LESS_EQUAL :
     case GRN_OP_GREATER_EQUAL :
-      processed = grn_table_select_index_range(ctx, table, index, si, res);
+      processed = grn_table_select_index_range(ctx, table, index, si, res);
+      break;
+    default :
+      /* todo : implement */
+      /* todo : handle SCAN_PRE_CONST */
+      break;
+    }
+  } else {
+    switch (si->op) {
+    case GRN_OP_CALL :
+      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
+        grn_rc rc;
+        grn_proc *proc = (grn_proc *)(si->args[0]);
+        rc = proc->selector(ctx, table, NULL, si->nargs, si->args,
+                            res, si->logical_op);
+        if (rc) {
+          /* TODO: report error */
+        } else {
+          processed = GRN_TRUE;
+        }
+      }
+    default :
+      break;
+    }
+  }
+  return processed;
+}
+
+static grn_bool
+grn_table_select_can_use_top_k(grn_ctx *ctx, scan_info **sis, int n,
+                               grn_operator op, unsigned int res_size)
+{
+  scan_info *si;
+  grn_obj **indexes;
+  int i, n_indexes;
+
+  if (n != 1) {
+    return GRN_FALSE;
+  }
+  if (op != GRN_OP_OR || res_size > 0) {
+    return GRN_FALSE;
+  }
+
+  si = sis[0];
+  if (si->op != GRN_OP_MATCH || (si->flags & SCAN_ACCESSOR)) {
+    return GRN_FALSE;
+  }
+
+  n_indexes = GRN_BULK_VSIZE(&(si->index)) / sizeof(grn_obj *);
+  if (n_indexes == 0) {
+    return GRN_FALSE;
+  }
+  indexes = (grn_obj **)GRN_BULK_HEAD(&(si->index));
+  if (indexes[0]->header.type != GRN_COLUMN_INDEX) {
+    return GRN_FALSE;
+  }
+  for (i = 1; i < n_indexes; i++) {
+    if (indexes[i] != indexes[0]) {
+      return GRN_FALSE;
+    }
+  }
+
+  return GRN_TRUE;
+}
+
+static grn_bool
+grn_table_select_bitmap_is_available(grn_ctx *ctx, scan_info **sis, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    scan_info *si = sis[i];
+    grn_obj *index;
+    switch (si->logical_op) {
+    case GRN_OP_OR :
+    case GRN_OP_AND :
+    case GRN_OP_AND_NOT :
+      break;
+    default :
+      return GRN_FALSE;
+    }
+    if (si->flags & SCAN_POP) {
+      continue;
+    }
+    if (si->flags & SCAN_ACCESSOR) {
+      return GRN_FALSE;
+    }
+    if (GRN_BULK_VSIZE(&(si->index)) != sizeof(grn_obj *)) {
+      return GRN_FALSE;
+    }
+    index = GRN_PTR_VALUE(&(si->index));
+    if (index->header.type != GRN_COLUMN_INDEX) {
+      return GRN_FALSE;
+    }
+    switch (si->op) {
+    case GRN_OP_EQUAL :
+      if (GRN_BULK_VSIZE(si->query) == 0) {
+        return GRN_FALSE;
+      }
+      break;
+    case GRN_OP_LESS :
+    case GRN_OP_GREATER :
+    case GRN_OP_LESS_EQUAL :
+    case GRN_OP_GREATER_EQUAL :
+      break;
+    default :
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
+static grn_bool
+grn_table_select_bitmap_equal(grn_ctx *ctx, grn_obj *index, scan_info *si,
+                              grn_bitmap *bitmap)
+{
+  grn_obj *domain = grn_ctx_at(ctx, index->header.domain);
+  grn_id tid;
+  grn_ii *ii = (grn_ii *)index;
+  grn_ii_cursor *c;
+  grn_ii_posting *posting;
+
+  if (!domain) {
+    return GRN_FALSE;
+  }
+  if (GRN_OBJ_GET_DOMAIN(si->query) == DB_OBJ(domain)->id) {
+    tid = GRN_RECORD_VALUE(si->query);
+  } else {
+    tid = grn_table_get(ctx, domain,
+                        GRN_BULK_HEAD(si->query),
+                        GRN_BULK_VSIZE(si->query));
+  }
+  if (tid == GRN_ID_NIL) {
+    return GRN_TRUE;
+  }
+  if ((c = grn_ii_cursor_open(ctx, ii, tid, GRN_ID_NIL, GRN_ID_MAX,
+                              ii->n_elements - 1, 0))) {
+    while ((posting = grn_ii_cursor_next(ctx, c))) {
+      if (grn_bitmap_add(ctx, bitmap, posting->rid)) { break; }
+    }
+    grn_ii_cursor_close(ctx, c);
+  }
+  return GRN_TRUE;
+}
+
+/*
+  Returns GRN_FALSE when the query can't be used as a key of the
+  lexicon. The caller falls back to the normal path that evaluates the
+  condition by sequential scan like grn_table_select_index_range().
+*/
+static grn_bool
+grn_table_select_bitmap_range(grn_ctx *ctx, grn_obj *index, scan_info *si,
+                              grn_bitmap *bitmap)
+{
+  grn_obj *index_table;
+  grn_obj range;
+  grn_bool processed = GRN_FALSE;
+
+  index_table = grn_ctx_at(ctx, index->header.domain);
+  if (!index_table) {
+    return GRN_FALSE;
+  }
+
+  GRN_OBJ_INIT(&range, GRN_BULK, 0, index_table->header.domain);
+  if (grn_obj_cast(ctx, si->query, &range, GRN_FALSE) == GRN_SUCCESS) {
+    grn_table_cursor *cursor;
+    const void *min = NULL, *max = NULL;
+    unsigned int min_size = 0, max_size = 0;
+    int flags = GRN_CURSOR_ASCENDING;
+
+    switch (si->op) {
+    case GRN_OP_LESS :
+      flags |= GRN_CURSOR_LT;
+      max = GRN_BULK_HEAD(&range);
+      max_size = GRN_BULK_VSIZE(&range);
+      break;
+    case GRN_OP_GREATER :
+      flags |= GRN_CURSOR_GT;
+      min = GRN_BULK_HEAD(&range);
+      min_size = GRN_BULK_VSIZE(&range);
+      break;
+    case GRN_OP_LESS_EQUAL :
+      flags |= GRN_CURSOR_LE;
+      max = GRN_BULK_HEAD(&range);
+      max_size = GRN_BULK_VSIZE(&range);
+      break;
+    case GRN_OP_GREATER_EQUAL :
+      flags |= GRN_CURSOR_GE;
+      min = GRN_BULK_HEAD(&range);
+      min_size = GRN_BULK_VSIZE(&range);
       break;
     default :
-      /* todo : implement */
-      /* todo : handle SCAN_PRE_CONST */
       break;
     }
-  } else {
-    switch (si->op) {
-    case GRN_OP_CALL :
-      if (grn_obj_is_selector_proc(ctx, si->args[0])) {
-        grn_rc rc;
-        grn_proc *proc = (grn_proc *)(si->args[0]);
-        rc = proc->selector(ctx, table, NULL, si->nargs, si->args,
-                            res, si->logical_op);
-        if (rc) {
-          /* TODO: report error */
-        } else {
-          processed = GRN_TRUE;
+    cursor = grn_table_cursor_open(ctx, index_table,
+                                   min, min_size, max, max_size,
+                                   0, -1, flags);
+    if (cursor) {
+      uint32_t sid;
+      grn_obj *index_cursor;
+
+      sid = GRN_UINT32_VALUE_AT(&(si->wv), 0);
+      index_cursor = grn_index_cursor_open(ctx, cursor, index,
+                                           GRN_ID_NIL, GRN_ID_MAX, 0);
+      if (index_cursor) {
+        grn_posting *posting;
+        while ((posting = grn_index_cursor_next(ctx, index_cursor, NULL))) {
+          if (sid == 0 || posting->sid == sid) {
+            if (grn_bitmap_add(ctx, bitmap, posting->rid)) { break; }
+          }
+        }
+        grn_obj_unlink(ctx, index_cursor);
+        processed = GRN_TRUE;
+      }
+      grn_table_cursor_close(ctx, cursor);
+    }
+  }
+  GRN_OBJ_FIN(ctx, &range);
+
+  grn_obj_unlink(ctx, index_table);
+
+  return processed;
+}
+
+static grn_rc
+grn_table_select_bitmap_merge(grn_ctx *ctx, grn_bitmap *bitmap,
+                              grn_bitmap *other, grn_operator logical_op)
+{
+  switch (logical_op) {
+  case GRN_OP_OR :
+    return grn_bitmap_or(ctx, bitmap, other);
+  case GRN_OP_AND :
+    return grn_bitmap_and(ctx, bitmap, other);
+  case GRN_OP_AND_NOT :
+    return grn_bitmap_and_not(ctx, bitmap, other);
+  default :
+    return GRN_INVALID_ARGUMENT;
+  }
+}
+
+/*
+  Evaluates index only conditions as compressed bitmaps and adds
+  matched records to res at once. It is used only when the caller
+  doesn't use scores. Each record has the same score as a record
+  matched by one condition. If n_hits isn't NULL, only the number of
+  matched records is stored to it and res isn't changed. If a condition
+  can't be evaluated by its index, res isn't changed and GRN_FALSE is
+  returned to evaluate all conditions by the normal path.
+*/
+static grn_bool
+grn_table_select_bitmap(grn_ctx *ctx, grn_obj *table, scan_info **sis, int n,
+                        grn_obj *res, int64_t *n_hits)
+{
+  int i;
+  grn_bitmap *bitmap;
+  grn_obj bitmap_stack;
+  grn_bool processed = GRN_TRUE;
+
+  if (!grn_table_select_bitmap_is_available(ctx, sis, n)) {
+    return GRN_FALSE;
+  }
+  if (!(bitmap = grn_bitmap_open(ctx))) {
+    return GRN_FALSE;
+  }
+
+  GRN_PTR_INIT(&bitmap_stack, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  for (i = 0; i < n; i++) {
+    scan_info *si = sis[i];
+    grn_bitmap *matched;
+    grn_rc rc;
+    if (si->flags & SCAN_POP) {
+      grn_obj *stacked;
+      GRN_PTR_POP(&bitmap_stack, stacked);
+      rc = grn_table_select_bitmap_merge(ctx, (grn_bitmap *)stacked, bitmap,
+                                         si->logical_op);
+      grn_bitmap_close(ctx, bitmap);
+      bitmap = (grn_bitmap *)stacked;
+    } else {
+      grn_obj *index = GRN_PTR_VALUE(&(si->index));
+      if (si->flags & SCAN_PUSH) {
+        grn_bitmap *pushed = bitmap;
+        if (!(bitmap = grn_bitmap_open(ctx))) {
+          bitmap = pushed;
+          processed = GRN_FALSE;
+          break;
         }
+        GRN_PTR_PUT(ctx, &bitmap_stack, pushed);
+      }
+      if (!(matched = grn_bitmap_open(ctx))) {
+        processed = GRN_FALSE;
+        break;
+      }
+      if (si->op == GRN_OP_EQUAL) {
+        processed = grn_table_select_bitmap_equal(ctx, index, si, matched);
+      } else {
+        processed = grn_table_select_bitmap_range(ctx, index, si, matched);
       }
+      if (!processed) {
+        grn_bitmap_close(ctx, matched);
+        break;
+      }
+      rc = grn_table_select_bitmap_merge(ctx, bitmap, matched, si->logical_op);
+      grn_bitmap_close(ctx, matched);
+    }
+    if (rc && !ctx->rc) {
+      ERR(rc, "[table][select][bitmap] failed to merge");
+    }
+    GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
+                  ":", "filter(%d)", grn_bitmap_size(ctx, bitmap));
+    if (ctx->rc) { break; }
+  }
+  while (GRN_BULK_VSIZE(&bitmap_stack) > 0) {
+    grn_obj *stacked;
+    GRN_PTR_POP(&bitmap_stack, stacked);
+    grn_bitmap_close(ctx, (grn_bitmap *)stacked);
+  }
+  GRN_OBJ_FIN(ctx, &bitmap_stack);
+
+  if (ctx->rc || !processed) {
+    /* do nothing */
+  } else if (n_hits) {
+    *n_hits = grn_bitmap_size(ctx, bitmap);
+  } else {
+    grn_bitmap_cursor cursor;
+    grn_ii_posting posting;
+    posting.sid = 1;
+    posting.pos = 0;
+    posting.weight = 0;
+    grn_bitmap_cursor_init(ctx, &cursor, bitmap);
+    while ((posting.rid = grn_bitmap_cursor_next(ctx, &cursor))) {
+      grn_ii_posting_add(ctx, &posting, (grn_hash *)res, GRN_OP_OR);
+    }
+  }
+  grn_bitmap_close(ctx, bitmap);
+
+  return processed;
+}
+
+/*
+  A condition combined by && is evaluated for each record in the
+  current result set instead of searching its index when the result set
+  is smaller than the number of records the index returns. It is
+  applied only to comparisons of a scalar column whose index doesn't
+  normalize nor tokenize values because the results must be the same.
+*/
+static grn_bool
+grn_table_select_prefer_sequential(grn_ctx *ctx, grn_obj *table,
+                                   scan_info *si, grn_obj *res)
+{
+  int i;
+  grn_obj *column = NULL;
+  grn_obj *index;
+  grn_obj *lexicon;
+  grn_obj *tokenizer, *normalizer;
+  unsigned int n_records, estimated_size;
+
+  if (si->logical_op != GRN_OP_AND || (si->flags & SCAN_PUSH)) {
+    return GRN_FALSE;
+  }
+  switch (si->op) {
+  case GRN_OP_EQUAL :
+  case GRN_OP_LESS :
+  case GRN_OP_GREATER :
+  case GRN_OP_LESS_EQUAL :
+  case GRN_OP_GREATER_EQUAL :
+    break;
+  default :
+    return GRN_FALSE;
+  }
+  if (si->flags & SCAN_ACCESSOR) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < si->nargs; i++) {
+    grn_obj *arg = si->args[i];
+    switch (arg->header.type) {
+    case GRN_COLUMN_FIX_SIZE :
+    case GRN_COLUMN_VAR_SIZE :
+      column = arg;
+      break;
     default :
       break;
     }
   }
-  return processed;
+  if (!column ||
+      (column->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+      GRN_OBJ_COLUMN_SCALAR ||
+      DB_OBJ(column)->range >= GRN_N_RESERVED_TYPES) {
+    return GRN_FALSE;
+  }
+  if (GRN_BULK_VSIZE(&(si->index)) == 0) {
+    return GRN_FALSE;
+  }
+  index = GRN_PTR_VALUE(&(si->index));
+  if (index->header.type != GRN_COLUMN_INDEX) {
+    return GRN_FALSE;
+  }
+  if (!(lexicon = grn_ctx_at(ctx, index->header.domain))) {
+    return GRN_FALSE;
+  }
+  grn_table_get_info(ctx, lexicon, NULL, NULL, &tokenizer, &normalizer, NULL);
+  if (tokenizer || normalizer) {
+    return GRN_FALSE;
+  }
+
+  n_records = GRN_HASH_SIZE((grn_hash *)res);
+  if (!scan_info_estimate_size(ctx, si, table, &estimated_size)) {
+    return GRN_FALSE;
+  }
+  if (n_records >= estimated_size) {
+    return GRN_FALSE;
+  }
+  GRN_LOG(ctx, GRN_LOG_DEBUG,
+          "[table][select][filter] evaluate sequentially: "
+          "n_records:%u estimated:%u",
+          n_records, estimated_size);
+  return GRN_TRUE;
 }
 
 grn_obj *
@@ -5358,8 +8250,27 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
       grn_expr *e = (grn_expr *)expr;
       grn_expr_code *codes = e->codes;
       uint32_t codes_curr = e->codes_curr;
+      grn_bool bitmap_processed = GRN_FALSE;
+      grn_bool count_only = (ctx->impl->top_k.limit == 0);
+      if (op == GRN_OP_OR && res_size == 0) {
+        scan_info_optimize(ctx, expr, sis, n, NULL);
+      }
+      if (ctx->impl->top_k.limit >= 0 &&
+          !grn_table_select_can_use_top_k(ctx, sis, n, op, res_size)) {
+        ctx->impl->top_k.limit = -1;
+      }
+      if (ctx->impl->score_ignorable &&
+          op == GRN_OP_OR && res_size == 0 &&
+          DB_OBJ(res)->max_n_subrecs == 0) {
+        int64_t *n_hits = NULL;
+        if (count_only && ctx->impl->top_k.limit == -1) {
+          n_hits = &(ctx->impl->top_k.n_hits);
+        }
+        bitmap_processed = grn_table_select_bitmap(ctx, table, sis, n, res,
+                                                   n_hits);
+      }
       GRN_PTR_INIT(&res_stack, GRN_OBJ_VECTOR, GRN_ID_NIL);
-      for (i = 0; i < n; i++) {
+      for (i = 0; i < n && !bitmap_processed; i++) {
         scan_info *si = sis[i];
         if (si->flags & SCAN_POP) {
           grn_obj *res_;
@@ -5386,7 +8297,9 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
             GRN_PTR_PUT(ctx, &res_stack, res);
             res = res_;
           }
-          processed = grn_table_select_index(ctx, table, si, res);
+          if (!grn_table_select_prefer_sequential(ctx, table, si, res)) {
+            processed = grn_table_select_index(ctx, table, si, res);
+          }
           if (!processed) {
             if (ctx->rc) { break; }
             e->codes = codes + si->start;
@@ -5408,6 +8321,7 @@ grn_table_select(grn_ctx *ctx, grn_obj *table, grn_obj *expr,
       e->codes = codes;
       e->codes_curr = codes_curr;
     } else {
+      ctx->impl->top_k.limit = -1;
       if (!ctx->rc) {
         grn_table_select_sequential(ctx, table, expr, v, res, op);
       }
@@ -6949,7 +9863,15 @@ grn_expr_dump_plan(grn_ctx *ctx, grn_obj *expr, grn_obj *buffer)
   sis = scan_info_build(ctx, expr, &n, GRN_OP_OR, 0);
   if (sis) {
     int i;
-    grn_inspect_scan_info_list(ctx, buffer, sis, n);
+    unsigned int *sizes;
+    sizes = GRN_MALLOCN(unsigned int, n);
+    if (sizes) {
+      scan_info_optimize(ctx, expr, sis, n, sizes);
+    }
+    scan_info_list_inspect(ctx, buffer, sis, n, sizes);
+    if (sizes) {
+      GRN_FREE(sizes);
+    }
     for (i = 0; i < n; i++) {
       SI_FREE(sis[i]);
     }
@@ -6998,3 +9920,203 @@ grn_expr_estimate_size(grn_ctx *ctx, grn_obj *expr)
 #endif
   GRN_API_RETURN(size);
 }
+
+/*
+  grn_expr_cache keeps parsed expressions per context. Parsing a long
+  query or filter costs for each request even when only offset, limit
+  and so on are changed. Cached expressions refer tables and columns.
+  So they are expired when schema generation of the database is
+  changed.
+
+  scan_info isn't cached. The order of conditions in scan_info depends
+  on the current estimated size of each condition.
+*/
+typedef struct _grn_expr_cache_entry grn_expr_cache_entry;
+
+struct _grn_expr_cache {
+  grn_expr_cache_entry *next;
+  grn_expr_cache_entry *prev;
+  grn_hash *hash;
+  grn_obj *db;
+};
+
+struct _grn_expr_cache_entry {
+  grn_expr_cache_entry *next;
+  grn_expr_cache_entry *prev;
+  grn_obj *expr;
+  grn_obj *match_columns;
+  uint32_t schema_generation;
+  grn_id id;
+};
+
+static grn_expr_cache *
+grn_expr_cache_open(grn_ctx *ctx)
+{
+  grn_expr_cache *cache;
+
+  cache = GRN_MALLOC(sizeof(grn_expr_cache));
+  if (!cache) {
+    return NULL;
+  }
+  cache->hash = grn_hash_create(ctx, NULL, GRN_CACHE_MAX_KEY_SIZE,
+                                sizeof(grn_expr_cache_entry),
+                                GRN_OBJ_KEY_VAR_SIZE);
+  if (!cache->hash) {
+    GRN_FREE(cache);
+    return NULL;
+  }
+  cache->next = (grn_expr_cache_entry *)cache;
+  cache->prev = (grn_expr_cache_entry *)cache;
+  cache->db = ctx->impl->db;
+  return cache;
+}
+
+static void
+grn_expr_cache_expire_entry(grn_ctx *ctx, grn_expr_cache *cache,
+                            grn_expr_cache_entry *entry)
+{
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  grn_obj_unlink(ctx, entry->expr);
+  if (entry->match_columns) {
+    grn_obj_unlink(ctx, entry->match_columns);
+  }
+  grn_hash_delete_by_id(ctx, cache->hash, entry->id, NULL);
+}
+
+void
+grn_expr_cache_close(grn_ctx *ctx)
+{
+  grn_expr_cache *cache = ctx->impl->expr_cache;
+  grn_expr_cache_entry *entry0;
+
+  if (!cache) {
+    return;
+  }
+
+  entry0 = (grn_expr_cache_entry *)cache;
+  while (entry0 != entry0->prev) {
+    grn_expr_cache_expire_entry(ctx, cache, entry0->prev);
+  }
+  grn_hash_close(ctx, cache->hash);
+  GRN_FREE(cache);
+  ctx->impl->expr_cache = NULL;
+}
+
+grn_obj *
+grn_expr_cache_fetch(grn_ctx *ctx, const char *key, uint32_t key_size,
+                     grn_obj **match_columns)
+{
+  grn_expr_cache *cache = ctx->impl->expr_cache;
+  grn_expr_cache_entry *entry;
+
+  if (!cache || !ctx->impl->db) {
+    return NULL;
+  }
+  if (cache->db != ctx->impl->db) {
+    grn_expr_cache_close(ctx);
+    return NULL;
+  }
+  if (!grn_hash_get(ctx, cache->hash, key, key_size, (void **)&entry)) {
+    return NULL;
+  }
+  if (entry->schema_generation != grn_db_schema_generation(cache->db)) {
+    grn_expr_cache_expire_entry(ctx, cache, entry);
+    return NULL;
+  }
+
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  {
+    grn_expr_cache_entry *entry0 = (grn_expr_cache_entry *)cache;
+    entry->next = entry0->next;
+    entry->prev = entry0;
+    entry0->next->prev = entry;
+    entry0->next = entry;
+  }
+
+  *match_columns = entry->match_columns;
+  return entry->expr;
+}
+
+/*
+  Parsed expression owns columns that are referred by it. Persistent
+  columns may be removed while the expression is cached. Unlinking them
+  is no-op. So they are forgotten not to refer removed columns on
+  expiring.
+*/
+static void
+grn_expr_cache_forget_persistent_objs(grn_ctx *ctx, grn_obj *expr)
+{
+  grn_expr *e = (grn_expr *)expr;
+  grn_obj **objs = (grn_obj **)GRN_BULK_HEAD(&(e->objs));
+  size_t i, n_objs, n_kept_objs = 0;
+
+  n_objs = GRN_BULK_VSIZE(&(e->objs)) / sizeof(grn_obj *);
+  for (i = 0; i < n_objs; i++) {
+    grn_obj *obj = objs[i];
+    if (GRN_DB_OBJP(obj) &&
+        DB_OBJ(obj)->id != GRN_ID_NIL &&
+        !(DB_OBJ(obj)->id & GRN_OBJ_TMP_OBJECT)) {
+      continue;
+    }
+    objs[n_kept_objs++] = obj;
+  }
+  grn_bulk_truncate(ctx, &(e->objs), n_kept_objs * sizeof(grn_obj *));
+}
+
+/*
+  Returns GRN_TRUE when the cache takes "expr" and "match_columns". They
+  must not be unlinked by the caller in the case.
+*/
+grn_bool
+grn_expr_cache_update(grn_ctx *ctx, const char *key, uint32_t key_size,
+                      grn_obj *expr, grn_obj *match_columns)
+{
+  grn_expr_cache *cache = ctx->impl->expr_cache;
+  grn_expr_cache_entry *entry;
+  grn_id id;
+  int added = 0;
+
+  if (grn_expr_cache_max_n_entries == 0 || !ctx->impl->db) {
+    return GRN_FALSE;
+  }
+  if (!(DB_OBJ(expr)->id & GRN_OBJ_TMP_OBJECT)) {
+    return GRN_FALSE;
+  }
+  if (cache && cache->db != ctx->impl->db) {
+    grn_expr_cache_close(ctx);
+    cache = NULL;
+  }
+  if (!cache) {
+    if (!(cache = grn_expr_cache_open(ctx))) {
+      ERRCLR(ctx);
+      return GRN_FALSE;
+    }
+    ctx->impl->expr_cache = cache;
+  }
+
+  id = grn_hash_add(ctx, cache->hash, key, key_size, (void **)&entry, &added);
+  if (!id || !added) {
+    return GRN_FALSE;
+  }
+  grn_expr_cache_forget_persistent_objs(ctx, expr);
+  if (match_columns) {
+    grn_expr_cache_forget_persistent_objs(ctx, match_columns);
+  }
+  entry->expr = expr;
+  entry->match_columns = match_columns;
+  entry->schema_generation = grn_db_schema_generation(cache->db);
+  entry->id = id;
+  {
+    grn_expr_cache_entry *entry0 = (grn_expr_cache_entry *)cache;
+    entry->next = entry0->next;
+    entry->prev = entry0;
+    entry0->next->prev = entry;
+    entry0->next = entry;
+  }
+  if (GRN_HASH_SIZE(cache->hash) > grn_expr_cache_max_n_entries) {
+    grn_expr_cache_expire_entry(ctx, cache, cache->prev);
+  }
+  return GRN_TRUE;
+}
@@ -249,6 +249,7 @@ typedef pthread_cond_t grn_cond;
 # define COND_SIGNAL(c) pthread_cond_signal(&c)
 # define COND_WAIT(c,m) pthread_cond_wait(&c, &m)
 # define COND_BROADCAST(c) pthread_cond_broadcast(&c)
+# define COND_FIN(c)    pthread_cond_destroy(&c)
 # ifdef HAVE_PTHREAD_CONDATTR_SETPSHARED
 #  define COND_INIT_SHARED(c) do {\
   pthread_condattr_t condattr;\
@@ -392,11 +393,18 @@ typedef struct
   } \
 } while (0)
 
+#  define COND_FIN(c) do { \
+  CloseHandle((c).sema_); \
+  MUTEX_FIN((c).waiters_count_lock_); \
+  CloseHandle((c).waiters_done_); \
+} while (0)
+
 # else /* WIN32 */
 /* todo */
 typedef int grn_cond;
 #  define COND_INIT(c)   ((c) = 0)
 #  define COND_SIGNAL(c)
+#  define COND_FIN(c)
 #  define COND_WAIT(c,m) do { \
   MUTEX_UNLOCK(m); \
   grn_nanosleep(1000000); \
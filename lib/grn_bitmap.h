@@ -0,0 +1,82 @@
+/* -*- c-basic-offset: 2 -*- */
+/*
+  Copyright(C) 2015 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef GRN_BITMAP_H
+#define GRN_BITMAP_H
+
+#include "grn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  grn_bitmap is a compressed set of record IDs. IDs are partitioned by
+  the upper 16 bits. Each partition is stored as a sorted array of the
+  lower 16 bits while it is sparse and as a 65536 bits bitset when it
+  is dense.
+*/
+
+#define GRN_BITMAP_ARRAY_MAX_SIZE 4096
+#define GRN_BITMAP_N_WORDS        (0x10000 / 64)
+
+typedef struct {
+  uint16_t key;
+  grn_bool is_bitset;
+  uint32_t n_values;
+  uint32_t capacity;
+  union {
+    uint16_t *values;
+    uint64_t *words;
+  } data;
+} grn_bitmap_container;
+
+typedef struct _grn_bitmap grn_bitmap;
+struct _grn_bitmap {
+  grn_bitmap_container *containers;
+  uint32_t n_containers;
+  uint32_t capacity;
+};
+
+typedef struct {
+  grn_bitmap *bitmap;
+  uint32_t container;
+  uint32_t offset;
+  uint64_t word;
+} grn_bitmap_cursor;
+
+grn_bitmap *grn_bitmap_open(grn_ctx *ctx);
+void grn_bitmap_close(grn_ctx *ctx, grn_bitmap *bitmap);
+grn_rc grn_bitmap_add(grn_ctx *ctx, grn_bitmap *bitmap, grn_id id);
+grn_bool grn_bitmap_contain(grn_ctx *ctx, grn_bitmap *bitmap, grn_id id);
+uint32_t grn_bitmap_size(grn_ctx *ctx, grn_bitmap *bitmap);
+
+/* These operations update bitmap in place. */
+grn_rc grn_bitmap_and(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other);
+grn_rc grn_bitmap_or(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other);
+grn_rc grn_bitmap_and_not(grn_ctx *ctx, grn_bitmap *bitmap, grn_bitmap *other);
+
+void grn_bitmap_cursor_init(grn_ctx *ctx, grn_bitmap_cursor *cursor,
+                            grn_bitmap *bitmap);
+grn_id grn_bitmap_cursor_next(grn_ctx *ctx, grn_bitmap_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GRN_BITMAP_H */
@@ -160,12 +160,30 @@ struct _grn_ctx_impl {
   grn_obj names;
   grn_obj levels;
 
+  /* output flush portion */
+  struct {
+    size_t threshold_size;
+    grn_bool is_flushed;
+  } output_flush;
+
   /* command portion */
   grn_command_version command_version;
 
   /* match escalation portion */
   int64_t match_escalation_threshold;
 
+  /* top-k portion */
+  struct {
+    int limit;
+    int64_t n_hits;
+  } top_k;
+
+  /* result set portion */
+  grn_bool score_ignorable;
+
+  /* expression cache portion */
+  struct _grn_expr_cache *expr_cache;
+
   /* lifetime portion */
   grn_proc_func *finalizer;
 
@@ -49,6 +49,7 @@ struct _grn_db {
   grn_ja *specs;
   grn_tiny_array values;
   grn_critical_section lock;
+  uint32_t schema_generation;
 };
 
 typedef struct {
@@ -63,6 +64,7 @@ GRN_API grn_rc grn_db_close(grn_ctx *ctx, grn_obj *db);
 grn_obj *grn_db_keys(grn_obj *s);
 
 uint32_t grn_db_lastmod(grn_obj *s);
+uint32_t grn_db_schema_generation(grn_obj *s);
 
 grn_rc _grn_table_delete_by_id(grn_ctx *ctx, grn_obj *table, grn_id id,
                                grn_table_delete_optarg *optarg);
@@ -82,6 +84,7 @@ grn_rc grn_table_search(grn_ctx *ctx, grn_obj *table,
                         grn_operator mode, grn_obj *res, grn_operator op);
 
 grn_id grn_table_next(grn_ctx *ctx, grn_obj *table, grn_id id);
+grn_id grn_table_max_id(grn_ctx *ctx, grn_obj *table);
 
 int grn_table_get_key2(grn_ctx *ctx, grn_obj *table, grn_id id, grn_obj *bulk);
 
@@ -38,6 +38,18 @@ typedef enum {
   SCAN_CONST
 } scan_stat;
 
+void grn_expr_init_from_env(void);
+
+typedef struct _grn_expr_cache grn_expr_cache;
+
+void grn_expr_cache_close(grn_ctx *ctx);
+grn_obj *grn_expr_cache_fetch(grn_ctx *ctx, const char *key, uint32_t key_size,
+                              grn_obj **match_columns);
+grn_bool grn_expr_cache_update(grn_ctx *ctx, const char *key, uint32_t key_size,
+                               grn_obj *expr, grn_obj *match_columns);
+
+grn_rc grn_table_apply_scorer(grn_ctx *ctx, grn_obj *table, grn_obj *scorer);
+
 typedef struct _grn_scan_info scan_info;
 typedef grn_bool (*grn_scan_info_each_arg_callback)(grn_ctx *ctx, grn_obj *obj, void *user_data);
 
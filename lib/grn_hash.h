@@ -236,7 +236,8 @@ struct _grn_hash {
   uint32_t max_offset_;
   uint32_t n_garbages_;
   uint32_t n_entries_;
-  grn_id *index;
+  void *groups_buffer;
+  struct _grn_tiny_hash_group *groups;
   grn_id garbages;
   grn_tiny_array a;
   grn_tiny_bitmap bitmap;
@@ -257,7 +258,11 @@ struct _grn_hash {
   uint32_t n_garbages;\
   uint32_t lock;\
   grn_id normalizer;\
-  uint32_t reserved[15]
+  uint32_t rehash_idx_offset;\
+  uint32_t rehash_max_offset;\
+  uint32_t rehash_position;\
+  uint32_t rehash_n_segments_to_clear;\
+  uint32_t reserved[11]
 
 struct _grn_hash_header_common {
   GRN_HASH_HEADER_COMMON_FIELDS;
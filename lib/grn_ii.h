@@ -28,6 +28,8 @@
 extern "C" {
 #endif
 
+typedef struct _grn_ii_chunk_cache grn_ii_chunk_cache;
+
 struct _grn_ii {
   grn_db_obj obj;
   grn_io *seg;
@@ -37,6 +39,9 @@ struct _grn_ii {
   grn_encoding encoding;
   uint32_t n_elements;
   struct grn_ii_header *header;
+  grn_critical_section lock; /* serializes updates with background merges */
+  grn_critical_section chunk_cache_lock;
+  grn_ii_chunk_cache *chunk_cache;
 };
 
 #define GRN_II_BGQSIZE 16
@@ -47,6 +52,9 @@ struct _grn_ii {
 #define GRN_II_MAX_CHUNK          (1 << (GRN_II_W_TOTAL_CHUNK - GRN_II_W_CHUNK))
 #define GRN_II_N_CHUNK_VARIATION  (GRN_II_W_CHUNK - GRN_II_W_LEAST_CHUNK)
 
+/* 1: GRN_OBJ_COMPRESS_BP128 is supported. */
+#define GRN_II_VERSION            1
+
 struct grn_ii_header {
   uint64_t total_chunk_size;
   uint64_t bmax;
@@ -59,7 +67,9 @@ struct grn_ii_header {
   uint32_t bgqhead;
   uint32_t bgqtail;
   uint32_t bgqbody[GRN_II_BGQSIZE];
-  uint32_t reserved[288];
+  uint32_t version;
+  uint32_t chunk_generation; /* incremented whenever a chunk is freed */
+  uint32_t reserved[286];
   uint32_t ainfo[GRN_II_MAX_LSEG];
   uint32_t binfo[GRN_II_MAX_LSEG];
   uint32_t free_chunks[GRN_II_N_CHUNK_VARIATION + 1];
@@ -88,6 +98,11 @@ struct _grn_ii_updspec {
 typedef struct _grn_ii_updspec grn_ii_updspec;
 
 void grn_ii_init_from_env(void);
+void grn_ii_merger_init(void);
+void grn_ii_merger_fin(void);
+void grn_ii_chunk_cache_init(void);
+void grn_ii_chunk_cache_fin(void);
+void grn_ii_chunk_cache_get_statistics(uint64_t *n_hits, uint64_t *n_misses);
 
 GRN_API grn_ii *grn_ii_create(grn_ctx *ctx, const char *path, grn_obj *lexicon,
                               uint32_t flags);
@@ -174,6 +189,8 @@ grn_rc grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int str
 void grn_ii_resolve_sel_and(grn_ctx *ctx, grn_hash *s, grn_operator op);
 
 grn_rc grn_ii_at(grn_ctx *ctx, grn_ii *ii, grn_id id, grn_hash *s, grn_operator op);
+grn_rc grn_ii_at_terms(grn_ctx *ctx, grn_ii *ii, grn_hash *terms, grn_hash *s,
+                       grn_operator op);
 
 void grn_ii_inspect_values(grn_ctx *ctx, grn_ii *ii, grn_obj *buf);
 void grn_ii_cursor_inspect(grn_ctx *ctx, grn_ii_cursor *c, grn_obj *buf);
@@ -69,6 +69,7 @@ typedef struct {
   void *map;
   uint32_t nref;
   uint32_t count;
+  uint32_t accessed;
 #ifdef WIN32
   HANDLE fmo;
 #endif /* WIN32 */
@@ -107,6 +108,11 @@ struct _grn_io {
   uint32_t count;
   uint8_t flags;
   uint32_t *lock;
+  uint32_t nfaults;
+  uint32_t clock_hand;
+  uint32_t n_pins;
+  struct _grn_io *managed_next;
+  struct _grn_io *managed_prev;
 };
 
 GRN_API grn_io *grn_io_create(grn_ctx *ctx, const char *path,
@@ -233,6 +239,7 @@ void grn_io_seg_map_(grn_ctx *ctx, grn_io *io, uint32_t segno, grn_io_mapinfo *i
         break;\
       }\
       info->count = grn_gtick;\
+      info->accessed = 1;\
     }\
   } else {\
     for (retry = 0; !info->map; retry++) {\
@@ -353,6 +360,20 @@ uint32_t grn_io_get_type(grn_io *io);
 void grn_io_init_from_env(void);
 
 uint32_t grn_io_expire(grn_ctx *ctx, grn_io *io, int count_thresh, uint32_t limit);
+
+typedef struct {
+  uint64_t mapped_size;
+  uint64_t max_mapped_size;
+  uint64_t n_faults;
+  uint64_t n_evictions;
+} grn_io_segment_manager_statistics;
+
+void grn_io_segment_manager_init(void);
+void grn_io_segment_manager_fin(void);
+void grn_io_segment_manager_reclaim(grn_ctx *ctx);
+void grn_io_segment_manager_get_statistics(grn_io_segment_manager_statistics *statistics);
+void grn_io_pin(grn_io *io);
+void grn_io_unpin(grn_io *io);
 uint32_t grn_expire(grn_ctx *ctx, int count_thresh, uint32_t limit);
 
 /* encode/decode */
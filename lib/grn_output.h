@@ -63,6 +63,10 @@ grn_rc grn_output_format_set_columns(grn_ctx *ctx, grn_obj_format *format,
                                      grn_obj *table,
                                      const char *columns, int columns_len);
 
+void grn_output_init_from_env(void);
+void grn_output_flush_reset(grn_ctx *ctx);
+void grn_output_flush_if_needed(grn_ctx *ctx, grn_obj *outbuf);
+
 #define GRN_OUTPUT_ARRAY_OPEN(name,nelements) \
   (grn_ctx_output_array_open(ctx, name, nelements))
 #define GRN_OUTPUT_ARRAY_CLOSE() \
@@ -64,6 +64,12 @@ void grn_rset_recinfo_update_calc_values(grn_ctx *ctx,
                                          grn_obj *table,
                                          grn_obj *value);
 
+/* It must be called before n_subrecs of ri is updated. */
+void grn_rset_recinfo_merge_calc_values(grn_ctx *ctx,
+                                        grn_rset_recinfo *ri,
+                                        grn_obj *table,
+                                        grn_rset_recinfo *other_ri);
+
 int64_t *grn_rset_recinfo_get_max_(grn_ctx *ctx,
                                    grn_rset_recinfo *ri,
                                    grn_obj *table);
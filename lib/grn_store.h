@@ -72,11 +72,13 @@ void *grn_ra_ref_cache(grn_ctx *ctx, grn_ra *ra, grn_id id, grn_ra_cache *cache)
 /**** variable sized elements ****/
 
 typedef struct _grn_ja grn_ja;
+typedef struct _grn_ja_zstd_dictionaries grn_ja_zstd_dictionaries;
 
 struct _grn_ja {
   grn_db_obj obj;
   grn_io *io;
   struct grn_ja_header *header;
+  grn_ja_zstd_dictionaries *zstd_dictionaries;
 };
 
 GRN_API grn_ja *grn_ja_create(grn_ctx *ctx, const char *path,
@@ -102,6 +104,22 @@ GRN_API uint32_t grn_ja_size(grn_ctx *ctx, grn_ja *ja, grn_id id);
 
 void grn_ja_check(grn_ctx *ctx, grn_ja *ja);
 
+grn_rc grn_ja_train_dictionary(grn_ctx *ctx, grn_ja *ja,
+                               uint32_t max_n_samples);
+
+typedef struct {
+  uint32_t n_entries;
+  uint64_t size;
+  uint64_t max_size;
+  uint64_t n_hits;
+  uint64_t n_misses;
+} grn_ja_value_cache_statistics;
+
+void grn_ja_init_from_env(void);
+void grn_ja_value_cache_init(void);
+void grn_ja_value_cache_fin(void);
+void grn_ja_value_cache_get_statistics(grn_ja_value_cache_statistics *statistics);
+
 /*
 
 typedef struct _grn_vgram_vnode
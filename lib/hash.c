@@ -19,6 +19,9 @@
 #include "grn_output.h"
 #include <string.h>
 #include <limits.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif /* __SSE2__ */
 
 #include "grn_store.h"
 #include "grn_normalizer.h"
@@ -1298,17 +1301,6 @@ grn_io_hash_idx_at(grn_ctx *ctx, grn_hash *hash, grn_id id)
                                 id, GRN_TABLE_ADD);
 }
 
-inline static grn_id *
-grn_hash_idx_at(grn_ctx *ctx, grn_hash *hash, grn_id id)
-{
-  if (grn_hash_is_io_hash(hash)) {
-    id = (id & *hash->max_offset) + hash->header.common->idx_offset;
-    return grn_io_hash_idx_at(ctx, hash, id);
-  } else {
-    return hash->index + (id & *hash->max_offset);
-  }
-}
-
 inline static void *
 grn_io_hash_key_at(grn_ctx *ctx, grn_hash *hash, uint32_t pos)
 {
@@ -1568,6 +1560,62 @@ grn_io_hash_create_io(grn_ctx *ctx, const char *path,
                                   grn_io_auto, 4, array_spec);
 }
 
+/*
+  Persistent hashes are resized incrementally so that grn_hash_add()
+  doesn't stall while a large index is rebuilt.
+  grn_io_hash_rehash_start() reserves a new index in the other half of
+  the index segments. Then grn_io_hash_rehash_step() clears one
+  segment of the new index on each grn_hash_add() until
+  header->rehash_n_segments_to_clear is 0. The current index is used
+  as is while the new index is cleared. After that,
+  grn_io_hash_rehash_step() copies GRN_IO_HASH_REHASH_N_SLOTS_PER_STEP
+  slots of the current index to the new index on each grn_hash_add().
+  While the new index is ready, new keys are added only to the new
+  index, lookups consult the new index and then the current index, and
+  deleted keys are marked as GARBAGE in both of them. Clearing a
+  segment and copying a slot are idempotent and the progress is kept
+  in the header, so the rehash is resumed after a crash.
+*/
+#define GRN_IO_HASH_REHASH_N_SLOTS_PER_STEP 64
+
+inline static grn_bool
+grn_io_hash_is_rehashing(grn_hash *hash)
+{
+  return hash->header.common->rehash_max_offset != 0;
+}
+
+/* Returns GRN_TRUE when the new index is cleared and used. */
+inline static grn_bool
+grn_io_hash_is_rehash_index_ready(grn_hash *hash)
+{
+  return grn_io_hash_is_rehashing(hash) &&
+    hash->header.common->rehash_n_segments_to_clear == 0;
+}
+
+static void
+grn_io_hash_rehash_finish(grn_ctx *ctx, grn_hash *hash)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  /* The order is important to recover in grn_io_hash_rehash_recover(). */
+  header->idx_offset = header->rehash_idx_offset;
+  header->max_offset = header->rehash_max_offset;
+  header->rehash_max_offset = 0;
+  header->rehash_position = 0;
+}
+
+/* Finishes the migration interrupted after idx_offset is switched. */
+static void
+grn_io_hash_rehash_recover(grn_ctx *ctx, grn_hash *hash)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  if (header->rehash_max_offset != 0 &&
+      header->idx_offset == header->rehash_idx_offset) {
+    GRN_LOG(ctx, GRN_LOG_NOTICE,
+            "[hash][rehash][recover] finish interrupted rehash");
+    grn_io_hash_rehash_finish(ctx, hash);
+  }
+}
+
 static grn_rc
 grn_io_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
                  uint32_t key_size, uint32_t value_size, uint32_t flags,
@@ -1610,6 +1658,10 @@ grn_io_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   header->curr_key = 0;
   header->lock = 0;
   header->idx_offset = 0;
+  header->rehash_idx_offset = 0;
+  header->rehash_max_offset = 0;
+  header->rehash_position = 0;
+  header->rehash_n_segments_to_clear = 0;
   header->value_size = value_size;
   header->entry_size = entry_size;
   header->max_offset = max_offset;
@@ -1652,6 +1704,65 @@ grn_io_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
 
 #define INITIAL_INDEX_SIZE 256U
 
+/*
+  Tiny hashes, which are used for temporary tables and result sets,
+  don't use double hashing. Their index is an array of cache line sized
+  groups. A group has GRN_TINY_HASH_GROUP_SIZE slots and a control byte
+  for each slot: GRN_TINY_HASH_CTRL_EMPTY, GRN_TINY_HASH_CTRL_DELETED or
+  7 bits fingerprint of the hash value. All control bytes in a group
+  are compared at once, so an entry is read only when its fingerprint
+  matches. Only control bytes tell whether a slot is used. A slot is
+  identified by (group << 4) | position.
+*/
+#define GRN_TINY_HASH_GROUP_SIZE     12
+#define GRN_TINY_HASH_GROUP_MASK     ((1U << GRN_TINY_HASH_GROUP_SIZE) - 1)
+#define GRN_TINY_HASH_CTRL_EMPTY     0x80
+#define GRN_TINY_HASH_CTRL_DELETED   0xfe
+#define GRN_TINY_HASH_CTRL_SENTINEL  0xff
+#define GRN_TINY_HASH_INITIAL_N_GROUPS (INITIAL_INDEX_SIZE / 16)
+
+typedef struct _grn_tiny_hash_group grn_tiny_hash_group;
+struct _grn_tiny_hash_group {
+  uint8_t ctrl[16];
+  grn_id ids[GRN_TINY_HASH_GROUP_SIZE];
+};
+
+#define GRN_TINY_HASH_SLOT_CTRL(hash, slot)\
+  ((hash)->groups[(slot) >> 4].ctrl[(slot) & 0xf])
+#define GRN_TINY_HASH_SLOT_ID(hash, slot)\
+  ((hash)->groups[(slot) >> 4].ids[(slot) & 0xf])
+
+inline static uint32_t
+grn_tiny_hash_n_groups(grn_hash *hash)
+{
+  return (*hash->max_offset + 1) / GRN_TINY_HASH_GROUP_SIZE;
+}
+
+static grn_rc
+grn_tiny_hash_alloc_groups(grn_ctx *ctx, grn_hash *hash, uint32_t n_groups)
+{
+  void *buffer;
+  grn_tiny_hash_group *groups;
+  uint32_t i;
+
+  buffer = GRN_CTX_ALLOC(ctx, (n_groups + 1) * sizeof(grn_tiny_hash_group));
+  if (!buffer) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  groups = (grn_tiny_hash_group *)
+    (((uintptr_t)buffer + sizeof(grn_tiny_hash_group) - 1) &
+     ~((uintptr_t)sizeof(grn_tiny_hash_group) - 1));
+  for (i = 0; i < n_groups; i++) {
+    memset(groups[i].ctrl, GRN_TINY_HASH_CTRL_EMPTY, GRN_TINY_HASH_GROUP_SIZE);
+    memset(groups[i].ctrl + GRN_TINY_HASH_GROUP_SIZE,
+           GRN_TINY_HASH_CTRL_SENTINEL, 16 - GRN_TINY_HASH_GROUP_SIZE);
+  }
+  hash->groups_buffer = buffer;
+  hash->groups = groups;
+  *hash->max_offset = n_groups * GRN_TINY_HASH_GROUP_SIZE - 1;
+  return GRN_SUCCESS;
+}
+
 static uint32_t
 grn_tiny_hash_calculate_entry_size(uint32_t key_size, uint32_t value_size,
                                    uint32_t flags)
@@ -1684,8 +1795,9 @@ grn_tiny_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   if (path) {
     return GRN_INVALID_ARGUMENT;
   }
-  hash->index = GRN_CTX_ALLOC(ctx, INITIAL_INDEX_SIZE * sizeof(grn_id));
-  if (!hash->index) {
+  hash->max_offset = &hash->max_offset_;
+  if (grn_tiny_hash_alloc_groups(ctx, hash, GRN_TINY_HASH_INITIAL_N_GROUPS)) {
+    hash->groups_buffer = NULL;
     return GRN_NO_MEMORY_AVAILABLE;
   }
 
@@ -1698,8 +1810,6 @@ grn_tiny_hash_init(grn_ctx *ctx, grn_hash *hash, const char *path,
   hash->entry_size = entry_size;
   hash->n_garbages = &hash->n_garbages_;
   hash->n_entries = &hash->n_entries_;
-  hash->max_offset = &hash->max_offset_;
-  hash->max_offset_ = INITIAL_INDEX_SIZE - 1;
   hash->io = NULL;
   hash->n_garbages_ = 0;
   hash->n_entries_ = 0;
@@ -1771,6 +1881,7 @@ grn_hash_open(grn_ctx *ctx, const char *path)
             hash->io = io;
             hash->header.common = header;
             hash->lock = &header->lock;
+            grn_io_hash_rehash_recover(ctx, hash);
             hash->tokenizer = grn_ctx_at(ctx, header->tokenizer);
             if (header->flags & GRN_OBJ_KEY_NORMALIZE) {
               header->flags &= ~GRN_OBJ_KEY_NORMALIZE;
@@ -1800,7 +1911,7 @@ grn_hash_open(grn_ctx *ctx, const char *path)
 static grn_rc
 grn_tiny_hash_fin(grn_ctx *ctx, grn_hash *hash)
 {
-  if (!hash->index) {
+  if (!hash->groups_buffer) {
     return GRN_INVALID_ARGUMENT;
   }
 
@@ -1808,10 +1919,15 @@ grn_tiny_hash_fin(grn_ctx *ctx, grn_hash *hash)
 
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
     uint32_t num_remaining_entries = *hash->n_entries;
-    grn_id *hash_ptr;
-    for (hash_ptr = hash->index; num_remaining_entries; hash_ptr++) {
-      const grn_id id = *hash_ptr;
-      if (id && id != GARBAGE) {
+    uint32_t slot;
+    for (slot = 0; num_remaining_entries; slot++) {
+      grn_id id;
+      if ((slot & 0xf) == GRN_TINY_HASH_GROUP_SIZE) {
+        slot += 16 - GRN_TINY_HASH_GROUP_SIZE - 1;
+        continue;
+      }
+      id = GRN_TINY_HASH_SLOT_ID(hash, slot);
+      if (GRN_TINY_HASH_SLOT_CTRL(hash, slot) < GRN_TINY_HASH_CTRL_EMPTY) {
         grn_tiny_hash_entry * const entry =
             (grn_tiny_hash_entry *)grn_tiny_array_get(&hash->a, id);
         GRN_ASSERT(entry);
@@ -1824,7 +1940,7 @@ grn_tiny_hash_fin(grn_ctx *ctx, grn_hash *hash)
   }
   grn_tiny_array_fin(&hash->a);
   grn_tiny_bitmap_fin(&hash->bitmap);
-  GRN_CTX_FREE(ctx, hash->index);
+  GRN_CTX_FREE(ctx, hash->groups_buffer);
   return GRN_SUCCESS;
 }
 
@@ -1911,15 +2027,482 @@ grn_hash_calculate_step(uint32_t hash_value)
   return (hash_value >> 2) | 0x1010101;
 }
 
+#ifdef __GNUC__
+# define GRN_TINY_HASH_CTZ(mask) ((uint32_t)__builtin_ctz(mask))
+#else /* __GNUC__ */
+inline static uint32_t
+GRN_TINY_HASH_CTZ(uint32_t mask)
+{
+  uint32_t n = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    n++;
+  }
+  return n;
+}
+#endif /* __GNUC__ */
+
+inline static uint32_t
+grn_tiny_hash_mix(uint32_t hash_value)
+{
+  /* Keys of result sets are record IDs and their hash values are IDs. */
+  return hash_value * 0x9e3779b1U;
+}
+
+inline static uint8_t
+grn_tiny_hash_fingerprint(uint32_t mixed_hash_value)
+{
+  return (uint8_t)(mixed_hash_value >> 25);
+}
+
+inline static uint32_t
+grn_tiny_hash_group_match(const uint8_t *group, uint8_t ctrl)
+{
+#ifdef __SSE2__
+  const __m128i ctrls = _mm_load_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrls,
+                                                    _mm_set1_epi8((char)ctrl)));
+#else /* __SSE2__ */
+  uint32_t i, mask = 0;
+  for (i = 0; i < GRN_TINY_HASH_GROUP_SIZE; i++) {
+    if (group[i] == ctrl) {
+      mask |= 1U << i;
+    }
+  }
+  return mask;
+#endif /* __SSE2__ */
+}
+
+/* Matches GRN_TINY_HASH_CTRL_EMPTY and GRN_TINY_HASH_CTRL_DELETED. */
+inline static uint32_t
+grn_tiny_hash_group_match_free(const uint8_t *group)
+{
+#ifdef __SSE2__
+  const __m128i ctrls = _mm_load_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(ctrls) & GRN_TINY_HASH_GROUP_MASK;
+#else /* __SSE2__ */
+  uint32_t i, mask = 0;
+  for (i = 0; i < GRN_TINY_HASH_GROUP_SIZE; i++) {
+    if (group[i] & 0x80) {
+      mask |= 1U << i;
+    }
+  }
+  return mask;
+#endif /* __SSE2__ */
+}
+
+/*
+  Groups are probed by triangular numbers. It visits all groups because
+  the number of groups is a power of 2.
+*/
+#define GRN_TINY_HASH_EACH_GROUP(hash, mixed_hash_value, group_id, block) do {\
+  const uint32_t group_mask_ = grn_tiny_hash_n_groups(hash) - 1;\
+  uint32_t group_id = (mixed_hash_value) & group_mask_;\
+  uint32_t n_probes_;\
+  for (n_probes_ = 1; n_probes_ <= group_mask_ + 1; n_probes_++) {\
+    block\
+    group_id = (group_id + n_probes_) & group_mask_;\
+  }\
+} while (0)
+
+/*
+  Returns the ID of the entry for key or GRN_ID_NIL. If slot isn't NULL,
+  it's set to the slot of the found entry or the first free slot where
+  key should be put.
+*/
+inline static grn_id
+grn_tiny_hash_find(grn_ctx *ctx, grn_hash *hash, uint32_t hash_value,
+                   const void *key, unsigned int key_size, uint32_t *slot)
+{
+  const uint32_t mixed_hash_value = grn_tiny_hash_mix(hash_value);
+  const uint8_t fingerprint = grn_tiny_hash_fingerprint(mixed_hash_value);
+  grn_bool free_slot_found = GRN_FALSE;
+
+  GRN_TINY_HASH_EACH_GROUP(hash, mixed_hash_value, group_id, {
+    grn_tiny_hash_group * const group = hash->groups + group_id;
+    uint32_t mask;
+
+    mask = grn_tiny_hash_group_match(group->ctrl, fingerprint);
+    while (mask) {
+      const uint32_t position = GRN_TINY_HASH_CTZ(mask);
+      const grn_id id = group->ids[position];
+      grn_hash_entry *entry;
+      mask &= mask - 1;
+      entry = grn_hash_entry_at(ctx, hash, id, 0);
+      if (entry &&
+          grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
+                                     key, key_size)) {
+        if (slot) {
+          *slot = (group_id << 4) | position;
+        }
+        return id;
+      }
+    }
+
+    mask = grn_tiny_hash_group_match_free(group->ctrl);
+    if (mask) {
+      if (slot && !free_slot_found) {
+        *slot = (group_id << 4) | GRN_TINY_HASH_CTZ(mask);
+        free_slot_found = GRN_TRUE;
+      }
+      if (grn_tiny_hash_group_match(group->ctrl, GRN_TINY_HASH_CTRL_EMPTY)) {
+        break;
+      }
+    }
+  });
+
+  return GRN_ID_NIL;
+}
+
+inline static grn_bool
+grn_tiny_hash_find_slot_by_id(grn_ctx *ctx, grn_hash *hash,
+                              uint32_t hash_value, grn_id id, uint32_t *slot)
+{
+  const uint32_t mixed_hash_value = grn_tiny_hash_mix(hash_value);
+  const uint8_t fingerprint = grn_tiny_hash_fingerprint(mixed_hash_value);
+
+  GRN_TINY_HASH_EACH_GROUP(hash, mixed_hash_value, group_id, {
+    grn_tiny_hash_group * const group = hash->groups + group_id;
+    uint32_t mask;
+
+    mask = grn_tiny_hash_group_match(group->ctrl, fingerprint);
+    while (mask) {
+      const uint32_t position = GRN_TINY_HASH_CTZ(mask);
+      mask &= mask - 1;
+      if (group->ids[position] == id) {
+        *slot = (group_id << 4) | position;
+        return GRN_TRUE;
+      }
+    }
+    if (grn_tiny_hash_group_match(group->ctrl, GRN_TINY_HASH_CTRL_EMPTY)) {
+      break;
+    }
+  });
+
+  return GRN_FALSE;
+}
+
+inline static void
+grn_tiny_hash_put_slot(grn_hash *hash, uint32_t slot,
+                       uint32_t hash_value, grn_id id)
+{
+  if (GRN_TINY_HASH_SLOT_CTRL(hash, slot) == GRN_TINY_HASH_CTRL_DELETED) {
+    (*hash->n_garbages)--;
+  }
+  GRN_TINY_HASH_SLOT_CTRL(hash, slot) =
+    grn_tiny_hash_fingerprint(grn_tiny_hash_mix(hash_value));
+  GRN_TINY_HASH_SLOT_ID(hash, slot) = id;
+}
+
+static grn_rc
+grn_tiny_hash_reset(grn_ctx *ctx, grn_hash *hash, uint32_t expected_n_entries)
+{
+  void * const old_groups_buffer = hash->groups_buffer;
+  grn_tiny_hash_group * const old_groups = hash->groups;
+  const uint32_t old_n_groups = grn_tiny_hash_n_groups(hash);
+  uint32_t n_groups = GRN_TINY_HASH_INITIAL_N_GROUPS;
+  uint32_t i;
+
+  GRN_ASSERT(ctx == hash->ctx);
+  while (n_groups * GRN_TINY_HASH_GROUP_SIZE <= expected_n_entries) {
+    n_groups *= 2;
+  }
+  if (grn_tiny_hash_alloc_groups(ctx, hash, n_groups)) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  *hash->n_garbages = 0;
+
+  for (i = 0; i < old_n_groups; i++) {
+    uint32_t position;
+    for (position = 0; position < GRN_TINY_HASH_GROUP_SIZE; position++) {
+      const grn_id id = old_groups[i].ids[position];
+      grn_hash_entry *entry;
+      uint32_t mixed_hash_value;
+      if (old_groups[i].ctrl[position] & GRN_TINY_HASH_CTRL_EMPTY) {
+        continue;
+      }
+      entry = grn_hash_entry_at(ctx, hash, id, 0);
+      mixed_hash_value = grn_tiny_hash_mix(entry->hash_value);
+      GRN_TINY_HASH_EACH_GROUP(hash, mixed_hash_value, group_id, {
+        const uint32_t mask =
+          grn_tiny_hash_group_match_free(hash->groups[group_id].ctrl);
+        if (mask) {
+          grn_tiny_hash_put_slot(hash,
+                                 (group_id << 4) | GRN_TINY_HASH_CTZ(mask),
+                                 entry->hash_value, id);
+          break;
+        }
+      });
+    }
+  }
+
+  GRN_CTX_FREE(ctx, old_groups_buffer);
+  return GRN_SUCCESS;
+}
+
+/*
+  Returns the slot that has the entry for key or the empty slot that
+  ends the probe sequence in the index at idx_offset. *garbage_slot is
+  set to the first GARBAGE slot on the sequence. Returns NULL on error.
+*/
+inline static grn_id *
+grn_io_hash_find_slot(grn_ctx *ctx, grn_hash *hash,
+                      uint32_t idx_offset, uint32_t max_offset,
+                      uint32_t hash_value,
+                      const void *key, unsigned int key_size,
+                      grn_id **garbage_slot)
+{
+  uint32_t i;
+  const uint32_t step = grn_hash_calculate_step(hash_value);
+  for (i = hash_value; ; i += step) {
+    grn_id id;
+    grn_hash_entry *entry;
+    grn_id * const slot =
+      grn_io_hash_idx_at(ctx, hash, (i & max_offset) + idx_offset);
+    if (!slot) {
+      return NULL;
+    }
+    id = *slot;
+    if (!id) {
+      return slot;
+    }
+    if (id == GARBAGE) {
+      if (garbage_slot && !*garbage_slot) {
+        *garbage_slot = slot;
+      }
+      continue;
+    }
+    entry = grn_io_hash_entry_at(ctx, hash, id, 0);
+    if (!entry) {
+      return NULL;
+    }
+    if (grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
+                                   key, key_size)) {
+      return slot;
+    }
+  }
+}
+
+/*
+  Returns the slot that has id or the empty slot that ends the probe
+  sequence in the index at idx_offset. Returns NULL on error.
+*/
+inline static grn_id *
+grn_io_hash_find_slot_by_id(grn_ctx *ctx, grn_hash *hash,
+                            uint32_t idx_offset, uint32_t max_offset,
+                            uint32_t hash_value, grn_id id)
+{
+  uint32_t i;
+  const uint32_t step = grn_hash_calculate_step(hash_value);
+  for (i = hash_value; ; i += step) {
+    grn_id * const slot =
+      grn_io_hash_idx_at(ctx, hash, (i & max_offset) + idx_offset);
+    if (!slot) {
+      return NULL;
+    }
+    if (!*slot || *slot == id) {
+      return slot;
+    }
+  }
+}
+
+/*
+  Returns the slot that has the entry for key or NULL. If insert_slot
+  isn't NULL, it's set to the slot where key should be added or NULL on
+  error.
+*/
+inline static grn_id *
+grn_io_hash_find(grn_ctx *ctx, grn_hash *hash, uint32_t hash_value,
+                 const void *key, unsigned int key_size,
+                 grn_id **insert_slot)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  grn_id *slot;
+  grn_id *garbage_slot = NULL;
+
+  if (insert_slot) {
+    *insert_slot = NULL;
+  }
+  if (grn_io_hash_is_rehash_index_ready(hash)) {
+    slot = grn_io_hash_find_slot(ctx, hash,
+                                 header->rehash_idx_offset,
+                                 header->rehash_max_offset,
+                                 hash_value, key, key_size, &garbage_slot);
+    if (!slot) {
+      return NULL;
+    }
+    if (*slot) {
+      return slot;
+    }
+    if (insert_slot) {
+      *insert_slot = garbage_slot ? garbage_slot : slot;
+    }
+    slot = grn_io_hash_find_slot(ctx, hash,
+                                 header->idx_offset, header->max_offset,
+                                 hash_value, key, key_size, NULL);
+    if (!slot) {
+      if (insert_slot) {
+        *insert_slot = NULL;
+      }
+      return NULL;
+    }
+    return *slot ? slot : NULL;
+  }
+
+  slot = grn_io_hash_find_slot(ctx, hash,
+                               header->idx_offset, header->max_offset,
+                               hash_value, key, key_size, &garbage_slot);
+  if (!slot) {
+    return NULL;
+  }
+  if (*slot) {
+    return slot;
+  }
+  if (insert_slot) {
+    *insert_slot = garbage_slot ? garbage_slot : slot;
+  }
+  return NULL;
+}
+
+/*
+  Marks the slots of id as GARBAGE. Returns GRN_FALSE when id isn't in
+  the index.
+*/
+static grn_bool
+grn_io_hash_remove_from_index(grn_ctx *ctx, grn_hash *hash,
+                              uint32_t hash_value, grn_id id)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  grn_bool found = GRN_FALSE;
+  grn_id *slot;
+
+  if (grn_io_hash_is_rehash_index_ready(hash)) {
+    slot = grn_io_hash_find_slot_by_id(ctx, hash,
+                                       header->rehash_idx_offset,
+                                       header->rehash_max_offset,
+                                       hash_value, id);
+    if (slot && *slot) {
+      *slot = GARBAGE;
+      found = GRN_TRUE;
+    }
+  }
+  slot = grn_io_hash_find_slot_by_id(ctx, hash,
+                                     header->idx_offset, header->max_offset,
+                                     hash_value, id);
+  if (slot && *slot) {
+    *slot = GARBAGE;
+    found = GRN_TRUE;
+  }
+  return found;
+}
+
+static grn_rc
+grn_io_hash_rehash_start(grn_ctx *ctx, grn_hash *hash, uint32_t index_size)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  const uint32_t n_slots_per_segment = IDX_MASK_IN_A_SEGMENT + 1;
+
+  header->rehash_position = 0;
+  header->rehash_idx_offset = MAX_INDEX_SIZE - header->idx_offset;
+  header->rehash_n_segments_to_clear =
+    (index_size + n_slots_per_segment - 1) / n_slots_per_segment;
+  header->rehash_max_offset = index_size - 1;
+  *hash->n_garbages = 0;
+  return GRN_SUCCESS;
+}
+
+/* Clears n_segments segments of the new index. */
+static grn_rc
+grn_io_hash_rehash_clear(grn_ctx *ctx, grn_hash *hash, uint32_t n_segments)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  const uint32_t n_slots_per_segment = IDX_MASK_IN_A_SEGMENT + 1;
+  const uint32_t n_all_segments =
+    (header->rehash_max_offset + n_slots_per_segment) / n_slots_per_segment;
+
+  for (; n_segments > 0 && header->rehash_n_segments_to_clear > 0;
+       n_segments--) {
+    uint32_t i = n_all_segments - header->rehash_n_segments_to_clear;
+    /*
+     * The following grn_io_hash_idx_at() allocates memory for a new segment
+     * and returns a pointer to the new segment. It's actually bad manners
+     * but faster than calling grn_io_hash_idx_at() for each element.
+     */
+    grn_id * const dest_ptr =
+      grn_io_hash_idx_at(ctx, hash,
+                         i * n_slots_per_segment + header->rehash_idx_offset);
+    if (!dest_ptr) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    memset(dest_ptr, 0, GRN_HASH_SEGMENT_SIZE);
+    header->rehash_n_segments_to_clear--;
+  }
+  return GRN_SUCCESS;
+}
+
+/*
+  Clears a segment of the new index if it isn't ready. Otherwise,
+  copies n_slots slots of the current index to the new index.
+  UINT32_MAX as n_slots finishes the rehash.
+*/
+static grn_rc
+grn_io_hash_rehash_step(grn_ctx *ctx, grn_hash *hash, uint32_t n_slots)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  const uint32_t max_offset = header->max_offset;
+  uint32_t position = header->rehash_position;
+  grn_id *src_ptr = NULL;
+
+  if (!grn_io_hash_is_rehash_index_ready(hash)) {
+    grn_rc rc;
+    rc = grn_io_hash_rehash_clear(ctx, hash,
+                                  n_slots == UINT32_MAX ? UINT32_MAX : 1);
+    if (rc != GRN_SUCCESS || n_slots != UINT32_MAX) {
+      return rc;
+    }
+  }
+
+  for (; n_slots > 0 && position <= max_offset;
+       n_slots--, position++, src_ptr++) {
+    grn_id entry_id;
+    grn_hash_entry *entry;
+    grn_id *dest_ptr;
+    if (!src_ptr || !(position & IDX_MASK_IN_A_SEGMENT)) {
+      src_ptr = grn_io_hash_idx_at(ctx, hash, position + header->idx_offset);
+      if (!src_ptr) {
+        return GRN_NO_MEMORY_AVAILABLE;
+      }
+    }
+    entry_id = *src_ptr;
+    if (!entry_id || (entry_id == GARBAGE)) {
+      continue;
+    }
+    entry = grn_hash_entry_at(ctx, hash, entry_id, GRN_TABLE_ADD);
+    if (!entry) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    dest_ptr = grn_io_hash_find_slot_by_id(ctx, hash,
+                                           header->rehash_idx_offset,
+                                           header->rehash_max_offset,
+                                           entry->hash_value, entry_id);
+    if (!dest_ptr) {
+      return GRN_NO_MEMORY_AVAILABLE;
+    }
+    *dest_ptr = entry_id;
+  }
+  header->rehash_position = position;
+
+  if (position > max_offset) {
+    grn_io_hash_rehash_finish(ctx, hash);
+  }
+  return GRN_SUCCESS;
+}
+
 static grn_rc
 grn_hash_reset(grn_ctx *ctx, grn_hash *hash, uint32_t expected_n_entries)
 {
-  grn_id *new_index = NULL;
   uint32_t new_index_size = INITIAL_INDEX_SIZE;
-  grn_id *src_ptr = NULL, *dest_ptr = NULL;
-  uint32_t src_offset = 0, dest_offset = 0;
   const uint32_t n_entries = *hash->n_entries;
-  const uint32_t max_offset = *hash->max_offset;
 
   if (!expected_n_entries) {
     expected_n_entries = n_entries * 2;
@@ -1927,87 +2510,51 @@ grn_hash_reset(grn_ctx *ctx, grn_hash *hash, uint32_t expected_n_entries)
   if (expected_n_entries > INT_MAX) {
     return GRN_NO_MEMORY_AVAILABLE;
   }
+  if (!grn_hash_is_io_hash(hash)) {
+    return grn_tiny_hash_reset(ctx, hash, expected_n_entries);
+  }
   while (new_index_size <= expected_n_entries) {
     new_index_size *= 2;
   }
 
-  if (grn_hash_is_io_hash(hash)) {
-    uint32_t i;
-    src_offset = hash->header.common->idx_offset;
-    dest_offset = MAX_INDEX_SIZE - src_offset;
-    for (i = 0; i < new_index_size; i += (IDX_MASK_IN_A_SEGMENT + 1)) {
-      /*
-       * The following grn_io_hash_idx_at() allocates memory for a new segment
-       * and returns a pointer to the new segment. It's actually bad manners
-       * but faster than calling grn_io_hash_idx_at() for each element.
-       */
-      dest_ptr = grn_io_hash_idx_at(ctx, hash, i + dest_offset);
-      if (!dest_ptr) {
-        return GRN_NO_MEMORY_AVAILABLE;
-      }
-      memset(dest_ptr, 0, GRN_HASH_SEGMENT_SIZE);
-    }
-  } else {
-    GRN_ASSERT(ctx == hash->ctx);
-    new_index = GRN_CTX_ALLOC(ctx, new_index_size * sizeof(grn_id));
-    if (!new_index) {
-      return GRN_NO_MEMORY_AVAILABLE;
+  if (grn_io_hash_is_rehashing(hash)) {
+    grn_rc rc = grn_io_hash_rehash_step(ctx, hash, UINT32_MAX);
+    if (rc != GRN_SUCCESS) {
+      return rc;
     }
-    src_ptr = hash->index;
   }
+  return grn_io_hash_rehash_start(ctx, hash, new_index_size);
+}
 
-  {
-    uint32_t src_pos, count;
-    const uint32_t new_max_offset = new_index_size - 1;
-    for (count = 0, src_pos = 0; count < n_entries && src_pos <= max_offset;
-         src_pos++, src_ptr++) {
-      uint32_t i, step;
-      grn_id entry_id;
-      grn_hash_entry *entry;
-      if (grn_hash_is_io_hash(hash) && !(src_pos & IDX_MASK_IN_A_SEGMENT)) {
-        src_ptr = grn_io_hash_idx_at(ctx, hash, src_pos + src_offset);
-        if (!src_ptr) {
-          return GRN_NO_MEMORY_AVAILABLE;
-        }
-      }
-      entry_id = *src_ptr;
-      if (!entry_id || (entry_id == GARBAGE)) {
-        continue;
-      }
-      entry = grn_hash_entry_at(ctx, hash, entry_id, GRN_TABLE_ADD);
-      if (!entry) {
-        return GRN_NO_MEMORY_AVAILABLE;
-      }
-      step = grn_hash_calculate_step(entry->hash_value);
-      for (i = entry->hash_value; ; i += step) {
-        i &= new_max_offset;
-        if (grn_hash_is_io_hash(hash)) {
-          dest_ptr = grn_io_hash_idx_at(ctx, hash, i + dest_offset);
-          if (!dest_ptr) {
-            return GRN_NO_MEMORY_AVAILABLE;
-          }
-        } else {
-          dest_ptr = new_index + i;
-        }
-        if (!*dest_ptr) {
-          break;
-        }
-      }
-      *dest_ptr = entry_id;
-      count++;
+/*
+  Moves the rehash forward and starts a new rehash when the index that
+  accepts new keys is full.
+*/
+inline static grn_rc
+grn_io_hash_prepare_add(grn_ctx *ctx, grn_hash *hash)
+{
+  grn_hash_header_common * const header = hash->header.common;
+  const uint32_t n_used_slots = *hash->n_entries + *hash->n_garbages;
+
+  if (grn_io_hash_is_rehashing(hash)) {
+    grn_rc rc;
+    rc = grn_io_hash_rehash_step(ctx, hash,
+                                 GRN_IO_HASH_REHASH_N_SLOTS_PER_STEP);
+    if (rc != GRN_SUCCESS) {
+      return rc;
     }
-    *hash->max_offset = new_max_offset;
-    *hash->n_garbages = 0;
   }
-
-  if (grn_hash_is_io_hash(hash)) {
-    hash->header.common->idx_offset = dest_offset;
+  if (grn_io_hash_is_rehashing(hash)) {
+    /* New keys are added to the current index until the new one is ready. */
+    if (grn_io_hash_is_rehash_index_ready(hash) &&
+        n_used_slots * 2 > header->rehash_max_offset) {
+      return grn_hash_reset(ctx, hash, 0);
+    }
   } else {
-    grn_id * const old_index = hash->index;
-    hash->index = new_index;
-    GRN_CTX_FREE(ctx, old_index);
+    if (n_used_slots * 2 > header->max_offset) {
+      return grn_hash_reset(ctx, hash, 0);
+    }
   }
-
   return GRN_SUCCESS;
 }
 
@@ -2165,39 +2712,19 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
   }
 
   {
-    uint32_t i;
-    const uint32_t step = grn_hash_calculate_step(hash_value);
-    grn_id id, *index, *garbage_index = NULL;
+    grn_id id, *index, *insert_index;
     grn_hash_entry *entry;
 
     /* lock */
-    if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
-      grn_hash_reset(ctx, hash, 0);
-    }
-
-    for (i = hash_value; ; i += step) {
-      index = grn_hash_idx_at(ctx, hash, i);
-      if (!index) {
-        return GRN_ID_NIL;
-      }
-      id = *index;
-      if (!id) {
-        break;
-      }
-      if (id == GARBAGE) {
-        if (!garbage_index) {
-          garbage_index = index;
-        }
-        continue;
+    if (!grn_hash_is_io_hash(hash)) {
+      uint32_t slot;
+      if ((*hash->n_entries + *hash->n_garbages) * 2 > *hash->max_offset) {
+        grn_hash_reset(ctx, hash, 0);
       }
-
-      entry = grn_hash_entry_at(ctx, hash, id, GRN_TABLE_ADD);
-      if (!entry) {
-        return GRN_ID_NIL;
-      }
-      if (grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
-                                     key, key_size)) {
+      id = grn_tiny_hash_find(ctx, hash, hash_value, key, key_size, &slot);
+      if (id) {
         if (value) {
+          entry = grn_hash_entry_at(ctx, hash, id, 0);
           *value = grn_hash_entry_get_value(hash, entry);
         }
         if (added) {
@@ -2205,21 +2732,50 @@ grn_hash_add(grn_ctx *ctx, grn_hash *hash, const void *key,
         }
         return id;
       }
+      id = grn_tiny_hash_add(ctx, hash, hash_value, key, key_size, value);
+      if (!id) {
+        return GRN_ID_NIL;
+      }
+      grn_tiny_hash_put_slot(hash, slot, hash_value, id);
+      (*hash->n_entries)++;
+      if (added) {
+        *added = 1;
+      }
+      return id;
     }
 
-    if (grn_hash_is_io_hash(hash)) {
-      id = grn_io_hash_add(ctx, hash, hash_value, key, key_size, value);
-    } else {
-      id = grn_tiny_hash_add(ctx, hash, hash_value, key, key_size, value);
+    if (grn_io_hash_prepare_add(ctx, hash) != GRN_SUCCESS) {
+      return GRN_ID_NIL;
+    }
+
+    index = grn_io_hash_find(ctx, hash, hash_value, key, key_size,
+                             &insert_index);
+    if (index) {
+      id = *index;
+      if (value) {
+        entry = grn_hash_entry_at(ctx, hash, id, GRN_TABLE_ADD);
+        if (!entry) {
+          return GRN_ID_NIL;
+        }
+        *value = grn_hash_entry_get_value(hash, entry);
+      }
+      if (added) {
+        *added = 0;
+      }
+      return id;
+    }
+    if (!insert_index) {
+      return GRN_ID_NIL;
     }
+
+    id = grn_io_hash_add(ctx, hash, hash_value, key, key_size, value);
     if (!id) {
       return GRN_ID_NIL;
     }
-    if (garbage_index) {
+    if (*insert_index == GARBAGE) {
       (*hash->n_garbages)--;
-      index = garbage_index;
     }
-    *index = id;
+    *insert_index = id;
     (*hash->n_entries)++;
     /* unlock */
 
@@ -2251,32 +2807,32 @@ grn_hash_get(grn_ctx *ctx, grn_hash *hash, const void *key,
     }
   }
 
+  if (!grn_hash_is_io_hash(hash)) {
+    const grn_id id = grn_tiny_hash_find(ctx, hash, hash_value,
+                                         key, key_size, NULL);
+    if (id && value) {
+      grn_hash_entry * const entry = grn_hash_entry_at(ctx, hash, id, 0);
+      *value = grn_hash_entry_get_value(hash, entry);
+    }
+    return id;
+  }
+
   {
-    uint32_t i;
-    const uint32_t step = grn_hash_calculate_step(hash_value);
-    for (i = hash_value; ; i += step) {
-      grn_id id;
-      grn_id * const index = grn_hash_idx_at(ctx, hash, i);
-      if (!index) {
-        return GRN_ID_NIL;
-      }
-      id = *index;
-      if (!id) {
+    grn_id id;
+    grn_id * const index = grn_io_hash_find(ctx, hash, hash_value,
+                                            key, key_size, NULL);
+    if (!index) {
+      return GRN_ID_NIL;
+    }
+    id = *index;
+    if (value) {
+      grn_hash_entry * const entry = grn_hash_entry_at(ctx, hash, id, 0);
+      if (!entry) {
         return GRN_ID_NIL;
       }
-      if (id != GARBAGE) {
-        grn_hash_entry * const entry = grn_hash_entry_at(ctx, hash, id, 0);
-        if (entry) {
-          if (grn_hash_entry_compare_key(ctx, hash, entry, hash_value,
-                                         key, key_size)) {
-            if (value) {
-              *value = grn_hash_entry_get_value(hash, entry);
-            }
-            return id;
-          }
-        }
-      }
+      *value = grn_hash_entry_get_value(hash, entry);
     }
+    return id;
   }
 }
 
@@ -2462,7 +3018,6 @@ grn_hash_set_value(grn_ctx *ctx, grn_hash *hash, grn_id id,
 }
 
 #define DELETE_IT do {\
-  *ep = GARBAGE;\
   if (grn_hash_is_io_hash(hash)) {\
     uint32_t size = key_size - 1;\
     grn_id *garbages;\
@@ -2498,16 +3053,22 @@ grn_hash_delete_by_id(grn_ctx *ctx, grn_hash *hash, grn_id id,
   /* lock */
   ee = grn_hash_entry_at(ctx, hash, id, 0);
   if (ee) {
-    grn_id e, *ep;
-    uint32_t i, key_size, h = ee->key, s = grn_hash_calculate_step(h);
+    grn_id e;
+    uint32_t key_size, h = ee->key;
     key_size = (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) ? ee->size : hash->key_size;
-    for (i = h; ; i += s) {
-      if (!(ep = grn_hash_idx_at(ctx, hash, i))) { return GRN_NO_MEMORY_AVAILABLE; }
-      if (!(e = *ep)) { break; }
-      if (e == id) {
+    if (!grn_hash_is_io_hash(hash)) {
+      uint32_t slot;
+      if (grn_tiny_hash_find_slot_by_id(ctx, hash, h, id, &slot)) {
+        e = id;
+        GRN_TINY_HASH_SLOT_ID(hash, slot) = GARBAGE;
+        GRN_TINY_HASH_SLOT_CTRL(hash, slot) = GRN_TINY_HASH_CTRL_DELETED;
         DELETE_IT;
-        break;
       }
+      return rc;
+    }
+    if (grn_io_hash_remove_from_index(ctx, hash, h, id)) {
+      e = id;
+      DELETE_IT;
     }
   }
   /* unlock */
@@ -2518,7 +3079,7 @@ grn_rc
 grn_hash_delete(grn_ctx *ctx, grn_hash *hash, const void *key, uint32_t key_size,
                 grn_table_delete_optarg *optarg)
 {
-  uint32_t h, i, m, s;
+  uint32_t h;
   grn_rc rc = GRN_INVALID_ARGUMENT;
   if (hash->obj.header.flags & GRN_OBJ_KEY_VAR_SIZE) {
     if (key_size > hash->key_size) { return GRN_INVALID_ARGUMENT; }
@@ -2531,21 +3092,27 @@ grn_hash_delete(grn_ctx *ctx, grn_hash *hash, const void *key, uint32_t key_size
       h = grn_hash_calculate_hash_value(key, key_size);
     }
   }
-  s = grn_hash_calculate_step(h);
+  if (!grn_hash_is_io_hash(hash)) {
+    uint32_t slot;
+    grn_id e;
+    e = grn_tiny_hash_find(ctx, hash, h, key, key_size, &slot);
+    if (e) {
+      entry_str * const ee = grn_hash_entry_at(ctx, hash, e, 0);
+      GRN_TINY_HASH_SLOT_ID(hash, slot) = GARBAGE;
+      GRN_TINY_HASH_SLOT_CTRL(hash, slot) = GRN_TINY_HASH_CTRL_DELETED;
+      DELETE_IT;
+    }
+    return rc;
+  }
   {
     grn_id e, *ep;
     /* lock */
-    m = *hash->max_offset;
-    for (i = h; ; i += s) {
-      if (!(ep = grn_hash_idx_at(ctx, hash, i))) { return GRN_NO_MEMORY_AVAILABLE; }
-      if (!(e = *ep)) { break; }
-      if (e == GARBAGE) { continue; }
-      {
-        entry_str * const ee = grn_hash_entry_at(ctx, hash, e, 0);
-        if (ee && match_key(ctx, hash, ee, h, key, key_size)) {
-          DELETE_IT;
-          break;
-        }
+    ep = grn_io_hash_find(ctx, hash, h, key, key_size, NULL);
+    if (ep) {
+      entry_str * const ee = grn_hash_entry_at(ctx, hash, *ep, 0);
+      e = *ep;
+      if (ee && grn_io_hash_remove_from_index(ctx, hash, h, e)) {
+        DELETE_IT;
       }
     }
     /* unlock */
@@ -3011,19 +3578,37 @@ sort_val32(grn_ctx *ctx,
 inline static grn_id
 entry2id(grn_ctx *ctx, grn_hash *hash, entry *e)
 {
+  grn_hash_header_common * const header = hash->header.common;
   entry *e2;
   grn_id id, *ep;
   uint32_t i, h = e->key, s = grn_hash_calculate_step(h);
-  for (i = h; ; i += s) {
-    if (!(ep = grn_hash_idx_at(ctx, hash, i))) { return GRN_ID_NIL; }
-    if (!(id = *ep)) { break; }
-    if (id != GARBAGE) {
-      e2 = grn_hash_entry_at(ctx, hash, id, 0);
-      if (!e2) { return GRN_ID_NIL; }
-      if (e2 == e) { break; }
+  uint32_t idx_offset, max_offset;
+  if (!grn_hash_is_io_hash(hash)) {
+    return grn_tiny_array_id(&hash->a, e);
+  }
+  if (grn_io_hash_is_rehash_index_ready(hash)) {
+    idx_offset = header->rehash_idx_offset;
+    max_offset = header->rehash_max_offset;
+  } else {
+    idx_offset = header->idx_offset;
+    max_offset = header->max_offset;
+  }
+  for (;;) {
+    for (i = h; ; i += s) {
+      ep = grn_io_hash_idx_at(ctx, hash, (i & max_offset) + idx_offset);
+      if (!ep) { return GRN_ID_NIL; }
+      if (!(id = *ep)) { break; }
+      if (id != GARBAGE) {
+        e2 = grn_hash_entry_at(ctx, hash, id, 0);
+        if (!e2) { return GRN_ID_NIL; }
+        if (e2 == e) { return id; }
+      }
     }
+    if (idx_offset == header->idx_offset) { break; }
+    idx_offset = header->idx_offset;
+    max_offset = header->max_offset;
   }
-  return id;
+  return GRN_ID_NIL;
 }
 
 int
@@ -3260,7 +3845,7 @@ grn_rhash_group(grn_hash *s, int limit, grn_group_optarg *optarg)
   byte *key, *ekey, *gkey = NULL;
   int funcp, dir;
   unsigned int rsize;
-  if (!s || !s->index) { return NULL; }
+  if (!s || !s->groups_buffer) { return NULL; }
   if (optarg) {
     unit = grn_rec_userdef;
     rsize = optarg->key_size;
@@ -35,6 +35,16 @@
 #include "grn_scorer.h"
 #include "grn_util.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+# define GRN_II_BP128_SSE2
+# include <emmintrin.h>
+# ifdef __GNUC__
+#  define GRN_II_BP128_SSE2_FUNC __attribute__((target("sse2")))
+# else
+#  define GRN_II_BP128_SSE2_FUNC
+# endif
+#endif
+
 #ifdef GRN_WITH_ONIGMO
 # define GRN_II_SELECT_ENABLE_SEQUENTIAL_SEARCH
 #endif
@@ -74,8 +84,15 @@
 # define S_IWUSR 0200
 #endif /* S_IWUSR */
 
-static grn_bool grn_ii_cursor_set_min_enable = GRN_FALSE;
+static grn_bool grn_ii_cursor_set_min_enable = GRN_TRUE;
 static double grn_ii_select_too_many_index_match_ratio = -1;
+static grn_bool grn_ii_bp128_simd_enable = GRN_TRUE;
+static int grn_ii_build_n_threads = 1;
+static uint32_t grn_ii_build_n_records_per_thread_min = 0x1000;
+static grn_bool grn_ii_background_merge_enable = GRN_FALSE;
+static size_t grn_ii_chunk_cache_size = 0;
+static int grn_ii_select_n_threads = 1;
+static uint32_t grn_ii_select_n_postings_per_thread_min = 0x10000;
 
 void
 grn_ii_init_from_env(void)
@@ -85,10 +102,10 @@ grn_ii_init_from_env(void)
     grn_getenv("GRN_II_CURSOR_SET_MIN_ENABLE",
                grn_ii_cursor_set_min_enable_env,
                GRN_ENV_BUFFER_SIZE);
-    if (grn_ii_cursor_set_min_enable_env[0]) {
-      grn_ii_cursor_set_min_enable = GRN_TRUE;
-    } else {
+    if (strcmp(grn_ii_cursor_set_min_enable_env, "no") == 0) {
       grn_ii_cursor_set_min_enable = GRN_FALSE;
+    } else {
+      grn_ii_cursor_set_min_enable = GRN_TRUE;
     }
   }
 
@@ -102,6 +119,99 @@ grn_ii_init_from_env(void)
         atof(grn_ii_select_too_many_index_match_ratio_env);
     }
   }
+
+  {
+    char grn_ii_bp128_simd_enable_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_BP128_SIMD_ENABLE",
+               grn_ii_bp128_simd_enable_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (strcmp(grn_ii_bp128_simd_enable_env, "no") == 0) {
+      grn_ii_bp128_simd_enable = GRN_FALSE;
+    } else {
+      grn_ii_bp128_simd_enable = GRN_TRUE;
+    }
+#if defined(GRN_II_BP128_SSE2) && defined(__GNUC__)
+    if (!__builtin_cpu_supports("sse2")) {
+      grn_ii_bp128_simd_enable = GRN_FALSE;
+    }
+#endif
+  }
+
+  {
+    char grn_ii_build_n_threads_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_BUILD_N_THREADS",
+               grn_ii_build_n_threads_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_build_n_threads_env[0]) {
+      grn_ii_build_n_threads = atoi(grn_ii_build_n_threads_env);
+      if (grn_ii_build_n_threads < 1) {
+        grn_ii_build_n_threads = 1;
+      }
+    }
+  }
+
+  {
+    char grn_ii_build_n_records_per_thread_min_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_BUILD_N_RECORDS_PER_THREAD_MIN",
+               grn_ii_build_n_records_per_thread_min_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_build_n_records_per_thread_min_env[0]) {
+      grn_ii_build_n_records_per_thread_min =
+        atoi(grn_ii_build_n_records_per_thread_min_env);
+      if (grn_ii_build_n_records_per_thread_min < 1) {
+        grn_ii_build_n_records_per_thread_min = 1;
+      }
+    }
+  }
+
+  {
+    char grn_ii_background_merge_enable_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_BACKGROUND_MERGE_ENABLE",
+               grn_ii_background_merge_enable_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (strcmp(grn_ii_background_merge_enable_env, "yes") == 0) {
+      grn_ii_background_merge_enable = GRN_TRUE;
+    } else {
+      grn_ii_background_merge_enable = GRN_FALSE;
+    }
+  }
+
+  {
+    char grn_ii_chunk_cache_size_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_CHUNK_CACHE_SIZE",
+               grn_ii_chunk_cache_size_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_chunk_cache_size_env[0]) {
+      grn_ii_chunk_cache_size = atoi(grn_ii_chunk_cache_size_env);
+    }
+  }
+
+  {
+    char grn_ii_select_n_threads_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_SELECT_N_THREADS",
+               grn_ii_select_n_threads_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_select_n_threads_env[0]) {
+      grn_ii_select_n_threads = atoi(grn_ii_select_n_threads_env);
+      if (grn_ii_select_n_threads < 1) {
+        grn_ii_select_n_threads = 1;
+      }
+    }
+  }
+
+  {
+    char grn_ii_select_n_postings_per_thread_min_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_II_SELECT_N_POSTINGS_PER_THREAD_MIN",
+               grn_ii_select_n_postings_per_thread_min_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ii_select_n_postings_per_thread_min_env[0]) {
+      grn_ii_select_n_postings_per_thread_min =
+        atoi(grn_ii_select_n_postings_per_thread_min_env);
+      if (grn_ii_select_n_postings_per_thread_min < 1) {
+        grn_ii_select_n_postings_per_thread_min = 1;
+      }
+    }
+  }
 }
 
 /* segment */
@@ -373,6 +483,8 @@ chunk_new(grn_ctx *ctx, grn_ii *ii, uint32_t *res, uint32_t size)
   }
 }
 
+static void ii_chunk_cache_invalidate(grn_ii *ii, uint32_t chunk);
+
 static grn_rc
 chunk_free(grn_ctx *ctx, grn_ii *ii, uint32_t offset, uint32_t dummy, uint32_t size)
 {
@@ -387,6 +499,7 @@ chunk_free(grn_ctx *ctx, grn_ii *ii, uint32_t offset, uint32_t dummy, uint32_t s
   grn_io_win iw, iw_;
   grn_ii_ginfo *ginfo;
   uint32_t seg, m, *gseg;
+  ii_chunk_cache_invalidate(ii, offset);
   seg = offset >> GRN_II_N_CHUNK_VARIATION;
   if (size > S_CHUNK) {
     int n = (size + S_CHUNK - 1) >> GRN_II_W_CHUNK;
@@ -1342,6 +1455,128 @@ unpack_32(uint32_t *p, uint8_t *dp)
 }
 /* </generated> */
 
+/*
+  GRN_OBJ_COMPRESS_BP128 index packs each UNIT_SIZE block vertically:
+  the i-th value is stored in the (i % 4)-th lane and each lane is a
+  sequence of w-bit values in 32-bit words. The n-th words of the
+  four lanes are stored in a row as a 128-bit word. So four values
+  are decoded at once by SIMD shift and mask. A block is w 128-bit
+  words because each lane has UNIT_SIZE / 4 = 32 values.
+*/
+#define BP128_N_LANES 4
+#define BP128_WORD_SIZE (sizeof(uint32_t) * BP128_N_LANES)
+
+static uint8_t *
+pack_bp128(uint32_t *p, int w, uint8_t *rp)
+{
+  int i, lane, shift = 0;
+  uint32_t words[BP128_N_LANES];
+  if (!w) { return rp; }
+  memset(words, 0, BP128_WORD_SIZE);
+  for (i = 0; i < UNIT_SIZE; i += BP128_N_LANES) {
+    for (lane = 0; lane < BP128_N_LANES; lane++) {
+      words[lane] |= p[i + lane] << shift;
+    }
+    shift += w;
+    if (shift >= 32) {
+      grn_memcpy(rp, words, BP128_WORD_SIZE);
+      rp += BP128_WORD_SIZE;
+      shift -= 32;
+      for (lane = 0; lane < BP128_N_LANES; lane++) {
+        words[lane] = shift ? p[i + lane] >> (w - shift) : 0;
+      }
+    }
+  }
+  return rp;
+}
+
+static uint8_t *
+unpack_bp128_scalar(uint32_t *p, uint8_t *dp, int w)
+{
+  int i, lane, shift = 0;
+  uint32_t words[BP128_N_LANES], next[BP128_N_LANES];
+  uint32_t mask = (w == 32) ? 0xffffffff : (1U << w) - 1;
+  grn_memcpy(words, dp, BP128_WORD_SIZE);
+  dp += BP128_WORD_SIZE;
+  for (i = 0; i < UNIT_SIZE; i += BP128_N_LANES) {
+    if (shift + w < 32) {
+      for (lane = 0; lane < BP128_N_LANES; lane++) {
+        p[i + lane] = (words[lane] >> shift) & mask;
+      }
+      shift += w;
+    } else if (shift + w == 32) {
+      for (lane = 0; lane < BP128_N_LANES; lane++) {
+        p[i + lane] = words[lane] >> shift;
+      }
+      shift = 0;
+      if (i + BP128_N_LANES < UNIT_SIZE) {
+        grn_memcpy(words, dp, BP128_WORD_SIZE);
+        dp += BP128_WORD_SIZE;
+      }
+    } else {
+      grn_memcpy(next, dp, BP128_WORD_SIZE);
+      dp += BP128_WORD_SIZE;
+      for (lane = 0; lane < BP128_N_LANES; lane++) {
+        p[i + lane] =
+          ((words[lane] >> shift) | (next[lane] << (32 - shift))) & mask;
+        words[lane] = next[lane];
+      }
+      shift += w - 32;
+    }
+  }
+  return dp;
+}
+
+#ifdef GRN_II_BP128_SSE2
+GRN_II_BP128_SSE2_FUNC
+static uint8_t *
+unpack_bp128_sse2(uint32_t *p, uint8_t *dp, int w)
+{
+  int i, shift = 0;
+  __m128i words, next, mask;
+  mask = _mm_set1_epi32((w == 32) ? -1 : (int)((1U << w) - 1));
+  words = _mm_loadu_si128((const __m128i *)dp);
+  dp += BP128_WORD_SIZE;
+  for (i = 0; i < UNIT_SIZE; i += BP128_N_LANES) {
+    __m128i values;
+    if (shift + w < 32) {
+      values = _mm_and_si128(_mm_srl_epi32(words, _mm_cvtsi32_si128(shift)),
+                             mask);
+      shift += w;
+    } else if (shift + w == 32) {
+      values = _mm_srl_epi32(words, _mm_cvtsi32_si128(shift));
+      shift = 0;
+      if (i + BP128_N_LANES < UNIT_SIZE) {
+        words = _mm_loadu_si128((const __m128i *)dp);
+        dp += BP128_WORD_SIZE;
+      }
+    } else {
+      next = _mm_loadu_si128((const __m128i *)dp);
+      dp += BP128_WORD_SIZE;
+      values = _mm_or_si128(_mm_srl_epi32(words, _mm_cvtsi32_si128(shift)),
+                            _mm_sll_epi32(next,
+                                          _mm_cvtsi32_si128(32 - shift)));
+      values = _mm_and_si128(values, mask);
+      words = next;
+      shift += w - 32;
+    }
+    _mm_storeu_si128((__m128i *)(p + i), values);
+  }
+  return dp;
+}
+#endif /* GRN_II_BP128_SSE2 */
+
+static uint8_t *
+unpack_bp128(uint32_t *p, uint8_t *dp, int w)
+{
+#ifdef GRN_II_BP128_SSE2
+  if (grn_ii_bp128_simd_enable) {
+    return unpack_bp128_sse2(p, dp, w);
+  }
+#endif /* GRN_II_BP128_SSE2 */
+  return unpack_bp128_scalar(p, dp, w);
+}
+
 static uint8_t *
 pack_(uint32_t *p, uint32_t i, int w, uint8_t *rp)
 {
@@ -1408,7 +1643,17 @@ pack_(uint32_t *p, uint32_t i, int w, uint8_t *rp)
 }
 
 static uint8_t *
-pack(uint32_t *p, uint32_t i, uint8_t *freq, uint8_t *rp)
+pack_block(uint32_t *p, uint32_t i, int w, grn_bool bp128, uint8_t *rp)
+{
+  if (bp128 && i == UNIT_SIZE) {
+    return pack_bp128(p, w, rp);
+  } else {
+    return pack_(p, i, w, rp);
+  }
+}
+
+static uint8_t *
+pack(uint32_t *p, uint32_t i, uint8_t *freq, grn_bool bp128, uint8_t *rp)
 {
   int32_t k, w;
   uint8_t ebuf[UNIT_SIZE], *ep = ebuf;
@@ -1418,7 +1663,7 @@ pack(uint32_t *p, uint32_t i, uint8_t *freq, uint8_t *rp)
   }
   if (i == s) {
     *rp++ = w;
-    return pack_(p, i, w, rp);
+    return pack_block(p, i, w, bp128, rp);
   }
   r = 1 << w;
   *rp++ = w + 0x80;
@@ -1443,7 +1688,7 @@ pack(uint32_t *p, uint32_t i, uint8_t *freq, uint8_t *rp)
       }
     }
   }
-  rp = pack_(p - i, i, w, rp);
+  rp = pack_block(p - i, i, w, bp128, rp);
   grn_memcpy(rp, ebuf, ep - ebuf);
   return rp + (ep - ebuf);
 }
@@ -1458,7 +1703,7 @@ grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
   memset(freq, 0, 33);
   for (j = 0, dp = data, dpe = dp + data_size; dp < dpe; j++, dp++) {
     if (j == UNIT_SIZE) {
-      rp = pack(buf, j, freq, rp);
+      rp = pack(buf, j, freq, GRN_FALSE, rp);
       memset(freq, 0, 33);
       j = 0;
     }
@@ -1469,7 +1714,7 @@ grn_p_enc(grn_ctx *ctx, uint32_t *data, uint32_t data_size, uint8_t **res)
       freq[0]++;
     }
   }
-  if (j) { rp = pack(buf, j, freq, rp); }
+  if (j) { rp = pack(buf, j, freq, GRN_FALSE, rp); }
   return rp - *res;
 }
 
@@ -1526,11 +1771,15 @@ datavec_fin(grn_ctx *ctx, datavec *dv)
   if (dv[0].data) { GRN_FREE(dv[0].data); }
 }
 
+#define II_BP128_P(ii) \
+  (((ii)->header->flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_BP128)
+
 size_t
-grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
+grn_p_encv(grn_ctx *ctx, grn_ii *ii, datavec *dv, uint32_t dvlen, uint8_t *res)
 {
   uint8_t *rp = res, freq[33];
   uint32_t pgap, usep, l, df, data_size, *dp, *dpe;
+  grn_bool bp128 = II_BP128_P(ii);
   if (!dvlen || !(df = dv[0].data_size)) { return 0; }
   for (usep = 0, data_size = 0, l = 0; l < dvlen; l++) {
     uint32_t dl = dv[l].data_size;
@@ -1566,7 +1815,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
         memset(freq, 0, 33);
         while (dp < dpe) {
           if (j == UNIT_SIZE) {
-            rp = pack(buf, j, freq, rp);
+            rp = pack(buf, j, freq, bp128, rp);
             memset(freq, 0, 33);
             j = 0;
           }
@@ -1578,7 +1827,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
             freq[0]++;
           }
         }
-        if (j) { rp = pack(buf, j, freq, rp); }
+        if (j) { rp = pack(buf, j, freq, bp128, rp); }
       } else {
         while (dp < dpe) { GRN_B_ENC(*dp++, rp); }
       }
@@ -1625,7 +1874,7 @@ grn_p_encv(grn_ctx *ctx, datavec *dv, uint32_t dvlen, uint8_t *res)
 } while (0)
 
 static uint8_t *
-unpack(uint8_t *dp, uint8_t *dpe, int i, uint32_t *rp)
+unpack(uint8_t *dp, uint8_t *dpe, int i, grn_bool bp128, uint32_t *rp)
 {
   uint8_t ne = 0, k = 0, w = *dp++;
   uint32_t m, *p = rp;
@@ -1637,7 +1886,10 @@ unpack(uint8_t *dp, uint8_t *dpe, int i, uint32_t *rp)
   } else {
     m = (1 << w) - 1;
   }
-  if (w) {
+  if (w && bp128 && i == UNIT_SIZE) {
+    if (dp + BP128_WORD_SIZE * w > dpe) { return NULL; }
+    dp = unpack_bp128(p, dp, w);
+  } else if (w) {
     while (i >= 8) {
       if (dp + w > dpe) { return NULL; }
       switch (w) {
@@ -1739,21 +1991,25 @@ grn_p_dec(grn_ctx *ctx, uint8_t *data, uint32_t data_size, uint32_t nreq, uint32
     }
     if (!nreq || nreq > orig_size) { nreq = orig_size; }
     for (rest = nreq; rest >= UNIT_SIZE; rest -= UNIT_SIZE) {
-      if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+      if (!(dp = unpack(dp, dpe, UNIT_SIZE, GRN_FALSE, rp))) { return 0; }
       rp += UNIT_SIZE;
     }
-    if (rest) { if (!(dp = unpack(dp, dpe, rest, rp))) { return 0; } }
+    if (rest) {
+      if (!(dp = unpack(dp, dpe, rest, GRN_FALSE, rp))) { return 0; }
+    }
     GRN_ASSERT(data + data_size == dp);
     return nreq;
   }
 }
 
 int
-grn_p_decv(grn_ctx *ctx, uint8_t *data, uint32_t data_size, datavec *dv, uint32_t dvlen)
+grn_p_decv(grn_ctx *ctx, grn_ii *ii, uint8_t *data, uint32_t data_size,
+           datavec *dv, uint32_t dvlen)
 {
   size_t size;
   uint32_t df, l, i, *rp, nreq;
   uint8_t *dp = data, *dpe = data + data_size;
+  grn_bool bp128 = II_BP128_P(ii);
   if (!data_size) {
     dv[0].data_size = 0;
     return 0;
@@ -1805,11 +2061,11 @@ grn_p_decv(grn_ctx *ctx, uint8_t *data, uint32_t data_size, datavec *dv, uint32_
       dv[l].data_size = n = (l < dvlen - 1) ? df : df + rest;
       if (usep & (1 << l)) {
         for (; n >= UNIT_SIZE; n -= UNIT_SIZE) {
-          if (!(dp = unpack(dp, dpe, UNIT_SIZE, rp))) { return 0; }
+          if (!(dp = unpack(dp, dpe, UNIT_SIZE, bp128, rp))) { return 0; }
           rp += UNIT_SIZE;
         }
         if (n) {
-          if (!(dp = unpack(dp, dpe, n, rp))) { return 0; }
+          if (!(dp = unpack(dp, dpe, n, bp128, rp))) { return 0; }
           rp += n;
         }
         dv[l].flags |= USE_P_ENC;
@@ -2542,7 +2798,7 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
     if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
       rdv[ii->n_elements - 1].flags = ODD;
     }
-    bufsize += grn_p_decv(ctx, scp, cinfo->size, rdv, ii->n_elements);
+    bufsize += grn_p_decv(ctx, ii, scp, cinfo->size, rdv, ii->n_elements);
     // (df in chunk list) = a[1] - sdf;
     {
       int j = 0;
@@ -2596,7 +2852,7 @@ chunk_merge(grn_ctx *ctx, grn_ii *ii, buffer *sb, buffer_term *bt,
       dv[j].data_size = np; dv[j].flags = f_p|ODD;
     }
     if ((enc = GRN_MALLOC((ndf * 4 + np) * 2))) {
-      encsize = grn_p_encv(ctx, dv, ii->n_elements, enc);
+      encsize = grn_p_encv(ctx, ii, dv, ii->n_elements, enc);
       if (!(rc = chunk_flush(ctx, ii, cinfo, enc, encsize))) {
         chunk_free(ctx, ii, segno, 0, size);
       }
@@ -2691,7 +2947,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
         }
       }
       if (sce > scp) {
-        size += grn_p_decv(ctx, scp, sce - scp, rdv, ii->n_elements);
+        size += grn_p_decv(ctx, ii, scp, sce - scp, rdv, ii->n_elements);
         {
           int j = 0;
           sdf = rdv[j].data_size;
@@ -2811,7 +3067,7 @@ buffer_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h,
               }
             }
           }
-          encsize = grn_p_encv(ctx, dv, ii->n_elements, dcp);
+          encsize = grn_p_encv(ctx, ii, dv, ii->n_elements, dcp);
 
           if (sb->header.chunk_size + S_SEGMENT <= (dcp - dc) + encsize) {
             int i;
@@ -3091,7 +3347,7 @@ grn_ii_buffer_check(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
         }
       }
       if (sce > scp) {
-        size += grn_p_decv(ctx, scp, sce - scp, rdv, ii->n_elements);
+        size += grn_p_decv(ctx, ii, scp, sce - scp, rdv, ii->n_elements);
         {
           int j = 0;
           sdf = rdv[j].data_size;
@@ -3486,6 +3742,490 @@ buffer_new(grn_ctx *ctx, grn_ii *ii, int size, uint32_t *pos,
   return pseg;
 }
 
+/* merger */
+
+/*
+ * Buffer segments that are getting full are merged into chunks by a
+ * background thread so that grn_ii_update_one() doesn't need to flush
+ * them in the loading thread. Requests are kept in a bounded queue.
+ * If the queue is full, the loading thread merges the buffer by itself.
+ * It slows down loading threads until the merger catches up.
+ */
+
+#define II_MERGER_QUEUE_SIZE 64
+#define II_MERGER_WATERMARK  (S_SEGMENT / 4)
+
+typedef struct {
+  grn_ii *ii;
+  uint32_t seg;
+} ii_merger_request;
+
+static struct {
+  grn_bool running;
+  grn_bool shutdown;
+  grn_thread thread;
+  grn_mutex mutex;
+  grn_cond cond;
+  ii_merger_request requests[II_MERGER_QUEUE_SIZE];
+  uint32_t head;
+  uint32_t n_requests;
+  grn_ii *merging;
+} ii_merger;
+
+inline static void
+ii_lock(grn_ii *ii)
+{
+  if (grn_ii_background_merge_enable) {
+    CRITICAL_SECTION_ENTER(ii->lock);
+  }
+}
+
+inline static void
+ii_unlock(grn_ii *ii)
+{
+  if (grn_ii_background_merge_enable) {
+    CRITICAL_SECTION_LEAVE(ii->lock);
+  }
+}
+
+/*
+ * Returns GRN_FALSE when the queue is full. The caller must merge the
+ * buffer by ii_merger_merge_buffer() in that case.
+ */
+static grn_bool
+ii_merger_request_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
+{
+  grn_bool queued = GRN_TRUE;
+  uint32_t i;
+  if (!ii_merger.running) { return queued; }
+  MUTEX_LOCK(ii_merger.mutex);
+  if (ii_merger.shutdown) { goto exit; }
+  for (i = 0; i < ii_merger.n_requests; i++) {
+    ii_merger_request *request =
+      &(ii_merger.requests[(ii_merger.head + i) % II_MERGER_QUEUE_SIZE]);
+    if (request->ii == ii && request->seg == seg) { goto exit; }
+  }
+  if (ii_merger.n_requests == II_MERGER_QUEUE_SIZE) {
+    GRN_LOG(ctx, GRN_LOG_DEBUG,
+            "[ii][merger] queue is full: merge synchronously: seg:%u", seg);
+    queued = GRN_FALSE;
+    goto exit;
+  }
+  {
+    ii_merger_request *request =
+      &(ii_merger.requests[(ii_merger.head + ii_merger.n_requests) %
+                           II_MERGER_QUEUE_SIZE]);
+    request->ii = ii;
+    request->seg = seg;
+    ii_merger.n_requests++;
+    COND_BROADCAST(ii_merger.cond);
+  }
+exit :
+  MUTEX_UNLOCK(ii_merger.mutex);
+  return queued;
+}
+
+/* Must be called in ii_merger.mutex. */
+static void
+ii_merger_drop_requests(grn_ii *ii)
+{
+  uint32_t i, n;
+  for (i = 0, n = 0; i < ii_merger.n_requests; i++) {
+    ii_merger_request *request =
+      &(ii_merger.requests[(ii_merger.head + i) % II_MERGER_QUEUE_SIZE]);
+    if (request->ii != ii) {
+      ii_merger.requests[(ii_merger.head + n) % II_MERGER_QUEUE_SIZE] =
+        *request;
+      n++;
+    }
+  }
+  ii_merger.n_requests = n;
+}
+
+/* Drops pending requests for ii and waits for the running merge of ii. */
+static void
+ii_merger_cancel(grn_ctx *ctx, grn_ii *ii)
+{
+  if (!ii_merger.running) { return; }
+  MUTEX_LOCK(ii_merger.mutex);
+  ii_merger_drop_requests(ii);
+  while (ii_merger.merging == ii) {
+    COND_WAIT(ii_merger.cond, ii_merger.mutex);
+  }
+  MUTEX_UNLOCK(ii_merger.mutex);
+}
+
+/*
+ * Drops pending requests for ii without waiting for the running merge.
+ * The caller must hold ii->lock so that no request for ii is queued
+ * again until it is released. The running merge waits for ii->lock.
+ */
+static void
+ii_merger_cancel_locked(grn_ctx *ctx, grn_ii *ii)
+{
+  if (!ii_merger.running) { return; }
+  MUTEX_LOCK(ii_merger.mutex);
+  ii_merger_drop_requests(ii);
+  MUTEX_UNLOCK(ii_merger.mutex);
+}
+
+/* Must be called in ii->lock. */
+static grn_rc
+ii_merger_merge_buffer(grn_ctx *ctx, grn_ii *ii, uint32_t seg, grn_hash *h)
+{
+  grn_rc rc = GRN_SUCCESS;
+  buffer *b;
+  uint32_t pseg;
+  /* The index may have failed to be truncated while we waited. */
+  if (!ii->seg) { return rc; }
+  if (ii->header->binfo[seg] != NOT_ASSIGNED &&
+      (pseg = buffer_open(ctx, ii, SEG2POS(seg, 0), NULL, &b)) != NOT_ASSIGNED) {
+    grn_bool need_merge = b->header.buffer_free < II_MERGER_WATERMARK;
+    grn_bool need_split = need_merge && SPLIT_COND;
+    buffer_close(ctx, ii, pseg);
+    if (need_split) {
+      rc = buffer_split(ctx, ii, seg, h);
+    } else if (need_merge) {
+      rc = buffer_flush(ctx, ii, seg, h);
+    }
+  }
+  return rc;
+}
+
+static void
+ii_merger_merge(grn_ctx *ctx, grn_ii *ii, uint32_t seg)
+{
+  grn_rc rc;
+  CRITICAL_SECTION_ENTER(ii->lock);
+  rc = ii_merger_merge_buffer(ctx, ii, seg, NULL);
+  CRITICAL_SECTION_LEAVE(ii->lock);
+  if (rc) {
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[ii][merger] failed to merge buffer: seg:%u rc:%d", seg, rc);
+    ERRCLR(ctx);
+  }
+}
+
+static grn_thread_func_result CALLBACK
+ii_merger_run(void *arg)
+{
+  grn_ctx ctx_, *ctx = &ctx_;
+  grn_ctx_init(ctx, 0);
+  MUTEX_LOCK(ii_merger.mutex);
+  for (;;) {
+    ii_merger_request request;
+    while (!ii_merger.n_requests && !ii_merger.shutdown) {
+      COND_WAIT(ii_merger.cond, ii_merger.mutex);
+    }
+    if (ii_merger.shutdown) { break; }
+    request = ii_merger.requests[ii_merger.head];
+    ii_merger.head = (ii_merger.head + 1) % II_MERGER_QUEUE_SIZE;
+    ii_merger.n_requests--;
+    ii_merger.merging = request.ii;
+    MUTEX_UNLOCK(ii_merger.mutex);
+    ii_merger_merge(ctx, request.ii, request.seg);
+    MUTEX_LOCK(ii_merger.mutex);
+    ii_merger.merging = NULL;
+    COND_BROADCAST(ii_merger.cond);
+  }
+  MUTEX_UNLOCK(ii_merger.mutex);
+  grn_ctx_fin(ctx);
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+void
+grn_ii_merger_init(void)
+{
+  grn_ctx *ctx = &grn_gctx;
+  if (!grn_ii_background_merge_enable) { return; }
+  MUTEX_INIT(ii_merger.mutex);
+  COND_INIT(ii_merger.cond);
+  ii_merger.shutdown = GRN_FALSE;
+  ii_merger.head = 0;
+  ii_merger.n_requests = 0;
+  ii_merger.merging = NULL;
+  if (THREAD_CREATE(ii_merger.thread, ii_merger_run, NULL)) {
+    GRN_LOG(ctx, GRN_LOG_ERROR,
+            "[ii][merger] failed to create thread: "
+            "buffers are merged synchronously");
+    COND_FIN(ii_merger.cond);
+    MUTEX_FIN(ii_merger.mutex);
+    return;
+  }
+  ii_merger.running = GRN_TRUE;
+}
+
+void
+grn_ii_merger_fin(void)
+{
+  if (!ii_merger.running) { return; }
+  MUTEX_LOCK(ii_merger.mutex);
+  ii_merger.shutdown = GRN_TRUE;
+  COND_BROADCAST(ii_merger.cond);
+  MUTEX_UNLOCK(ii_merger.mutex);
+  THREAD_JOIN(ii_merger.thread);
+  ii_merger.running = GRN_FALSE;
+  COND_FIN(ii_merger.cond);
+  MUTEX_FIN(ii_merger.mutex);
+}
+
+/* chunk cache */
+
+/*
+ * Decoded chunks are cached per index so that hot terms aren't decoded
+ * on every cursor. An entry is keyed by the term ID and the location of
+ * the encoded chunk. Chunks are never rewritten in place: they are
+ * only freed and allocated again. So chunk_free() drops only the
+ * entries of the freed chunk and increments chunk_generation in the
+ * header. The header may be shared with other processes. If
+ * chunk_generation is changed by other processes, all entries are
+ * dropped because we don't know which chunks were freed.
+ *
+ * The cache is disabled by default. GRN_II_CHUNK_CACHE_SIZE sets the
+ * max size of decoded data per index.
+ */
+
+#define II_CHUNK_CACHE_N_ENTRIES 1024
+
+typedef struct {
+  grn_id tid;
+  uint32_t segno;
+  uint32_t offset;
+  uint32_t size;
+  grn_bool referenced;
+  uint32_t n_values;
+  uint32_t data_sizes[MAX_N_ELEMENTS];
+  uint32_t *values;
+} ii_chunk_cache_entry;
+
+struct _grn_ii_chunk_cache {
+  uint32_t generation;
+  size_t total_size;
+  uint32_t clock_hand;
+  ii_chunk_cache_entry entries[II_CHUNK_CACHE_N_ENTRIES];
+};
+
+static struct {
+  grn_critical_section lock;
+  uint64_t n_hits;
+  uint64_t n_misses;
+} ii_chunk_cache_statistics;
+
+static void
+ii_chunk_cache_entry_clear(grn_ii_chunk_cache *cache,
+                           ii_chunk_cache_entry *entry)
+{
+  if (!entry->values) { return; }
+  cache->total_size -= entry->n_values * sizeof(uint32_t);
+  GRN_GFREE(entry->values);
+  entry->values = NULL;
+}
+
+static void
+ii_chunk_cache_clear(grn_ii_chunk_cache *cache)
+{
+  uint32_t i;
+  for (i = 0; i < II_CHUNK_CACHE_N_ENTRIES; i++) {
+    ii_chunk_cache_entry_clear(cache, &(cache->entries[i]));
+  }
+}
+
+static void
+ii_chunk_cache_close(grn_ii *ii)
+{
+  if (!ii->chunk_cache) { return; }
+  ii_chunk_cache_clear(ii->chunk_cache);
+  GRN_GFREE(ii->chunk_cache);
+  ii->chunk_cache = NULL;
+}
+
+inline static ii_chunk_cache_entry *
+ii_chunk_cache_entry_at(grn_ii_chunk_cache *cache,
+                        uint32_t segno, uint32_t offset)
+{
+  uint32_t h = (segno * 0x9e3779b1) ^ (offset * 0x85ebca6b);
+  return &(cache->entries[(h >> 16) & (II_CHUNK_CACHE_N_ENTRIES - 1)]);
+}
+
+/* Must be called in chunk_cache_lock. */
+inline static grn_ii_chunk_cache *
+ii_chunk_cache_get_current(grn_ii *ii)
+{
+  grn_ii_chunk_cache *cache = ii->chunk_cache;
+  if (!cache) {
+    if (!(cache = GRN_GCALLOC(sizeof(grn_ii_chunk_cache)))) { return NULL; }
+    cache->generation = ii->header->chunk_generation;
+    ii->chunk_cache = cache;
+  } else if (cache->generation != ii->header->chunk_generation) {
+    ii_chunk_cache_clear(cache);
+    cache->generation = ii->header->chunk_generation;
+  }
+  return cache;
+}
+
+/*
+ * Called by chunk_free(). Entries in a buffer's chunk have offsets in
+ * the chunk. So all entries are checked instead of looking up one slot.
+ */
+static void
+ii_chunk_cache_invalidate(grn_ii *ii, uint32_t chunk)
+{
+  grn_ii_chunk_cache *cache;
+  uint32_t i;
+
+  CRITICAL_SECTION_ENTER(ii->chunk_cache_lock);
+  cache = ii->chunk_cache;
+  if (cache && cache->generation == ii->header->chunk_generation) {
+    for (i = 0; i < II_CHUNK_CACHE_N_ENTRIES; i++) {
+      ii_chunk_cache_entry *entry = &(cache->entries[i]);
+      if (entry->values && entry->segno == chunk) {
+        ii_chunk_cache_entry_clear(cache, entry);
+      }
+    }
+    cache->generation++;
+  }
+  ii->header->chunk_generation++;
+  CRITICAL_SECTION_LEAVE(ii->chunk_cache_lock);
+}
+
+static grn_bool
+ii_chunk_cache_fetch(grn_ctx *ctx, grn_ii *ii, grn_id tid,
+                     uint32_t segno, uint32_t offset, uint32_t size,
+                     datavec *dv, uint32_t dvlen)
+{
+  grn_bool found = GRN_FALSE;
+  grn_ii_chunk_cache *cache;
+  ii_chunk_cache_entry *entry;
+
+  if (grn_ii_chunk_cache_size == 0) { return GRN_FALSE; }
+
+  CRITICAL_SECTION_ENTER(ii->chunk_cache_lock);
+  if ((cache = ii_chunk_cache_get_current(ii))) {
+    entry = ii_chunk_cache_entry_at(cache, segno, offset);
+    if (entry->values &&
+        entry->tid == tid &&
+        entry->segno == segno &&
+        entry->offset == offset &&
+        entry->size == size) {
+      uint32_t i, *rp;
+      if (dv[dvlen].data < dv[0].data + entry->n_values) {
+        if (dv[0].data) { GRN_FREE(dv[0].data); }
+        dv[0].data = NULL;
+        dv[dvlen].data = NULL;
+        if ((rp = GRN_MALLOC(entry->n_values * sizeof(uint32_t)))) {
+          dv[dvlen].data = rp + entry->n_values;
+        }
+      } else {
+        rp = dv[0].data;
+      }
+      if (rp) {
+        grn_memcpy(rp, entry->values, entry->n_values * sizeof(uint32_t));
+        for (i = 0; i < dvlen; i++) {
+          dv[i].data = rp;
+          dv[i].data_size = entry->data_sizes[i];
+          rp += entry->data_sizes[i];
+        }
+        entry->referenced = GRN_TRUE;
+        found = GRN_TRUE;
+      }
+    }
+  }
+  CRITICAL_SECTION_LEAVE(ii->chunk_cache_lock);
+
+  return found;
+}
+
+/*
+ * Stores the decoded chunk in dv. generation is chunk_generation when
+ * the chunk was read. The chunk isn't cached if any chunk was freed
+ * after that because the chunk may have been reused.
+ */
+static void
+ii_chunk_cache_store(grn_ctx *ctx, grn_ii *ii, grn_id tid,
+                     uint32_t segno, uint32_t offset, uint32_t size,
+                     uint32_t generation, datavec *dv, uint32_t dvlen,
+                     uint32_t n_values)
+{
+  grn_ii_chunk_cache *cache;
+  ii_chunk_cache_entry *entry;
+  size_t entry_size = n_values * sizeof(uint32_t);
+  uint32_t i, n_sweeps;
+
+  if (grn_ii_chunk_cache_size == 0) { return; }
+  if (n_values == 0 || entry_size > grn_ii_chunk_cache_size / 4) { return; }
+
+  CRITICAL_SECTION_ENTER(ii->chunk_cache_lock);
+  if (!(cache = ii_chunk_cache_get_current(ii)) ||
+      cache->generation != generation) {
+    goto exit;
+  }
+  entry = ii_chunk_cache_entry_at(cache, segno, offset);
+  ii_chunk_cache_entry_clear(cache, entry);
+  for (n_sweeps = 0;
+       cache->total_size + entry_size > grn_ii_chunk_cache_size &&
+         n_sweeps < II_CHUNK_CACHE_N_ENTRIES * 2;
+       n_sweeps++) {
+    ii_chunk_cache_entry *victim = &(cache->entries[cache->clock_hand]);
+    cache->clock_hand = (cache->clock_hand + 1) & (II_CHUNK_CACHE_N_ENTRIES - 1);
+    if (victim->referenced) {
+      victim->referenced = GRN_FALSE;
+    } else {
+      ii_chunk_cache_entry_clear(cache, victim);
+    }
+  }
+  if (cache->total_size + entry_size > grn_ii_chunk_cache_size) {
+    goto exit;
+  }
+  if (!(entry->values = GRN_GMALLOC(entry_size))) { goto exit; }
+  grn_memcpy(entry->values, dv[0].data, entry_size);
+  for (i = 0; i < dvlen; i++) {
+    entry->data_sizes[i] = dv[i].data_size;
+  }
+  entry->tid = tid;
+  entry->segno = segno;
+  entry->offset = offset;
+  entry->size = size;
+  entry->n_values = n_values;
+  entry->referenced = GRN_FALSE;
+  cache->total_size += entry_size;
+exit :
+  CRITICAL_SECTION_LEAVE(ii->chunk_cache_lock);
+}
+
+void
+grn_ii_chunk_cache_init(void)
+{
+  CRITICAL_SECTION_INIT(ii_chunk_cache_statistics.lock);
+  ii_chunk_cache_statistics.n_hits = 0;
+  ii_chunk_cache_statistics.n_misses = 0;
+}
+
+void
+grn_ii_chunk_cache_fin(void)
+{
+  CRITICAL_SECTION_FIN(ii_chunk_cache_statistics.lock);
+}
+
+void
+grn_ii_chunk_cache_get_statistics(uint64_t *n_hits, uint64_t *n_misses)
+{
+  CRITICAL_SECTION_ENTER(ii_chunk_cache_statistics.lock);
+  *n_hits = ii_chunk_cache_statistics.n_hits;
+  *n_misses = ii_chunk_cache_statistics.n_misses;
+  CRITICAL_SECTION_LEAVE(ii_chunk_cache_statistics.lock);
+}
+
+static void
+ii_chunk_cache_update_statistics(uint32_t n_hits, uint32_t n_misses)
+{
+  if (grn_ii_chunk_cache_size == 0) { return; }
+  if (n_hits == 0 && n_misses == 0) { return; }
+  CRITICAL_SECTION_ENTER(ii_chunk_cache_statistics.lock);
+  ii_chunk_cache_statistics.n_hits += n_hits;
+  ii_chunk_cache_statistics.n_misses += n_misses;
+  CRITICAL_SECTION_LEAVE(ii_chunk_cache_statistics.lock);
+}
+
 /* ii */
 
 static grn_ii *
@@ -3535,6 +4275,7 @@ _grn_ii_create(grn_ctx *ctx, grn_ii *ii, const char *path, grn_obj *lexicon, uin
     header->garbages[i] = NOT_ASSIGNED;
   }
   header->flags = flags;
+  header->version = GRN_II_VERSION;
   ii->seg = seg;
   ii->chunk = chunk;
   ii->lexicon = lexicon;
@@ -3560,6 +4301,9 @@ grn_ii_create(grn_ctx *ctx, const char *path, grn_obj *lexicon, uint32_t flags)
     GRN_FREE(ii);
     return NULL;
   }
+  CRITICAL_SECTION_INIT(ii->lock);
+  CRITICAL_SECTION_INIT(ii->chunk_cache_lock);
+  ii->chunk_cache = NULL;
   return ii;
 }
 
@@ -3603,6 +4347,11 @@ grn_ii_truncate(grn_ctx *ctx, grn_ii *ii)
   }
   lexicon = ii->lexicon;
   flags = ii->header->flags;
+  ii_lock(ii);
+  ii_merger_cancel_locked(ctx, ii);
+  CRITICAL_SECTION_ENTER(ii->chunk_cache_lock);
+  ii_chunk_cache_close(ii);
+  CRITICAL_SECTION_LEAVE(ii->chunk_cache_lock);
   if ((rc = grn_io_close(ctx, ii->seg))) { goto exit; }
   if ((rc = grn_io_close(ctx, ii->chunk))) { goto exit; }
   ii->seg = NULL;
@@ -3613,6 +4362,7 @@ grn_ii_truncate(grn_ctx *ctx, grn_ii *ii)
     rc = GRN_UNKNOWN_ERROR;
   }
 exit:
+  ii_unlock(ii);
   if (segpath) { GRN_FREE(segpath); }
   if (chunkpath) { GRN_FREE(chunkpath); }
   return rc;
@@ -3649,6 +4399,16 @@ grn_ii_open(grn_ctx *ctx, const char *path, grn_obj *lexicon)
     grn_io_close(ctx, chunk);
     return NULL;
   }
+  if (header->version > GRN_II_VERSION ||
+      ((header->flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_BP128 &&
+       header->version < 1)) {
+    ERR(GRN_INVALID_FORMAT,
+        "[ii][open] unsupported index version: <%u>: <%s>",
+        header->version, path);
+    grn_io_close(ctx, seg);
+    grn_io_close(ctx, chunk);
+    return NULL;
+  }
   if (!(ii = GRN_GMALLOC(sizeof(grn_ii)))) {
     grn_io_close(ctx, seg);
     grn_io_close(ctx, chunk);
@@ -3665,6 +4425,9 @@ grn_ii_open(grn_ctx *ctx, const char *path, grn_obj *lexicon)
   if ((header->flags & GRN_OBJ_WITH_SECTION)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_WEIGHT)) { ii->n_elements++; }
   if ((header->flags & GRN_OBJ_WITH_POSITION)) { ii->n_elements++; }
+  CRITICAL_SECTION_INIT(ii->lock);
+  CRITICAL_SECTION_INIT(ii->chunk_cache_lock);
+  ii->chunk_cache = NULL;
   return ii;
 }
 
@@ -3673,8 +4436,12 @@ grn_ii_close(grn_ctx *ctx, grn_ii *ii)
 {
   grn_rc rc;
   if (!ii) { return GRN_INVALID_ARGUMENT; }
+  ii_merger_cancel(ctx, ii);
   if ((rc = grn_io_close(ctx, ii->seg))) { return rc; }
   if ((rc = grn_io_close(ctx, ii->chunk))) { return rc; }
+  ii_chunk_cache_close(ii);
+  CRITICAL_SECTION_FIN(ii->chunk_cache_lock);
+  CRITICAL_SECTION_FIN(ii->lock);
   GRN_GFREE(ii);
   /*
   {
@@ -3721,8 +4488,11 @@ grn_ii_expire(grn_ctx *ctx, grn_ii *ii)
 #define BIT11_01(x) ((x >> 1) & 0x7ff)
 #define BIT31_12(x) (x >> 12)
 
-grn_rc
-grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
+static grn_rc ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid,
+                            grn_ii_updspec *u, grn_hash *h);
+
+static grn_rc
+ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
 {
   grn_rc rc = GRN_SUCCESS;
   buffer *b;
@@ -3730,8 +4500,9 @@ grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
   buffer_rec *br = NULL;
   buffer_term *bt;
   uint32_t pseg = 0, pos = 0, size, *a;
+  grn_bool merge_by_self = GRN_FALSE;
   if (!tid) { return rc; }
-  if (!u->tf || !u->sid) { return grn_ii_delete_one(ctx, ii, tid, u, h); }
+  if (!u->tf || !u->sid) { return ii_delete_one(ctx, ii, tid, u, h); }
   if (u->sid > ii->header->smax) { ii->header->smax = u->sid; }
   if (!(a = array_get(ctx, ii, tid))) { return GRN_NO_MEMORY_AVAILABLE; }
   if (!(bs = encode_rec(ctx, ii, u, &size, 0))) {
@@ -3856,8 +4627,15 @@ grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
     bt->pos_in_buffer = 0;
   }
   rc = buffer_put(ctx, ii, b, bt, br, bs, u, size);
+  if (grn_ii_background_merge_enable &&
+      b->header.buffer_free < II_MERGER_WATERMARK) {
+    merge_by_self = !ii_merger_request_merge(ctx, ii, LSEG(pos));
+  }
   buffer_close(ctx, ii, pseg);
   if (!a[0] || (a[0] & 1)) { a[0] = pos; }
+  if (!rc && merge_by_self) {
+    rc = ii_merger_merge_buffer(ctx, ii, LSEG(pos), h);
+  }
 exit :
   array_unref(ii, tid);
   if (bs) { GRN_FREE(bs); }
@@ -3877,7 +4655,17 @@ exit :
 }
 
 grn_rc
-grn_ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
+grn_ii_update_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
+{
+  grn_rc rc;
+  ii_lock(ii);
+  rc = ii_update_one(ctx, ii, tid, u, h);
+  ii_unlock(ii);
+  return rc;
+}
+
+static grn_rc
+ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
 {
   grn_rc rc = GRN_SUCCESS;
   buffer *b;
@@ -3885,6 +4673,7 @@ grn_ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
   buffer_rec *br;
   buffer_term *bt;
   uint32_t pseg, size, *a;
+  grn_bool merge_by_self = GRN_FALSE;
   if (!tid) { return rc; }
   if (!(a = array_at(ctx, ii, tid))) { return GRN_INVALID_ARGUMENT; }
   for (;;) {
@@ -3940,7 +4729,14 @@ grn_ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_h
     b->header.buffer_free -= size;
     br = (buffer_rec *)(((byte *)&b->terms[b->header.nterms]) + b->header.buffer_free);
     rc = buffer_put(ctx, ii, b, bt, br, bs, u, size);
+    if (grn_ii_background_merge_enable &&
+        b->header.buffer_free < II_MERGER_WATERMARK) {
+      merge_by_self = !ii_merger_request_merge(ctx, ii, LSEG(a[0]));
+    }
     buffer_close(ctx, ii, pseg);
+    if (!rc && merge_by_self) {
+      rc = ii_merger_merge_buffer(ctx, ii, LSEG(a[0]), h);
+    }
     break;
   }
 exit :
@@ -3949,6 +4745,16 @@ exit :
   return rc;
 }
 
+grn_rc
+grn_ii_delete_one(grn_ctx *ctx, grn_ii *ii, grn_id tid, grn_ii_updspec *u, grn_hash *h)
+{
+  grn_rc rc;
+  ii_lock(ii);
+  rc = ii_delete_one(ctx, ii, tid, u, h);
+  ii_unlock(ii);
+  return rc;
+}
+
 #define CHUNK_USED    1
 #define BUFFER_USED   2
 #define SOLE_DOC_USED 4
@@ -3980,6 +4786,7 @@ struct _grn_ii_cursor {
   uint32_t nchunks;
   uint32_t curr_chunk;
   chunk_info *cinfo;
+  grn_id *clrids;
   grn_io_win iw;
   uint8_t *cp;
   uint8_t *cpe;
@@ -3991,6 +4798,12 @@ struct _grn_ii_cursor {
   uint32_t buffer_pseg;
   int flags;
   uint32_t *ppseg;
+
+  uint32_t chunk_generation;
+  uint32_t chunk;
+  uint32_t chunk_offset;
+  uint32_t n_chunk_cache_hits;
+  uint32_t n_chunk_cache_misses;
 };
 
 static int
@@ -4064,6 +4877,7 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
     c->max = max;
     c->nelements = nelements;
     c->flags = flags;
+    c->chunk_generation = ii->header->chunk_generation;
     if (pos & 1) {
       c->stat = 0;
       if ((ii->header->flags & GRN_OBJ_WITH_SECTION)) {
@@ -4106,7 +4920,9 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             grn_ii_cursor_close(ctx, c);
             continue;
           }
-          if (!(c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks))) {
+          if (!(c->cinfo = GRN_MALLOCN(chunk_info, c->nchunks)) ||
+              !(c->clrids = GRN_MALLOCN(grn_id, c->nchunks))) {
+            if (c->cinfo) { GRN_FREE(c->cinfo); }
             buffer_close(ctx, ii, c->buffer_pseg);
             grn_io_win_unmap(&c->iw);
             GRN_FREE(c);
@@ -4118,6 +4934,7 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             GRN_B_DEC(c->cinfo[i].size, c->cp);
             GRN_B_DEC(c->cinfo[i].dgap, c->cp);
             crid += c->cinfo[i].dgap;
+            c->clrids[i] = crid;
             if (crid < min) { c->curr_chunk = i + 1; }
           }
           if (chunk_is_reused(ctx, ii, c, chunk, c->buf->header.chunk_size)) {
@@ -4125,6 +4942,8 @@ grn_ii_cursor_open(grn_ctx *ctx, grn_ii *ii, grn_id tid,
             continue;
           }
         }
+        c->chunk = chunk;
+        c->chunk_offset = bt->pos_in_chunk + (bt->size_in_chunk - (c->cpe - c->cp));
         if ((ii->header->flags & GRN_OBJ_WITH_POSITION)) {
           c->rdv[ii->n_elements - 1].flags = ODD;
         }
@@ -4140,6 +4959,33 @@ exit :
   return c;
 }
 
+/*
+ * Returns the index of the first chunk after the current one whose last
+ * record ID is not less than min. c->clrids is sorted, so gallop from
+ * the current chunk and then bisect the bracketed range.
+ */
+static inline uint32_t
+grn_ii_cursor_find_chunk(grn_ii_cursor *c, grn_id min)
+{
+  uint32_t low = c->curr_chunk, high, step = 1;
+  if (low >= c->nchunks || c->clrids[low] >= min) { return low; }
+  for (high = low + 1; high < c->nchunks && c->clrids[high] < min;) {
+    low = high;
+    step <<= 1;
+    high = low + step;
+  }
+  if (high > c->nchunks) { high = c->nchunks; }
+  while (low + 1 < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (c->clrids[mid] < min) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return high;
+}
+
 static inline void
 grn_ii_cursor_set_min(grn_ctx *ctx, grn_ii_cursor *c, grn_id min)
 {
@@ -4150,19 +4996,9 @@ grn_ii_cursor_set_min(grn_ctx *ctx, grn_ii_cursor *c, grn_id min)
   if (grn_ii_cursor_set_min_enable) {
     c->min = min;
     if (c->buf && c->pc.rid < c->min && c->curr_chunk < c->nchunks) {
-      uint32_t i, skip_chunk = 0;
-      grn_id rid;
-      for (i = 0, rid = GRN_ID_NIL; i < c->nchunks; i++) {
-        rid += c->cinfo[i].dgap;
-        if (rid < c->min) {
-          skip_chunk = i + 1;
-        } else {
-          rid -= c->cinfo[i].dgap;
-          break;
-        }
-      }
+      uint32_t skip_chunk = grn_ii_cursor_find_chunk(c, c->min);
       if (skip_chunk > c->curr_chunk) {
-        c->pc.rid = rid;
+        c->pc.rid = c->clrids[skip_chunk - 1];
         c->curr_chunk = skip_chunk;
         c->crp = c->cdp + c->cdf;
       }
@@ -4170,6 +5006,34 @@ grn_ii_cursor_set_min(grn_ctx *ctx, grn_ii_cursor *c, grn_id min)
   }
 }
 
+/*
+ * Skips postings whose record ID is less than c->min in the decoded
+ * chunk without materializing them.
+ */
+static inline void
+grn_ii_cursor_skip_chunk_postings(grn_ctx *ctx, grn_ii_cursor *c)
+{
+  uint32_t *crp = c->crp, *crpe = c->cdp + c->cdf;
+  uint32_t n;
+  grn_id rid = c->pc.rid;
+  while (crp < crpe && rid + *crp < c->min) {
+    rid += *crp++;
+  }
+  n = crp - c->crp;
+  if (!n) { return; }
+  if ((c->ii->header->flags & GRN_OBJ_WITH_POSITION)) {
+    uint32_t i, npos = 0;
+    for (i = 0; i < n; i++) { npos += 1 + c->ctp[i]; }
+    c->cpp += c->pc.rest + npos;
+  }
+  c->pc.rest = 0;
+  c->ctp += n;
+  if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) { c->csp += n; }
+  if ((c->ii->header->flags & GRN_OBJ_WITH_WEIGHT)) { c->cwp += n; }
+  c->crp = crp;
+  c->pc.rid = rid;
+}
+
 grn_ii_posting *
 grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
 {
@@ -4178,7 +5042,12 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
       if (c->stat & CHUNK_USED) {
         for (;;) {
           if (c->crp < c->cdp + c->cdf) {
-            uint32_t dgap = *c->crp++;
+            uint32_t dgap;
+            if (c->pc.rid < c->min) {
+              grn_ii_cursor_skip_chunk_postings(ctx, c);
+              if (c->crp == c->cdp + c->cdf) { continue; }
+            }
+            dgap = *c->crp++;
             c->pc.rid += dgap;
             if (dgap) { c->pc.sid = 0; }
             if ((c->ii->header->flags & GRN_OBJ_WITH_SECTION)) {
@@ -4222,7 +5091,21 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
             if (c->curr_chunk <= c->nchunks) {
               if (c->curr_chunk == c->nchunks) {
                 if (c->cp < c->cpe) {
-                  grn_p_decv(ctx, c->cp, c->cpe - c->cp, c->rdv, c->ii->n_elements);
+                  uint32_t size = c->cpe - c->cp;
+                  if (ii_chunk_cache_fetch(ctx, c->ii, c->id,
+                                           c->chunk, c->chunk_offset, size,
+                                           c->rdv, c->ii->n_elements)) {
+                    c->n_chunk_cache_hits++;
+                  } else {
+                    int n_values;
+                    n_values = grn_p_decv(ctx, c->ii, c->cp, size, c->rdv,
+                                          c->ii->n_elements);
+                    c->n_chunk_cache_misses++;
+                    ii_chunk_cache_store(ctx, c->ii, c->id,
+                                         c->chunk, c->chunk_offset, size,
+                                         c->chunk_generation,
+                                         c->rdv, c->ii->n_elements, n_values);
+                  }
                 } else {
                   c->pc.rid = 0;
                   break;
@@ -4230,20 +5113,30 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
               } else {
                 uint8_t *cp;
                 grn_io_win iw;
+                uint32_t segno = c->cinfo[c->curr_chunk].segno;
                 uint32_t size = c->cinfo[c->curr_chunk].size;
-                if (size && (cp = WIN_MAP(c->ii->chunk, ctx, &iw,
-                                          c->cinfo[c->curr_chunk].segno, 0,
-                                          size, grn_io_rdonly))) {
-                  grn_p_decv(ctx, cp, size, c->rdv, c->ii->n_elements);
+                if (size && ii_chunk_cache_fetch(ctx, c->ii, c->id,
+                                                 segno, 0, size,
+                                                 c->rdv, c->ii->n_elements)) {
+                  c->n_chunk_cache_hits++;
+                } else if (size && (cp = WIN_MAP(c->ii->chunk, ctx, &iw,
+                                                 segno, 0,
+                                                 size, grn_io_rdonly))) {
+                  int n_values;
+                  n_values = grn_p_decv(ctx, c->ii, cp, size, c->rdv,
+                                        c->ii->n_elements);
                   grn_io_win_unmap(&iw);
-                  if (chunk_is_reused(ctx, c->ii, c,
-                                      c->cinfo[c->curr_chunk].segno, size)) {
+                  c->n_chunk_cache_misses++;
+                  if (chunk_is_reused(ctx, c->ii, c, segno, size)) {
                     GRN_LOG(ctx, GRN_LOG_WARNING,
                             "chunk(%d) is reused by another thread",
-                            c->cinfo[c->curr_chunk].segno);
+                            segno);
                     c->pc.rid = 0;
                     break;
                   }
+                  ii_chunk_cache_store(ctx, c->ii, c->id, segno, 0, size,
+                                       c->chunk_generation,
+                                       c->rdv, c->ii->n_elements, n_values);
                 } else {
                   c->pc.rid = 0;
                   break;
@@ -4295,7 +5188,7 @@ grn_ii_cursor_next(grn_ctx *ctx, grn_ii_cursor *c)
             }
             if (c->pb.rid < c->min) {
               c->pb.rid = 0;
-              if (br->jump > 0) {
+              if (br->jump > 1) {
                 buffer_rec *jump_br = BUFFER_REC_AT(c->buf, br->jump);
                 uint8_t *jump_bp;
                 uint32_t jump_rid;
@@ -4431,8 +5324,11 @@ grn_rc
 grn_ii_cursor_close(grn_ctx *ctx, grn_ii_cursor *c)
 {
   if (!c) { return GRN_INVALID_ARGUMENT; }
+  ii_chunk_cache_update_statistics(c->n_chunk_cache_hits,
+                                   c->n_chunk_cache_misses);
   datavec_fin(ctx, c->rdv);
   if (c->cinfo) { GRN_FREE(c->cinfo); }
+  if (c->clrids) { GRN_FREE(c->clrids); }
   if (c->buf) { buffer_close(ctx, c->ii, c->buffer_pseg); }
   if (c->cp) { grn_io_win_unmap(&c->iw); }
   GRN_FREE(c);
@@ -5693,6 +6589,37 @@ grn_ii_posting_add(grn_ctx *ctx, grn_ii_posting *pos, grn_hash *s, grn_operator
   return ctx->rc;
 }
 
+/* Same as calling res_add() n_postings times for postings of a record
+   when subrecords aren't stored. */
+inline static void
+res_add_postings(grn_ctx *ctx, grn_hash *s, grn_rset_posinfo *pi,
+                 double score, int n_postings, grn_operator op)
+{
+  grn_rset_recinfo *ri;
+  switch (op) {
+  case GRN_OP_OR :
+    if (grn_hash_add(ctx, s, pi, s->key_size, (void **)&ri, NULL)) {
+      if (s->obj.header.flags & GRN_OBJ_WITH_SUBREC) {
+        ri->score += score;
+        ri->n_subrecs += n_postings;
+      }
+    }
+    break;
+  case GRN_OP_AND :
+    if (grn_hash_get(ctx, s, pi, s->key_size, (void **)&ri)) {
+      if (s->obj.header.flags & GRN_OBJ_WITH_SUBREC) {
+        ri->n_subrecs |= GRN_RSET_UTIL_BIT;
+        ri->score += score;
+        ri->n_subrecs += n_postings;
+      }
+    }
+    break;
+  default :
+    res_add(ctx, s, pi, score, op);
+    break;
+  }
+}
+
 #ifdef USE_BHEAP
 
 /* todo */
@@ -5798,6 +6725,150 @@ bt_pop(btr *bt)
 
 #endif /* USE_BHEAP */
 
+/* top-k */
+
+/*
+  It keeps the best "limit" records of a scored search. The root of
+  the heap is the worst kept record. Records are pushed in ascending
+  ID order, so a record that only ties the root is never better than
+  the root and is dropped.
+*/
+
+typedef struct {
+  grn_id rid;
+  int n_subrecs;
+  double score;
+} top_k_entry;
+
+typedef struct {
+  int n_entries;
+  int n_bins;
+  int limit;
+  top_k_entry *bins;
+  top_k_entry pending;
+  int64_t n_hits;
+} top_k_heap;
+
+#define TOP_K_HEAP_INITIAL_N_BINS 256
+
+static top_k_heap *
+top_k_heap_open(grn_ctx *ctx, int limit)
+{
+  top_k_heap *h = GRN_MALLOC(sizeof(top_k_heap));
+  if (!h) { return NULL; }
+  h->n_bins = limit < TOP_K_HEAP_INITIAL_N_BINS
+    ? limit
+    : TOP_K_HEAP_INITIAL_N_BINS;
+  if (h->n_bins == 0) {
+    /* Only counts records. */
+    h->bins = NULL;
+  } else if (!(h->bins = GRN_MALLOC(sizeof(top_k_entry) * h->n_bins))) {
+    GRN_FREE(h);
+    return NULL;
+  }
+  h->n_entries = 0;
+  h->limit = limit;
+  h->pending.rid = GRN_ID_NIL;
+  h->pending.n_subrecs = 0;
+  h->pending.score = 0;
+  h->n_hits = 0;
+  return h;
+}
+
+static void
+top_k_heap_close(grn_ctx *ctx, top_k_heap *h)
+{
+  if (!h) { return; }
+  if (h->bins) { GRN_FREE(h->bins); }
+  GRN_FREE(h);
+}
+
+static grn_rc
+top_k_heap_push(grn_ctx *ctx, top_k_heap *h, top_k_entry *entry)
+{
+  int n, n1, n2;
+  double score = entry->score;
+  top_k_entry *bins;
+  if (h->limit == 0) { return GRN_SUCCESS; }
+  if (h->n_entries < h->limit) {
+    if (h->n_entries >= h->n_bins) {
+      int max = h->n_bins * 2;
+      if (max > h->limit) { max = h->limit; }
+      bins = GRN_REALLOC(h->bins, sizeof(top_k_entry) * max);
+      if (!bins) { return GRN_NO_MEMORY_AVAILABLE; }
+      h->n_bins = max;
+      h->bins = bins;
+    }
+    bins = h->bins;
+    n = h->n_entries++;
+    while (n) {
+      n2 = (n - 1) >> 1;
+      if (bins[n2].score <= score) { break; }
+      bins[n] = bins[n2];
+      n = n2;
+    }
+  } else {
+    bins = h->bins;
+    if (score <= bins[0].score) { return GRN_SUCCESS; }
+    n = 0;
+    for (;;) {
+      n1 = n * 2 + 1;
+      n2 = n1 + 1;
+      if (n1 >= h->n_entries) { break; }
+      if (n2 < h->n_entries && bins[n2].score < bins[n1].score) { n1 = n2; }
+      if (score <= bins[n1].score) { break; }
+      bins[n] = bins[n1];
+      n = n1;
+    }
+  }
+  bins[n] = *entry;
+  return GRN_SUCCESS;
+}
+
+/* Sections of the same record arrive in a row, so they are summed up
+   before the record competes for a place in the heap. */
+static grn_rc
+top_k_heap_add(grn_ctx *ctx, top_k_heap *h, grn_id rid, double score)
+{
+  grn_rc rc = GRN_SUCCESS;
+  if (h->pending.rid != rid) {
+    if (h->pending.rid != GRN_ID_NIL) {
+      rc = top_k_heap_push(ctx, h, &(h->pending));
+    }
+    h->pending.rid = rid;
+    h->pending.n_subrecs = 0;
+    h->pending.score = 0;
+    h->n_hits++;
+  }
+  h->pending.score += score;
+  h->pending.n_subrecs++;
+  return rc;
+}
+
+static grn_rc
+top_k_heap_flush(grn_ctx *ctx, top_k_heap *h, grn_hash *s)
+{
+  int i;
+  grn_rc rc = GRN_SUCCESS;
+  if (h->pending.rid != GRN_ID_NIL) {
+    rc = top_k_heap_push(ctx, h, &(h->pending));
+    h->pending.rid = GRN_ID_NIL;
+  }
+  for (i = 0; i < h->n_entries; i++) {
+    top_k_entry *entry = &(h->bins[i]);
+    grn_rset_posinfo pi = {entry->rid, 0, 0};
+    grn_rset_recinfo *ri;
+    if (grn_hash_add(ctx, s, &pi, s->key_size, (void **)&ri, NULL)) {
+      if (s->obj.header.flags & GRN_OBJ_WITH_SUBREC) {
+        ri->score += entry->score;
+        ri->n_subrecs += entry->n_subrecs;
+      }
+    }
+  }
+  h->n_entries = 0;
+  return rc;
+}
+
 typedef enum {
   grn_wv_none = 0,
   grn_wv_static,
@@ -6315,9 +7386,38 @@ grn_ii_select_sequential_search(grn_ctx *ctx,
 }
 #endif
 
-grn_rc
-grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
-              grn_hash *s, grn_operator op, grn_select_optarg *optarg)
+/*
+  A partition restricts grn_ii_select_internal() to records in
+  [rid_min, rid_max]. Matched records are appended to records as
+  ii_select_record instead of being added to the result set because
+  partitions are processed by worker threads.
+*/
+typedef struct {
+  grn_id rid_min;
+  grn_id rid_max;
+  grn_obj *records;
+} ii_select_partition;
+
+const int II_SELECT_N_THREADS_MAX = 64;
+
+typedef struct {
+  grn_id rid;
+  uint32_t sid;
+  double score;
+} ii_select_record;
+
+static grn_rc grn_ii_select_parallel(grn_ctx *ctx, grn_ii *ii,
+                                     const char *string,
+                                     unsigned int string_len,
+                                     grn_hash *s, grn_operator op,
+                                     grn_select_optarg *optarg,
+                                     int n_workers);
+
+static grn_rc
+grn_ii_select_internal(grn_ctx *ctx, grn_ii *ii,
+                       const char *string, unsigned int string_len,
+                       grn_hash *s, grn_operator op, grn_select_optarg *optarg,
+                       ii_select_partition *partition)
 {
   btr *bt = NULL;
   grn_rc rc = GRN_SUCCESS;
@@ -6330,6 +7430,7 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_
   grn_obj *lexicon = ii->lexicon;
   grn_scorer_score_func *score_func = NULL;
   grn_scorer_matched_record record;
+  top_k_heap *top_k = NULL;
 
   if (!lexicon || !ii || !s) { return GRN_INVALID_ARGUMENT; }
   if (optarg) {
@@ -6401,12 +7502,33 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_
   }
   */
 #ifdef GRN_II_SELECT_ENABLE_SEQUENTIAL_SEARCH
-  if (grn_ii_select_sequential_search(ctx, ii, string, string_len,
+  if (!partition &&
+      grn_ii_select_sequential_search(ctx, ii, string, string_len,
                                       s, op, wvm, optarg, tis, n)) {
     goto exit;
   }
 #endif
 
+  if (!partition &&
+      grn_ii_select_n_threads > 1 &&
+      ctx->impl->top_k.limit < 0 &&
+      wvm != grn_wv_dynamic &&
+      !(optarg && optarg->scorer)) {
+    int n_workers =
+      (uint32_t)(*tis)->size / grn_ii_select_n_postings_per_thread_min;
+    if (n_workers > grn_ii_select_n_threads) {
+      n_workers = grn_ii_select_n_threads;
+    }
+    if (n_workers > II_SELECT_N_THREADS_MAX) {
+      n_workers = II_SELECT_N_THREADS_MAX;
+    }
+    if (n_workers > 1) {
+      rc = grn_ii_select_parallel(ctx, ii, string, string_len,
+                                  s, op, optarg, n_workers);
+      goto exit;
+    }
+  }
+
   if (optarg && optarg->scorer) {
     grn_proc *scorer = (grn_proc *)(optarg->scorer);
     score_func = scorer->callbacks.scorer.score;
@@ -6425,9 +7547,24 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_
     record.args_expr_offset = optarg->scorer_args_expr_offset;
   }
 
+  if (ctx->impl->top_k.limit >= 0 &&
+      op == GRN_OP_OR && !rep &&
+      GRN_HASH_SIZE(s) == 0 &&
+      DB_OBJ(s)->max_n_subrecs == 0) {
+    if (!(top_k = top_k_heap_open(ctx, ctx->impl->top_k.limit))) {
+      rc = GRN_NO_MEMORY_AVAILABLE;
+      goto exit;
+    }
+  }
+
+  if (partition && (*tis)->p->rid < partition->rid_min) {
+    if (token_info_skip(ctx, *tis, partition->rid_min, 0)) { goto exit; }
+  }
+
   for (;;) {
     rid = (*tis)->p->rid;
     sid = (*tis)->p->sid;
+    if (partition && rid > partition->rid_max) { goto exit; }
     for (tip = tis + 1, nrid = rid, nsid = sid + 1; tip < tie; tip++) {
       ti = *tip;
       if (token_info_skip(ctx, ti, rid, sid)) { goto exit; }
@@ -6536,7 +7673,23 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_
           } else {
             record_score = (noccur + tscore) * weight;
           }
-          res_add(ctx, s, &pi, record_score, op);
+          if (top_k) {
+            if ((rc = top_k_heap_add(ctx, top_k, rid, record_score))) {
+              goto exit;
+            }
+          } else if (partition) {
+            ii_select_record matched;
+            matched.rid = rid;
+            matched.sid = sid;
+            matched.score = record_score;
+            if ((rc = grn_bulk_write(ctx, partition->records,
+                                     (const char *)&matched,
+                                     sizeof(ii_select_record)))) {
+              goto exit;
+            }
+          } else {
+            res_add(ctx, s, &pi, record_score, op);
+          }
         }
 #undef SKIP_OR_BREAK
       }
@@ -6544,6 +7697,12 @@ grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_
     if (token_info_skip(ctx, *tis, nrid, nsid)) { goto exit; }
   }
 exit :
+  if (top_k) {
+    grn_rc flush_rc = top_k_heap_flush(ctx, top_k, s);
+    if (!rc) { rc = flush_rc; }
+    ctx->impl->top_k.n_hits = top_k->n_hits;
+    top_k_heap_close(ctx, top_k);
+  }
   if (score_func) {
     GRN_OBJ_FIN(ctx, &(record.terms));
     GRN_OBJ_FIN(ctx, &(record.term_weights));
@@ -6552,7 +7711,7 @@ exit :
     if (*tip) { token_info_close(ctx, *tip); }
   }
   if (tis) { GRN_FREE(tis); }
-  if (!only_skip_token) {
+  if (!only_skip_token && !partition) {
     grn_ii_resolve_sel_and(ctx, s, op);
   }
   //  grn_hash_cursor_clear(r);
@@ -6568,6 +7727,129 @@ exit :
   return rc;
 }
 
+/*
+  grn_ii_select_parallel() splits the record ID space of the indexed
+  table into n_workers ranges. Each worker traverses postings in its
+  range with its own grn_ctx and collects matched records. Collected
+  records are added to the result set in ascending record ID order
+  after all workers finish. So the result is the same as sequential
+  grn_ii_select().
+*/
+typedef struct {
+  grn_ctx ctx;
+  grn_ii *ii;
+  const char *string;
+  unsigned int string_len;
+  grn_hash *s;
+  grn_operator op;
+  grn_select_optarg *optarg;
+  ii_select_partition partition;
+  grn_obj records;
+  grn_rc rc;
+  grn_thread thread;
+  grn_bool running;
+} ii_select_worker;
+
+static grn_thread_func_result CALLBACK
+ii_select_worker_run(void *arg)
+{
+  ii_select_worker *worker = arg;
+  worker->rc = grn_ii_select_internal(&(worker->ctx), worker->ii,
+                                      worker->string, worker->string_len,
+                                      worker->s, worker->op, worker->optarg,
+                                      &(worker->partition));
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+static grn_rc
+grn_ii_select_parallel(grn_ctx *ctx, grn_ii *ii,
+                       const char *string, unsigned int string_len,
+                       grn_hash *s, grn_operator op, grn_select_optarg *optarg,
+                       int n_workers)
+{
+  int i;
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj *data_table;
+  grn_id max_id;
+  ii_select_worker *workers;
+
+  if (!(data_table = grn_ctx_at(ctx, DB_OBJ(ii)->range))) {
+    return ctx->rc;
+  }
+  max_id = grn_table_max_id(ctx, data_table);
+  if (max_id == GRN_ID_NIL) {
+    return GRN_SUCCESS;
+  }
+  if (!(workers = GRN_CALLOC(sizeof(ii_select_worker) * n_workers))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "[ii][select] search in parallel: n_threads:%d max_id:%u",
+          n_workers, max_id);
+  for (i = 0; i < n_workers; i++) {
+    ii_select_worker *worker = &(workers[i]);
+    grn_ctx_init(&(worker->ctx), 0);
+    grn_ctx_use(&(worker->ctx), grn_ctx_db(ctx));
+    GRN_TEXT_INIT(&(worker->records), 0);
+    worker->ii = ii;
+    worker->string = string;
+    worker->string_len = string_len;
+    worker->s = s;
+    worker->op = op;
+    worker->optarg = optarg;
+    worker->partition.rid_min =
+      GRN_ID_NIL + 1 + (uint64_t)max_id * i / n_workers;
+    worker->partition.rid_max =
+      GRN_ID_NIL + (uint64_t)max_id * (i + 1) / n_workers;
+    worker->partition.records = &(worker->records);
+  }
+  for (i = 0; i < n_workers; i++) {
+    ii_select_worker *worker = &(workers[i]);
+    if (THREAD_CREATE(worker->thread, ii_select_worker_run, worker)) {
+      SERR("[ii][select] failed to create worker thread");
+      rc = ctx->rc;
+      break;
+    }
+    worker->running = GRN_TRUE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    ii_select_worker *worker = &(workers[i]);
+    if (worker->running) {
+      THREAD_JOIN(worker->thread);
+    }
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    ii_select_worker *worker = &(workers[i]);
+    if (!rc && worker->running) {
+      if (worker->rc) {
+        rc = worker->rc;
+        ERR(rc, "[ii][select] worker<%d>: %s", i, worker->ctx.errbuf);
+      } else {
+        ii_select_record *record, *record_end;
+        record = (ii_select_record *)GRN_BULK_HEAD(&(worker->records));
+        record_end = (ii_select_record *)GRN_BULK_CURR(&(worker->records));
+        for (; record < record_end; record++) {
+          grn_rset_posinfo pi = {record->rid, record->sid, 0};
+          res_add(ctx, s, &pi, record->score, op);
+        }
+      }
+    }
+    GRN_OBJ_FIN(&(worker->ctx), &(worker->records));
+    grn_ctx_fin(&(worker->ctx));
+  }
+  GRN_FREE(workers);
+  return rc;
+}
+
+grn_rc
+grn_ii_select(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len,
+              grn_hash *s, grn_operator op, grn_select_optarg *optarg)
+{
+  return grn_ii_select_internal(ctx, ii, string, string_len,
+                                s, op, optarg, NULL);
+}
+
 uint32_t
 grn_ii_estimate_size_for_query(grn_ctx *ctx, grn_ii *ii,
                                const char *query, unsigned int query_len,
@@ -6692,6 +7974,11 @@ grn_ii_sel(grn_ctx *ctx, grn_ii *ii, const char *string, unsigned int string_len
     /* todo : support subrec
     grn_rset_init(ctx, s, grn_rec_document, 0, grn_rec_none, 0, 0);
     */
+    if (op == GRN_OP_OR && ctx->impl->match_escalation_threshold > 0) {
+      /* Escalated searches are merged into the same result set, so
+         records dropped by top-k search could not be counted. */
+      ctx->impl->top_k.limit = -1;
+    }
     if (grn_ii_select(ctx, ii, string, string_len, s, op, &arg)) {
       GRN_LOG(ctx, GRN_LOG_ERROR, "grn_ii_select on grn_ii_sel(1) failed !");
       return ctx->rc;
@@ -6736,6 +8023,100 @@ grn_ii_at(grn_ctx *ctx, grn_ii *ii, grn_id id, grn_hash *s, grn_operator op)
   return ctx->rc;
 }
 
+typedef struct {
+  grn_id rid;
+  grn_ii_cursor *cursor;
+} ii_cursor_heap_entry;
+
+inline static void
+ii_cursor_heap_sift_down(ii_cursor_heap_entry *heap, int n_entries)
+{
+  int n = 0, n1, n2;
+  ii_cursor_heap_entry entry = heap[0];
+  for (;;) {
+    n1 = n * 2 + 1;
+    n2 = n1 + 1;
+    if (n1 >= n_entries) { break; }
+    if (n2 < n_entries && heap[n2].rid < heap[n1].rid) { n1 = n2; }
+    if (entry.rid <= heap[n1].rid) { break; }
+    heap[n] = heap[n1];
+    n = n1;
+  }
+  heap[n] = entry;
+}
+
+/*
+ * Adds postings of all terms in terms, a hash whose keys are term IDs,
+ * to s. Cursors of the terms are merged by a heap ordered by record ID
+ * so that each record is looked up in s only once with the sum of the
+ * scores of its postings. The result is the same as calling grn_ii_at()
+ * for each term except the order of records in s.
+ */
+grn_rc
+grn_ii_at_terms(grn_ctx *ctx, grn_ii *ii, grn_hash *terms, grn_hash *s,
+                grn_operator op)
+{
+  ii_cursor_heap_entry *heap;
+  grn_id *tid;
+  grn_ii_cursor *c;
+  int n, n2, n_entries = 0;
+
+  if (GRN_HASH_SIZE(terms) == 0) { return ctx->rc; }
+  if (GRN_HASH_SIZE(terms) == 1 ||
+      s->key_size != sizeof(grn_id) ||
+      DB_OBJ(s)->max_n_subrecs > 0) {
+    GRN_HASH_EACH(ctx, terms, id, &tid, NULL, NULL, {
+      grn_ii_at(ctx, ii, *tid, s, op);
+    });
+    return ctx->rc;
+  }
+
+  if (!(heap = GRN_MALLOCN(ii_cursor_heap_entry, GRN_HASH_SIZE(terms)))) {
+    return ctx->rc;
+  }
+  GRN_HASH_EACH(ctx, terms, id, &tid, NULL, NULL, {
+    if ((c = grn_ii_cursor_open(ctx, ii, *tid, GRN_ID_NIL, GRN_ID_MAX,
+                                ii->n_elements - 1, 0))) {
+      if (grn_ii_cursor_next(ctx, c)) {
+        n = n_entries++;
+        while (n) {
+          n2 = (n - 1) >> 1;
+          if (heap[n2].rid <= c->post->rid) { break; }
+          heap[n] = heap[n2];
+          n = n2;
+        }
+        heap[n].rid = c->post->rid;
+        heap[n].cursor = c;
+      } else {
+        grn_ii_cursor_close(ctx, c);
+      }
+    }
+  });
+  while (n_entries > 0) {
+    grn_rset_posinfo pi = {heap[0].rid, 0, 0};
+    double score = 0;
+    int n_postings = 0;
+    do {
+      grn_ii_posting *posting;
+      c = heap[0].cursor;
+      score += 1 + c->post->weight;
+      n_postings++;
+      if ((posting = grn_ii_cursor_next(ctx, c))) {
+        if (posting->rid == pi.rid) { continue; }
+        heap[0].rid = posting->rid;
+      } else {
+        grn_ii_cursor_close(ctx, c);
+        if (--n_entries == 0) { break; }
+        heap[0] = heap[n_entries];
+      }
+      ii_cursor_heap_sift_down(heap, n_entries);
+    } while (heap[0].rid == pi.rid);
+    res_add_postings(ctx, s, &pi, score, n_postings, op);
+  }
+  GRN_FREE(heap);
+  return ctx->rc;
+}
+
 void
 grn_ii_resolve_sel_and(grn_ctx *ctx, grn_hash *s, grn_operator op)
 {
@@ -6811,7 +8192,8 @@ grn_ii_cursor_next_all(grn_ctx *ctx, grn_ii_cursor *c)
             if (c->curr_chunk <= c->nchunks) {
               if (c->curr_chunk == c->nchunks) {
                 if (c->cp < c->cpe) {
-                  grn_p_decv(ctx, c->cp, c->cpe - c->cp, c->rdv, c->ii->n_elements);
+                  grn_p_decv(ctx, c->ii, c->cp, c->cpe - c->cp, c->rdv,
+                             c->ii->n_elements);
                 } else {
                   c->pc.rid = 0;
                   break;
@@ -6823,7 +8205,7 @@ grn_ii_cursor_next_all(grn_ctx *ctx, grn_ii_cursor *c)
                 if (size && (cp = WIN_MAP(c->ii->chunk, ctx, &iw,
                                           c->cinfo[c->curr_chunk].segno, 0,
                                           size, grn_io_rdonly))) {
-                  grn_p_decv(ctx, cp, size, c->rdv, c->ii->n_elements);
+                  grn_p_decv(ctx, c->ii, cp, size, c->rdv, c->ii->n_elements);
                   grn_io_win_unmap(&iw);
                 } else {
                   c->pc.rid = 0;
@@ -7035,6 +8417,7 @@ const char *TMPFILE_PATH = "grn_ii_buffer_tmp";
 const uint32_t II_BUFFER_NCOUNTERS_MARGIN = 0x100000;
 const size_t II_BUFFER_BLOCK_SIZE = 0x1000000;
 const uint32_t II_BUFFER_BLOCK_READ_UNIT_SIZE = 0x200000;
+const int II_BUFFER_N_THREADS_MAX = 64;
 
 typedef struct {
   uint32_t nrecs;
@@ -7094,6 +8477,9 @@ struct _grn_ii_buffer {
   size_t packed_buf_size;
   size_t packed_len;
   size_t total_chunk_size;
+  // stuff for parsing in parallel
+  grn_ii_buffer *parent;
+  grn_critical_section lock;
 };
 
 static ii_buffer_block *
@@ -7312,16 +8698,27 @@ grn_ii_buffer_flush(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
   size_t encsize;
   uint8_t *outbuf;
   ii_buffer_block *block;
+  grn_ii_buffer *parent = ii_buffer->parent;
   GRN_LOG(ctx, GRN_LOG_NOTICE, "flushing:%d npostings:%" GRN_FMT_SIZE,
           ii_buffer->nblocks, ii_buffer->block_pos);
   if (!(block = block_new(ctx, ii_buffer))) { return; }
   if (!(outbuf = allocate_outbuf(ctx, ii_buffer))) { return; }
+  /* Workers share the lexicon and the temporary file with the parent. */
+  if (parent) { CRITICAL_SECTION_ENTER(parent->lock); }
   encsize = encode_terms(ctx, ii_buffer, outbuf, block);
+  if (parent) { CRITICAL_SECTION_LEAVE(parent->lock); }
   encode_postings(ctx, ii_buffer, outbuf);
   encode_last_tf(ctx, ii_buffer, outbuf);
+  if (parent) {
+    CRITICAL_SECTION_ENTER(parent->lock);
+    ii_buffer->filepos = parent->filepos;
+    block->head = parent->filepos;
+  }
   {
-    ssize_t r = grn_write(ii_buffer->tmpfd, outbuf, encsize);
+    int tmpfd = parent ? parent->tmpfd : ii_buffer->tmpfd;
+    ssize_t r = grn_write(tmpfd, outbuf, encsize);
     if (r != encsize) {
+      if (parent) { CRITICAL_SECTION_LEAVE(parent->lock); }
       ERR(GRN_INPUT_OUTPUT_ERROR, "write returned %" GRN_FMT_LLD " != %" GRN_FMT_LLU,
           (long long int)r, (unsigned long long int)encsize);
       return;
@@ -7329,6 +8726,10 @@ grn_ii_buffer_flush(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
     ii_buffer->filepos += r;
     block->tail = ii_buffer->filepos;
   }
+  if (parent) {
+    parent->filepos = ii_buffer->filepos;
+    CRITICAL_SECTION_LEAVE(parent->lock);
+  }
   GRN_FREE(outbuf);
   memset(ii_buffer->counters, 0,
          grn_table_size(ctx, ii_buffer->tmp_lexicon) *
@@ -7767,7 +9168,7 @@ grn_ii_buffer_merge(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
       bt = &term_buffer->terms[nterm];
       a[0] = SEG2POS(ii_buffer->lseg,
                      (sizeof(buffer_header) + sizeof(buffer_term) * nterm));
-      packed_len = grn_p_encv(ctx, ii_buffer->data_vectors,
+      packed_len = grn_p_encv(ctx, ii_buffer->ii, ii_buffer->data_vectors,
                               ii_buffer->ii->n_elements,
                               ii_buffer->packed_buf +
                               ii_buffer->packed_len);
@@ -7812,6 +9213,8 @@ grn_ii_buffer_open(grn_ctx *ctx, grn_ii *ii,
       ii_buffer->packed_len = 0;
       ii_buffer->packed_buf_size = 0;
       ii_buffer->total_chunk_size = 0;
+      ii_buffer->parent = NULL;
+      CRITICAL_SECTION_INIT(ii_buffer->lock);
       if (ii_buffer->counters) {
         ii_buffer->block_buf = GRN_MALLOCN(grn_id, II_BUFFER_BLOCK_SIZE);
         if (ii_buffer->block_buf) {
@@ -7941,10 +9344,14 @@ grn_rc
 grn_ii_buffer_close(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
 {
   uint32_t i;
-  grn_obj_flags flags;
-  grn_table_get_info(ctx, ii_buffer->ii->lexicon, &flags, NULL, NULL, NULL, NULL);
-  if ((flags & GRN_OBJ_TABLE_TYPE_MASK) == GRN_OBJ_TABLE_PAT_KEY) {
-    grn_pat_cache_disable(ctx, (grn_pat *)ii_buffer->ii->lexicon);
+  if (!ii_buffer->parent) {
+    grn_obj_flags flags;
+    grn_table_get_info(ctx, ii_buffer->ii->lexicon, &flags,
+                       NULL, NULL, NULL, NULL);
+    if ((flags & GRN_OBJ_TABLE_TYPE_MASK) == GRN_OBJ_TABLE_PAT_KEY) {
+      grn_pat_cache_disable(ctx, (grn_pat *)ii_buffer->ii->lexicon);
+    }
+    CRITICAL_SECTION_FIN(ii_buffer->lock);
   }
   if (ii_buffer->tmp_lexicon) {
     grn_obj_close(ctx, ii_buffer->tmp_lexicon);
@@ -7971,6 +9378,48 @@ grn_ii_buffer_close(grn_ctx *ctx, grn_ii_buffer *ii_buffer)
   return ctx->rc;
 }
 
+static void
+grn_ii_buffer_parse_record(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                           grn_id rid, grn_obj *rv, int ncols, grn_obj **cols)
+{
+  int sid;
+  grn_obj **col;
+  for (sid = 1, col = cols; sid <= ncols; sid++, col++) {
+    grn_obj_reinit_for(ctx, rv, *col);
+    if (GRN_OBJ_TABLEP(*col)) {
+      grn_table_get_key2(ctx, *col, rid, rv);
+    } else {
+      grn_obj_get_value(ctx, *col, rid, rv);
+    }
+    switch (rv->header.type) {
+    case GRN_BULK :
+      grn_ii_buffer_tokenize(ctx, ii_buffer, rid, sid, 0,
+                             GRN_TEXT_VALUE(rv), GRN_TEXT_LEN(rv));
+      break;
+    case GRN_VECTOR :
+      if (rv->u.v.body) {
+        int i;
+        int n_sections = rv->u.v.n_sections;
+        grn_section *sections = rv->u.v.sections;
+        const char *head = GRN_BULK_HEAD(rv->u.v.body);
+        for (i = 0; i < n_sections; i++) {
+          grn_section *section = sections + i;
+          if (section->length == 0) {
+            continue;
+          }
+          grn_ii_buffer_tokenize(ctx, ii_buffer, rid,
+                                 sid, section->weight,
+                                 head + section->offset, section->length);
+        }
+      }
+      break;
+    default :
+      ERR(GRN_INVALID_ARGUMENT, "[index] invalid object assigned as value");
+      break;
+    }
+  }
+}
+
 static void
 grn_ii_buffer_parse(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
                     grn_obj *target, int ncols, grn_obj **cols)
@@ -7983,48 +9432,186 @@ grn_ii_buffer_parse(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
     grn_obj rv;
     GRN_TEXT_INIT(&rv, 0);
     while ((rid = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
-      int sid;
-      grn_obj **col;
-      for (sid = 1, col = cols; sid <= ncols; sid++, col++) {
-        grn_obj_reinit_for(ctx, &rv, *col);
-        if (GRN_OBJ_TABLEP(*col)) {
-          grn_table_get_key2(ctx, *col, rid, &rv);
-        } else {
-          grn_obj_get_value(ctx, *col, rid, &rv);
-        }
-        switch (rv.header.type) {
-        case GRN_BULK :
-          grn_ii_buffer_tokenize(ctx, ii_buffer, rid, sid, 0,
-                                 GRN_TEXT_VALUE(&rv), GRN_TEXT_LEN(&rv));
-          break;
-        case GRN_VECTOR :
-          if (rv.u.v.body) {
-            int i;
-            int n_sections = rv.u.v.n_sections;
-            grn_section *sections = rv.u.v.sections;
-            const char *head = GRN_BULK_HEAD(rv.u.v.body);
-            for (i = 0; i < n_sections; i++) {
-              grn_section *section = sections + i;
-              if (section->length == 0) {
-                continue;
-              }
-              grn_ii_buffer_tokenize(ctx, ii_buffer, rid,
-                                     sid, section->weight,
-                                     head + section->offset, section->length);
-            }
-          }
-          break;
-        default :
-          ERR(GRN_INVALID_ARGUMENT, "[index] invalid object assigned as value");
-          break;
-        }
-      }
+      grn_ii_buffer_parse_record(ctx, ii_buffer, rid, &rv, ncols, cols);
     }
     GRN_OBJ_FIN(ctx, &rv);
     grn_table_cursor_close(ctx, tc);
   }
 }
 
+/*
+  Records are partitioned into ID ranges and each range is tokenized
+  by a worker thread with its own context. Workers write blocks to the
+  temporary file of the parent. Blocks are collected in the range
+  order, so postings of each term are still sorted by record ID when
+  grn_ii_buffer_commit() merges them.
+*/
+typedef struct {
+  grn_ctx ctx;
+  grn_ii_buffer *ii_buffer;
+  grn_obj *target;
+  int ncols;
+  grn_obj **cols;
+  grn_id start;
+  grn_id end;
+  grn_thread thread;
+  grn_bool running;
+} ii_buffer_worker;
+
+static grn_ii_buffer *
+ii_buffer_worker_open(grn_ctx *ctx, grn_ii_buffer *parent,
+                      size_t block_buf_size)
+{
+  grn_ii_buffer *ii_buffer = GRN_MALLOCN(grn_ii_buffer, 1);
+  if (!ii_buffer) { return NULL; }
+  memset(ii_buffer, 0, sizeof(grn_ii_buffer));
+  ii_buffer->ii = parent->ii;
+  ii_buffer->lexicon = parent->lexicon;
+  ii_buffer->parent = parent;
+  ii_buffer->tmpfd = -1;
+  ii_buffer->ncounters = II_BUFFER_NCOUNTERS_MARGIN;
+  ii_buffer->counters = GRN_CALLOC(ii_buffer->ncounters *
+                                   sizeof(ii_buffer_counter));
+  ii_buffer->block_buf = GRN_MALLOCN(grn_id, block_buf_size);
+  ii_buffer->block_buf_size = block_buf_size;
+  if (!ii_buffer->counters || !ii_buffer->block_buf) {
+    grn_ii_buffer_close(ctx, ii_buffer);
+    return NULL;
+  }
+  return ii_buffer;
+}
+
+static grn_thread_func_result CALLBACK
+ii_buffer_worker_run(void *arg)
+{
+  ii_buffer_worker *worker = arg;
+  grn_ctx *ctx = &(worker->ctx);
+  grn_ii_buffer *ii_buffer = worker->ii_buffer;
+  grn_id rid;
+  grn_obj rv;
+  GRN_TEXT_INIT(&rv, 0);
+  for (rid = worker->start; rid < worker->end; rid++) {
+    if (grn_table_at(ctx, worker->target, rid) == GRN_ID_NIL) { continue; }
+    grn_ii_buffer_parse_record(ctx, ii_buffer, rid, &rv,
+                               worker->ncols, worker->cols);
+  }
+  GRN_OBJ_FIN(ctx, &rv);
+  if (ii_buffer->block_pos) {
+    grn_ii_buffer_flush(ctx, ii_buffer);
+  }
+  return GRN_THREAD_FUNC_RETURN_VALUE;
+}
+
+static void
+grn_ii_buffer_parse_parallel(grn_ctx *ctx, grn_ii_buffer *ii_buffer,
+                             grn_obj *target, int ncols, grn_obj **cols)
+{
+  int i, n_workers = grn_ii_build_n_threads;
+  grn_id max_id = grn_table_max_id(ctx, target);
+  size_t block_buf_size;
+  ii_buffer_worker *workers;
+
+  if (n_workers > II_BUFFER_N_THREADS_MAX) {
+    n_workers = II_BUFFER_N_THREADS_MAX;
+  }
+  if (max_id / grn_ii_build_n_records_per_thread_min < n_workers) {
+    n_workers = max_id / grn_ii_build_n_records_per_thread_min;
+  }
+  if (n_workers <= 1) {
+    grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+    return;
+  }
+  if (!(workers = GRN_CALLOC(sizeof(ii_buffer_worker) * n_workers))) {
+    grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+    return;
+  }
+  /* Workers split the block buffer of the parent. It isn't used while
+     workers parse records. */
+  GRN_FREE(ii_buffer->block_buf);
+  ii_buffer->block_buf = NULL;
+  ii_buffer->block_buf_size = 0;
+  block_buf_size = II_BUFFER_BLOCK_SIZE / n_workers;
+  for (i = 0; i < n_workers; i++) {
+    ii_buffer_worker *worker = &(workers[i]);
+    grn_ctx_init(&(worker->ctx), 0);
+    grn_ctx_use(&(worker->ctx), grn_ctx_db(ctx));
+    worker->target = target;
+    worker->ncols = ncols;
+    worker->cols = cols;
+    worker->start = GRN_ID_NIL + 1 + (uint64_t)max_id * i / n_workers;
+    worker->end = GRN_ID_NIL + 1 + (uint64_t)max_id * (i + 1) / n_workers;
+    worker->ii_buffer = ii_buffer_worker_open(&(worker->ctx), ii_buffer,
+                                              block_buf_size);
+    if (!worker->ii_buffer) {
+      break;
+    }
+  }
+  if (i < n_workers) {
+    int n_initialized = i + 1;
+    GRN_LOG(ctx, GRN_LOG_WARNING,
+            "[ii][build] failed to allocate buffer for worker: <%d>: "
+            "parse sequentially", i);
+    for (i = 0; i < n_initialized; i++) {
+      ii_buffer_worker *worker = &(workers[i]);
+      if (worker->ii_buffer) {
+        grn_ii_buffer_close(&(worker->ctx), worker->ii_buffer);
+      }
+      grn_ctx_fin(&(worker->ctx));
+    }
+    GRN_FREE(workers);
+    ii_buffer->block_buf = GRN_MALLOCN(grn_id, II_BUFFER_BLOCK_SIZE);
+    if (!ii_buffer->block_buf) { return; }
+    ii_buffer->block_buf_size = II_BUFFER_BLOCK_SIZE;
+    grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+    return;
+  }
+
+  GRN_LOG(ctx, GRN_LOG_NOTICE,
+          "[ii][build] parse in parallel: n_threads:%d max_id:%u",
+          n_workers, max_id);
+  for (i = 0; i < n_workers; i++) {
+    ii_buffer_worker *worker = &(workers[i]);
+    if (THREAD_CREATE(worker->thread, ii_buffer_worker_run, worker)) {
+      GRN_LOG(ctx, GRN_LOG_WARNING,
+              "[ii][build] failed to create worker thread: <%d>: "
+              "parse in the current thread", i);
+      ii_buffer_worker_run(worker);
+      continue;
+    }
+    worker->running = GRN_TRUE;
+  }
+  for (i = 0; i < n_workers; i++) {
+    ii_buffer_worker *worker = &(workers[i]);
+    if (worker->running) {
+      THREAD_JOIN(worker->thread);
+    }
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    ii_buffer_worker *worker = &(workers[i]);
+    grn_ii_buffer *worker_buffer = worker->ii_buffer;
+    if (worker_buffer) {
+      if (worker->ctx.rc && !ctx->rc) {
+        ERR(worker->ctx.rc, "[ii][build] worker<%d>: %s",
+            i, worker->ctx.errbuf);
+      }
+      if (!ctx->rc) {
+        uint32_t j;
+        for (j = 0; j < worker_buffer->nblocks; j++) {
+          ii_buffer_block *block = block_new(ctx, ii_buffer);
+          if (!block) { break; }
+          *block = worker_buffer->blocks[j];
+          ii_buffer->nblocks++;
+        }
+        ii_buffer->total_size += worker_buffer->total_size;
+      }
+      grn_ii_buffer_close(&(worker->ctx), worker_buffer);
+    }
+    grn_ctx_fin(&(worker->ctx));
+  }
+  GRN_FREE(workers);
+}
+
 grn_rc
 grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
 {
@@ -8059,7 +9646,12 @@ grn_ii_build(grn_ctx *ctx, grn_ii *ii, uint64_t sparsity)
             target = grn_ctx_at(ctx, target->header.domain);
           }
           if (target) {
-            grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+            if (grn_ii_build_n_threads > 1) {
+              grn_ii_buffer_parse_parallel(ctx, ii_buffer,
+                                           target, ncols, cols);
+            } else {
+              grn_ii_buffer_parse(ctx, ii_buffer, target, ncols, cols);
+            }
             grn_ii_buffer_commit(ctx, ii_buffer);
           } else {
             ERR(GRN_INVALID_ARGUMENT, "failed to resolve the target");
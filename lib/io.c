@@ -60,6 +60,7 @@ typedef struct _grn_io_fileinfo {
 #define IO_HEADER_SIZE 64
 
 static uint32_t grn_io_version_default = GRN_IO_VERSION_DEFAULT;
+static uint64_t grn_io_max_mapped_size = 0;
 
 inline static grn_rc grn_fileinfo_open(grn_ctx *ctx, fileinfo *fi, const char *path, int flags);
 inline static void grn_fileinfo_init(fileinfo *fis, int nfis);
@@ -110,6 +111,141 @@ grn_io_init_from_env(void)
   if (version_env[0]) {
     grn_io_version_default = atoi(version_env);
   }
+
+  {
+    char max_mapped_size_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_IO_MAX_MAPPED_SIZE",
+               max_mapped_size_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (max_mapped_size_env[0]) {
+      grn_io_max_mapped_size = strtoull(max_mapped_size_env, NULL, 0);
+    }
+  }
+}
+
+/*
+ * The segment manager keeps the total size of mapped segments under
+ * GRN_IO_MAX_MAPPED_SIZE. It manages file backed ios that use
+ * GRN_IO_EXPIRE_SEGMENT such as columns and inverted indexes. Their
+ * segments are reference counted by GRN_IO_SEG_REF() and
+ * GRN_IO_SEG_UNREF() so that unreferenced segments can be unmapped at
+ * any time. Ios that cache segment addresses, such as hash tables and
+ * patricia tries, aren't managed.
+ *
+ * Eviction uses the CLOCK algorithm. GRN_IO_SEG_REF() marks the
+ * segment as accessed and the clock hand visits managed ios in turn.
+ * An accessed segment gets a second chance. An unaccessed and
+ * unreferenced segment is unmapped.
+ *
+ * Segments are evicted at any time. The GRN_IO_MAX_REF handshake in
+ * grn_io_seg_expire() unmaps only unreferenced segments. Callers such
+ * as grn_table_sort() that keep using values after they unref their
+ * segments pin the io by grn_io_pin() while they use the values. A
+ * segment of a pinned io isn't evicted. The pin is checked while the
+ * segment is held by the handshake, so a value referenced after
+ * grn_io_pin() stays mapped until grn_io_unpin().
+ */
+#define GRN_IO_SEGMENT_MANAGER_MAX_N_SCANS 4096
+
+#define GRN_IO_SEGMENT_MANAGED_P(io)\
+  ((io)->fis &&\
+   ((io)->flags &\
+    (GRN_IO_EXPIRE_GTICK|GRN_IO_EXPIRE_SEGMENT|GRN_IO_TEMPORARY)) ==\
+   GRN_IO_EXPIRE_SEGMENT)
+
+static struct {
+  grn_critical_section lock;
+  grn_io *ios;
+  grn_io *clock_hand;
+  /* in KiB to update atomically */
+  uint32_t mapped_size;
+  uint64_t n_evictions;
+} grn_io_segment_manager;
+
+inline static uint32_t
+grn_io_segment_manager_size(grn_io *io)
+{
+  return (io->header->segment_size + 1023) / 1024;
+}
+
+void
+grn_io_segment_manager_init(void)
+{
+  CRITICAL_SECTION_INIT(grn_io_segment_manager.lock);
+  grn_io_segment_manager.ios = NULL;
+  grn_io_segment_manager.clock_hand = NULL;
+  grn_io_segment_manager.mapped_size = 0;
+  grn_io_segment_manager.n_evictions = 0;
+}
+
+void
+grn_io_segment_manager_fin(void)
+{
+  CRITICAL_SECTION_FIN(grn_io_segment_manager.lock);
+}
+
+static void
+grn_io_segment_manager_add(grn_io *io)
+{
+  CRITICAL_SECTION_ENTER(grn_io_segment_manager.lock);
+  io->managed_prev = NULL;
+  io->managed_next = grn_io_segment_manager.ios;
+  if (io->managed_next) {
+    io->managed_next->managed_prev = io;
+  }
+  grn_io_segment_manager.ios = io;
+  CRITICAL_SECTION_LEAVE(grn_io_segment_manager.lock);
+}
+
+static void
+grn_io_segment_manager_remove(grn_io *io)
+{
+  CRITICAL_SECTION_ENTER(grn_io_segment_manager.lock);
+  if (grn_io_segment_manager.clock_hand == io) {
+    grn_io_segment_manager.clock_hand = io->managed_next;
+  }
+  if (io->managed_prev) {
+    io->managed_prev->managed_next = io->managed_next;
+  } else {
+    grn_io_segment_manager.ios = io->managed_next;
+  }
+  if (io->managed_next) {
+    io->managed_next->managed_prev = io->managed_prev;
+  }
+  io->managed_next = NULL;
+  io->managed_prev = NULL;
+  CRITICAL_SECTION_LEAVE(grn_io_segment_manager.lock);
+}
+
+void
+grn_io_pin(grn_io *io)
+{
+  uint32_t n_pins;
+  GRN_ATOMIC_ADD_EX(&(io->n_pins), 1, n_pins);
+}
+
+void
+grn_io_unpin(grn_io *io)
+{
+  uint32_t n_pins;
+  GRN_ATOMIC_ADD_EX(&(io->n_pins), -1, n_pins);
+}
+
+void
+grn_io_segment_manager_get_statistics(grn_io_segment_manager_statistics *statistics)
+{
+  grn_io *io;
+  statistics->mapped_size = 0;
+  statistics->max_mapped_size = grn_io_max_mapped_size;
+  statistics->n_faults = 0;
+  CRITICAL_SECTION_ENTER(grn_io_segment_manager.lock);
+  for (io = grn_io_segment_manager.ios; io; io = io->managed_next) {
+    statistics->mapped_size +=
+      (uint64_t)(io->nmaps) * io->header->segment_size;
+    statistics->n_faults += io->nfaults;
+  }
+  statistics->n_evictions = grn_io_segment_manager.n_evictions;
+  CRITICAL_SECTION_LEAVE(grn_io_segment_manager.lock);
 }
 
 static inline uint32_t
@@ -202,6 +338,11 @@ grn_io_create_tmp(uint32_t header_size, uint32_t segment_size,
         io->count = 0;
         io->flags = GRN_IO_TEMPORARY;
         io->lock = &header->lock;
+        io->nfaults = 0;
+        io->clock_hand = 0;
+        io->n_pins = 0;
+        io->managed_next = NULL;
+        io->managed_prev = NULL;
         io->path[0] = '\0';
         return io;
       }
@@ -215,6 +356,9 @@ grn_io_create_tmp(uint32_t header_size, uint32_t segment_size,
 static void
 grn_io_register(grn_io *io)
 {
+  if (GRN_IO_SEGMENT_MANAGED_P(io)) {
+    grn_io_segment_manager_add(io);
+  }
   if (io->fis && (io->flags & (GRN_IO_EXPIRE_GTICK|GRN_IO_EXPIRE_SEGMENT))) {
     grn_bool succeeded = GRN_FALSE;
     CRITICAL_SECTION_ENTER(grn_glock);
@@ -234,6 +378,9 @@ grn_io_register(grn_io *io)
 static void
 grn_io_unregister(grn_io *io)
 {
+  if (GRN_IO_SEGMENT_MANAGED_P(io)) {
+    grn_io_segment_manager_remove(io);
+  }
   if (io->fis && (io->flags & (GRN_IO_EXPIRE_GTICK|GRN_IO_EXPIRE_SEGMENT))) {
     grn_bool succeeded = GRN_FALSE;
     CRITICAL_SECTION_ENTER(grn_glock);
@@ -304,6 +451,11 @@ grn_io_create(grn_ctx *ctx, const char *path, uint32_t header_size, uint32_t seg
             io->count = 0;
             io->flags = flags;
             io->lock = &header->lock;
+            io->nfaults = 0;
+            io->clock_hand = 0;
+            io->n_pins = 0;
+            io->managed_next = NULL;
+            io->managed_prev = NULL;
             grn_io_register(io);
             return io;
           }
@@ -562,6 +714,11 @@ grn_io_open(grn_ctx *ctx, const char *path, grn_io_mode mode)
             io->count = 0;
             io->flags = header->flags;
             io->lock = &header->lock;
+            io->nfaults = 0;
+            io->clock_hand = 0;
+            io->n_pins = 0;
+            io->managed_next = NULL;
+            io->managed_prev = NULL;
             if (!array_init(io, io->header->n_arrays)) {
               grn_io_register(io);
               return io;
@@ -610,6 +767,12 @@ grn_io_close(grn_ctx *ctx, grn_io *io)
           fi = &io->fis[fno];
         }
         GRN_MUNMAP(&grn_gctx, io, &mi->fmo, fi, mi->map, segment_size);
+        if (GRN_IO_SEGMENT_MANAGED_P(io)) {
+          uint32_t mapped_size;
+          GRN_ATOMIC_ADD_EX(&(grn_io_segment_manager.mapped_size),
+                            -grn_io_segment_manager_size(io),
+                            mapped_size);
+        }
       }
     }
     GRN_GFREE(io->maps);
@@ -1037,46 +1200,10 @@ grn_io_win_unmap(grn_io_win *iw)
   }
 }
 
-#define DO_MAP(io,fmo,fi,pos,size,segno,res) do {\
-  if (((res) = GRN_MMAP(&grn_gctx, (io), (fmo), (fi), (pos), (size)))) {\
-    uint32_t nmaps;\
-    if (io->max_map_seg < segno) { io->max_map_seg = segno; }\
-    GRN_ATOMIC_ADD_EX(&io->nmaps, 1, nmaps);\
-    {\
-      uint64_t tail = io->base + (uint64_t)(size) * ((segno) + 1);\
-      if (tail > io->header->curr_size) { io->header->curr_size = tail; }\
-    }\
-  }\
-} while (0)
-
-void
-grn_io_seg_map_(grn_ctx *ctx, grn_io *io, uint32_t segno, grn_io_mapinfo *info)
-{
-  uint32_t segment_size = io->header->segment_size;
-  if ((io->flags & GRN_IO_TEMPORARY)) {
-    DO_MAP(io, &info->fmo, NULL, 0, segment_size, segno, info->map);
-  } else {
-    unsigned long file_size = grn_io_compute_file_size(io->header->version);
-    uint32_t segments_per_file = file_size / segment_size;
-    uint32_t bseg = segno + io->base_seg;
-    uint32_t fno = bseg / segments_per_file;
-    off_t base = fno ? 0 : io->base - (uint64_t)segment_size * io->base_seg;
-    off_t pos = (uint64_t)segment_size * (bseg % segments_per_file) + base;
-    fileinfo *fi = &io->fis[fno];
-    if (!grn_fileinfo_opened(fi)) {
-      char path[PATH_MAX];
-      gen_pathname(io->path, path, fno);
-      if (!grn_fileinfo_open(ctx, fi, path, O_RDWR|O_CREAT)) {
-        DO_MAP(io, &info->fmo, fi, pos, segment_size, segno, info->map);
-      }
-    } else {
-      DO_MAP(io, &info->fmo, fi, pos, segment_size, segno, info->map);
-    }
-  }
-}
-
-grn_rc
-grn_io_seg_expire(grn_ctx *ctx, grn_io *io, uint32_t segno, uint32_t nretry)
+/* `skip_pinned' is GRN_TRUE to keep segments of a pinned io mapped. */
+static grn_rc
+grn_io_seg_expire_(grn_ctx *ctx, grn_io *io, uint32_t segno, uint32_t nretry,
+                   grn_bool skip_pinned)
 {
   uint32_t retry, *pnref;
   grn_io_mapinfo *info;
@@ -1103,14 +1230,31 @@ grn_io_seg_expire(grn_ctx *ctx, grn_io *io, uint32_t segno, uint32_t nretry)
  segno, nref);
           return GRN_RESOURCE_DEADLOCK_AVOIDED;
         }
+      } else if (skip_pinned && io->n_pins > 0) {
+        GRN_ATOMIC_ADD_EX(pnref, -(GRN_IO_MAX_REF + 1), nref);
+        GRN_FUTEX_WAKE(pnref);
+        return GRN_RESOURCE_BUSY;
       } else {
         uint32_t nmaps;
-        fileinfo *fi = &(io->fis[segno]);
+        fileinfo *fi = NULL;
+        if (io->fis) {
+          unsigned long file_size =
+            grn_io_compute_file_size(io->header->version);
+          uint32_t segments_per_file = file_size / io->header->segment_size;
+          uint32_t bseg = segno + io->base_seg;
+          fi = &(io->fis[bseg / segments_per_file]);
+        }
         GRN_MUNMAP(&grn_gctx, io, &info->fmo, fi,
                    info->map, io->header->segment_size);
         info->map = NULL;
         GRN_ATOMIC_ADD_EX(pnref, -(GRN_IO_MAX_REF + 1), nref);
         GRN_ATOMIC_ADD_EX(&io->nmaps, -1, nmaps);
+        if (GRN_IO_SEGMENT_MANAGED_P(io)) {
+          uint32_t mapped_size;
+          GRN_ATOMIC_ADD_EX(&(grn_io_segment_manager.mapped_size),
+                            -grn_io_segment_manager_size(io),
+                            mapped_size);
+        }
         GRN_FUTEX_WAKE(pnref);
         return GRN_SUCCESS;
       }
@@ -1120,6 +1264,117 @@ grn_io_seg_expire(grn_ctx *ctx, grn_io *io, uint32_t segno, uint32_t nretry)
   }
 }
 
+grn_rc
+grn_io_seg_expire(grn_ctx *ctx, grn_io *io, uint32_t segno, uint32_t nretry)
+{
+  return grn_io_seg_expire_(ctx, io, segno, nretry, GRN_FALSE);
+}
+
+void
+grn_io_segment_manager_reclaim(grn_ctx *ctx)
+{
+  uint32_t n_scans = 0, n_evictions = 0;
+  uint32_t n_scans_at_head = (uint32_t)-1;
+
+  if (grn_io_max_mapped_size == 0 ||
+      (uint64_t)(grn_io_segment_manager.mapped_size) * 1024 <=
+      grn_io_max_mapped_size) {
+    return;
+  }
+
+  CRITICAL_SECTION_ENTER(grn_io_segment_manager.lock);
+  while (n_scans < GRN_IO_SEGMENT_MANAGER_MAX_N_SCANS &&
+         (uint64_t)(grn_io_segment_manager.mapped_size) * 1024 >
+         grn_io_max_mapped_size) {
+    grn_io *io = grn_io_segment_manager.clock_hand;
+    if (!io) {
+      /* Stop when a round finds no mapped segment. */
+      if (n_scans == n_scans_at_head) { break; }
+      n_scans_at_head = n_scans;
+      io = grn_io_segment_manager.clock_hand = grn_io_segment_manager.ios;
+      if (!io) { break; }
+    }
+    for (; io->clock_hand <= io->max_map_seg; io->clock_hand++) {
+      grn_io_mapinfo *info = &(io->maps[io->clock_hand]);
+      if (!info->map) { continue; }
+      if (n_scans++ >= GRN_IO_SEGMENT_MANAGER_MAX_N_SCANS) { break; }
+      if (info->accessed) {
+        info->accessed = 0;
+        continue;
+      }
+      if (grn_io_seg_expire_(ctx, io, io->clock_hand, 0, GRN_TRUE) ==
+          GRN_SUCCESS) {
+        n_evictions++;
+        if ((uint64_t)(grn_io_segment_manager.mapped_size) * 1024 <=
+            grn_io_max_mapped_size) {
+          io->clock_hand++;
+          break;
+        }
+      }
+    }
+    if (io->clock_hand > io->max_map_seg) {
+      io->clock_hand = 0;
+      grn_io_segment_manager.clock_hand = io->managed_next;
+    }
+  }
+  grn_io_segment_manager.n_evictions += n_evictions;
+  CRITICAL_SECTION_LEAVE(grn_io_segment_manager.lock);
+
+  if (n_evictions) {
+    GRN_LOG(ctx, GRN_LOG_DEBUG,
+            "[io][segment-manager] evicted: <%u> segments (%u scanned)",
+            n_evictions, n_scans);
+  }
+}
+
+#define DO_MAP(io,fmo,fi,pos,size,segno,res) do {\
+  if (((res) = GRN_MMAP(&grn_gctx, (io), (fmo), (fi), (pos), (size)))) {\
+    uint32_t nmaps;\
+    if (io->max_map_seg < segno) { io->max_map_seg = segno; }\
+    GRN_ATOMIC_ADD_EX(&io->nmaps, 1, nmaps);\
+    {\
+      uint64_t tail = io->base + (uint64_t)(size) * ((segno) + 1);\
+      if (tail > io->header->curr_size) { io->header->curr_size = tail; }\
+    }\
+  }\
+} while (0)
+
+void
+grn_io_seg_map_(grn_ctx *ctx, grn_io *io, uint32_t segno, grn_io_mapinfo *info)
+{
+  uint32_t segment_size = io->header->segment_size;
+  if ((io->flags & GRN_IO_TEMPORARY)) {
+    DO_MAP(io, &info->fmo, NULL, 0, segment_size, segno, info->map);
+  } else {
+    unsigned long file_size = grn_io_compute_file_size(io->header->version);
+    uint32_t segments_per_file = file_size / segment_size;
+    uint32_t bseg = segno + io->base_seg;
+    uint32_t fno = bseg / segments_per_file;
+    off_t base = fno ? 0 : io->base - (uint64_t)segment_size * io->base_seg;
+    off_t pos = (uint64_t)segment_size * (bseg % segments_per_file) + base;
+    fileinfo *fi = &io->fis[fno];
+    if (!grn_fileinfo_opened(fi)) {
+      char path[PATH_MAX];
+      gen_pathname(io->path, path, fno);
+      if (!grn_fileinfo_open(ctx, fi, path, O_RDWR|O_CREAT)) {
+        DO_MAP(io, &info->fmo, fi, pos, segment_size, segno, info->map);
+      }
+    } else {
+      DO_MAP(io, &info->fmo, fi, pos, segment_size, segno, info->map);
+    }
+  }
+  if (info->map) {
+    uint32_t nfaults;
+    GRN_ATOMIC_ADD_EX(&io->nfaults, 1, nfaults);
+    if (GRN_IO_SEGMENT_MANAGED_P(io)) {
+      uint32_t size = grn_io_segment_manager_size(io);
+      uint32_t mapped_size;
+      GRN_ATOMIC_ADD_EX(&(grn_io_segment_manager.mapped_size),
+                        size, mapped_size);
+    }
+  }
+}
+
 uint32_t
 grn_io_expire(grn_ctx *ctx, grn_io *io, int count_thresh, uint32_t limit)
 {
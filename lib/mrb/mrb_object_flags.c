@@ -67,6 +67,8 @@ grn_mrb_object_flags_init(grn_ctx *ctx)
   MRB_DEFINE_FLAG(COMPRESS_NONE);
   MRB_DEFINE_FLAG(COMPRESS_ZLIB);
   MRB_DEFINE_FLAG(COMPRESS_LZ4);
+  MRB_DEFINE_FLAG(COMPRESS_ZSTD);
+  MRB_DEFINE_FLAG(COMPRESS_BP128);
 
   MRB_DEFINE_FLAG(WITH_SECTION);
   MRB_DEFINE_FLAG(WITH_WEIGHT);
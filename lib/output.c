@@ -20,10 +20,82 @@
 #include <string.h>
 #include "grn_str.h"
 #include "grn_db.h"
+#include "grn_store.h"
 #include "grn_expr_code.h"
 #include "grn_util.h"
 #include "grn_output.h"
 
+#include <stdlib.h>
+
+static size_t grn_output_flush_threshold_size = 0;
+
+void
+grn_output_init_from_env(void)
+{
+  {
+    char grn_output_flush_threshold_size_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_OUTPUT_FLUSH_THRESHOLD_SIZE",
+               grn_output_flush_threshold_size_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_output_flush_threshold_size_env[0]) {
+      int threshold_size = atoi(grn_output_flush_threshold_size_env);
+      if (threshold_size < 0) {
+        threshold_size = 0;
+      }
+      grn_output_flush_threshold_size = threshold_size;
+    }
+  }
+}
+
+void
+grn_output_flush_reset(grn_ctx *ctx)
+{
+  ctx->impl->output_flush.threshold_size = grn_output_flush_threshold_size;
+  ctx->impl->output_flush.is_flushed = GRN_FALSE;
+}
+
+/*
+  Passes the output accumulated so far to the output handler while a
+  large response is being produced. The handler may send it as a chunk
+  and rewind the output buffer. If the handler keeps the output in the
+  buffer (it doesn't support partial output), the threshold is doubled
+  so that the handler isn't called for each record.
+
+  XML isn't flushed because select response is transformed as a whole.
+*/
+void
+grn_output_flush_if_needed(grn_ctx *ctx, grn_obj *outbuf)
+{
+  size_t size;
+
+  if (ctx->impl->output_flush.threshold_size == 0) {
+    return;
+  }
+  if (outbuf != ctx->impl->outbuf) {
+    return;
+  }
+  size = GRN_BULK_VSIZE(outbuf);
+  if (size < ctx->impl->output_flush.threshold_size) {
+    return;
+  }
+
+  switch (ctx->impl->output_type) {
+  case GRN_CONTENT_JSON :
+  case GRN_CONTENT_TSV :
+  case GRN_CONTENT_MSGPACK :
+    break;
+  default :
+    return;
+  }
+
+  grn_ctx_output_flush(ctx, 0);
+  if (GRN_BULK_VSIZE(outbuf) < size) {
+    ctx->impl->output_flush.is_flushed = GRN_TRUE;
+  } else {
+    ctx->impl->output_flush.threshold_size *= 2;
+  }
+}
+
 #define LEVELS (&ctx->impl->levels)
 #define DEPTH (GRN_BULK_VSIZE(LEVELS)>>2)
 #define CURR_LEVEL (DEPTH ? (GRN_UINT32_VALUE_AT(LEVELS, (DEPTH - 1))) : 0)
@@ -1337,66 +1409,422 @@ grn_output_table_record_by_expression(grn_ctx *ctx, grn_obj *outbuf,
   }
 }
 
+/*
+  Records are output after their IDs are collected. Each output column
+  is resolved once before outputting records. If an output column is a
+  scalar column of a builtin type that is reached through _key of
+  result sets and scalar reference columns, record IDs in the column's
+  table are computed for all records at once and values are written
+  from the column store to the output without temporary grn_obj. IDs
+  are shared by output columns that are reached by the same path.
+  Other output columns are output by grn_text_atoj() or the output
+  columns expression.
+*/
+typedef struct {
+  grn_obj *column;
+  int code_start;
+  int n_codes;
+  grn_obj *source;
+  grn_id range;
+  int n_hops;
+  grn_id *ids;
+  grn_bool own_ids;
+  grn_ra_cache cache;
+} grn_output_records_column;
+
+static grn_bool
+grn_output_records_column_is_hop(grn_ctx *ctx, grn_accessor *a)
+{
+  switch (a->action) {
+  case GRN_ACCESSOR_GET_KEY :
+    {
+      grn_obj *domain;
+      if (!a->obj || a->obj->header.domain == GRN_ID_NIL) {
+        return GRN_FALSE;
+      }
+      domain = grn_ctx_at(ctx, a->obj->header.domain);
+      return domain && GRN_OBJ_TABLEP(domain);
+    }
+  case GRN_ACCESSOR_GET_COLUMN_VALUE :
+    {
+      grn_obj *range;
+      if (!a->obj || a->obj->header.type != GRN_COLUMN_FIX_SIZE) {
+        return GRN_FALSE;
+      }
+      range = grn_ctx_at(ctx, DB_OBJ(a->obj)->range);
+      return range && GRN_OBJ_TABLEP(range);
+    }
+  default :
+    return GRN_FALSE;
+  }
+}
+
+static void
+grn_output_records_column_init(grn_ctx *ctx,
+                               grn_output_records_column *column,
+                               grn_obj *object)
+{
+  grn_obj *source = NULL;
+
+  column->column = object;
+  column->code_start = 0;
+  column->n_codes = 0;
+  column->source = NULL;
+  column->range = GRN_ID_NIL;
+  column->n_hops = 0;
+  column->ids = NULL;
+  column->own_ids = GRN_FALSE;
+
+  switch (object->header.type) {
+  case GRN_ACCESSOR :
+    {
+      grn_accessor *a;
+      for (a = (grn_accessor *)object; a->next; a = a->next) {
+        if (!grn_output_records_column_is_hop(ctx, a)) {
+          return;
+        }
+        column->n_hops++;
+      }
+      if (a->action != GRN_ACCESSOR_GET_COLUMN_VALUE) {
+        return;
+      }
+      source = a->obj;
+    }
+    break;
+  case GRN_COLUMN_FIX_SIZE :
+  case GRN_COLUMN_VAR_SIZE :
+    source = object;
+    break;
+  default :
+    return;
+  }
+
+  switch (source->header.type) {
+  case GRN_COLUMN_FIX_SIZE :
+    column->range = DB_OBJ(source)->range;
+    if (!(GRN_DB_BOOL <= column->range && column->range <= GRN_DB_TIME)) {
+      return;
+    }
+    GRN_RA_CACHE_INIT((grn_ra *)source, &(column->cache));
+    break;
+  case GRN_COLUMN_VAR_SIZE :
+    if ((source->header.flags & GRN_OBJ_COLUMN_TYPE_MASK) !=
+        GRN_OBJ_COLUMN_SCALAR) {
+      return;
+    }
+    column->range = DB_OBJ(source)->range;
+    if (!(GRN_DB_SHORT_TEXT <= column->range &&
+          column->range <= GRN_DB_LONG_TEXT)) {
+      return;
+    }
+    break;
+  default :
+    return;
+  }
+  column->source = source;
+}
+
+static void
+grn_output_records_column_fin(grn_ctx *ctx, grn_output_records_column *column)
+{
+  if (!column->source) {
+    return;
+  }
+  if (column->source->header.type == GRN_COLUMN_FIX_SIZE) {
+    GRN_RA_CACHE_FIN((grn_ra *)(column->source), &(column->cache));
+  }
+  if (column->own_ids) {
+    GRN_FREE(column->ids);
+  }
+}
+
+static grn_bool
+grn_output_records_column_have_same_path(grn_output_records_column *column1,
+                                         grn_output_records_column *column2)
+{
+  int i;
+  grn_accessor *a1, *a2;
+
+  if (column1->n_hops != column2->n_hops) {
+    return GRN_FALSE;
+  }
+  a1 = (grn_accessor *)(column1->column);
+  a2 = (grn_accessor *)(column2->column);
+  for (i = 0; i < column1->n_hops; i++, a1 = a1->next, a2 = a2->next) {
+    if (a1->action != a2->action || a1->obj != a2->obj) {
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
+static void
+grn_output_records_column_resolve_ids(grn_ctx *ctx,
+                                      grn_output_records_column *columns,
+                                      int n_columns,
+                                      grn_output_records_column *column,
+                                      grn_id *record_ids, int n_records)
+{
+  int i, j;
+  grn_accessor *a;
+
+  if (!column->source) {
+    return;
+  }
+  if (column->n_hops == 0) {
+    column->ids = record_ids;
+    return;
+  }
+  for (i = 0; i < n_columns; i++) {
+    grn_output_records_column *resolved = &(columns[i]);
+    if (resolved == column) {
+      break;
+    }
+    if (resolved->ids &&
+        grn_output_records_column_have_same_path(resolved, column)) {
+      column->ids = resolved->ids;
+      return;
+    }
+  }
+
+  column->ids = GRN_MALLOCN(grn_id, n_records);
+  if (!column->ids) {
+    ERRCLR(ctx);
+    column->source = NULL;
+    return;
+  }
+  column->own_ids = GRN_TRUE;
+  grn_memcpy(column->ids, record_ids, sizeof(grn_id) * n_records);
+  for (i = 0, a = (grn_accessor *)(column->column);
+       i < column->n_hops;
+       i++, a = a->next) {
+    if (a->action == GRN_ACCESSOR_GET_KEY) {
+      for (j = 0; j < n_records; j++) {
+        grn_id id = column->ids[j];
+        if (id == GRN_ID_NIL) {
+          continue;
+        }
+        if (grn_table_get_key(ctx, a->obj, id, &(column->ids[j]),
+                              sizeof(grn_id)) != sizeof(grn_id)) {
+          column->ids[j] = GRN_ID_NIL;
+        }
+      }
+    } else {
+      grn_ra *ra = (grn_ra *)(a->obj);
+      grn_ra_cache cache;
+      GRN_RA_CACHE_INIT(ra, &cache);
+      for (j = 0; j < n_records; j++) {
+        grn_id id = column->ids[j];
+        grn_id *value;
+        if (id == GRN_ID_NIL) {
+          continue;
+        }
+        value = grn_ra_ref_cache(ctx, ra, id, &cache);
+        column->ids[j] = value ? *value : GRN_ID_NIL;
+      }
+      GRN_RA_CACHE_FIN(ra, &cache);
+    }
+  }
+}
+
+static void
+grn_output_records_column_value(grn_ctx *ctx, grn_obj *outbuf,
+                                grn_content_type output_type,
+                                grn_output_records_column *column,
+                                grn_id id)
+{
+  if (column->source->header.type == GRN_COLUMN_VAR_SIZE) {
+    grn_io_win iw;
+    uint32_t value_len = 0;
+    void *value;
+    value = grn_ja_ref(ctx, (grn_ja *)(column->source), id, &iw, &value_len);
+    if (value) {
+      grn_output_str(ctx, outbuf, output_type, value, value_len);
+      grn_ja_unref(ctx, &iw);
+    } else {
+      grn_output_str(ctx, outbuf, output_type, "", 0);
+    }
+    return;
+  }
+
+  {
+    const void *value;
+    value = grn_ra_ref_cache(ctx, (grn_ra *)(column->source), id,
+                             &(column->cache));
+#define VALUE_OF(type) (value ? *((const type *)value) : 0)
+    switch (column->range) {
+    case GRN_DB_BOOL :
+      grn_output_bool(ctx, outbuf, output_type, VALUE_OF(uint8_t));
+      break;
+    case GRN_DB_INT8 :
+      grn_output_int32(ctx, outbuf, output_type, VALUE_OF(int8_t));
+      break;
+    case GRN_DB_UINT8 :
+      grn_output_int32(ctx, outbuf, output_type, VALUE_OF(uint8_t));
+      break;
+    case GRN_DB_INT16 :
+      grn_output_int32(ctx, outbuf, output_type, VALUE_OF(int16_t));
+      break;
+    case GRN_DB_UINT16 :
+      grn_output_int32(ctx, outbuf, output_type, VALUE_OF(uint16_t));
+      break;
+    case GRN_DB_INT32 :
+      grn_output_int32(ctx, outbuf, output_type, VALUE_OF(int32_t));
+      break;
+    case GRN_DB_UINT32 :
+      grn_output_int64(ctx, outbuf, output_type, VALUE_OF(uint32_t));
+      break;
+    case GRN_DB_INT64 :
+      grn_output_int64(ctx, outbuf, output_type, VALUE_OF(int64_t));
+      break;
+    case GRN_DB_UINT64 :
+      grn_output_uint64(ctx, outbuf, output_type, VALUE_OF(uint64_t));
+      break;
+    case GRN_DB_FLOAT :
+      grn_output_float(ctx, outbuf, output_type, VALUE_OF(double));
+      break;
+    case GRN_DB_TIME :
+      grn_output_time(ctx, outbuf, output_type, VALUE_OF(int64_t));
+      break;
+    }
+#undef VALUE_OF
+  }
+}
+
+static grn_id *
+grn_output_table_records_collect_ids(grn_ctx *ctx, grn_table_cursor *tc,
+                                     grn_obj *ids)
+{
+  grn_id id;
+  while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
+    GRN_RECORD_PUT(ctx, ids, id);
+  }
+  return (grn_id *)GRN_BULK_HEAD(ids);
+}
+
+static int
+grn_output_table_records_split_expression(grn_ctx *ctx,
+                                          grn_obj *expression,
+                                          grn_output_records_column *columns)
+{
+  int n_columns = 0;
+  int previous_comma_offset = -1;
+  grn_bool is_first_comma = GRN_TRUE;
+  grn_bool have_comma = GRN_FALSE;
+  grn_expr *expr = (grn_expr *)expression;
+  grn_expr_code *code;
+  grn_expr_code *code_end = expr->codes + expr->codes_curr;
+
+#define ADD_COLUMN(start, n) do {\
+  grn_output_records_column *column_ = &(columns[n_columns++]);\
+  grn_expr_code *code_ = expr->codes + (start);\
+  if ((n) == 1 && code_->op == GRN_OP_GET_VALUE && code_->value) {\
+    grn_output_records_column_init(ctx, column_, code_->value);\
+  } else {\
+    column_->column = NULL;\
+    column_->source = NULL;\
+    column_->n_hops = 0;\
+    column_->ids = NULL;\
+    column_->own_ids = GRN_FALSE;\
+  }\
+  column_->code_start = (start);\
+  column_->n_codes = (n);\
+} while (0)
+
+  for (code = expr->codes; code < code_end; code++) {
+    if (code->op == GRN_OP_COMMA) {
+      int code_start_offset = previous_comma_offset + 1;
+
+      have_comma = GRN_TRUE;
+      if (is_first_comma) {
+        int second_code_offset;
+        unsigned int second_code_n_used_codes;
+        second_code_offset = code - expr->codes - 1;
+        second_code_n_used_codes =
+          grn_expr_code_n_used_codes(ctx,
+                                     expr->codes,
+                                     expr->codes + second_code_offset);
+        code_start_offset =
+          second_code_offset - second_code_n_used_codes + 1;
+        ADD_COLUMN(0, code_start_offset);
+        is_first_comma = GRN_FALSE;
+      }
+      ADD_COLUMN(code_start_offset,
+                 code - expr->codes - code_start_offset);
+      previous_comma_offset = code - expr->codes;
+    }
+  }
+
+  if (!have_comma && expr->codes_curr > 0) {
+    ADD_COLUMN(0, expr->codes_curr);
+  }
+#undef ADD_COLUMN
+
+  return n_columns;
+}
+
 static inline void
 grn_output_table_records_by_expression(grn_ctx *ctx, grn_obj *outbuf,
                                        grn_content_type output_type,
                                        grn_table_cursor *tc,
                                        grn_obj_format *format)
 {
-  int n_elements = 0;
-  grn_id id;
+  int i, j, n_elements, n_columns, n_records;
   grn_obj *record;
   grn_expr *expr = (grn_expr *)format->expression;
-  grn_expr_code *code;
-  grn_expr_code *code_end = expr->codes + expr->codes_curr;
+  grn_output_records_column *columns;
+  grn_obj ids;
+  grn_id *record_ids;
 
   n_elements = count_n_elements_in_expression(ctx, format->expression);
+  /* Columns without comma have one element. */
+  columns = GRN_MALLOCN(grn_output_records_column,
+                        n_elements > 0 ? n_elements : 1);
+  if (!columns) {
+    return;
+  }
+  n_columns = grn_output_table_records_split_expression(ctx,
+                                                        format->expression,
+                                                        columns);
+
+  GRN_RECORD_INIT(&ids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  record_ids = grn_output_table_records_collect_ids(ctx, tc, &ids);
+  n_records = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+  for (i = 0; i < n_columns; i++) {
+    grn_output_records_column_resolve_ids(ctx, columns, n_columns,
+                                          &(columns[i]),
+                                          record_ids, n_records);
+  }
+
   record = grn_expr_get_var_by_offset(ctx, format->expression, 0);
-  while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
-    int previous_comma_offset = -1;
-    grn_bool is_first_comma = GRN_TRUE;
-    grn_bool have_comma = GRN_FALSE;
-    GRN_RECORD_SET(ctx, record, id);
+  for (j = 0; j < n_records; j++) {
+    GRN_RECORD_SET(ctx, record, record_ids[j]);
     grn_output_array_open(ctx, outbuf, output_type, "HIT", n_elements);
-    for (code = expr->codes; code < code_end; code++) {
-      if (code->op == GRN_OP_COMMA) {
-        int code_start_offset = previous_comma_offset + 1;
-        int code_end_offset;
+    for (i = 0; i < n_columns; i++) {
+      grn_output_records_column *column = &(columns[i]);
+      if (column->source && column->ids[j] != GRN_ID_NIL) {
+        grn_output_records_column_value(ctx, outbuf, output_type,
+                                        column, column->ids[j]);
+      } else {
+        grn_expr_code *original_codes = expr->codes;
         int original_codes_curr = expr->codes_curr;
-
-        have_comma = GRN_TRUE;
-        if (is_first_comma) {
-          int second_code_offset;
-          unsigned int second_code_n_used_codes;
-          second_code_offset = code - expr->codes - 1;
-          second_code_n_used_codes =
-            grn_expr_code_n_used_codes(ctx,
-                                       expr->codes,
-                                       expr->codes + second_code_offset);
-          expr->codes_curr = second_code_offset - second_code_n_used_codes + 1;
-          grn_output_table_record_by_expression(ctx, outbuf, output_type,
-                                                format->expression);
-          code_start_offset = expr->codes_curr;
-          is_first_comma = GRN_FALSE;
-        }
-        code_end_offset = code - expr->codes - code_start_offset;
-        expr->codes += code_start_offset;
-        expr->codes_curr = code_end_offset;
+        expr->codes += column->code_start;
+        expr->codes_curr = column->n_codes;
         grn_output_table_record_by_expression(ctx, outbuf, output_type,
                                               format->expression);
-        expr->codes -= code_start_offset;
+        expr->codes = original_codes;
         expr->codes_curr = original_codes_curr;
-        previous_comma_offset = code - expr->codes;
       }
     }
-
-    if (!have_comma && expr->codes_curr > 0) {
-      grn_output_table_record_by_expression(ctx, outbuf, output_type,
-                                            format->expression);
-    }
-
     grn_output_array_close(ctx, outbuf, output_type);
+    grn_output_flush_if_needed(ctx, outbuf);
   }
+
+  for (i = 0; i < n_columns; i++) {
+    grn_output_records_column_fin(ctx, &(columns[i]));
+  }
+  GRN_OBJ_FIN(ctx, &ids);
+  GRN_FREE(columns);
 }
 
 static inline void
@@ -1405,17 +1833,51 @@ grn_output_table_records_by_columns(grn_ctx *ctx, grn_obj *outbuf,
                                     grn_table_cursor *tc,
                                     grn_obj_format *format)
 {
-  int i;
-  grn_id id;
+  int i, j, n_records;
   int ncolumns = GRN_BULK_VSIZE(&format->columns)/sizeof(grn_obj *);
   grn_obj **columns = (grn_obj **)GRN_BULK_HEAD(&format->columns);
-  while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
+  grn_output_records_column *records_columns;
+  grn_obj ids;
+  grn_id *record_ids;
+
+  records_columns = GRN_MALLOCN(grn_output_records_column,
+                                ncolumns > 0 ? ncolumns : 1);
+  if (!records_columns) {
+    return;
+  }
+  for (i = 0; i < ncolumns; i++) {
+    grn_output_records_column_init(ctx, &(records_columns[i]), columns[i]);
+  }
+
+  GRN_RECORD_INIT(&ids, GRN_OBJ_VECTOR, GRN_ID_NIL);
+  record_ids = grn_output_table_records_collect_ids(ctx, tc, &ids);
+  n_records = GRN_BULK_VSIZE(&ids) / sizeof(grn_id);
+  for (i = 0; i < ncolumns; i++) {
+    grn_output_records_column_resolve_ids(ctx, records_columns, ncolumns,
+                                          &(records_columns[i]),
+                                          record_ids, n_records);
+  }
+
+  for (j = 0; j < n_records; j++) {
     grn_output_array_open(ctx, outbuf, output_type, "HIT", ncolumns);
     for (i = 0; i < ncolumns; i++) {
-      grn_text_atoj(ctx, outbuf, output_type, columns[i], id);
+      grn_output_records_column *column = &(records_columns[i]);
+      if (column->source && column->ids[j] != GRN_ID_NIL) {
+        grn_output_records_column_value(ctx, outbuf, output_type,
+                                        column, column->ids[j]);
+      } else {
+        grn_text_atoj(ctx, outbuf, output_type, columns[i], record_ids[j]);
+      }
     }
     grn_output_array_close(ctx, outbuf, output_type);
+    grn_output_flush_if_needed(ctx, outbuf);
+  }
+
+  for (i = 0; i < ncolumns; i++) {
+    grn_output_records_column_fin(ctx, &(records_columns[i]));
   }
+  GRN_OBJ_FIN(ctx, &ids);
+  GRN_FREE(records_columns);
 }
 
 void
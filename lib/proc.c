@@ -873,6 +873,115 @@ grn_select_drilldowns(grn_ctx *ctx, grn_obj *table,
   GRN_OUTPUT_MAP_CLOSE();
 }
 
+static grn_bool
+grn_select_is_sorted_by_score_descending(grn_ctx *ctx,
+                                         const char *sortby,
+                                         unsigned int sortby_len)
+{
+  const char *key = "-_score";
+  unsigned int key_len = strlen(key);
+  const char *end = sortby + sortby_len;
+
+  while (sortby < end && grn_isspace(sortby, ctx->encoding) == 1) {
+    sortby++;
+  }
+  while (sortby < end && grn_isspace(end - 1, ctx->encoding) == 1) {
+    end--;
+  }
+  return (end - sortby) == key_len && memcmp(sortby, key, key_len) == 0;
+}
+
+/*
+  Only the first "offset + limit" records are output when records are
+  sorted by score descending and nothing else needs the rest of the
+  result set. In the case, full text search keeps only the best
+  records instead of adding all matched records to the result set.
+  0 means that only the number of matched records is needed.
+*/
+static int
+grn_select_top_k_limit(grn_ctx *ctx,
+                       const char *sortby, unsigned int sortby_len,
+                       int offset, int limit,
+                       unsigned int n_drilldowns,
+                       unsigned int scorer_len,
+                       unsigned int adjuster_len)
+{
+  if (n_drilldowns > 0 || scorer_len > 0 || adjuster_len > 0) {
+    return -1;
+  }
+  if (limit == 0) {
+    return 0;
+  }
+  if (offset < 0 || limit <= 0 || limit > INT32_MAX - offset) {
+    return -1;
+  }
+  if (!grn_select_is_sorted_by_score_descending(ctx, sortby, sortby_len)) {
+    return -1;
+  }
+  return offset + limit;
+}
+
+static grn_bool
+grn_select_refer_score(const char *text, unsigned int text_len)
+{
+  const char *name = "_score";
+  unsigned int name_len = strlen(name);
+  unsigned int i;
+
+  for (i = 0; i + name_len <= text_len; i++) {
+    if (memcmp(text + i, name, name_len) == 0) {
+      return GRN_TRUE;
+    }
+  }
+  return GRN_FALSE;
+}
+
+/*
+  Scores and the order of matched records aren't visible when nothing
+  refers _score and all outputs are sorted explicitly or not output.
+  In the case, filter conditions can be evaluated as bitmaps.
+*/
+static grn_bool
+grn_select_is_score_ignorable(grn_ctx *ctx,
+                              unsigned int query_len,
+                              unsigned int scorer_len,
+                              const char *sortby, unsigned int sortby_len,
+                              const char *output_columns,
+                              unsigned int output_columns_len,
+                              int limit,
+                              drilldown_info *drilldowns,
+                              unsigned int n_drilldowns,
+                              unsigned int adjuster_len)
+{
+  unsigned int i;
+
+  if (query_len > 0 || scorer_len > 0 || adjuster_len > 0) {
+    return GRN_FALSE;
+  }
+  if (sortby_len == 0 && limit != 0) {
+    return GRN_FALSE;
+  }
+  if (grn_select_refer_score(sortby, sortby_len) ||
+      grn_select_refer_score(output_columns, output_columns_len)) {
+    return GRN_FALSE;
+  }
+  for (i = 0; i < n_drilldowns; i++) {
+    drilldown_info *drilldown = &(drilldowns[i]);
+    if (drilldown->sortby_len == 0 && drilldown->limit != 0) {
+      return GRN_FALSE;
+    }
+    if (grn_select_refer_score(drilldown->keys, drilldown->keys_len) ||
+        grn_select_refer_score(drilldown->sortby, drilldown->sortby_len) ||
+        grn_select_refer_score(drilldown->output_columns,
+                               drilldown->output_columns_len) ||
+        grn_select_refer_score(drilldown->calc_target_name,
+                               drilldown->calc_target_name_len)) {
+      return GRN_FALSE;
+    }
+  }
+  return GRN_TRUE;
+}
+
 static grn_rc
 grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
            const char *match_columns, unsigned int match_columns_len,
@@ -891,11 +1000,13 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
            const char *adjuster, unsigned int adjuster_len)
 {
   uint32_t nkeys, nhits;
+  int64_t top_k_n_hits = -1;
   uint16_t cacheable = 1, taintable = 0;
   grn_table_sort_key *keys;
   grn_obj *outbuf = ctx->impl->outbuf;
   grn_content_type output_type = ctx->impl->output_type;
   grn_obj *table_, *match_columns_ = NULL, *cond = NULL, *scorer_, *res = NULL, *sorted;
+  grn_bool is_cond_cached = GRN_FALSE;
   char cache_key[GRN_CACHE_MAX_KEY_SIZE];
   uint32_t cache_key_size;
   long long int threshold, original_threshold = 0;
@@ -1008,8 +1119,37 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     // match_columns_ = grn_obj_column(ctx, table_, match_columns, match_columns_len);
     if (query_len || filter_len) {
       grn_obj *v;
-      GRN_EXPR_CREATE_FOR_QUERY(ctx, table_, cond, v);
-      if (cond) {
+      grn_obj expr_cache_key;
+      grn_bool use_expr_cache = GRN_FALSE;
+
+      GRN_TEXT_INIT(&expr_cache_key, 0);
+      /* Expanded query depends on data of query expander. */
+      if (query_expander_len == 0) {
+        grn_id table_id = grn_obj_id(ctx, table_);
+        GRN_TEXT_PUT(ctx, &expr_cache_key, &table_id, sizeof(grn_id));
+        GRN_TEXT_PUT(ctx, &expr_cache_key, match_columns, match_columns_len);
+        GRN_TEXT_PUTC(ctx, &expr_cache_key, '\0');
+        GRN_TEXT_PUT(ctx, &expr_cache_key, query, query_len);
+        GRN_TEXT_PUTC(ctx, &expr_cache_key, '\0');
+        GRN_TEXT_PUT(ctx, &expr_cache_key, query_flags, query_flags_len);
+        GRN_TEXT_PUTC(ctx, &expr_cache_key, '\0');
+        GRN_TEXT_PUT(ctx, &expr_cache_key, filter, filter_len);
+        use_expr_cache =
+          GRN_TEXT_LEN(&expr_cache_key) <= GRN_CACHE_MAX_KEY_SIZE;
+      }
+      if (use_expr_cache) {
+        cond = grn_expr_cache_fetch(ctx,
+                                    GRN_TEXT_VALUE(&expr_cache_key),
+                                    GRN_TEXT_LEN(&expr_cache_key),
+                                    &match_columns_);
+        if (cond) {
+          is_cond_cached = GRN_TRUE;
+        }
+      }
+      if (!cond) {
+        GRN_EXPR_CREATE_FOR_QUERY(ctx, table_, cond, v);
+      }
+      if (cond && !is_cond_cached) {
         if (match_columns_len) {
           GRN_EXPR_CREATE_FOR_QUERY(ctx, table_, match_columns_, v);
           if (match_columns_) {
@@ -1017,6 +1157,7 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
                            NULL, GRN_OP_MATCH, GRN_OP_AND,
                            GRN_EXPR_SYNTAX_SCRIPT);
             if (ctx->rc) {
+              GRN_OBJ_FIN(ctx, &expr_cache_key);
               goto exit;
             }
           } else {
@@ -1030,6 +1171,7 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
           if (query_flags_len) {
             flags |= grn_parse_query_flags(ctx, query_flags, query_flags_len);
             if (ctx->rc) {
+              GRN_OBJ_FIN(ctx, &expr_cache_key);
               goto exit;
             }
           } else {
@@ -1044,6 +1186,7 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
               query_len = GRN_TEXT_LEN(&query_expander_buf);
             } else {
               GRN_OBJ_FIN(ctx, &query_expander_buf);
+              GRN_OBJ_FIN(ctx, &expr_cache_key);
               goto exit;
             }
           }
@@ -1061,6 +1204,15 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
                          match_columns_, GRN_OP_MATCH, GRN_OP_AND,
                          GRN_EXPR_SYNTAX_SCRIPT);
         }
+        if (!ctx->rc && use_expr_cache) {
+          is_cond_cached = grn_expr_cache_update(ctx,
+                                                 GRN_TEXT_VALUE(&expr_cache_key),
+                                                 GRN_TEXT_LEN(&expr_cache_key),
+                                                 cond, match_columns_);
+        }
+      }
+      GRN_OBJ_FIN(ctx, &expr_cache_key);
+      if (cond) {
         cacheable *= ((grn_expr *)cond)->cacheable;
         taintable += ((grn_expr *)cond)->taintable;
         /*
@@ -1071,7 +1223,23 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
         GRN_LOG(ctx, GRN_LOG_NOTICE, "query=(%s)", GRN_TEXT_VALUE(&strbuf));
         GRN_OBJ_FIN(ctx, &strbuf);
         */
-        if (!ctx->rc) { res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR); }
+        if (!ctx->rc) {
+          ctx->impl->top_k.limit =
+            grn_select_top_k_limit(ctx, sortby, sortby_len, offset, limit,
+                                   n_drilldowns, scorer_len, adjuster_len);
+          ctx->impl->top_k.n_hits = -1;
+          ctx->impl->score_ignorable =
+            grn_select_is_score_ignorable(ctx, query_len, scorer_len,
+                                          sortby, sortby_len,
+                                          output_columns, output_columns_len,
+                                          limit, drilldowns, n_drilldowns,
+                                          adjuster_len);
+          res = grn_table_select(ctx, table_, cond, NULL, GRN_OP_OR);
+          top_k_n_hits = ctx->impl->top_k.n_hits;
+          ctx->impl->top_k.limit = -1;
+          ctx->impl->top_k.n_hits = -1;
+          ctx->impl->score_ignorable = GRN_FALSE;
+        }
       } else {
         /* todo */
         ERRCLR(ctx);
@@ -1079,7 +1247,11 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     } else {
       res = table_;
     }
-    nhits = res ? grn_table_size(ctx, res) : 0;
+    if (res && top_k_n_hits >= 0) {
+      nhits = top_k_n_hits;
+    } else {
+      nhits = res ? grn_table_size(ctx, res) : 0;
+    }
     GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
                   ":", "select(%d)", nhits);
 
@@ -1127,22 +1299,11 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
         grn_obj *v;
         GRN_EXPR_CREATE_FOR_QUERY(ctx, res, scorer_, v);
         if (scorer_ && v) {
-          grn_table_cursor *tc;
           grn_expr_parse(ctx, scorer_, scorer, scorer_len, NULL, GRN_OP_MATCH, GRN_OP_AND,
                          GRN_EXPR_SYNTAX_SCRIPT|GRN_EXPR_ALLOW_UPDATE);
           cacheable *= ((grn_expr *)scorer_)->cacheable;
           taintable += ((grn_expr *)scorer_)->taintable;
-          if ((tc = grn_table_cursor_open(ctx, res, NULL, 0, NULL, 0, 0, -1, 0))) {
-            grn_id id;
-            while ((id = grn_table_cursor_next(ctx, tc)) != GRN_ID_NIL) {
-              GRN_RECORD_SET(ctx, v, id);
-              grn_expr_exec(ctx, scorer_, 0);
-              if (ctx->rc) {
-                break;
-              }
-            }
-            grn_table_cursor_close(ctx, tc);
-          }
+          grn_table_apply_scorer(ctx, res, scorer_);
           grn_obj_unlink(ctx, scorer_);
         }
         GRN_QUERY_LOG(ctx, GRN_QUERY_LOG_SIZE,
@@ -1190,6 +1351,7 @@ grn_select(grn_ctx *ctx, const char *table, unsigned int table_len,
     }
     GRN_OUTPUT_ARRAY_CLOSE();
     if (!ctx->rc && cacheable && cache_key_size <= GRN_CACHE_MAX_KEY_SIZE
+        && !ctx->impl->output_flush.is_flushed
         && (!cache || cache_len != 2 || *cache != 'n' || *(cache + 1) != 'o')) {
       grn_cache_update(ctx, cache_obj, cache_key, cache_key_size, outbuf);
     }
@@ -1202,11 +1364,13 @@ exit :
   if (match_escalation_threshold_len) {
     grn_ctx_set_match_escalation_threshold(ctx, original_threshold);
   }
-  if (match_columns_) {
-    grn_obj_unlink(ctx, match_columns_);
-  }
-  if (cond) {
-    grn_obj_unlink(ctx, cond);
+  if (!is_cond_cached) {
+    if (match_columns_) {
+      grn_obj_unlink(ctx, match_columns_);
+    }
+    if (cond) {
+      grn_obj_unlink(ctx, cond);
+    }
   }
   /* GRN_LOG(ctx, GRN_LOG_NONE, "%d", ctx->seqno); */
   return ctx->rc;
@@ -1394,11 +1558,18 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   grn_timeval now;
   grn_cache *cache;
   grn_cache_statistics statistics;
+  uint64_t n_ii_chunk_cache_hits, n_ii_chunk_cache_misses;
+  grn_ja_value_cache_statistics ja_value_cache_statistics;
+  grn_io_segment_manager_statistics io_statistics;
 
   grn_timeval_now(ctx, &now);
   cache = grn_cache_current_get(ctx);
   grn_cache_get_statistics(ctx, cache, &statistics);
-  GRN_OUTPUT_MAP_OPEN("RESULT", 9);
+  grn_ii_chunk_cache_get_statistics(&n_ii_chunk_cache_hits,
+                                    &n_ii_chunk_cache_misses);
+  grn_ja_value_cache_get_statistics(&ja_value_cache_statistics);
+  grn_io_segment_manager_get_statistics(&io_statistics);
+  GRN_OUTPUT_MAP_OPEN("RESULT", 18);
   GRN_OUTPUT_CSTR("alloc_count");
   GRN_OUTPUT_INT32(grn_alloc_count());
   GRN_OUTPUT_CSTR("starttime");
@@ -1423,6 +1594,24 @@ proc_status(grn_ctx *ctx, int nargs, grn_obj **args, grn_user_data *user_data)
   GRN_OUTPUT_INT32(grn_get_default_command_version());
   GRN_OUTPUT_CSTR("max_command_version");
   GRN_OUTPUT_INT32(GRN_COMMAND_VERSION_MAX);
+  GRN_OUTPUT_CSTR("n_ii_chunk_cache_hits");
+  GRN_OUTPUT_INT64(n_ii_chunk_cache_hits);
+  GRN_OUTPUT_CSTR("n_ii_chunk_cache_misses");
+  GRN_OUTPUT_INT64(n_ii_chunk_cache_misses);
+  GRN_OUTPUT_CSTR("ja_value_cache_size");
+  GRN_OUTPUT_INT64(ja_value_cache_statistics.size);
+  GRN_OUTPUT_CSTR("n_ja_value_cache_hits");
+  GRN_OUTPUT_INT64(ja_value_cache_statistics.n_hits);
+  GRN_OUTPUT_CSTR("n_ja_value_cache_misses");
+  GRN_OUTPUT_INT64(ja_value_cache_statistics.n_misses);
+  GRN_OUTPUT_CSTR("io_mapped_size");
+  GRN_OUTPUT_INT64(io_statistics.mapped_size);
+  GRN_OUTPUT_CSTR("io_max_mapped_size");
+  GRN_OUTPUT_INT64(io_statistics.max_mapped_size);
+  GRN_OUTPUT_CSTR("n_io_segment_faults");
+  GRN_OUTPUT_INT64(io_statistics.n_faults);
+  GRN_OUTPUT_CSTR("n_io_segment_evictions");
+  GRN_OUTPUT_INT64(io_statistics.n_evictions);
   GRN_OUTPUT_MAP_CLOSE();
   return NULL;
 }
@@ -1487,6 +1676,12 @@ grn_parse_column_create_flags(grn_ctx *ctx, const char *nptr, const char *end)
     } else if (!memcmp(nptr, "COMPRESS_LZ4", 12)) {
       flags |= GRN_OBJ_COMPRESS_LZ4;
       nptr += 12;
+    } else if (!memcmp(nptr, "COMPRESS_ZSTD", 13)) {
+      flags |= GRN_OBJ_COMPRESS_ZSTD;
+      nptr += 13;
+    } else if (!memcmp(nptr, "COMPRESS_BP128", 14)) {
+      flags |= GRN_OBJ_COMPRESS_BP128;
+      nptr += 14;
     } else if (!memcmp(nptr, "WITH_SECTION", 12)) {
       flags |= GRN_OBJ_WITH_SECTION;
       nptr += 12;
@@ -1573,6 +1768,12 @@ grn_column_create_flags_to_text(grn_ctx *ctx, grn_obj *buf, grn_obj_flags flags)
   case GRN_OBJ_COMPRESS_LZ4:
     GRN_TEXT_PUTS(ctx, buf, "|COMPRESS_LZ4");
     break;
+  case GRN_OBJ_COMPRESS_ZSTD:
+    GRN_TEXT_PUTS(ctx, buf, "|COMPRESS_ZSTD");
+    break;
+  case GRN_OBJ_COMPRESS_BP128:
+    GRN_TEXT_PUTS(ctx, buf, "|COMPRESS_BP128");
+    break;
   }
   if (flags & GRN_OBJ_PERSISTENT) {
     GRN_TEXT_PUTS(ctx, buf, "|PERSISTENT");
@@ -2073,6 +2274,75 @@ exit :
   return NULL;
 }
 
+static grn_obj *
+proc_column_train_dictionary(grn_ctx *ctx, int nargs, grn_obj **args,
+                             grn_user_data *user_data)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_obj *table = NULL;
+  grn_obj *column = NULL;
+  uint32_t max_n_samples = 0;
+  if (GRN_TEXT_LEN(VAR(0)) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc, "[column][train-dictionary] table name isn't specified");
+    goto exit;
+  }
+  table = grn_ctx_get(ctx, GRN_TEXT_VALUE(VAR(0)), GRN_TEXT_LEN(VAR(0)));
+  if (!table) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[column][train-dictionary] table isn't found: <%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
+    goto exit;
+  }
+  if (GRN_TEXT_LEN(VAR(1)) == 0) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[column][train-dictionary] column name isn't specified: <%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)));
+    goto exit;
+  }
+  column = grn_obj_column(ctx, table,
+                          GRN_TEXT_VALUE(VAR(1)), GRN_TEXT_LEN(VAR(1)));
+  if (!column) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[column][train-dictionary] column isn't found: <%.*s.%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)),
+        (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    goto exit;
+  }
+  if (column->header.type != GRN_COLUMN_VAR_SIZE) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[column][train-dictionary] column isn't a variable size column: "
+        "<%.*s.%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)),
+        (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    goto exit;
+  }
+  if ((column->header.flags & GRN_OBJ_COMPRESS_MASK) !=
+      GRN_OBJ_COMPRESS_ZSTD) {
+    rc = GRN_INVALID_ARGUMENT;
+    ERR(rc,
+        "[column][train-dictionary] column isn't compressed by Zstandard: "
+        "<%.*s.%.*s>",
+        (int)GRN_TEXT_LEN(VAR(0)), GRN_TEXT_VALUE(VAR(0)),
+        (int)GRN_TEXT_LEN(VAR(1)), GRN_TEXT_VALUE(VAR(1)));
+    goto exit;
+  }
+  if (GRN_TEXT_LEN(VAR(2)) > 0) {
+    max_n_samples = grn_atoui(GRN_TEXT_VALUE(VAR(2)), GRN_BULK_CURR(VAR(2)),
+                              NULL);
+  }
+  rc = grn_ja_train_dictionary(ctx, (grn_ja *)column, max_n_samples);
+exit :
+  GRN_OUTPUT_BOOL(!rc);
+  if (column) { grn_obj_unlink(ctx, column); }
+  if (table) { grn_obj_unlink(ctx, table); }
+  return NULL;
+}
+
 #define GRN_STRLEN(s) ((s) ? strlen(s) : 0)
 
 static void
@@ -6829,6 +7099,11 @@ grn_db_init_builtin_query(grn_ctx *ctx)
   DEF_VAR(vars[2], "new_name");
   DEF_COMMAND("column_rename", proc_column_rename, 3, vars);
 
+  DEF_VAR(vars[0], "table");
+  DEF_VAR(vars[1], "name");
+  DEF_VAR(vars[2], "max_n_samples");
+  DEF_COMMAND("column_train_dictionary", proc_column_train_dictionary, 3, vars);
+
   DEF_VAR(vars[0], "path");
   DEF_COMMAND(GRN_EXPR_MISSING_NAME, proc_missing, 1, vars);
 
@@ -98,6 +98,66 @@ grn_rset_recinfo_update_calc_values(grn_ctx *ctx,
   GRN_OBJ_FIN(ctx, &value_int64);
 }
 
+void
+grn_rset_recinfo_merge_calc_values(grn_ctx *ctx,
+                                   grn_rset_recinfo *ri,
+                                   grn_obj *table,
+                                   grn_rset_recinfo *other_ri)
+{
+  grn_table_group_flags flags;
+  byte *values;
+  byte *other_values;
+  int n_subrecs;
+  int other_n_subrecs;
+
+  flags = DB_OBJ(table)->flags.group;
+
+  values = (((byte *)ri->subrecs) +
+            GRN_RSET_SUBRECS_SIZE(DB_OBJ(table)->subrec_size,
+                                  DB_OBJ(table)->max_n_subrecs));
+  other_values = (((byte *)other_ri->subrecs) +
+                  GRN_RSET_SUBRECS_SIZE(DB_OBJ(table)->subrec_size,
+                                        DB_OBJ(table)->max_n_subrecs));
+  n_subrecs = GRN_RSET_N_SUBRECS(ri);
+  other_n_subrecs = GRN_RSET_N_SUBRECS(other_ri);
+  if (other_n_subrecs == 0) {
+    return;
+  }
+
+  if (flags & GRN_TABLE_GROUP_CALC_MAX) {
+    int64_t current_max = *((int64_t *)values);
+    int64_t other_max = *((int64_t *)other_values);
+    if (n_subrecs == 0 || other_max > current_max) {
+      *((int64_t *)values) = other_max;
+    }
+    values += GRN_RSET_MAX_SIZE;
+    other_values += GRN_RSET_MAX_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_MIN) {
+    int64_t current_min = *((int64_t *)values);
+    int64_t other_min = *((int64_t *)other_values);
+    if (n_subrecs == 0 || other_min < current_min) {
+      *((int64_t *)values) = other_min;
+    }
+    values += GRN_RSET_MIN_SIZE;
+    other_values += GRN_RSET_MIN_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_SUM) {
+    *((int64_t *)values) += *((int64_t *)other_values);
+    values += GRN_RSET_SUM_SIZE;
+    other_values += GRN_RSET_SUM_SIZE;
+  }
+  if (flags & GRN_TABLE_GROUP_CALC_AVG) {
+    double current_average = *((double *)values);
+    double other_average = *((double *)other_values);
+    *((double *)values) +=
+      (other_average - current_average) * other_n_subrecs /
+      (n_subrecs + other_n_subrecs);
+    values += GRN_RSET_AVG_SIZE;
+    other_values += GRN_RSET_AVG_SIZE;
+  }
+}
+
 int64_t *
 grn_rset_recinfo_get_max_(grn_ctx *ctx,
                           grn_rset_recinfo *ri,
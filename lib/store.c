@@ -17,6 +17,7 @@
 #include "grn.h"
 #include "grn_str.h"
 #include "grn_store.h"
+#include "grn_hash.h"
 #include "grn_ctx_impl.h"
 #include "grn_output.h"
 #include <string.h>
@@ -329,6 +330,7 @@ struct grn_ja_header {
 #define SEG_HUGE       (0x20000000U)
 #define SEG_EINFO      (0x30000000U)
 #define SEG_GINFO      (0x40000000U)
+#define SEG_DICT       (0x50000000U)
 #define SEG_MASK       (0xf0000000U)
 
 #define SEGMENTS_AT(ja,seg) ((ja)->header->dsegs[seg])
@@ -339,6 +341,718 @@ struct grn_ja_header {
 #define SEGMENTS_GINFO_ON(ja,seg,width) (SEGMENTS_AT(ja,seg) = SEG_GINFO|(width))
 #define SEGMENTS_OFF(ja,seg) (SEGMENTS_AT(ja,seg) = 0)
 
+#ifdef GRN_WITH_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+/*
+  Zstandard compressed columns can have trained dictionaries. A
+  dictionary is stored in a dedicated segment marked as SEG_DICT. The
+  segment starts with grn_ja_zstd_dictionary_header. The dictionary
+  that has the largest generation is used for compression. Older
+  dictionaries are kept until all values are recompressed with the new
+  dictionary because values refer their dictionary by its ID.
+
+  Readers and writers take a reference to a dictionary under
+  grn_ja_zstd_dictionaries::lock and release it after (de)compression.
+  A retired dictionary is freed by the last reference holder.
+*/
+#define GRN_JA_ZSTD_COMPRESSION_LEVEL             3
+#define GRN_JA_ZSTD_DICTIONARY_MAX_SIZE           (110 * 1024)
+#define GRN_JA_ZSTD_N_DICTIONARIES_MAX            8
+#define GRN_JA_ZSTD_N_CONTEXTS_MAX                8
+#define GRN_JA_ZSTD_RECOMPRESS_MAX_N_TRIES        3
+#define GRN_JA_ZSTD_TRAIN_DEFAULT_MAX_N_SAMPLES   10000
+#define GRN_JA_ZSTD_TRAIN_MAX_SAMPLES_SIZE        (GRN_JA_ZSTD_DICTIONARY_MAX_SIZE * 100)
+
+typedef struct {
+  uint32_t size;
+  uint32_t generation;
+} grn_ja_zstd_dictionary_header;
+
+typedef struct {
+  uint32_t seg;
+  uint32_t generation;
+  unsigned int id;
+  uint32_t n_refs;
+  grn_bool retired;
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+} grn_ja_zstd_dictionary;
+
+struct _grn_ja_zstd_dictionaries {
+  grn_critical_section lock;
+  uint32_t n_dictionaries;
+  /* Sorted by generation. The last one is the current dictionary. */
+  grn_ja_zstd_dictionary *dictionaries[GRN_JA_ZSTD_N_DICTIONARIES_MAX];
+  /* The number of values written with an old dictionary after the
+     current dictionary is added. */
+  uint32_t n_stale_writes;
+  uint32_t n_cctxs;
+  ZSTD_CCtx *cctxs[GRN_JA_ZSTD_N_CONTEXTS_MAX];
+  uint32_t n_dctxs;
+  ZSTD_DCtx *dctxs[GRN_JA_ZSTD_N_CONTEXTS_MAX];
+};
+
+static void
+grn_ja_zstd_dictionary_free(grn_ctx *ctx, grn_ja_zstd_dictionary *dictionary)
+{
+  if (dictionary->cdict) {
+    ZSTD_freeCDict(dictionary->cdict);
+  }
+  if (dictionary->ddict) {
+    ZSTD_freeDDict(dictionary->ddict);
+  }
+  GRN_GFREE(dictionary);
+}
+
+static grn_rc
+grn_ja_zstd_dictionary_read_generation(grn_ctx *ctx, grn_ja *ja, uint32_t seg,
+                                       uint32_t *generation)
+{
+  byte *addr = NULL;
+
+  GRN_IO_SEG_REF(ja->io, seg, addr);
+  if (!addr) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  *generation = ((grn_ja_zstd_dictionary_header *)addr)->generation;
+  GRN_IO_SEG_UNREF(ja->io, seg);
+  return GRN_SUCCESS;
+}
+
+static grn_ja_zstd_dictionary *
+grn_ja_zstd_dictionary_load(grn_ctx *ctx, grn_ja *ja, uint32_t seg)
+{
+  byte *addr = NULL;
+  grn_ja_zstd_dictionary_header *header;
+  grn_ja_zstd_dictionary *dictionary;
+  const void *content;
+
+  GRN_IO_SEG_REF(ja->io, seg, addr);
+  if (!addr) {
+    return NULL;
+  }
+  header = (grn_ja_zstd_dictionary_header *)addr;
+  content = header + 1;
+  if (header->size == 0 ||
+      header->size > JA_SEGMENT_SIZE - sizeof(grn_ja_zstd_dictionary_header)) {
+    GRN_IO_SEG_UNREF(ja->io, seg);
+    ERR(GRN_FILE_CORRUPT,
+        "[ja][zstd][dictionary] broken dictionary: <%u>: size:<%u>",
+        seg, header->size);
+    return NULL;
+  }
+  dictionary = GRN_GCALLOC(sizeof(grn_ja_zstd_dictionary));
+  if (!dictionary) {
+    GRN_IO_SEG_UNREF(ja->io, seg);
+    return NULL;
+  }
+  dictionary->seg = seg;
+  dictionary->generation = header->generation;
+  dictionary->id = ZSTD_getDictID_fromDict(content, header->size);
+  dictionary->cdict = ZSTD_createCDict(content, header->size,
+                                       GRN_JA_ZSTD_COMPRESSION_LEVEL);
+  dictionary->ddict = ZSTD_createDDict(content, header->size);
+  GRN_IO_SEG_UNREF(ja->io, seg);
+  if (!dictionary->cdict || !dictionary->ddict) {
+    grn_ja_zstd_dictionary_free(ctx, dictionary);
+    ERR(GRN_ZSTD_ERROR,
+        "[ja][zstd][dictionary] failed to load dictionary: <%u>", seg);
+    return NULL;
+  }
+  return dictionary;
+}
+
+/* Must be called with dictionaries->lock. */
+static void
+grn_ja_zstd_dictionaries_retire(grn_ctx *ctx,
+                                grn_ja_zstd_dictionaries *dictionaries,
+                                uint32_t i)
+{
+  grn_ja_zstd_dictionary *dictionary = dictionaries->dictionaries[i];
+  for (; i + 1 < dictionaries->n_dictionaries; i++) {
+    dictionaries->dictionaries[i] = dictionaries->dictionaries[i + 1];
+  }
+  dictionaries->n_dictionaries--;
+  if (dictionary->n_refs == 0) {
+    grn_ja_zstd_dictionary_free(ctx, dictionary);
+  } else {
+    dictionary->retired = GRN_TRUE;
+  }
+}
+
+/* Must be called with dictionaries->lock. */
+static grn_ja_zstd_dictionary *
+grn_ja_zstd_dictionaries_find_by_seg(grn_ja_zstd_dictionaries *dictionaries,
+                                     uint32_t seg, uint32_t *i)
+{
+  for (*i = 0; *i < dictionaries->n_dictionaries; (*i)++) {
+    if (dictionaries->dictionaries[*i]->seg == seg) {
+      return dictionaries->dictionaries[*i];
+    }
+  }
+  return NULL;
+}
+
+static grn_rc
+grn_ja_zstd_dictionaries_add(grn_ctx *ctx, grn_ja *ja, uint32_t seg)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  grn_ja_zstd_dictionary *dictionary;
+  grn_ja_zstd_dictionary *same_seg_dictionary;
+  uint32_t i;
+
+  dictionary = grn_ja_zstd_dictionary_load(ctx, ja, seg);
+  if (!dictionary) {
+    return ctx->rc == GRN_SUCCESS ? GRN_NO_MEMORY_AVAILABLE : ctx->rc;
+  }
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  /* The segment may be reused for a newer dictionary by another process. */
+  same_seg_dictionary =
+    grn_ja_zstd_dictionaries_find_by_seg(dictionaries, seg, &i);
+  if (same_seg_dictionary) {
+    if (same_seg_dictionary->generation == dictionary->generation) {
+      CRITICAL_SECTION_LEAVE(dictionaries->lock);
+      grn_ja_zstd_dictionary_free(ctx, dictionary);
+      return GRN_SUCCESS;
+    }
+    grn_ja_zstd_dictionaries_retire(ctx, dictionaries, i);
+  }
+  if (dictionaries->n_dictionaries == GRN_JA_ZSTD_N_DICTIONARIES_MAX) {
+    CRITICAL_SECTION_LEAVE(dictionaries->lock);
+    grn_ja_zstd_dictionary_free(ctx, dictionary);
+    ERR(GRN_NO_MEMORY_AVAILABLE,
+        "[ja][zstd][dictionary] too many dictionaries: <%u>",
+        GRN_JA_ZSTD_N_DICTIONARIES_MAX);
+    return ctx->rc;
+  }
+  for (i = dictionaries->n_dictionaries; i > 0; i--) {
+    if (dictionaries->dictionaries[i - 1]->generation <
+        dictionary->generation) {
+      break;
+    }
+    dictionaries->dictionaries[i] = dictionaries->dictionaries[i - 1];
+  }
+  dictionaries->dictionaries[i] = dictionary;
+  dictionaries->n_dictionaries++;
+  if (i + 1 == dictionaries->n_dictionaries) {
+    dictionaries->n_stale_writes = 0;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  return GRN_SUCCESS;
+}
+
+/* Adds dictionaries in SEG_DICT segments that aren't loaded yet. They
+   may be stored by another process after the column is opened. */
+static grn_rc
+grn_ja_zstd_dictionaries_load_new(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  uint32_t seg;
+
+  for (seg = 0; seg < JA_N_DSEGMENTS; seg++) {
+    grn_rc rc;
+    grn_ja_zstd_dictionary *dictionary;
+    uint32_t generation;
+    uint32_t i;
+    if ((SEGMENTS_AT(ja, seg) & SEG_MASK) != SEG_DICT) {
+      continue;
+    }
+    rc = grn_ja_zstd_dictionary_read_generation(ctx, ja, seg, &generation);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+    CRITICAL_SECTION_ENTER(dictionaries->lock);
+    dictionary = grn_ja_zstd_dictionaries_find_by_seg(dictionaries, seg, &i);
+    CRITICAL_SECTION_LEAVE(dictionaries->lock);
+    if (dictionary && dictionary->generation == generation) {
+      continue;
+    }
+    rc = grn_ja_zstd_dictionaries_add(ctx, ja, seg);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+  }
+  return GRN_SUCCESS;
+}
+
+static void
+grn_ja_zstd_dictionaries_close(grn_ctx *ctx, grn_ja *ja)
+{
+  uint32_t i;
+  grn_ja_zstd_dictionaries *dictionaries = ja->zstd_dictionaries;
+  if (!dictionaries) {
+    return;
+  }
+  for (i = 0; i < dictionaries->n_dictionaries; i++) {
+    grn_ja_zstd_dictionary_free(ctx, dictionaries->dictionaries[i]);
+  }
+  for (i = 0; i < dictionaries->n_cctxs; i++) {
+    ZSTD_freeCCtx(dictionaries->cctxs[i]);
+  }
+  for (i = 0; i < dictionaries->n_dctxs; i++) {
+    ZSTD_freeDCtx(dictionaries->dctxs[i]);
+  }
+  CRITICAL_SECTION_FIN(dictionaries->lock);
+  GRN_GFREE(dictionaries);
+  ja->zstd_dictionaries = NULL;
+}
+
+static grn_rc
+grn_ja_zstd_dictionaries_open(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_rc rc;
+
+  ja->zstd_dictionaries = GRN_GCALLOC(sizeof(grn_ja_zstd_dictionaries));
+  if (!ja->zstd_dictionaries) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  CRITICAL_SECTION_INIT(ja->zstd_dictionaries->lock);
+  rc = grn_ja_zstd_dictionaries_load_new(ctx, ja);
+  if (rc != GRN_SUCCESS) {
+    grn_ja_zstd_dictionaries_close(ctx, ja);
+  }
+  return rc;
+}
+
+/* Returns the current dictionary with a reference or NULL. */
+static grn_ja_zstd_dictionary *
+grn_ja_zstd_dictionaries_ref_current(grn_ja *ja)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  grn_ja_zstd_dictionary *dictionary = NULL;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_dictionaries > 0) {
+    dictionary = dictionaries->dictionaries[dictionaries->n_dictionaries - 1];
+    dictionary->n_refs++;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  return dictionary;
+}
+
+/* Returns the dictionary that has the ID with a reference or NULL. */
+static grn_ja_zstd_dictionary *
+grn_ja_zstd_dictionaries_ref(grn_ja *ja, unsigned int id)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  grn_ja_zstd_dictionary *dictionary = NULL;
+  uint32_t i;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  for (i = dictionaries->n_dictionaries; i > 0; i--) {
+    if (dictionaries->dictionaries[i - 1]->id == id) {
+      dictionary = dictionaries->dictionaries[i - 1];
+      dictionary->n_refs++;
+      break;
+    }
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  return dictionary;
+}
+
+/* `written' is GRN_TRUE when a value compressed with the dictionary
+   is stored. */
+static void
+grn_ja_zstd_dictionaries_unref(grn_ctx *ctx, grn_ja *ja,
+                               grn_ja_zstd_dictionary *dictionary,
+                               grn_bool written)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (written &&
+      (dictionary->retired ||
+       dictionaries->n_dictionaries == 0 ||
+       dictionary !=
+       dictionaries->dictionaries[dictionaries->n_dictionaries - 1])) {
+    dictionaries->n_stale_writes++;
+  }
+  dictionary->n_refs--;
+  if (dictionary->retired && dictionary->n_refs == 0) {
+    grn_ja_zstd_dictionary_free(ctx, dictionary);
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+}
+
+static ZSTD_CCtx *
+grn_ja_zstd_cctx_open(grn_ja *ja)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  ZSTD_CCtx *cctx = NULL;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_cctxs > 0) {
+    cctx = dictionaries->cctxs[--dictionaries->n_cctxs];
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  if (!cctx) {
+    cctx = ZSTD_createCCtx();
+  }
+  return cctx;
+}
+
+static void
+grn_ja_zstd_cctx_close(grn_ja *ja, ZSTD_CCtx *cctx)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_cctxs < GRN_JA_ZSTD_N_CONTEXTS_MAX) {
+    dictionaries->cctxs[dictionaries->n_cctxs++] = cctx;
+    cctx = NULL;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  if (cctx) {
+    ZSTD_freeCCtx(cctx);
+  }
+}
+
+static ZSTD_DCtx *
+grn_ja_zstd_dctx_open(grn_ja *ja)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  ZSTD_DCtx *dctx = NULL;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_dctxs > 0) {
+    dctx = dictionaries->dctxs[--dictionaries->n_dctxs];
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  if (!dctx) {
+    dctx = ZSTD_createDCtx();
+  }
+  return dctx;
+}
+
+static void
+grn_ja_zstd_dctx_close(grn_ja *ja, ZSTD_DCtx *dctx)
+{
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_dctxs < GRN_JA_ZSTD_N_CONTEXTS_MAX) {
+    dictionaries->dctxs[dictionaries->n_dctxs++] = dctx;
+    dctx = NULL;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  if (dctx) {
+    ZSTD_freeDCtx(dctx);
+  }
+}
+#endif /* GRN_WITH_ZSTD */
+
+/*
+ * Decompressed values of compressed columns are cached in a LRU cache
+ * shared by all columns and contexts. An entry is keyed by the column,
+ * the record ID and the element info of the value. The element info
+ * has the location and the size of the compressed value, so it's
+ * changed whenever the value is updated. Entries are removed by
+ * grn_ja_replace() too because a location may be reused for the next
+ * value of the same record.
+ */
+
+static size_t grn_ja_value_cache_max_size = 32 * 1024 * 1024;
+
+typedef struct {
+  uint64_t ja;
+  uint64_t version;
+  grn_id id;
+  uint32_t padding;
+} grn_ja_value_cache_key;
+
+typedef struct _grn_ja_value_cache_entry grn_ja_value_cache_entry;
+
+struct _grn_ja_value_cache_entry {
+  grn_ja_value_cache_entry *next;
+  grn_ja_value_cache_entry *prev;
+  grn_ja *ja;
+  grn_id hash_id;
+  uint32_t size;
+  void *value;
+};
+
+static struct {
+  grn_ja_value_cache_entry *next;
+  grn_ja_value_cache_entry *prev;
+  grn_critical_section lock;
+  grn_hash *hash;
+  size_t total_size;
+  uint64_t n_hits;
+  uint64_t n_misses;
+} grn_ja_value_cache;
+
+void
+grn_ja_init_from_env(void)
+{
+  {
+    char grn_ja_value_cache_size_env[GRN_ENV_BUFFER_SIZE];
+    grn_getenv("GRN_JA_VALUE_CACHE_SIZE",
+               grn_ja_value_cache_size_env,
+               GRN_ENV_BUFFER_SIZE);
+    if (grn_ja_value_cache_size_env[0]) {
+      grn_ja_value_cache_max_size = atoi(grn_ja_value_cache_size_env);
+    }
+  }
+}
+
+void
+grn_ja_value_cache_init(void)
+{
+  grn_ja_value_cache_entry *head =
+    (grn_ja_value_cache_entry *)&grn_ja_value_cache;
+  CRITICAL_SECTION_INIT(grn_ja_value_cache.lock);
+  grn_ja_value_cache.next = head;
+  grn_ja_value_cache.prev = head;
+  grn_ja_value_cache.hash = NULL;
+  grn_ja_value_cache.total_size = 0;
+  grn_ja_value_cache.n_hits = 0;
+  grn_ja_value_cache.n_misses = 0;
+}
+
+/* Must be called in grn_ja_value_cache.lock. */
+static void
+grn_ja_value_cache_entry_remove(grn_ja_value_cache_entry *entry)
+{
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+  grn_ja_value_cache.total_size -= entry->size;
+  GRN_GFREE(entry->value);
+  grn_hash_delete_by_id(&grn_gctx, grn_ja_value_cache.hash,
+                        entry->hash_id, NULL);
+}
+
+void
+grn_ja_value_cache_fin(void)
+{
+  grn_ja_value_cache_entry *head =
+    (grn_ja_value_cache_entry *)&grn_ja_value_cache;
+  while (head->prev != head) {
+    grn_ja_value_cache_entry_remove(head->prev);
+  }
+  if (grn_ja_value_cache.hash) {
+    grn_hash_close(&grn_gctx, grn_ja_value_cache.hash);
+    grn_ja_value_cache.hash = NULL;
+  }
+  CRITICAL_SECTION_FIN(grn_ja_value_cache.lock);
+}
+
+void
+grn_ja_value_cache_get_statistics(grn_ja_value_cache_statistics *statistics)
+{
+  CRITICAL_SECTION_ENTER(grn_ja_value_cache.lock);
+  statistics->n_entries =
+    grn_ja_value_cache.hash ? GRN_HASH_SIZE(grn_ja_value_cache.hash) : 0;
+  statistics->size = grn_ja_value_cache.total_size;
+  statistics->max_size = grn_ja_value_cache_max_size;
+  statistics->n_hits = grn_ja_value_cache.n_hits;
+  statistics->n_misses = grn_ja_value_cache.n_misses;
+  CRITICAL_SECTION_LEAVE(grn_ja_value_cache.lock);
+}
+
+inline static grn_bool
+grn_ja_value_cache_is_enabled(grn_ja *ja)
+{
+  if (grn_ja_value_cache_max_size == 0) {
+    return GRN_FALSE;
+  }
+  switch (ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
+  case GRN_OBJ_COMPRESS_ZLIB :
+  case GRN_OBJ_COMPRESS_LZ4 :
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return GRN_TRUE;
+  default :
+    return GRN_FALSE;
+  }
+}
+
+/* Returns the element info of the value as the version or 0. */
+inline static uint64_t
+grn_ja_value_cache_version(grn_ctx *ctx, grn_ja *ja, grn_id id)
+{
+  uint64_t version = 0;
+  uint32_t pseg = ja->header->esegs[id >> JA_W_EINFO_IN_A_SEGMENT];
+  if (pseg != JA_ESEG_VOID) {
+    grn_ja_einfo *einfo = NULL;
+    GRN_IO_SEG_REF(ja->io, pseg, einfo);
+    if (einfo) {
+      version = *((uint64_t *)&einfo[id & JA_M_EINFO_IN_A_SEGMENT]);
+      GRN_IO_SEG_UNREF(ja->io, pseg);
+    }
+  }
+  return version;
+}
+
+inline static void
+grn_ja_value_cache_key_init(grn_ja_value_cache_key *key,
+                            grn_ja *ja, grn_id id, uint64_t version)
+{
+  key->ja = (uint64_t)(uintptr_t)ja;
+  key->version = version;
+  key->id = id;
+  key->padding = 0;
+}
+
+/*
+ * Copies the cached value of the record to iw->uncompressed_value. It
+ * returns NULL and sets *version on miss.
+ */
+static void *
+grn_ja_value_cache_fetch(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                         grn_io_win *iw, uint32_t *value_len,
+                         uint64_t *version)
+{
+  grn_ja_value_cache_key key;
+  grn_ja_value_cache_entry *entry;
+  void *value = NULL;
+
+  *version = grn_ja_value_cache_version(ctx, ja, id);
+  if (*version == 0) {
+    return NULL;
+  }
+  grn_ja_value_cache_key_init(&key, ja, id, *version);
+
+  CRITICAL_SECTION_ENTER(grn_ja_value_cache.lock);
+  if (grn_ja_value_cache.hash &&
+      grn_hash_get(&grn_gctx, grn_ja_value_cache.hash,
+                   &key, sizeof(grn_ja_value_cache_key), (void **)&entry)) {
+    grn_ja_value_cache_entry *head =
+      (grn_ja_value_cache_entry *)&grn_ja_value_cache;
+    if ((value = GRN_MALLOC(entry->size))) {
+      grn_memcpy(value, entry->value, entry->size);
+      *value_len = entry->size;
+      entry->prev->next = entry->next;
+      entry->next->prev = entry->prev;
+      entry->next = head->next;
+      entry->prev = head;
+      head->next->prev = entry;
+      head->next = entry;
+    }
+  }
+  if (value) {
+    grn_ja_value_cache.n_hits++;
+  } else {
+    grn_ja_value_cache.n_misses++;
+  }
+  CRITICAL_SECTION_LEAVE(grn_ja_value_cache.lock);
+
+  if (value) {
+    iw->io = ja->io;
+    iw->ctx = ctx;
+    iw->tiny_p = 0;
+    iw->size = 0;
+    iw->addr = NULL;
+    iw->uncompressed_value = value;
+  }
+  return value;
+}
+
+static void
+grn_ja_value_cache_store(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                         uint64_t version, void *value, uint32_t value_len)
+{
+  grn_ja_value_cache_key key;
+  grn_ja_value_cache_entry *entry;
+  grn_ja_value_cache_entry *head =
+    (grn_ja_value_cache_entry *)&grn_ja_value_cache;
+  grn_id hash_id;
+  int added = 0;
+  void *cached_value;
+
+  if (version == 0 || value_len == 0 ||
+      value_len > grn_ja_value_cache_max_size / 4) {
+    return;
+  }
+  /* The value may be updated while it's decompressed. */
+  if (grn_ja_value_cache_version(ctx, ja, id) != version) {
+    return;
+  }
+  if (!(cached_value = GRN_GMALLOC(value_len))) {
+    return;
+  }
+  grn_memcpy(cached_value, value, value_len);
+  grn_ja_value_cache_key_init(&key, ja, id, version);
+
+  CRITICAL_SECTION_ENTER(grn_ja_value_cache.lock);
+  if (!grn_ja_value_cache.hash) {
+    grn_ja_value_cache.hash =
+      grn_hash_create(&grn_gctx, NULL, sizeof(grn_ja_value_cache_key),
+                      sizeof(grn_ja_value_cache_entry), 0);
+    if (!grn_ja_value_cache.hash) {
+      goto exit;
+    }
+  }
+  while (head->prev != head &&
+         grn_ja_value_cache.total_size + value_len >
+           grn_ja_value_cache_max_size) {
+    grn_ja_value_cache_entry_remove(head->prev);
+  }
+  hash_id = grn_hash_add(&grn_gctx, grn_ja_value_cache.hash,
+                         &key, sizeof(grn_ja_value_cache_key),
+                         (void **)&entry, &added);
+  if (!hash_id || !added) {
+    goto exit;
+  }
+  entry->ja = ja;
+  entry->hash_id = hash_id;
+  entry->size = value_len;
+  entry->value = cached_value;
+  entry->next = head->next;
+  entry->prev = head;
+  head->next->prev = entry;
+  head->next = entry;
+  grn_ja_value_cache.total_size += value_len;
+  cached_value = NULL;
+exit :
+  CRITICAL_SECTION_LEAVE(grn_ja_value_cache.lock);
+  if (cached_value) {
+    GRN_GFREE(cached_value);
+  }
+}
+
+static void
+grn_ja_value_cache_remove(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                          uint64_t version)
+{
+  grn_ja_value_cache_key key;
+  grn_ja_value_cache_entry *entry;
+
+  if (!grn_ja_value_cache.hash) {
+    return;
+  }
+  grn_ja_value_cache_key_init(&key, ja, id, version);
+  CRITICAL_SECTION_ENTER(grn_ja_value_cache.lock);
+  if (grn_hash_get(&grn_gctx, grn_ja_value_cache.hash,
+                   &key, sizeof(grn_ja_value_cache_key), (void **)&entry)) {
+    grn_ja_value_cache_entry_remove(entry);
+  }
+  CRITICAL_SECTION_LEAVE(grn_ja_value_cache.lock);
+}
+
+/* Removes all entries of ja. It's called before ja is closed. */
+static void
+grn_ja_value_cache_remove_all(grn_ctx *ctx, grn_ja *ja)
+{
+  grn_ja_value_cache_entry *head =
+    (grn_ja_value_cache_entry *)&grn_ja_value_cache;
+  grn_ja_value_cache_entry *entry;
+
+  if (!grn_ja_value_cache.hash) {
+    return;
+  }
+  CRITICAL_SECTION_ENTER(grn_ja_value_cache.lock);
+  for (entry = head->next; entry != head;) {
+    grn_ja_value_cache_entry *next = entry->next;
+    if (entry->ja == ja) {
+      grn_ja_value_cache_entry_remove(entry);
+    }
+    entry = next;
+  }
+  CRITICAL_SECTION_LEAVE(grn_ja_value_cache.lock);
+}
+
 static grn_ja *
 _grn_ja_create(grn_ctx *ctx, grn_ja *ja, const char *path,
                unsigned int max_element_size, uint32_t flags)
@@ -381,8 +1095,20 @@ _grn_ja_create(grn_ctx *ctx, grn_ja *ja, const char *path,
 
   ja->io = io;
   ja->header = header;
+  ja->zstd_dictionaries = NULL;
   SEGMENTS_EINFO_ON(ja, 0, 0);
   header->esegs[0] = 0;
+
+#ifdef GRN_WITH_ZSTD
+  if ((flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_ZSTD) {
+    if (grn_ja_zstd_dictionaries_open(ctx, ja) != GRN_SUCCESS) {
+      grn_io_close(ctx, io);
+      GRN_GFREE(header);
+      return NULL;
+    }
+  }
+#endif /* GRN_WITH_ZSTD */
+
   return ja;
 }
 
@@ -456,6 +1182,18 @@ grn_ja_open(grn_ctx *ctx, const char *path)
 
   ja->io = io;
   ja->header = header;
+  ja->zstd_dictionaries = NULL;
+
+#ifdef GRN_WITH_ZSTD
+  if ((header->flags & GRN_OBJ_COMPRESS_MASK) == GRN_OBJ_COMPRESS_ZSTD) {
+    if (grn_ja_zstd_dictionaries_open(ctx, ja) != GRN_SUCCESS) {
+      grn_io_close(ctx, io);
+      GRN_GFREE(header);
+      GRN_GFREE(ja);
+      return NULL;
+    }
+  }
+#endif /* GRN_WITH_ZSTD */
 
   return ja;
 }
@@ -473,6 +1211,10 @@ grn_ja_close(grn_ctx *ctx, grn_ja *ja)
 {
   grn_rc rc;
   if (!ja) { return GRN_INVALID_ARGUMENT; }
+  grn_ja_value_cache_remove_all(ctx, ja);
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_dictionaries_close(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
   rc = grn_io_close(ctx, ja->io);
   GRN_GFREE(ja->header);
   GRN_GFREE(ja);
@@ -504,6 +1246,10 @@ grn_ja_truncate(grn_ctx *ctx, grn_ja *ja)
   }
   max_element_size = ja->header->max_element_size;
   flags = ja->header->flags;
+  grn_ja_value_cache_remove_all(ctx, ja);
+#ifdef GRN_WITH_ZSTD
+  grn_ja_zstd_dictionaries_close(ctx, ja);
+#endif /* GRN_WITH_ZSTD */
   if ((rc = grn_io_close(ctx, ja->io))) { goto exit; }
   ja->io = NULL;
   if (path && (rc = grn_io_remove(ctx, path))) { goto exit; }
@@ -703,6 +1449,9 @@ grn_ja_replace(grn_ctx *ctx, grn_ja *ja, grn_id id,
   }
   GRN_IO_SEG_UNREF(ja->io, *pseg);
   grn_ja_free(ctx, ja, &eback);
+  if (grn_ja_value_cache_is_enabled(ja)) {
+    grn_ja_value_cache_remove(ctx, ja, id, *((uint64_t *)&eback));
+  }
 exit :
   grn_io_unlock(ja->io);
   return rc;
@@ -1267,20 +2016,123 @@ grn_ja_ref_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *va
 }
 #endif /* GRN_WITH_LZ4 */
 
+#ifdef GRN_WITH_ZSTD
+static void *
+grn_ja_ref_zstd(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
+{
+  void *packed_value;
+  uint32_t packed_value_len;
+  void *zstd_value;
+  size_t zstd_value_len;
+  uint64_t original_value_len;
+  void *uncompressed_value;
+  unsigned int dictionary_id;
+  ZSTD_DCtx *dctx;
+  size_t result;
+
+  if (!(packed_value = grn_ja_ref_raw(ctx, ja, id, iw, &packed_value_len))) {
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  if (packed_value_len == 0) {
+    *value_len = 0;
+    return packed_value;
+  }
+  original_value_len = *((uint64_t *)packed_value);
+  zstd_value = (void *)((uint64_t *)packed_value + 1);
+  zstd_value_len = packed_value_len - sizeof(uint64_t);
+  if (!(uncompressed_value = GRN_MALLOC(original_value_len))) {
+    grn_ja_unref(ctx, iw);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  if (!(dctx = grn_ja_zstd_dctx_open(ja))) {
+    GRN_FREE(uncompressed_value);
+    grn_ja_unref(ctx, iw);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  dictionary_id = ZSTD_getDictID_fromFrame(zstd_value, zstd_value_len);
+  if (dictionary_id == 0) {
+    result = ZSTD_decompressDCtx(dctx,
+                                 uncompressed_value, original_value_len,
+                                 zstd_value, zstd_value_len);
+  } else {
+    grn_ja_zstd_dictionary *dictionary;
+    dictionary = grn_ja_zstd_dictionaries_ref(ja, dictionary_id);
+    if (!dictionary &&
+        grn_ja_zstd_dictionaries_load_new(ctx, ja) == GRN_SUCCESS) {
+      dictionary = grn_ja_zstd_dictionaries_ref(ja, dictionary_id);
+    }
+    if (dictionary) {
+      result = ZSTD_decompress_usingDDict(dctx,
+                                          uncompressed_value,
+                                          original_value_len,
+                                          zstd_value, zstd_value_len,
+                                          dictionary->ddict);
+      grn_ja_zstd_dictionaries_unref(ctx, ja, dictionary, GRN_FALSE);
+    } else {
+      ERR(GRN_ZSTD_ERROR,
+          "[ja][zstd] dictionary isn't found: <%u>: <%u>",
+          id, dictionary_id);
+      result = (size_t)-1;
+    }
+  }
+  grn_ja_zstd_dctx_close(ja, dctx);
+  grn_ja_unref(ctx, iw);
+  if (ZSTD_isError(result) || result != original_value_len) {
+    GRN_FREE(uncompressed_value);
+    iw->uncompressed_value = NULL;
+    *value_len = 0;
+    return NULL;
+  }
+  iw->uncompressed_value = uncompressed_value;
+  *value_len = original_value_len;
+  return iw->uncompressed_value;
+}
+#endif /* GRN_WITH_ZSTD */
+
 void *
 grn_ja_ref(grn_ctx *ctx, grn_ja *ja, grn_id id, grn_io_win *iw, uint32_t *value_len)
 {
-#ifdef GRN_WITH_ZLIB
-  if (ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
-    return grn_ja_ref_zlib(ctx, ja, id, iw, value_len);
+  void *value;
+  uint64_t version = 0;
+  grn_bool use_cache = grn_ja_value_cache_is_enabled(ja);
+
+  if (use_cache) {
+    value = grn_ja_value_cache_fetch(ctx, ja, id, iw, value_len, &version);
+    if (value) {
+      return value;
+    }
   }
+
+  switch (ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
+#ifdef GRN_WITH_ZLIB
+  case GRN_OBJ_COMPRESS_ZLIB :
+    value = grn_ja_ref_zlib(ctx, ja, id, iw, value_len);
+    break;
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
-    return grn_ja_ref_lz4(ctx, ja, id, iw, value_len);
-  }
+  case GRN_OBJ_COMPRESS_LZ4 :
+    value = grn_ja_ref_lz4(ctx, ja, id, iw, value_len);
+    break;
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_ref_raw(ctx, ja, id, iw, value_len);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    value = grn_ja_ref_zstd(ctx, ja, id, iw, value_len);
+    break;
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_ref_raw(ctx, ja, id, iw, value_len);
+  }
+
+  if (use_cache && value && iw->uncompressed_value) {
+    grn_ja_value_cache_store(ctx, ja, id, version, value, *value_len);
+  }
+  return value;
 }
 
 grn_obj *
@@ -1404,21 +2256,388 @@ grn_ja_put_lz4(grn_ctx *ctx, grn_ja *ja, grn_id id,
 }
 #endif /* GRN_WITH_LZ4 */
 
+#ifdef GRN_WITH_ZSTD
+inline static grn_rc
+grn_ja_put_zstd(grn_ctx *ctx, grn_ja *ja, grn_id id,
+                void *value, uint32_t value_len, int flags, uint64_t *cas)
+{
+  grn_rc rc;
+  void *packed_value;
+  void *zstd_value;
+  size_t zstd_value_len;
+  ZSTD_CCtx *cctx;
+  grn_ja_zstd_dictionary *dictionary;
+
+  if (value_len == 0) {
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
+
+  zstd_value_len = ZSTD_compressBound(value_len);
+  if (!(packed_value = GRN_MALLOC(zstd_value_len + sizeof(uint64_t)))) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  if (!(cctx = grn_ja_zstd_cctx_open(ja))) {
+    GRN_FREE(packed_value);
+    ERR(GRN_ZSTD_ERROR, "[ja][zstd] failed to create compression context");
+    return ctx->rc;
+  }
+  zstd_value = (void *)((uint64_t *)packed_value + 1);
+  /* The reference is kept until the value is stored. See
+     grn_ja_zstd_remove_old_dictionaries(). */
+  dictionary = grn_ja_zstd_dictionaries_ref_current(ja);
+  if (dictionary) {
+    zstd_value_len = ZSTD_compress_usingCDict(cctx,
+                                              zstd_value, zstd_value_len,
+                                              value, value_len,
+                                              dictionary->cdict);
+  } else {
+    zstd_value_len = ZSTD_compressCCtx(cctx,
+                                       zstd_value, zstd_value_len,
+                                       value, value_len,
+                                       GRN_JA_ZSTD_COMPRESSION_LEVEL);
+  }
+  grn_ja_zstd_cctx_close(ja, cctx);
+  if (ZSTD_isError(zstd_value_len)) {
+    if (dictionary) {
+      grn_ja_zstd_dictionaries_unref(ctx, ja, dictionary, GRN_FALSE);
+    }
+    GRN_FREE(packed_value);
+    ERR(GRN_ZSTD_ERROR, "[ja][zstd] failed to compress: <%s>",
+        ZSTD_getErrorName(zstd_value_len));
+    return ctx->rc;
+  }
+  *(uint64_t *)packed_value = value_len;
+  rc = grn_ja_put_raw(ctx, ja, id,
+                      packed_value, zstd_value_len + sizeof(uint64_t),
+                      flags, cas);
+  if (dictionary) {
+    grn_ja_zstd_dictionaries_unref(ctx, ja, dictionary, rc == GRN_SUCCESS);
+  }
+  GRN_FREE(packed_value);
+  return rc;
+}
+#endif /* GRN_WITH_ZSTD */
+
 grn_rc
 grn_ja_put(grn_ctx *ctx, grn_ja *ja, grn_id id, void *value, uint32_t value_len,
            int flags, uint64_t *cas)
 {
+  switch (ja->header->flags & GRN_OBJ_COMPRESS_MASK) {
 #ifdef GRN_WITH_ZLIB
-  if (ja->header->flags & GRN_OBJ_COMPRESS_ZLIB) {
+  case GRN_OBJ_COMPRESS_ZLIB :
     return grn_ja_put_zlib(ctx, ja, id, value, value_len, flags, cas);
-  }
 #endif /* GRN_WITH_ZLIB */
 #ifdef GRN_WITH_LZ4
-  if (ja->header->flags & GRN_OBJ_COMPRESS_LZ4) {
+  case GRN_OBJ_COMPRESS_LZ4 :
     return grn_ja_put_lz4(ctx, ja, id, value, value_len, flags, cas);
-  }
 #endif /* GRN_WITH_LZ4 */
-  return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+#ifdef GRN_WITH_ZSTD
+  case GRN_OBJ_COMPRESS_ZSTD :
+    return grn_ja_put_zstd(ctx, ja, id, value, value_len, flags, cas);
+#endif /* GRN_WITH_ZSTD */
+  default :
+    return grn_ja_put_raw(ctx, ja, id, value, value_len, flags, cas);
+  }
+}
+
+#ifdef GRN_WITH_ZSTD
+/* Calls `block' for each id that has a non-empty value. `block' must
+   not use `break'. */
+#define GRN_JA_EACH_VALUE_ID(ctx, ja, id, block) do {                   \
+  uint32_t lseg_;                                                       \
+  for (lseg_ = 0; lseg_ < JA_N_ESEGMENTS; lseg_++) {                    \
+    uint32_t pos_;                                                      \
+    grn_ja_einfo *einfo_ = NULL;                                        \
+    const uint32_t pseg_ = ja->header->esegs[lseg_];                    \
+    if (pseg_ == JA_ESEG_VOID) { continue; }                            \
+    GRN_IO_SEG_REF(ja->io, pseg_, einfo_);                              \
+    if (!einfo_) { break; }                                             \
+    for (pos_ = 0; pos_ < JA_N_EINFO_IN_A_SEGMENT; pos_++) {            \
+      grn_ja_einfo * const ei_ = &einfo_[pos_];                         \
+      uint32_t size_;                                                   \
+      if (ETINY_P(ei_)) {                                               \
+        ETINY_DEC(ei_, size_);                                          \
+      } else if (EHUGE_P(ei_)) {                                        \
+        size_ = ei_->u.h.size;                                          \
+      } else {                                                          \
+        size_ = (ei_->u.n.c2 << 16) + ei_->u.n.size;                    \
+      }                                                                 \
+      id = (lseg_ << JA_W_EINFO_IN_A_SEGMENT) + pos_;                   \
+      if (id == GRN_ID_NIL || size_ == 0) { continue; }                 \
+      block                                                             \
+    }                                                                   \
+    GRN_IO_SEG_UNREF(ja->io, pseg_);                                    \
+  }                                                                     \
+} while (0)
+
+static grn_rc
+grn_ja_zstd_train(grn_ctx *ctx, grn_ja *ja, uint32_t max_n_samples,
+                  grn_obj *dictionary_content)
+{
+  grn_id id;
+  uint32_t n_values = 0;
+  uint32_t n_samples = 0;
+  uint32_t stride;
+  uint32_t nth = 0;
+  size_t *sample_sizes;
+  grn_obj samples;
+  size_t dictionary_size;
+
+  GRN_JA_EACH_VALUE_ID(ctx, ja, id, {
+    n_values++;
+  });
+  if (n_values == 0) {
+    ERR(GRN_INVALID_ARGUMENT, "[ja][zstd][train] no values");
+    return ctx->rc;
+  }
+  if (n_values > max_n_samples) {
+    stride = n_values / max_n_samples;
+  } else {
+    stride = 1;
+    max_n_samples = n_values;
+  }
+
+  sample_sizes = GRN_MALLOC(sizeof(size_t) * max_n_samples);
+  if (!sample_sizes) {
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  GRN_TEXT_INIT(&samples, 0);
+  GRN_JA_EACH_VALUE_ID(ctx, ja, id, {
+    grn_io_win iw;
+    void *value;
+    uint32_t value_len;
+    if ((nth++ % stride) != 0) { continue; }
+    if (n_samples == max_n_samples) { continue; }
+    if (GRN_TEXT_LEN(&samples) >= GRN_JA_ZSTD_TRAIN_MAX_SAMPLES_SIZE) {
+      continue;
+    }
+    value = grn_ja_ref(ctx, ja, id, &iw, &value_len);
+    if (!value) { continue; }
+    if (value_len > 0) {
+      GRN_TEXT_PUT(ctx, &samples, value, value_len);
+      sample_sizes[n_samples++] = value_len;
+    }
+    grn_ja_unref(ctx, &iw);
+  });
+
+  grn_bulk_space(ctx, dictionary_content, GRN_JA_ZSTD_DICTIONARY_MAX_SIZE);
+  dictionary_size =
+    ZDICT_trainFromBuffer(GRN_BULK_HEAD(dictionary_content),
+                          GRN_JA_ZSTD_DICTIONARY_MAX_SIZE,
+                          GRN_TEXT_VALUE(&samples),
+                          sample_sizes,
+                          n_samples);
+  GRN_OBJ_FIN(ctx, &samples);
+  GRN_FREE(sample_sizes);
+  if (ZDICT_isError(dictionary_size)) {
+    ERR(GRN_ZSTD_ERROR,
+        "[ja][zstd][train] failed to train dictionary: <%s>: "
+        "n_samples:<%u>",
+        ZDICT_getErrorName(dictionary_size), n_samples);
+    return ctx->rc;
+  }
+  GRN_BULK_REWIND(dictionary_content);
+  grn_bulk_space(ctx, dictionary_content, dictionary_size);
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "[ja][zstd][train] trained: n_values:<%u> n_samples:<%u> size:<%u>",
+          n_values, n_samples, (uint32_t)dictionary_size);
+  return GRN_SUCCESS;
+}
+
+static grn_rc
+grn_ja_zstd_store_dictionary(grn_ctx *ctx, grn_ja *ja,
+                             grn_obj *dictionary_content)
+{
+  grn_rc rc;
+  uint32_t seg = 0;
+  byte *addr = NULL;
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+  grn_ja_zstd_dictionary_header *header;
+  uint32_t generation = 1;
+
+  rc = grn_ja_zstd_dictionaries_load_new(ctx, ja);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+  if (grn_io_lock(ctx, ja->io, grn_lock_timeout)) {
+    return ctx->rc;
+  }
+  while (SEGMENTS_AT(ja, seg)) {
+    if (++seg >= JA_N_DSEGMENTS) {
+      grn_io_unlock(ja->io);
+      ERR(GRN_NOT_ENOUGH_SPACE, "grn_ja file (%s) is full", ja->io->path);
+      return ctx->rc;
+    }
+  }
+  GRN_IO_SEG_REF(ja->io, seg, addr);
+  if (!addr) {
+    grn_io_unlock(ja->io);
+    return GRN_NO_MEMORY_AVAILABLE;
+  }
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  if (dictionaries->n_dictionaries > 0) {
+    generation =
+      dictionaries->dictionaries[dictionaries->n_dictionaries - 1]->generation +
+      1;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  header = (grn_ja_zstd_dictionary_header *)addr;
+  header->size = GRN_BULK_VSIZE(dictionary_content);
+  header->generation = generation;
+  grn_memcpy(header + 1,
+             GRN_BULK_HEAD(dictionary_content),
+             GRN_BULK_VSIZE(dictionary_content));
+  GRN_IO_SEG_UNREF(ja->io, seg);
+  SEGMENTS_AT(ja, seg) = SEG_DICT;
+  grn_io_unlock(ja->io);
+
+  rc = grn_ja_zstd_dictionaries_add(ctx, ja, seg);
+  if (rc != GRN_SUCCESS) {
+    SEGMENTS_OFF(ja, seg);
+  }
+  return rc;
+}
+
+/* Recompresses values that aren't compressed with the current
+   dictionary. */
+static grn_rc
+grn_ja_zstd_recompress(grn_ctx *ctx, grn_ja *ja, unsigned int current_id,
+                       uint32_t *n_recompressed_values)
+{
+  grn_rc rc = GRN_SUCCESS;
+  grn_id id;
+
+  GRN_JA_EACH_VALUE_ID(ctx, ja, id, {
+    grn_io_win iw;
+    void *value;
+    uint32_t value_len;
+    unsigned int dictionary_id = 0;
+    if (rc != GRN_SUCCESS) { continue; }
+    value = grn_ja_ref_raw(ctx, ja, id, &iw, &value_len);
+    if (!value) {
+      rc = ctx->rc;
+      continue;
+    }
+    if (value_len > sizeof(uint64_t)) {
+      dictionary_id =
+        ZSTD_getDictID_fromFrame((uint64_t *)value + 1,
+                                 value_len - sizeof(uint64_t));
+    }
+    grn_ja_unref(ctx, &iw);
+    if (dictionary_id == current_id) { continue; }
+    value = grn_ja_ref(ctx, ja, id, &iw, &value_len);
+    if (!value) {
+      rc = ctx->rc;
+      continue;
+    }
+    rc = grn_ja_put_zstd(ctx, ja, id, value, value_len, GRN_OBJ_SET, NULL);
+    grn_ja_unref(ctx, &iw);
+    if (rc == GRN_SUCCESS) {
+      (*n_recompressed_values)++;
+    }
+  });
+  return rc;
+}
+
+/*
+  Removes dictionaries except the current dictionary. They aren't
+  removed when a value may be written with them after
+  grn_ja_zstd_recompress() passed it: a writer still has a reference
+  to them or has stored a value with them since the last check.
+*/
+static grn_rc
+grn_ja_zstd_remove_old_dictionaries(grn_ctx *ctx, grn_ja *ja,
+                                    grn_bool *removed)
+{
+  uint32_t i;
+  grn_ja_zstd_dictionaries * const dictionaries = ja->zstd_dictionaries;
+
+  if (grn_io_lock(ctx, ja->io, grn_lock_timeout)) {
+    return ctx->rc;
+  }
+  CRITICAL_SECTION_ENTER(dictionaries->lock);
+  *removed = (dictionaries->n_stale_writes == 0);
+  for (i = 0; *removed && i + 1 < dictionaries->n_dictionaries; i++) {
+    if (dictionaries->dictionaries[i]->n_refs > 0) {
+      *removed = GRN_FALSE;
+    }
+  }
+  if (*removed) {
+    while (dictionaries->n_dictionaries > 1) {
+      SEGMENTS_OFF(ja, dictionaries->dictionaries[0]->seg);
+      grn_ja_zstd_dictionaries_retire(ctx, dictionaries, 0);
+    }
+  } else {
+    dictionaries->n_stale_writes = 0;
+  }
+  CRITICAL_SECTION_LEAVE(dictionaries->lock);
+  grn_io_unlock(ja->io);
+  return GRN_SUCCESS;
+}
+#endif /* GRN_WITH_ZSTD */
+
+grn_rc
+grn_ja_train_dictionary(grn_ctx *ctx, grn_ja *ja, uint32_t max_n_samples)
+{
+#ifdef GRN_WITH_ZSTD
+  grn_rc rc;
+  grn_obj dictionary_content;
+  grn_ja_zstd_dictionary *current;
+  unsigned int current_id;
+  uint32_t n_recompressed_values = 0;
+  uint32_t n_tries;
+
+  if ((ja->header->flags & GRN_OBJ_COMPRESS_MASK) != GRN_OBJ_COMPRESS_ZSTD) {
+    ERR(GRN_INVALID_ARGUMENT,
+        "[ja][zstd][train] column isn't compressed by Zstandard");
+    return ctx->rc;
+  }
+  if (max_n_samples == 0) {
+    max_n_samples = GRN_JA_ZSTD_TRAIN_DEFAULT_MAX_N_SAMPLES;
+  }
+
+  GRN_TEXT_INIT(&dictionary_content, 0);
+  rc = grn_ja_zstd_train(ctx, ja, max_n_samples, &dictionary_content);
+  if (rc == GRN_SUCCESS) {
+    rc = grn_ja_zstd_store_dictionary(ctx, ja, &dictionary_content);
+  }
+  GRN_OBJ_FIN(ctx, &dictionary_content);
+  if (rc != GRN_SUCCESS) {
+    return rc;
+  }
+
+  current = grn_ja_zstd_dictionaries_ref_current(ja);
+  current_id = current->id;
+  grn_ja_zstd_dictionaries_unref(ctx, ja, current, GRN_FALSE);
+
+  for (n_tries = 1; ; n_tries++) {
+    grn_bool removed;
+    rc = grn_ja_zstd_recompress(ctx, ja, current_id, &n_recompressed_values);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+    rc = grn_ja_zstd_remove_old_dictionaries(ctx, ja, &removed);
+    if (rc != GRN_SUCCESS) {
+      return rc;
+    }
+    if (removed) {
+      break;
+    }
+    if (n_tries == GRN_JA_ZSTD_RECOMPRESS_MAX_N_TRIES) {
+      GRN_LOG(ctx, GRN_LOG_WARNING,
+              "[ja][zstd][train] old dictionaries are kept "
+              "because they are still used by concurrent writers");
+      break;
+    }
+  }
+  GRN_LOG(ctx, GRN_LOG_INFO,
+          "[ja][zstd][train] recompressed: <%u>", n_recompressed_values);
+  return GRN_SUCCESS;
+#else /* GRN_WITH_ZSTD */
+  ERR(GRN_FUNCTION_NOT_IMPLEMENTED,
+      "[ja][train] Zstandard support isn't enabled");
+  return ctx->rc;
+#endif /* GRN_WITH_ZSTD */
 }
 
 static grn_rc
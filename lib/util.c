@@ -516,6 +516,9 @@ grn_store_inspect_body(grn_ctx *ctx, grn_obj *buf, grn_obj *obj)
   case GRN_OBJ_COMPRESS_LZ4 :
     GRN_TEXT_PUTS(ctx, buf, "lz4");
     break;
+  case GRN_OBJ_COMPRESS_ZSTD :
+    GRN_TEXT_PUTS(ctx, buf, "zstd");
+    break;
   default:
     break;
   }
@@ -305,10 +305,66 @@ s_output_raw(grn_ctx *ctx, int flags, FILE *stream)
   }
 }
 
+static grn_bool s_output_in_body = GRN_FALSE;
+
+static void
+s_output_typed_partial(grn_ctx *ctx, FILE *stream)
+{
+  char *chunk = NULL;
+  unsigned int chunk_size = 0;
+  int recv_flags;
+
+  grn_ctx_recv(ctx, &chunk, &chunk_size, &recv_flags);
+  if (chunk_size == 0) {
+    return;
+  }
+
+  if (!s_output_in_body) {
+    grn_obj head, body, foot;
+    GRN_TEXT_INIT(&head, 0);
+    GRN_TEXT_INIT(&body, GRN_OBJ_DO_SHALLOW_COPY);
+    GRN_TEXT_INIT(&foot, 0);
+    GRN_TEXT_SET(ctx, &body, chunk, chunk_size);
+    output_envelope(ctx, ctx->rc, &head, &body, &foot);
+    fwrite(GRN_TEXT_VALUE(&head), 1, GRN_TEXT_LEN(&head), stream);
+    GRN_OBJ_FIN(ctx, &head);
+    GRN_OBJ_FIN(ctx, &body);
+    GRN_OBJ_FIN(ctx, &foot);
+    s_output_in_body = GRN_TRUE;
+  }
+  fwrite(chunk, 1, chunk_size, stream);
+}
+
 static void
 s_output_typed(grn_ctx *ctx, int flags, FILE *stream)
 {
-  if (ctx && ctx->impl && (flags & GRN_CTX_TAIL)) {
+  if (ctx && ctx->impl && !(flags & GRN_CTX_TAIL)) {
+    s_output_typed_partial(ctx, stream);
+  } else if (ctx && ctx->impl && s_output_in_body) {
+    char *chunk = NULL;
+    unsigned int chunk_size = 0;
+    int recv_flags;
+    grn_obj head, body, foot;
+    grn_obj *command;
+
+    GRN_TEXT_INIT(&head, 0);
+    GRN_TEXT_INIT(&body, GRN_OBJ_DO_SHALLOW_COPY);
+    GRN_TEXT_INIT(&foot, 0);
+    grn_ctx_recv(ctx, &chunk, &chunk_size, &recv_flags);
+    GRN_TEXT_SET(ctx, &body, chunk, chunk_size);
+    output_envelope(ctx, ctx->rc, &head, &body, &foot);
+    fwrite(GRN_TEXT_VALUE(&body), 1, GRN_TEXT_LEN(&body), stream);
+    fwrite(GRN_TEXT_VALUE(&foot), 1, GRN_TEXT_LEN(&foot), stream);
+    fputc('\n', stream);
+    fflush(stream);
+    GRN_OBJ_FIN(ctx, &head);
+    GRN_OBJ_FIN(ctx, &body);
+    GRN_OBJ_FIN(ctx, &foot);
+    s_output_in_body = GRN_FALSE;
+
+    command = GRN_CTX_USER_DATA(ctx)->ptr;
+    GRN_BULK_REWIND(command);
+  } else if (ctx && ctx->impl) {
     char *chunk = NULL;
     unsigned int chunk_size = 0;
     int recv_flags;
@@ -400,6 +456,7 @@ c_output(grn_ctx *ctx)
   int flags;
   char *str;
   unsigned int str_len;
+  grn_bool in_body = GRN_FALSE;
   do {
     grn_ctx_recv(ctx, &str, &str_len, &flags);
     /*
@@ -408,7 +465,28 @@ c_output(grn_ctx *ctx)
       return -1;
     }
     */
-    if (str_len || ctx->rc) {
+    if (in_body || ((flags & GRN_CTX_MORE) && ctx->rc == GRN_SUCCESS)) {
+      /* The response is sent in pieces. Write envelope around them. */
+      grn_obj head, body, foot;
+      GRN_TEXT_INIT(&head, 0);
+      GRN_TEXT_INIT(&body, GRN_OBJ_DO_SHALLOW_COPY);
+      GRN_TEXT_INIT(&foot, 0);
+      GRN_TEXT_SET(ctx, &body, str, str_len);
+      output_envelope(ctx, ctx->rc, &head, &body, &foot);
+      if (!in_body) {
+        fwrite(GRN_TEXT_VALUE(&head), 1, GRN_TEXT_LEN(&head), output);
+        in_body = GRN_TRUE;
+      }
+      fwrite(GRN_TEXT_VALUE(&body), 1, GRN_TEXT_LEN(&body), output);
+      if (!(flags & GRN_CTX_MORE)) {
+        fwrite(GRN_TEXT_VALUE(&foot), 1, GRN_TEXT_LEN(&foot), output);
+        fputc('\n', output);
+        fflush(output);
+      }
+      GRN_OBJ_FIN(ctx, &head);
+      GRN_OBJ_FIN(ctx, &body);
+      GRN_OBJ_FIN(ctx, &foot);
+    } else if (str_len || ctx->rc) {
       grn_obj head, body, foot;
       GRN_TEXT_INIT(&head, 0);
       GRN_TEXT_INIT(&body, GRN_OBJ_DO_SHALLOW_COPY);
@@ -912,8 +990,7 @@ h_output_typed(grn_ctx *ctx, int flags, ht_context *hc)
   unsigned int chunk_size = 0;
   int recv_flags;
   grn_bool should_return_body;
-
-  if (!(flags & GRN_CTX_TAIL)) { return; }
+  grn_bool is_last_message = (flags & GRN_CTX_TAIL);
 
   switch (hc->msg->header.qtype) {
   case 'G' :
@@ -933,16 +1010,69 @@ h_output_typed(grn_ctx *ctx, int flags, ht_context *hc)
   grn_ctx_recv(ctx, &chunk, &chunk_size, &recv_flags);
   GRN_TEXT_SET(ctx, &body, chunk, chunk_size);
 
+  if (!is_last_message && GRN_TEXT_LEN(&body) == 0) {
+    goto exit;
+  }
+
   output_envelope(ctx, expr_rc, &head, &body, &foot);
-  h_output_set_header(ctx, &header, expr_rc,
-                      GRN_TEXT_LEN(&head) +
-                      GRN_TEXT_LEN(&body) +
-                      GRN_TEXT_LEN(&foot));
-  if (should_return_body) {
-    h_output_send(ctx, fd, &header, &head, &body, &foot);
+  if (!hc->in_body && is_last_message) {
+    h_output_set_header(ctx, &header, expr_rc,
+                        GRN_TEXT_LEN(&head) +
+                        GRN_TEXT_LEN(&body) +
+                        GRN_TEXT_LEN(&foot));
+    if (should_return_body) {
+      h_output_send(ctx, fd, &header, &head, &body, &foot);
+    } else {
+      h_output_send(ctx, fd, &header, NULL, NULL, NULL);
+    }
   } else {
-    h_output_send(ctx, fd, &header, NULL, NULL, NULL);
+    /* The response is too large to be buffered. Send it as chunks:
+       the envelope head with the first chunk and the envelope foot
+       with the last chunk. */
+    grn_obj chunk_head, chunk_foot;
+    GRN_TEXT_INIT(&chunk_head, 0);
+    GRN_TEXT_INIT(&chunk_foot, 0);
+    if (!hc->in_body) {
+      h_output_set_header(ctx, &header, expr_rc, -1);
+      hc->in_body = GRN_TRUE;
+      hc->is_chunked = GRN_TRUE;
+      if (should_return_body) {
+        grn_text_printf(ctx, &header, "%x\r\n",
+                        (unsigned int)(GRN_TEXT_LEN(&head) +
+                                       GRN_TEXT_LEN(&body)));
+        GRN_TEXT_PUT(ctx, &header, GRN_TEXT_VALUE(&head), GRN_TEXT_LEN(&head));
+        GRN_TEXT_PUTS(ctx, &chunk_foot, "\r\n");
+      }
+    } else {
+      GRN_BULK_REWIND(&header);
+      if (is_last_message) {
+        GRN_TEXT_PUT(ctx, &chunk_foot,
+                     GRN_TEXT_VALUE(&foot), GRN_TEXT_LEN(&foot));
+      }
+      if (GRN_TEXT_LEN(&body) + GRN_TEXT_LEN(&chunk_foot) > 0) {
+        grn_text_printf(ctx, &chunk_head, "%x\r\n",
+                        (unsigned int)(GRN_TEXT_LEN(&body) +
+                                       GRN_TEXT_LEN(&chunk_foot)));
+        GRN_TEXT_PUTS(ctx, &chunk_foot, "\r\n");
+      }
+    }
+    if (is_last_message) {
+      GRN_TEXT_PUTS(ctx, &chunk_foot, "0\r\n");
+      GRN_TEXT_PUTS(ctx, &chunk_foot, "Connection: close\r\n");
+      GRN_TEXT_PUTS(ctx, &chunk_foot, "\r\n");
+    }
+    if (should_return_body) {
+      h_output_send(ctx, fd,
+                    GRN_TEXT_LEN(&header) > 0 ? &header : NULL,
+                    &chunk_head, &body, &chunk_foot);
+    } else if (GRN_TEXT_LEN(&header) > 0) {
+      h_output_send(ctx, fd, &header, NULL, NULL, NULL);
+    }
+    GRN_OBJ_FIN(ctx, &chunk_foot);
+    GRN_OBJ_FIN(ctx, &chunk_head);
   }
+
+exit :
   GRN_OBJ_FIN(ctx, &foot);
   GRN_OBJ_FIN(ctx, &body);
   GRN_OBJ_FIN(ctx, &head);
@@ -2062,6 +2192,26 @@ g_output(grn_ctx *ctx, int flags, void *arg)
   grn_edge *edge = arg;
   grn_com *com = edge->com;
   grn_msg *req = edge->msg, *msg = (grn_msg *)ctx->impl->outbuf;
+  if (!(flags & GRN_CTX_TAIL)) {
+    /* Output buffer may be referred by the running command. Send a copy
+       of it and keep using it. */
+    grn_msg *chunk;
+    if (GRN_BULK_VSIZE(ctx->impl->outbuf) == 0) {
+      return;
+    }
+    chunk = (grn_msg *)grn_msg_open(ctx, com, &edge->send_old);
+    chunk->edge_id = req->edge_id;
+    chunk->header.proto = req->header.proto == GRN_COM_PROTO_MBREQ
+      ? GRN_COM_PROTO_MBRES : req->header.proto;
+    GRN_TEXT_PUT(ctx, (grn_obj *)chunk,
+                 GRN_BULK_HEAD(ctx->impl->outbuf),
+                 GRN_BULK_VSIZE(ctx->impl->outbuf));
+    GRN_BULK_REWIND(ctx->impl->outbuf);
+    if (grn_msg_send(ctx, (grn_obj *)chunk, GRN_CTX_MORE)) {
+      edge->stat = EDGE_ABORT;
+    }
+    return;
+  }
   msg->edge_id = req->edge_id;
   msg->header.proto = req->header.proto == GRN_COM_PROTO_MBREQ
     ? GRN_COM_PROTO_MBRES : req->header.proto;
@@ -2533,6 +2683,9 @@ show_version(void)
 #ifdef GRN_WITH_LZ4
   printf(",lz4");
 #endif
+#ifdef GRN_WITH_ZSTD
+  printf(",zstd");
+#endif
 #ifdef USE_KQUEUE
   printf(",kqueue");
 #endif
@@ -0,0 +1,29 @@
+#!/usr/bin/env ruby
+#
+# Generates fixture/select/index/compress_bp128/memos.grn:
+#
+#   % test/command/tools/select/index/generate-compress-bp128-fixture.rb > \
+#       test/command/fixture/select/index/compress_bp128/memos.grn
+#
+# "Groonga" is in more than two UNIT_SIZE (128) blocks of records with
+# varying record ID gaps and term frequencies so that its record IDs,
+# term frequencies and positions are packed as BP128 blocks.
+
+N_RECORDS = 400
+
+puts('#@disable-logging')
+puts("load --table Memos")
+puts("[")
+puts("[\"content\"],")
+records = (1..N_RECORDS).collect do |id|
+  words = []
+  if (id % 7).nonzero?
+    words.concat(["Groonga"] * (1 + id % 3))
+  end
+  words << "Mroonga" if (id % 5).zero?
+  words << "Rroonga" if words.empty?
+  "[#{words.join(" ").dump}]"
+end
+puts(records.join(",\n"))
+puts("]")
+puts('#@enable-logging')
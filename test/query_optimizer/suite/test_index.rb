@@ -28,6 +28,7 @@ class TestIndex < QueryOptimizerTestCase
   logical_op: <or>
   query:      <"Groonga">
   expr:       <0..2>
+  estimated:  <0>
     DUMP
   end
 
@@ -38,11 +39,33 @@ class TestIndex < QueryOptimizerTestCase
   logical_op: <or>
   query:      <"Groonga">
   expr:       <0..2>
+  estimated:  <0>
 [1]
   op:         <equal>
   logical_op: <and>
   query:      <2>
   expr:       <3..7>
+  estimated:  <0>
+    DUMP
+  end
+
+  def test_reorder_by_estimated_size
+    @logs.add(:message => "Groonga is fast")
+    @logs.add(:message => "Groonga is a full text search engine")
+    @logs.add(:message => "Mroonga is a MySQL storage engine based on Groonga")
+    assert_equal(<<-DUMP, dump_plan("message @ 'Groonga' && message @ 'MySQL'"))
+[0]
+  op:         <match>
+  logical_op: <or>
+  query:      <"MySQL">
+  expr:       <3..5>
+  estimated:  <1>
+[1]
+  op:         <match>
+  logical_op: <and>
+  query:      <"Groonga">
+  expr:       <0..2>
+  estimated:  <5>
     DUMP
   end
 end
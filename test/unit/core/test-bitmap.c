@@ -0,0 +1,228 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2015 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <gcutter.h>
+
+#include "../lib/grn-assertions.h"
+
+#include <grn_bitmap.h>
+
+void data_add(void);
+void test_add(gconstpointer data);
+void data_set_operation(void);
+void test_set_operation(gconstpointer data);
+
+/* IDs in 3 partitions. A partition has 0x10000 IDs. */
+#define MAX_ID (0x10000 * 3)
+
+static grn_ctx ctx;
+static grn_bitmap *bitmap;
+static grn_bitmap *other;
+static gboolean *expected;
+static gboolean *other_expected;
+
+void
+cut_setup(void)
+{
+  grn_ctx_init(&ctx, 0);
+  bitmap = NULL;
+  other = NULL;
+  expected = g_new0(gboolean, MAX_ID);
+  other_expected = g_new0(gboolean, MAX_ID);
+}
+
+void
+cut_teardown(void)
+{
+  if (bitmap) {
+    grn_bitmap_close(&ctx, bitmap);
+  }
+  if (other) {
+    grn_bitmap_close(&ctx, other);
+  }
+  g_free(expected);
+  g_free(other_expected);
+  grn_ctx_fin(&ctx);
+}
+
+/*
+  Adds "n" IDs from "start" by "step" in descending order to check that
+  IDs can be added in any order. A small "step" makes dense partitions
+  that are stored as bitsets.
+*/
+static void
+add_ids(grn_bitmap *target, gboolean *target_expected,
+        grn_id start, guint step, guint n)
+{
+  guint i;
+  for (i = n; i > 0; i--) {
+    grn_id id = start + (i - 1) * step;
+    if (id == GRN_ID_NIL || id >= MAX_ID) {
+      continue;
+    }
+    grn_test_assert(grn_bitmap_add(&ctx, target, id));
+    target_expected[id] = TRUE;
+  }
+}
+
+static void
+cut_assert_bitmap(void)
+{
+  grn_bitmap_cursor cursor;
+  grn_id id, expected_id, n_expected = 0;
+
+  grn_bitmap_cursor_init(&ctx, &cursor, bitmap);
+  for (expected_id = 1; expected_id < MAX_ID; expected_id++) {
+    if (!expected[expected_id]) {
+      continue;
+    }
+    n_expected++;
+    id = grn_bitmap_cursor_next(&ctx, &cursor);
+    grn_test_assert_equal_id(&ctx, expected_id, id);
+  }
+  grn_test_assert_equal_id(&ctx, GRN_ID_NIL,
+                           grn_bitmap_cursor_next(&ctx, &cursor));
+  cut_assert_equal_uint(n_expected, grn_bitmap_size(&ctx, bitmap));
+
+  for (id = 1; id < MAX_ID; id += 97) {
+    cut_assert_equal_boolean(expected[id],
+                             grn_bitmap_contain(&ctx, bitmap, id),
+                             cut_message("<%u>", id));
+  }
+}
+
+void
+data_add(void)
+{
+#define ADD_DATA(label, start, step, n)                 \
+  gcut_add_datum(label,                                 \
+                 "start", G_TYPE_UINT, start,           \
+                 "step", G_TYPE_UINT, step,             \
+                 "n", G_TYPE_UINT, n,                   \
+                 NULL)
+
+  ADD_DATA("empty", 1, 1, 0);
+  ADD_DATA("sparse", 1, 37, 100);
+  ADD_DATA("array max size", 1, 2, GRN_BITMAP_ARRAY_MAX_SIZE);
+  ADD_DATA("bitset", 1, 2, GRN_BITMAP_ARRAY_MAX_SIZE + 1);
+  ADD_DATA("full partition", 1, 1, 0x10000);
+  ADD_DATA("over partitions", 0x10000 - 10, 3, 0x10000);
+
+#undef ADD_DATA
+}
+
+void
+test_add(gconstpointer data)
+{
+  bitmap = grn_bitmap_open(&ctx);
+  cut_assert_not_null(bitmap);
+  add_ids(bitmap, expected,
+          gcut_data_get_uint(data, "start"),
+          gcut_data_get_uint(data, "step"),
+          gcut_data_get_uint(data, "n"));
+  /* Adding the same IDs again doesn't change anything. */
+  add_ids(bitmap, expected,
+          gcut_data_get_uint(data, "start"),
+          gcut_data_get_uint(data, "step"),
+          gcut_data_get_uint(data, "n"));
+  cut_assert_bitmap();
+}
+
+void
+data_set_operation(void)
+{
+  static const struct {
+    const gchar *label;
+    guint step;
+    guint n;
+  } patterns[] = {
+    {"empty", 1, 0},
+    {"sparse", 37, 4000},
+    {"dense", 3, 60000},
+  };
+  static const struct {
+    const gchar *label;
+    grn_operator op;
+  } operations[] = {
+    {"and", GRN_OP_AND},
+    {"or", GRN_OP_OR},
+    {"and not", GRN_OP_AND_NOT},
+  };
+  guint i, j, k;
+
+  for (i = 0; i < G_N_ELEMENTS(operations); i++) {
+    for (j = 0; j < G_N_ELEMENTS(patterns); j++) {
+      for (k = 0; k < G_N_ELEMENTS(patterns); k++) {
+        gcut_add_datum(cut_take_printf("%s: %s - %s",
+                                       operations[i].label,
+                                       patterns[j].label,
+                                       patterns[k].label),
+                       "op", G_TYPE_UINT, operations[i].op,
+                       "step", G_TYPE_UINT, patterns[j].step,
+                       "n", G_TYPE_UINT, patterns[j].n,
+                       "other_step", G_TYPE_UINT, patterns[k].step,
+                       "other_n", G_TYPE_UINT, patterns[k].n,
+                       NULL);
+      }
+    }
+  }
+}
+
+void
+test_set_operation(gconstpointer data)
+{
+  grn_operator op = gcut_data_get_uint(data, "op");
+  grn_id id;
+
+  bitmap = grn_bitmap_open(&ctx);
+  cut_assert_not_null(bitmap);
+  other = grn_bitmap_open(&ctx);
+  cut_assert_not_null(other);
+
+  /* The first partition has only "bitmap" IDs. "1 + 111 * 600" is in
+     the second partition and shares IDs with "1 + 37 * n" and
+     "1 + 3 * n". */
+  add_ids(bitmap, expected, 1,
+          gcut_data_get_uint(data, "step"),
+          gcut_data_get_uint(data, "n"));
+  add_ids(other, other_expected, 1 + 111 * 600,
+          gcut_data_get_uint(data, "other_step"),
+          gcut_data_get_uint(data, "other_n"));
+
+  switch (op) {
+  case GRN_OP_AND :
+    grn_test_assert(grn_bitmap_and(&ctx, bitmap, other));
+    for (id = 1; id < MAX_ID; id++) {
+      expected[id] = expected[id] && other_expected[id];
+    }
+    break;
+  case GRN_OP_OR :
+    grn_test_assert(grn_bitmap_or(&ctx, bitmap, other));
+    for (id = 1; id < MAX_ID; id++) {
+      expected[id] = expected[id] || other_expected[id];
+    }
+    break;
+  default :
+    grn_test_assert(grn_bitmap_and_not(&ctx, bitmap, other));
+    for (id = 1; id < MAX_ID; id++) {
+      expected[id] = expected[id] && !other_expected[id];
+    }
+    break;
+  }
+  cut_assert_bitmap();
+}
@@ -0,0 +1,148 @@
+/* -*- c-basic-offset: 2; coding: utf-8 -*- */
+/*
+  Copyright(C) 2015 Brazil
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License version 2.1 as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <grn_io.h>
+
+#include <stdlib.h>
+
+#include <gcutter.h>
+#include <glib/gstdio.h>
+
+#include "../lib/grn-assertions.h"
+
+void test_n_io_segment_evictions(void);
+
+static gchar *tmp_directory;
+static gchar *max_mapped_size_env;
+
+static grn_ctx *context;
+static grn_obj *database;
+
+void
+cut_startup(void)
+{
+  tmp_directory = g_build_filename(grn_test_get_tmp_dir(),
+                                   "command-status",
+                                   NULL);
+}
+
+void
+cut_shutdown(void)
+{
+  g_free(tmp_directory);
+}
+
+static void
+remove_tmp_directory(void)
+{
+  cut_remove_path(tmp_directory, NULL);
+}
+
+void
+cut_setup(void)
+{
+  const gchar *database_path;
+
+  remove_tmp_directory();
+  g_mkdir_with_parents(tmp_directory, 0700);
+
+  max_mapped_size_env = g_strdup(g_getenv("GRN_IO_MAX_MAPPED_SIZE"));
+  g_setenv("GRN_IO_MAX_MAPPED_SIZE", "1", TRUE);
+  grn_io_init_from_env();
+
+  context = g_new0(grn_ctx, 1);
+  grn_ctx_init(context, 0);
+
+  database_path = cut_build_path(tmp_directory, "database.groonga", NULL);
+  database = grn_db_create(context, database_path, NULL);
+}
+
+void
+cut_teardown(void)
+{
+  if (context) {
+    grn_obj_unlink(context, database);
+    grn_ctx_fin(context);
+    g_free(context);
+  }
+
+  if (max_mapped_size_env) {
+    g_setenv("GRN_IO_MAX_MAPPED_SIZE", max_mapped_size_env, TRUE);
+    grn_io_init_from_env();
+    g_free(max_mapped_size_env);
+  } else {
+    g_setenv("GRN_IO_MAX_MAPPED_SIZE", "0", TRUE);
+    grn_io_init_from_env();
+    g_unsetenv("GRN_IO_MAX_MAPPED_SIZE");
+  }
+
+  remove_tmp_directory();
+}
+
+static guint64
+status_n_io_segment_evictions(void)
+{
+  const gchar *status;
+  const gchar *name = "\"n_io_segment_evictions\":";
+  const gchar *value;
+
+  status = send_command("status");
+  value = strstr(status, name);
+  cut_assert_not_null(value, cut_message("%s", status));
+  return g_ascii_strtoull(value + strlen(name), NULL, 10);
+}
+
+void
+test_n_io_segment_evictions(void)
+{
+  guint64 n_evictions_before;
+
+  assert_send_command("table_create Users TABLE_HASH_KEY ShortText");
+  assert_send_command("column_create Users name COLUMN_SCALAR ShortText");
+  assert_send_command("column_create Users age COLUMN_SCALAR Int32");
+
+  n_evictions_before = status_n_io_segment_evictions();
+  assert_send_command("load --table Users\n"
+                      "[\n"
+                      "{\"_key\":\"mori\", \"name\":\"Daijiro MORI\", "
+                      "\"age\":32},\n"
+                      "{\"_key\":\"gunyara-kun\", \"name\":\"Tasuku SUENAGA\", "
+                      "\"age\":29},\n"
+                      "{\"_key\":\"yu\", \"name\":\"Yutaro Shimamura\", "
+                      "\"age\":30}\n"
+                      "]");
+  cut_assert_operator_uint(n_evictions_before,
+                           <,
+                           status_n_io_segment_evictions());
+
+  n_evictions_before = status_n_io_segment_evictions();
+  cut_assert_equal_string(
+      "[[[3],"
+       "[[\"_key\",\"ShortText\"],"
+        "[\"name\",\"ShortText\"],"
+        "[\"age\",\"Int32\"]],"
+       "[\"gunyara-kun\",\"Tasuku SUENAGA\",29],"
+       "[\"yu\",\"Yutaro Shimamura\",30],"
+       "[\"mori\",\"Daijiro MORI\",32]]]",
+    send_command("select Users "
+                 "--output_columns _key,name,age "
+                 "--sortby age"));
+  cut_assert_operator_uint(n_evictions_before,
+                           <,
+                           status_n_io_segment_evictions());
+}
@@ -44,6 +44,7 @@ void data_add_and_delete(void);
 void test_add_and_delete(gconstpointer data);
 void data_truncate(void);
 void test_truncate(gconstpointer data);
+void test_rehash_and_reopen(void);
 
 static GArray *ids;
 
@@ -613,3 +614,57 @@ test_truncate(gconstpointer data)
   grn_test_assert(grn_hash_truncate(context, hash));
   cut_assert_equal_uint(0, GRN_HASH_SIZE(hash));
 }
+
+static void
+add_uint32_keys(uint32_t from, uint32_t to)
+{
+  uint32_t key;
+
+  for (key = from; key < to; key++) {
+    grn_id added_id;
+    added_id = grn_hash_add(context, hash, &key, sizeof(uint32_t), NULL, NULL);
+    if (added_id != key + 1) {
+      cut_fail("failed to add: key = %u; id = %u", key, added_id);
+    }
+  }
+}
+
+static void
+cut_assert_get_uint32_keys(uint32_t n_keys)
+{
+  uint32_t key;
+
+  cut_assert_equal_uint(n_keys, GRN_HASH_SIZE(hash));
+  for (key = 0; key < n_keys; key++) {
+    grn_id found_id;
+    found_id = grn_hash_get(context, hash, &key, sizeof(uint32_t), NULL);
+    if (found_id != key + 1) {
+      cut_fail("failed to get: key = %u; id = %u", key, found_id);
+    }
+  }
+}
+
+void
+test_rehash_and_reopen(void)
+{
+  /* The initial index has 2^20 slots and is rehashed at half full. */
+  const uint32_t n_keys_to_start_rehash = (1U << 19) + 1;
+
+  cut_assert_create_hash();
+
+  /* The new index is still being cleared. */
+  add_uint32_keys(0, n_keys_to_start_rehash + 1);
+  cut_assert_open_hash();
+  cut_assert_get_uint32_keys(n_keys_to_start_rehash + 1);
+
+  /* The current index is being copied to the new index. */
+  add_uint32_keys(n_keys_to_start_rehash + 1, n_keys_to_start_rehash + 1000);
+  cut_assert_open_hash();
+  cut_assert_get_uint32_keys(n_keys_to_start_rehash + 1000);
+
+  /* The rehash is finished. */
+  add_uint32_keys(n_keys_to_start_rehash + 1000,
+                  n_keys_to_start_rehash + 100000);
+  cut_assert_open_hash();
+  cut_assert_get_uint32_keys(n_keys_to_start_rehash + 100000);
+}
@@ -41,6 +41,10 @@ void test_int_index(void);
 void test_mroonga_index(void);
 void test_mroonga_index_score(void);
 void test_estimate_size_for_query(void);
+void test_chunk_cache(void);
+void test_background_merge(void);
+void data_cursor_set_min(void);
+void test_cursor_set_min(gconstpointer data);
 
 #define TYPE_SIZE 1024
 
@@ -56,6 +60,12 @@ static grn_obj *db;
 static grn_obj *type;
 static grn_obj *lexicon;
 static grn_ii *inverted_index;
+static gchar *chunk_cache_size_env;
+static gboolean chunk_cache_size_env_changed;
+static gchar *background_merge_enable_env;
+static gboolean background_merge_enable_env_changed;
+static gchar *cursor_set_min_enable_env;
+static gboolean cursor_set_min_enable_env_changed;
 
 void
 cut_startup(void)
@@ -123,6 +133,10 @@ cut_setup(void)
   g_free(table_path);
 
   inverted_index = NULL;
+
+  chunk_cache_size_env_changed = FALSE;
+  background_merge_enable_env_changed = FALSE;
+  cursor_set_min_enable_env_changed = FALSE;
 }
 
 static void
@@ -152,6 +166,19 @@ record_ids_free(void)
   }
 }
 
+/* grn_ii_init_from_env() keeps the current value for an unset variable
+   in some cases. So "default_value" is applied before unsetting it. */
+static void
+restore_env(const gchar *name, gchar *value, const gchar *default_value)
+{
+  g_setenv(name, value ? value : default_value, TRUE);
+  grn_ii_init_from_env();
+  if (!value) {
+    g_unsetenv(name);
+  }
+  g_free(value);
+}
+
 void
 cut_teardown(void)
 {
@@ -169,6 +196,27 @@ cut_teardown(void)
     path = NULL;
   }
 
+  if (chunk_cache_size_env_changed) {
+    restore_env("GRN_II_CHUNK_CACHE_SIZE", chunk_cache_size_env, "0");
+    chunk_cache_size_env = NULL;
+  }
+
+  if (background_merge_enable_env_changed) {
+    grn_ii_merger_fin();
+    restore_env("GRN_II_BACKGROUND_MERGE_ENABLE",
+                background_merge_enable_env,
+                "no");
+    background_merge_enable_env = NULL;
+    grn_ii_merger_init();
+  }
+
+  if (cursor_set_min_enable_env_changed) {
+    restore_env("GRN_II_CURSOR_SET_MIN_ENABLE",
+                cursor_set_min_enable_env,
+                "yes");
+    cursor_set_min_enable_env = NULL;
+  }
+
   remove_tmp_directory();
 
   record_ids_free();
@@ -972,3 +1020,365 @@ test_estimate_size_for_query(void)
                                                          strlen("Groonga"),
                                                          NULL));
 }
+
+static void
+load_memos(const gchar *content, guint n)
+{
+  GString *command;
+  guint i;
+
+  command = g_string_new("load --table Memos\n[\n");
+  for (i = 0; i < n; i++) {
+    g_string_append_printf(command, "{\"content\":\"%s\"}", content);
+    if (i + 1 < n) {
+      g_string_append(command, ",");
+    }
+    g_string_append(command, "\n");
+  }
+  g_string_append(command, "]");
+  assert_send_command(cut_take_string(g_string_free(command, FALSE)));
+}
+
+static const gchar *
+count_memos(const gchar *term)
+{
+  return send_command(cut_take_printf("select Memos "
+                                      "--filter 'content @ \"%s\"' "
+                                      "--output_columns _id "
+                                      "--limit 0",
+                                      term));
+}
+
+void
+test_chunk_cache(void)
+{
+  GString *command;
+  guint i;
+  uint64_t n_hits, n_misses, n_hits_before, n_misses_before;
+
+  chunk_cache_size_env = g_strdup(g_getenv("GRN_II_CHUNK_CACHE_SIZE"));
+  chunk_cache_size_env_changed = TRUE;
+  g_setenv("GRN_II_CHUNK_CACHE_SIZE", "1048576", TRUE);
+  grn_ii_init_from_env();
+
+  grn_obj_close(context, db);
+  db = grn_db_create(context,
+                     cut_build_path(tmp_directory, "chunk-cache.grn", NULL),
+                     NULL);
+
+  assert_send_command("table_create Memos TABLE_NO_KEY");
+  assert_send_command("column_create Memos content COLUMN_SCALAR ShortText");
+  assert_send_command("table_create Terms TABLE_PAT_KEY ShortText "
+                      "--default_tokenizer TokenDelimit");
+
+  /* "a" and "z" are in different buffers because many terms between
+     them are built offline. So an update of "z" doesn't free the chunk
+     of "a". */
+  load_memos("a", 100);
+  command = g_string_new("load --table Memos\n[\n");
+  for (i = 0; i < 40000; i++) {
+    g_string_append_printf(command, "{\"content\":\"m%05u\"}", i % 20000);
+    if (i + 1 < 40000) {
+      g_string_append(command, ",");
+    }
+    g_string_append(command, "\n");
+  }
+  g_string_append(command, "]");
+  assert_send_command(cut_take_string(g_string_free(command, FALSE)));
+  load_memos("z", 100);
+  assert_send_command("column_create Terms index COLUMN_INDEX Memos content");
+
+  grn_ii_chunk_cache_get_statistics(&n_hits_before, &n_misses_before);
+  cut_assert_equal_string("[[[100],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("a"));
+  cut_assert_equal_string("[[[100],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("z"));
+  grn_ii_chunk_cache_get_statistics(&n_hits, &n_misses);
+  cut_assert_equal_uint(n_misses_before + 2, n_misses);
+
+  n_hits_before = n_hits;
+  n_misses_before = n_misses;
+  cut_assert_equal_string("[[[100],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("a"));
+  cut_assert_equal_string("[[[100],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("z"));
+  grn_ii_chunk_cache_get_statistics(&n_hits, &n_misses);
+  cut_assert_operator_uint(n_hits_before, <, n_hits);
+  cut_assert_equal_uint(n_misses_before, n_misses);
+
+  /* Flushes the buffer of "z". */
+  load_memos("z", 30000);
+  assert_send_command("delete Memos --filter '_id <= 10'");
+
+  n_hits_before = n_hits;
+  n_misses_before = n_misses;
+  cut_assert_equal_string("[[[90],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("a"));
+  grn_ii_chunk_cache_get_statistics(&n_hits, &n_misses);
+  cut_assert_operator_uint(n_hits_before, <, n_hits);
+  cut_assert_equal_uint(n_misses_before, n_misses);
+
+  n_hits_before = n_hits;
+  n_misses_before = n_misses;
+  cut_assert_equal_string("[[[30100],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("z"));
+  grn_ii_chunk_cache_get_statistics(&n_hits, &n_misses);
+  cut_assert_equal_uint(n_misses_before + 1, n_misses);
+}
+
+#define N_LOADERS 4
+#define N_MEMOS_PER_LOADER 20000
+#define N_WORDS 1000
+
+typedef struct {
+  grn_obj *db;
+  guint offset;
+  grn_rc rc;
+} loader_data;
+
+static gpointer
+load_memos_in_thread(gpointer user_data)
+{
+  loader_data *data = user_data;
+  grn_ctx ctx;
+  grn_obj *memos, *content, value;
+  guint i;
+
+  grn_ctx_init(&ctx, 0);
+  grn_ctx_use(&ctx, data->db);
+  memos = grn_ctx_get(&ctx, "Memos", -1);
+  content = grn_ctx_get(&ctx, "Memos.content", -1);
+  GRN_TEXT_INIT(&value, 0);
+  for (i = 0; i < N_MEMOS_PER_LOADER && ctx.rc == GRN_SUCCESS; i++) {
+    grn_id id;
+    gchar text[64];
+    id = grn_table_add(&ctx, memos, NULL, 0, NULL);
+    if (id == GRN_ID_NIL) {
+      break;
+    }
+    g_snprintf(text, sizeof(text), "common w%05u",
+               (data->offset + i) % N_WORDS);
+    GRN_TEXT_SETS(&ctx, &value, text);
+    grn_obj_set_value(&ctx, content, id, &value, GRN_OBJ_SET);
+  }
+  data->rc = ctx.rc;
+  if (data->rc == GRN_SUCCESS && i < N_MEMOS_PER_LOADER) {
+    data->rc = GRN_UNKNOWN_ERROR;
+  }
+  GRN_OBJ_FIN(&ctx, &value);
+  grn_ctx_fin(&ctx);
+  return NULL;
+}
+
+void
+test_background_merge(void)
+{
+  GThread *threads[N_LOADERS];
+  loader_data data[N_LOADERS];
+  guint i;
+
+  background_merge_enable_env =
+    g_strdup(g_getenv("GRN_II_BACKGROUND_MERGE_ENABLE"));
+  background_merge_enable_env_changed = TRUE;
+  grn_ii_merger_fin();
+  g_setenv("GRN_II_BACKGROUND_MERGE_ENABLE", "yes", TRUE);
+  grn_ii_init_from_env();
+  grn_ii_merger_init();
+
+  grn_obj_close(context, db);
+  db = grn_db_create(context,
+                     cut_build_path(tmp_directory, "background-merge.grn",
+                                    NULL),
+                     NULL);
+
+  assert_send_command("table_create Memos TABLE_NO_KEY");
+  assert_send_command("column_create Memos content COLUMN_SCALAR ShortText");
+  assert_send_command("table_create Terms TABLE_PAT_KEY ShortText "
+                      "--default_tokenizer TokenDelimit");
+  assert_send_command("column_create Terms index COLUMN_INDEX Memos content");
+
+  for (i = 0; i < N_LOADERS; i++) {
+    data[i].db = db;
+    data[i].offset = i * N_MEMOS_PER_LOADER;
+    data[i].rc = GRN_SUCCESS;
+    threads[i] = g_thread_new("loader", load_memos_in_thread, &(data[i]));
+  }
+  for (i = 0; i < N_LOADERS; i++) {
+    g_thread_join(threads[i]);
+  }
+  for (i = 0; i < N_LOADERS; i++) {
+    grn_test_assert(data[i].rc, cut_message("loader: <%u>", i));
+  }
+
+  cut_assert_equal_string(
+    cut_take_printf("[[[%u],[[\"_id\",\"UInt32\"]]]]",
+                    N_LOADERS * N_MEMOS_PER_LOADER),
+    count_memos("common"));
+  cut_assert_equal_string(
+    cut_take_printf("[[[%u],[[\"_id\",\"UInt32\"]]]]",
+                    N_LOADERS * N_MEMOS_PER_LOADER / N_WORDS),
+    count_memos("w00007"));
+  cut_assert_equal_string(
+    cut_take_printf("[[[%u],[[\"_id\",\"UInt32\"]]]]",
+                    N_LOADERS * N_MEMOS_PER_LOADER / N_WORDS),
+    count_memos("w00999"));
+
+  assert_send_command("truncate Terms.index");
+  cut_assert_equal_string("[[[0],[[\"_id\",\"UInt32\"]]]]",
+                          count_memos("common"));
+}
+
+#define N_RECORDS 100000
+#define N_POSITIONS 16
+#define RARE_INTERVAL 97
+#define DELETE_INTERVAL 5
+#define RARE_RECORD_P(id)                               \
+  (((id) % RARE_INTERVAL) == 0 &&                       \
+   ((id) <= N_RECORDS / 4 || (id) > N_RECORDS * 3 / 4))
+
+void
+data_cursor_set_min(void)
+{
+#define ADD_DATUM(label, enable)                        \
+  gcut_add_datum(label,                                 \
+                 "enable", G_TYPE_STRING, enable,       \
+                 NULL)
+
+  ADD_DATUM("enabled", "yes");
+  ADD_DATUM("disabled", "no");
+
+#undef ADD_DATUM
+}
+
+static void
+update_posting(grn_id term_id, grn_id record_id,
+               const guint *positions, guint n_positions,
+               gboolean delete)
+{
+  grn_ii_updspec *spec;
+  guint i;
+
+  spec = grn_ii_updspec_open(context, record_id, 1);
+  for (i = 0; i < n_positions; i++) {
+    grn_test_assert(grn_ii_updspec_add(context, spec, positions[i], 0));
+  }
+  if (delete) {
+    grn_test_assert(grn_ii_delete_one(context, inverted_index,
+                                      term_id, spec, NULL));
+  } else {
+    grn_test_assert(grn_ii_update_one(context, inverted_index,
+                                      term_id, spec, NULL));
+  }
+  grn_ii_updspec_close(context, spec);
+}
+
+static GList *
+search_record_ids(const gchar *query, grn_obj *result, grn_operator op)
+{
+  GList *ids = NULL;
+  grn_id record_id;
+
+  grn_test_assert(grn_ii_sel(context, inverted_index, query, strlen(query),
+                             (grn_hash *)result, op, NULL));
+
+  for (record_id = 1; record_id <= N_RECORDS; record_id++) {
+    if (grn_table_get(context, result, &record_id, sizeof(grn_id))) {
+      ids = g_list_append(ids, g_strdup_printf("%u", record_id));
+    }
+  }
+  return gcut_take_list(ids, g_free);
+}
+
+/*
+  "alpha" has many positions with large gaps in all records so that its
+  postings are split into multiple chunks. "rare" is in every
+  RARE_INTERVAL-th record except the middle half of records so that
+  the "alpha" cursor skips whole chunks by the "rare" cursor. "rare" is
+  just before an "alpha" only in every other one of them. Every
+  DELETE_INTERVAL-th record is deleted at last.
+*/
+void
+test_cursor_set_min(gconstpointer data)
+{
+  grn_obj *records, *result;
+  grn_id alpha_id, rare_id, record_id;
+  guint32 seed = 1;
+  GList *expected_phrase = NULL, *expected_and = NULL;
+
+  cursor_set_min_enable_env =
+    g_strdup(g_getenv("GRN_II_CURSOR_SET_MIN_ENABLE"));
+  cursor_set_min_enable_env_changed = TRUE;
+  g_setenv("GRN_II_CURSOR_SET_MIN_ENABLE",
+           gcut_data_get_string(data, "enable"),
+           TRUE);
+  grn_ii_init_from_env();
+
+  grn_obj_set_info(context, lexicon, GRN_INFO_DEFAULT_TOKENIZER,
+                   grn_ctx_get(context, "TokenDelimit", -1));
+  inverted_index = grn_ii_create(context, path, lexicon,
+                                 GRN_OBJ_WITH_POSITION);
+  cut_assert_not_null(inverted_index);
+  alpha_id = grn_table_add(context, lexicon, "alpha", strlen("alpha"), NULL);
+  rare_id = grn_table_add(context, lexicon, "rare", strlen("rare"), NULL);
+
+  records = grn_table_create(context, NULL, 0, NULL,
+                             GRN_OBJ_TABLE_NO_KEY, NULL, NULL);
+  for (record_id = 1; record_id <= N_RECORDS; record_id++) {
+    guint positions[N_POSITIONS], position = 0, i;
+    grn_test_assert_equal_id(context,
+                             record_id,
+                             grn_table_add(context, records, NULL, 0, NULL));
+    for (i = 0; i < N_POSITIONS; i++) {
+      seed = seed * 1103515245 + 12345;
+      position += 2 + (seed >> 18);
+      positions[i] = position;
+    }
+    update_posting(alpha_id, record_id, positions, N_POSITIONS, FALSE);
+    if (RARE_RECORD_P(record_id)) {
+      guint rare_position;
+      if ((record_id % (RARE_INTERVAL * 2)) == 0) {
+        rare_position = positions[N_POSITIONS / 2] - 1;
+      } else {
+        rare_position = positions[N_POSITIONS - 1] + 2;
+      }
+      update_posting(rare_id, record_id, &rare_position, 1, FALSE);
+      if ((record_id % DELETE_INTERVAL) != 0) {
+        gchar *id_string = g_strdup_printf("%u", record_id);
+        expected_and = g_list_append(expected_and, id_string);
+        if ((record_id % (RARE_INTERVAL * 2)) == 0) {
+          expected_phrase = g_list_append(expected_phrase,
+                                          g_strdup(id_string));
+        }
+      }
+    }
+  }
+  for (record_id = DELETE_INTERVAL;
+       record_id <= N_RECORDS;
+       record_id += DELETE_INTERVAL) {
+    update_posting(alpha_id, record_id, NULL, 0, TRUE);
+    if (RARE_RECORD_P(record_id)) {
+      update_posting(rare_id, record_id, NULL, 0, TRUE);
+    }
+  }
+  gcut_take_list(expected_phrase, g_free);
+  gcut_take_list(expected_and, g_free);
+
+  result = grn_table_create(context, NULL, 0, NULL,
+                            GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                            records, NULL);
+  gcut_assert_equal_list_string(
+    expected_phrase,
+    search_record_ids("rare alpha", result, GRN_OP_OR));
+  grn_obj_close(context, result);
+
+  result = grn_table_create(context, NULL, 0, NULL,
+                            GRN_OBJ_TABLE_HASH_KEY|GRN_OBJ_WITH_SUBREC,
+                            records, NULL);
+  search_record_ids("rare", result, GRN_OP_OR);
+  gcut_assert_equal_list_string(
+    expected_and,
+    search_record_ids("alpha", result, GRN_OP_AND));
+  grn_obj_close(context, result);
+
+  grn_obj_close(context, records);
+}